@@ -23,12 +23,15 @@
 
 #include <pthread.h>
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef _POSIX_PRIORITY_SCHEDULING
@@ -40,9 +43,9 @@
 
 #include "audio.h"
 #include "driver-inout.h"
-#include "endian-conv.h"
 #include "errors.h"
 #include "event-waiter.h"
+#include "format-conv.h"
 #include "gui-settings.h"
 #include "gui-subs.h"
 #include "main.h"
@@ -64,9 +67,26 @@ void* editing_driver_object = NULL;
 void* current_driver_object = NULL;
 void* file_driver_object = NULL;
 
-int audio_ctlpipe, audio_backpipe;
+msg_queue* audio_back_queue;
 gint8 player_mute_channels[32];
 
+/* The player and the mixer instance it drives. There's one instance
+   for each mixer type that has been used so far; they are created by
+   the audio thread and never freed, so other threads may safely access
+   the current one at any time. */
+static XMPlayer* player = NULL;
+static st_mixer_ctx* audio_mixer_ctx = NULL;
+static GList* audio_mixer_ctxs = NULL;
+
+/* Rendering of the channels to separate outputs: one instance of the
+   current mixer per channel, each of them fed only with the commands
+   for its channel by the driver_*() functions. Audio thread only. */
+static st_mixer_ctx* audio_stem_ctxs[32];
+static int audio_stems = 0;
+static tracer* audio_tracer = NULL;
+static tracer_index* audio_tracer_index = NULL;
+static guint audio_tracer_index_idle = 0;
+
 /* Time buffers for Visual<->Audio synchronization */
 
 time_buffer* audio_playerpos_tb;
@@ -91,33 +111,109 @@ static int confirm_tempo = 0, confirm_bpm = 0;
 
 /* Internal variables */
 
+/* Both directions carry small fixed-size messages; requests are sent
+   much more seldom than the audio thread wakes up, so this is plenty. */
+#define AUDIO_QUEUE_CAPACITY 256
+
 static int nice_value = 0;
-static int ctlpipe, backpipe;
-static pthread_t threadid;
+static msg_queue* audio_ctl_queue;
+/* Held while the control requests are handled; see driver-inout.h */
+static GMutex audio_mix_mutex;
+static pthread_t threadid, gui_threadid;
 
 static int playing = 0;
 static gboolean playing_noloop;
 
+/* Note events on their way from the audio thread to audio_mix(), which
+   may run in a driver's own thread. A stop invalidates the events still
+   in the queue by bumping the generation. */
+typedef struct audio_note_event {
+    audio_ctl_msg msg;
+    gint generation;
+} audio_note_event;
+
+#define AUDIO_NOTE_EVENTS_MAX 64
+
+static msg_queue* audio_note_queue;
+static gint audio_note_generation = 0;
+static gint64 audio_mix_walltime; /* when audio_mix() was entered the last time */
+
 // --- for audio_mix() "main loop":
 
-static int mixfmt_req, mixfmt, mixfmt_conv;
+static int mixfmt_req;
 static int mixfreq_req;
-static int audio_numchannels;
 static float audio_ampfactor = 1.0;
 
-static double pitchbend = +0.0, pitchbend_req;
+static double pitchbend_req;
 static double audio_next_tick_time_unbent, audio_next_tick_time_bent, audio_current_playback_time_bent;
 static double audio_mixer_current_time;
 
-#define MIXFMT_16 1
-#define MIXFMT_STEREO 2
+/* What the mixer delivers, and what the driver wants */
+static format_conv_type mixfmt_type, mixfmt_dest_type;
+static int mixfmt_channels, mixfmt_dest_channels;
+static gboolean mixfmt_dither; /* float is dithered to 16 bits before the conversion */
+static format_conv_func mixfmt_convert; /* NULL if nothing is left to be done */
+
+/* Requantization of the float mixer output to 16 bits. The dither is
+   TPDF (the sum of two uniform random values, +-1 LSB peak), which
+   decorrelates the error from the signal completely. Noise shaping
+   additionally feeds the error back through a three-tap filter
+   (F-weighted, after Wannamaker), moving the noise out of the range
+   where the ear is most sensitive. */
+
+static audio_dither_mode audio_dither = AUDIO_DITHER_NONE;
+
+typedef struct audio_dither_state {
+    guint32 seed;
+    float err[2][3]; /* last errors per channel, latest first */
+} audio_dither_state;
+
+/* One per output; more than one when rendering stems */
+static audio_dither_state audio_dither_st[32] = { { 1 } };
+
+static inline float
+audio_dither_random(audio_dither_state* st)
+{
+    /* xorshift32; uniform in [0, 1) */
+    st->seed ^= st->seed << 13;
+    st->seed ^= st->seed >> 17;
+    st->seed ^= st->seed << 5;
+
+    return (st->seed >> 8) * (1.0f / 16777216.0f);
+}
+
+static void
+audio_dither_to_16(const float* src,
+    gint16* dest,
+    guint32 count,
+    int channels,
+    gboolean shaped,
+    audio_dither_state* st)
+{
+    guint32 i;
+    int ch;
+
+    for (i = 0; i < count; i++) {
+        for (ch = 0; ch < channels; ch++) {
+            float* const e = st->err[ch];
+            float v = *src++ * 32768.0f, q;
+
+            if (shaped) {
+                v -= 1.623f * e[0] - 0.982f * e[1] + 0.109f * e[2];
+            }
+            q = floorf(v + audio_dither_random(st) - audio_dither_random(st) + 0.5f);
+
+            if (shaped) {
+                e[2] = e[1];
+                e[1] = e[0];
+                /* An overdriven signal mustn't run the filter away */
+                e[0] = CLAMP(q - v, -2.0f, 2.0f);
+            }
 
-#define MIXFMT_CONV_TO_16 1
-#define MIXFMT_CONV_TO_8 2
-#define MIXFMT_CONV_TO_UNSIGNED 4
-#define MIXFMT_CONV_TO_STEREO 8
-#define MIXFMT_CONV_TO_MONO 16
-#define MIXFMT_CONV_BYTESWAP 32
+            *dest++ = CLAMP(q, -32768.0f, 32767.0f);
+        }
+    }
+}
 
 typedef struct PollInput {
     int fd;
@@ -128,6 +224,10 @@ typedef struct PollInput {
 
 static GList* inputs = NULL;
 
+/* A driver which can take data at any time, served between the control
+   messages without waiting in poll() */
+static PollInput* pull_input = NULL;
+
 /* Oscilloscope buffers */
 
 gint16* scopebufs[32];
@@ -135,9 +235,19 @@ gint32 scopebuf_length;
 scopebuf_endpoint scopebuf_start, scopebuf_end;
 int scopebuf_freq;
 gboolean scopebuf_ready;
+double scopebuf_sound_end[32];
 
 void audio_prepare_for_playing(void);
 
+/* Tells the GUI thread about the outcome of a request */
+static void
+audio_back_send(audio_back_id id)
+{
+    audio_back_msg msg = { id, NULL };
+
+    msg_queue_send(audio_back_queue, &msg);
+}
+
 static void
 audio_raise_priority(void)
 {
@@ -171,18 +281,138 @@ audio_restore_priority(void)
 #endif
 
 static void
-audio_ctlpipe_init_player(void)
+audio_stems_free(void)
+{
+    int i;
+
+    if (!audio_stems)
+        return;
+
+    audio_mixer_ctx->stems = NULL;
+    for (i = 0; i < audio_stems; i++) {
+        audio_stem_ctxs[i]->mixer->destroy(audio_stem_ctxs[i]->m);
+        g_free(audio_stem_ctxs[i]);
+    }
+    audio_stems = 0;
+}
+
+static void
+audio_stems_setup(int n)
+{
+    st_mixer_ctx* const mc = audio_mixer_ctx;
+    int i;
+
+    g_assert(n >= 1 && n <= 32);
+
+    audio_stems_free();
+    for (i = 0; i < n; i++) {
+        st_mixer_ctx* const sc = g_new0(st_mixer_ctx, 1);
+
+        sc->mixer = mc->mixer;
+        sc->m = mc->mixer->new();
+        sc->numchannels = mc->numchannels;
+        sc->pitchbend = mc->pitchbend;
+        sc->mixer->setnumch(sc->m, sc->numchannels);
+        sc->mixer->setampfactor(sc->m, audio_ampfactor);
+        sc->mixer->reset(sc->m);
+        audio_stem_ctxs[i] = sc;
+    }
+    audio_stems = n;
+    mc->stems = audio_stem_ctxs;
+
+    /* The output format is to be set up for the new instances */
+    mixfmt_req = -666;
+}
+
+/* Makes m the mixer driven by the player */
+static void
+audio_select_mixer(st_mixer* m)
+{
+    st_mixer_ctx* mc = NULL;
+    GList* l;
+
+    g_assert(m != NULL);
+
+    if (audio_mixer_ctx && audio_mixer_ctx->mixer == m)
+        return;
+
+    /* They are set up again for the new mixer with the next mix */
+    audio_stems_free();
+
+    for (l = audio_mixer_ctxs; l; l = l->next) {
+        if (((st_mixer_ctx*)l->data)->mixer == m) {
+            mc = l->data;
+            break;
+        }
+    }
+
+    if (!mc) {
+        mc = g_new0(st_mixer_ctx, 1);
+        mc->mixer = m;
+        mc->m = m->new();
+        audio_mixer_ctxs = g_list_append(audio_mixer_ctxs, mc);
+    }
+
+    if (audio_mixer_ctx) {
+        mc->numchannels = audio_mixer_ctx->numchannels;
+        mc->pitchbend = audio_mixer_ctx->pitchbend;
+    }
+    m->setampfactor(mc->m, audio_ampfactor);
+
+    g_atomic_pointer_set(&audio_mixer_ctx, mc);
+    xmplayer_set_mixer(player, mc);
+}
+
+static gboolean
+audio_tracer_index_build_idle(gpointer data)
+{
+    gboolean more;
+
+    /* The checkpoints must not miss any notes */
+    st_mixer_sample_allow_waiting(TRUE);
+    more = tracer_index_build(audio_tracer_index, 16);
+    st_mixer_sample_allow_waiting(FALSE);
+    if (more)
+        return TRUE;
+
+    audio_tracer_index_idle = 0;
+    return FALSE;
+}
+
+void audio_tracer_index_build(void)
+{
+    if (!audio_tracer_index_idle)
+        audio_tracer_index_idle = g_idle_add_full(G_PRIORITY_LOW, audio_tracer_index_build_idle, NULL, NULL);
+}
+
+void audio_tracer_index_reset(void)
+{
+    tracer_index_reset(audio_tracer_index, xm);
+    audio_tracer_index_build();
+}
+
+void audio_mixer_updatesample(st_mixer_sample_info* si)
+{
+    st_mixer_ctx* mc = g_atomic_pointer_get(&audio_mixer_ctx);
+
+    if (mc) {
+        mc->mixer->updatesample(mc->m, si);
+    }
+}
+
+static void
+audio_ctl_init_player(void)
 {
     g_assert(xm != NULL);
 
-    xmplayer_init_module();
+    xmplayer_init_module(player, xm);
 }
 
 static void
-audio_ctlpipe_play_song(int songpos,
+audio_ctl_play_song(int songpos,
     int patpos)
 {
-    audio_backpipe_id a;
+    audio_back_id a;
 
     g_assert(playback_driver != NULL);
     g_assert(mixer != NULL);
@@ -195,36 +425,37 @@ audio_ctlpipe_play_song(int songpos,
         audio_prepare_for_playing();
 
         if (gui_settings.permanent_channels) { /* Tracing only if really needed */
-            xmplayer_init_play_song(0, 0, TRUE);
+            xmplayer_init_play_song(player, 0, 0, TRUE);
 
             if (songpos > 0 || patpos > 0) { /* Tracing!!! */
+                st_mixer_ctx* const mc = audio_mixer_ctx;
                 int i;
 
-                tracer_setnumch(audio_numchannels);
-                tracer_trace(playback_driver->get_play_rate(playback_driver_object), songpos, patpos);
-                xmplayer_init_play_song(songpos, patpos, FALSE);
+                tracer_setnumch(audio_tracer, mc->numchannels);
+                tracer_trace(audio_tracer, player, audio_tracer_index, playback_driver->get_play_rate(playback_driver_object),
+                    songpos, patpos, gui_settings.permanent_channels);
+                xmplayer_init_play_song(player, songpos, patpos, FALSE);
 
-                for (i = 0; i < audio_numchannels; i++)
+                for (i = 0; i < mc->numchannels; i++)
                     if (gui_settings.permanent_channels & (1 << i))
-                        mixer->loadchsettings(i);
+                        mc->mixer->loadchsettings(mc->m, i, tracer_return_channel(audio_tracer, i));
             }
         } else {
-            xmplayer_init_play_song(songpos, patpos, TRUE);
+            xmplayer_init_play_song(player, songpos, patpos, TRUE);
         }
 
-        a = AUDIO_BACKPIPE_PLAYING_STARTED;
+        a = AUDIO_BACK_PLAYING_STARTED;
     } else {
-        a = AUDIO_BACKPIPE_DRIVER_OPEN_FAILED;
+        a = AUDIO_BACK_DRIVER_OPEN_FAILED;
     }
 
-    if (write(backpipe, &a, sizeof(a)) != sizeof(a))
-        fprintf(stderr, "\n\n*** audio_thread: write incomplete\n\n\n");
+    audio_back_send(a);
 }
 
 static void
-audio_ctlpipe_render_song_to_file(gchar* filename)
+audio_ctl_render_song_to_file(gchar* filename)
 {
-    audio_backpipe_id a = AUDIO_BACKPIPE_DRIVER_OPEN_FAILED;
+    audio_back_id a = AUDIO_BACK_DRIVER_OPEN_FAILED;
 
     g_assert(playback_driver != NULL);
     g_assert(mixer != NULL);
@@ -232,21 +463,26 @@ audio_ctlpipe_render_song_to_file(gchar* filename)
     g_assert(!playing);
 
 #if USE_SNDFILE || AUDIOFILE_VERSION
-    *((gchar**)file_driver_object) = filename;
+    ((st_file_driver_params*)file_driver_object)->filename = filename;
+    ((st_file_driver_params*)file_driver_object)->numchannels = xm->num_channels;
 
     if (driver_out_file.open(file_driver_object)) {
         current_driver_object = file_driver_object;
         current_driver = &driver_out_file;
         audio_prepare_for_playing();
         playing_noloop = TRUE;
-        xmplayer_init_play_song(0, 0, TRUE);
-        a = AUDIO_BACKPIPE_PLAYING_STARTED;
+        xmplayer_init_play_song(player, 0, 0, TRUE);
+        a = AUDIO_BACK_PLAYING_STARTED;
         audio_restore_priority();
     }
+
+    /* The driver needs the name only for opening the file */
+    ((st_file_driver_params*)file_driver_object)->filename = NULL;
 #endif
 
-    if (write(backpipe, &a, sizeof(a)) != sizeof(a))
-        fprintf(stderr, "\n\n*** audio_thread: write incomplete\n\n\n");
+    g_free(filename);
+
+    audio_back_send(a);
 }
 
 #if USE_SNDFILE || AUDIOFILE_VERSION
@@ -279,11 +515,11 @@ void audio_file_output_save_config(void)
 #endif
 
 static void
-audio_ctlpipe_play_pattern(int pattern,
+audio_ctl_play_pattern(int pattern,
     int patpos,
     int only1row)
 {
-    audio_backpipe_id a;
+    audio_back_id a;
 
     g_assert(playback_driver != NULL);
     g_assert(mixer != NULL);
@@ -295,62 +531,78 @@ audio_ctlpipe_play_pattern(int pattern,
             current_driver_object = editing_driver_object;
             current_driver = editing_driver;
             audio_prepare_for_playing();
-            xmplayer_init_play_pattern(pattern, patpos, only1row);
-            a = AUDIO_BACKPIPE_PLAYING_NOTE_STARTED;
+            xmplayer_init_play_pattern(player, pattern, patpos, only1row);
+            a = AUDIO_BACK_PLAYING_NOTE_STARTED;
         } else {
-            a = AUDIO_BACKPIPE_DRIVER_OPEN_FAILED;
+            a = AUDIO_BACK_DRIVER_OPEN_FAILED;
         }
     } else {
         if (playback_driver->open(playback_driver_object)) {
             current_driver_object = playback_driver_object;
             current_driver = playback_driver;
             audio_prepare_for_playing();
-            xmplayer_init_play_pattern(pattern, patpos, only1row);
-            a = AUDIO_BACKPIPE_PLAYING_PATTERN_STARTED;
+            xmplayer_init_play_pattern(player, pattern, patpos, only1row);
+            a = AUDIO_BACK_PLAYING_PATTERN_STARTED;
         } else {
-            a = AUDIO_BACKPIPE_DRIVER_OPEN_FAILED;
+            a = AUDIO_BACK_DRIVER_OPEN_FAILED;
         }
     }
 
-    if (write(backpipe, &a, sizeof(a)) != sizeof(a))
-        fprintf(stderr, "\n\n*** audio_thread: write incomplete\n\n\n");
+    audio_back_send(a);
 }
 
-static void
-audio_ctlpipe_play_note(int channel,
-    int note,
-    int instrument,
-    gboolean all)
+gint64
+audio_get_time(void)
 {
-    audio_backpipe_id a = AUDIO_BACKPIPE_PLAYING_NOTE_STARTED;
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
 
-    if (!playing) {
-        if (editing_driver->open(editing_driver_object)) {
-            current_driver_object = editing_driver_object;
-            current_driver = editing_driver;
-            audio_prepare_for_playing();
-        } else {
-            a = AUDIO_BACKPIPE_DRIVER_OPEN_FAILED;
-        }
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (gint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return (gint64)tv.tv_sec * 1000000 + tv.tv_usec;
     }
+}
 
-    if (write(backpipe, &a, sizeof(a)) != sizeof(a))
-        fprintf(stderr, "\n\n*** audio_thread: write incomplete\n\n\n");
+static void
+audio_apply_note(const audio_ctl_msg* msg)
+{
+    switch (msg->id) {
+    case AUDIO_CTL_PLAY_NOTE:
+        xmplayer_play_note(player, msg->u.note.channel, msg->u.note.note, msg->u.note.instrument, msg->u.note.all);
+        break;
+    case AUDIO_CTL_PLAY_NOTE_FULL:
+        xmplayer_play_note_full(player, msg->u.note_full.channel, msg->u.note_full.note, msg->u.note_full.sample,
+            msg->u.note_full.offset, msg->u.note_full.count);
+        break;
+    case AUDIO_CTL_PLAY_NOTE_KEYOFF:
+        xmplayer_play_note_keyoff(player, msg->u.note.channel);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
 
-    if (!playing)
-        return;
+/* Hands the note over to audio_mix() for sample-accurate timing */
+static void
+audio_queue_note(const audio_ctl_msg* msg)
+{
+    audio_note_event ev;
 
-    xmplayer_play_note(channel, note, instrument, all);
+    ev.msg = *msg;
+    ev.generation = g_atomic_int_get(&audio_note_generation);
+    if (!msg_queue_try_send(audio_note_queue, &ev))
+        audio_apply_note(msg);
 }
 
 static void
-audio_ctlpipe_play_note_full(int channel,
-    int note,
-    STSample* sample,
-    guint32 offset,
-    guint32 count)
+audio_ctl_play_note(const audio_ctl_msg* msg)
 {
-    audio_backpipe_id a = AUDIO_BACKPIPE_PLAYING_NOTE_STARTED;
+    audio_back_id a = AUDIO_BACK_PLAYING_NOTE_STARTED;
 
     if (!playing) {
         if (editing_driver->open(editing_driver_object)) {
@@ -358,39 +610,41 @@ audio_ctlpipe_play_note_full(int channel,
             current_driver = editing_driver;
             audio_prepare_for_playing();
         } else {
-            a = AUDIO_BACKPIPE_DRIVER_OPEN_FAILED;
+            a = AUDIO_BACK_DRIVER_OPEN_FAILED;
         }
     }
 
-    if (write(backpipe, &a, sizeof(a)) != sizeof(a))
-        fprintf(stderr, "\n\n*** audio_thread: write incomplete\n\n\n");
+    audio_back_send(a);
 
     if (!playing)
         return;
 
-    xmplayer_play_note_full(channel, note, sample, offset, count);
+    audio_queue_note(msg);
 }
 
 static void
-audio_ctlpipe_play_note_keyoff(int channel)
+audio_ctl_play_note_keyoff(const audio_ctl_msg* msg)
 {
     if (!playing)
         return;
 
-    xmplayer_play_note_keyoff(channel);
+    audio_queue_note(msg);
 }
 
 static void
-audio_ctlpipe_stop_playing(void)
+audio_ctl_stop_playing(void)
 {
-    audio_backpipe_id a = AUDIO_BACKPIPE_PLAYING_STOPPED;
+    audio_back_id a = AUDIO_BACK_PLAYING_STOPPED;
+
+    g_atomic_int_inc(&audio_note_generation);
 
     if (playing == 1) {
-        xmplayer_stop();
+        xmplayer_stop(player);
         current_driver->release(current_driver_object);
         current_driver = NULL;
         current_driver_object = NULL;
         playing = 0;
+        audio_stems_free();
     }
 
     if (set_songpos_wait_for != -1) {
@@ -399,18 +653,17 @@ audio_ctlpipe_stop_playing(void)
         set_songpos_wait_for = -1;
     }
 
-    if (write(backpipe, &a, sizeof(a)) != sizeof(a))
-        fprintf(stderr, "\n\n*** audio_thread: write incomplete\n\n\n");
+    audio_back_send(a);
 
     audio_raise_priority();
 }
 
 static void
-audio_ctlpipe_set_songpos(int songpos)
+audio_ctl_set_songpos(int songpos)
 {
     g_assert(playing);
 
-    xmplayer_set_songpos(songpos);
+    xmplayer_set_songpos(player, songpos);
     if (set_songpos_wait_for != -1) {
         /* confirm previous request */
         event_waiter_confirm(audio_songpos_ew, 0.0);
@@ -419,9 +672,9 @@ audio_ctlpipe_set_songpos(int songpos)
 }
 
 static void
-audio_ctlpipe_set_tempo(int tempo)
+audio_ctl_set_tempo(int tempo)
 {
-    xmplayer_set_tempo(tempo);
+    xmplayer_set_tempo(player, tempo);
     if (confirm_tempo != 0) {
         /* confirm previous request */
         event_waiter_confirm(audio_tempo_ew, 0.0);
@@ -430,9 +683,9 @@ audio_ctlpipe_set_tempo(int tempo)
 }
 
 static void
-audio_ctlpipe_set_bpm(int bpm)
+audio_ctl_set_bpm(int bpm)
 {
-    xmplayer_set_bpm(bpm);
+    xmplayer_set_bpm(player, bpm);
     if (confirm_bpm != 0) {
         /* confirm previous request */
         event_waiter_confirm(audio_bpm_ew, 0.0);
@@ -441,59 +694,39 @@ audio_ctlpipe_set_bpm(int bpm)
 }
 
 static void
-audio_ctlpipe_set_pattern(int pattern)
+audio_ctl_set_pattern(int pattern)
 {
     g_assert(playing);
 
-    xmplayer_set_pattern(pattern);
+    xmplayer_set_pattern(player, pattern);
 }
 
 static void
-audio_ctlpipe_set_amplification(float af)
+audio_ctl_set_amplification(float af)
 {
-    g_assert(mixer != NULL);
+    int i;
 
     audio_ampfactor = af;
-    mixer->setampfactor(af);
-}
-
-/* read()s on pipes are always non-blocking, so when we want to read 8
-   bytes, we might only get 4. this routine is a workaround. seems
-   like i can't put a pipe into blocking mode. alternatively the other
-   end of the pipe could send packets in one big chunk instead of
-   using single write()s. */
-void readpipe(int fd, void* p, int count)
-{
-    struct pollfd pfd = { fd, POLLIN, 0 };
-    int n;
-
-    while (count) {
-        n = read(fd, p, count);
-        count -= n;
-        p += n;
-        if (count != 0) {
-            pfd.revents = 0;
-            poll(&pfd, 1, -1);
-        }
+    if (audio_mixer_ctx) {
+        audio_mixer_ctx->mixer->setampfactor(audio_mixer_ctx->m, af);
+    }
+    for (i = 0; i < audio_stems; i++) {
+        audio_stem_ctxs[i]->mixer->setampfactor(audio_stem_ctxs[i]->m, af);
     }
 }
 
 static void
 audio_thread(void)
 {
-    gboolean result = FALSE;
     struct pollfd pfd[5] = {
-        { ctlpipe, POLLIN, 0 },
+        { -1, POLLIN, 0 },
     };
     GList* pl;
     PollInput* pi;
-    audio_ctlpipe_id c;
-    int a[4], i, npl;
-    void* b;
-    float af;
+    audio_ctl_msg msg;
+    int i, npl;
 
-    static char* msgbuf = NULL;
-    static int msgbuflen = 0;
+    pfd[0].fd = msg_queue_get_fd(audio_ctl_queue);
 
     audio_raise_priority();
 
@@ -514,7 +747,7 @@ loop:
             pfd[npl].events |= POLLOUT;
     }
 
-    if (poll(pfd, npl, -1) == -1) {
+    if (poll(pfd, npl, pull_input ? 0 : -1) == -1) {
         if (errno == EINTR)
             goto loop;
         perror("audio_thread:poll():");
@@ -522,88 +755,74 @@ loop:
     }
 
     if (pfd[0].revents & POLLIN) {
-        readpipe(ctlpipe, &c, sizeof(c));
-        switch (c) {
-        case AUDIO_CTLPIPE_INIT_PLAYER:
-            audio_ctlpipe_init_player();
-            break;
-        case AUDIO_CTLPIPE_PLAY_SONG:
-            readpipe(ctlpipe, a, 2 * sizeof(a[0]));
-            audio_ctlpipe_play_song(a[0], a[1]);
+        msg_queue_ack(audio_ctl_queue);
+    }
+
+    /* Drain the whole queue; several requests may be covered by a
+       single wakeup. */
+    g_mutex_lock(&audio_mix_mutex);
+    while (msg_queue_receive(audio_ctl_queue, &msg)) {
+        switch (msg.id) {
+        case AUDIO_CTL_INIT_PLAYER:
+            audio_ctl_init_player();
             break;
-        case AUDIO_CTLPIPE_PLAY_PATTERN:
-            readpipe(ctlpipe, a, 3 * sizeof(a[0]));
-            audio_ctlpipe_play_pattern(a[0], a[1], a[2]);
+        case AUDIO_CTL_PLAY_SONG:
+            audio_ctl_play_song(msg.u.song.songpos, msg.u.song.patpos);
             break;
-        case AUDIO_CTLPIPE_PLAY_NOTE:
-            readpipe(ctlpipe, a, 4 * sizeof(a[0]));
-            audio_ctlpipe_play_note(a[0], a[1], a[2], a[3]);
+        case AUDIO_CTL_PLAY_PATTERN:
+            audio_ctl_play_pattern(msg.u.pattern.pattern, msg.u.pattern.patpos, msg.u.pattern.only1row);
             break;
-        case AUDIO_CTLPIPE_PLAY_NOTE_FULL:
-            readpipe(ctlpipe, &a[0], 2 * sizeof(a[0]));
-            readpipe(ctlpipe, &b, 1 * sizeof(b));
-            readpipe(ctlpipe, &a[2], 2 * sizeof(a[0]));
-            audio_ctlpipe_play_note_full(a[0], a[1], b, a[2], a[3]);
+        case AUDIO_CTL_PLAY_NOTE:
+        case AUDIO_CTL_PLAY_NOTE_FULL:
+            audio_ctl_play_note(&msg);
             break;
-        case AUDIO_CTLPIPE_PLAY_NOTE_KEYOFF:
-            readpipe(ctlpipe, a, 1 * sizeof(a[0]));
-            audio_ctlpipe_play_note_keyoff(a[0]);
+        case AUDIO_CTL_PLAY_NOTE_KEYOFF:
+            audio_ctl_play_note_keyoff(&msg);
             break;
-        case AUDIO_CTLPIPE_STOP_PLAYING:
-            audio_ctlpipe_stop_playing();
+        case AUDIO_CTL_STOP_PLAYING:
+            audio_ctl_stop_playing();
             break;
-        case AUDIO_CTLPIPE_RENDER_SONG_TO_FILE:
-            readpipe(ctlpipe, a, sizeof(a[0]));
-            if (msgbuflen < a[0] + 1) {
-                g_free(msgbuf);
-                msgbuf = g_new(char, a[0] + 1);
-                msgbuflen = a[0] + 1;
-            }
-            readpipe(ctlpipe, msgbuf, a[0] + 1);
-            audio_ctlpipe_render_song_to_file(msgbuf);
+        case AUDIO_CTL_RENDER_SONG_TO_FILE:
+            audio_ctl_render_song_to_file(msg.u.filename);
             break;
-        case AUDIO_CTLPIPE_SET_SONGPOS:
-            result = (read(ctlpipe, a, 1 * sizeof(a[0])) != 1 * sizeof(a[0]));
-            audio_ctlpipe_set_songpos(a[0]);
+        case AUDIO_CTL_SET_SONGPOS:
+            audio_ctl_set_songpos(msg.u.value);
             break;
-        case AUDIO_CTLPIPE_SET_PATTERN:
-            result = (read(ctlpipe, a, 1 * sizeof(a[0])) != 1 * sizeof(a[0]));
-            audio_ctlpipe_set_pattern(a[0]);
+        case AUDIO_CTL_SET_PATTERN:
+            audio_ctl_set_pattern(msg.u.value);
             break;
-        case AUDIO_CTLPIPE_SET_AMPLIFICATION:
-            result = (read(ctlpipe, &af, sizeof(af)) != sizeof(af));
-            audio_ctlpipe_set_amplification(af);
+        case AUDIO_CTL_SET_AMPLIFICATION:
+            audio_ctl_set_amplification(msg.u.fvalue);
             break;
-        case AUDIO_CTLPIPE_SET_PITCHBEND:
-            result = (read(ctlpipe, &af, sizeof(af)) != sizeof(af));
-            pitchbend_req = af;
+        case AUDIO_CTL_SET_PITCHBEND:
+            pitchbend_req = msg.u.fvalue;
             break;
-        case AUDIO_CTLPIPE_SET_MIXER:
-            result = (read(ctlpipe, &b, sizeof(b)) != sizeof(b));
-            mixer = b;
+        case AUDIO_CTL_SET_MIXER:
+            mixer = msg.u.mixer;
+            audio_select_mixer(mixer);
             if (playing) {
-                mixer->reset();
+                audio_mixer_ctx->mixer->reset(audio_mixer_ctx->m);
                 mixfmt_req = -666;
-                mixer->setnumch(audio_numchannels);
+                audio_mixer_ctx->mixer->setnumch(audio_mixer_ctx->m, audio_mixer_ctx->numchannels);
             }
-            mixer->setampfactor(audio_ampfactor);
             break;
-        case AUDIO_CTLPIPE_SET_TEMPO:
-            readpipe(ctlpipe, a, 1 * sizeof(a[0]));
-            audio_ctlpipe_set_tempo(a[0]);
+        case AUDIO_CTL_SET_TEMPO:
+            audio_ctl_set_tempo(msg.u.value);
             break;
-        case AUDIO_CTLPIPE_SET_BPM:
-            readpipe(ctlpipe, a, 1 * sizeof(a[0]));
-            audio_ctlpipe_set_bpm(a[0]);
+        case AUDIO_CTL_SET_BPM:
+            audio_ctl_set_bpm(msg.u.value);
+            break;
+        case AUDIO_CTL_SET_DITHER:
+            audio_dither = msg.u.value;
+            mixfmt_req = -666;
             break;
         default:
-            fprintf(stderr, "\n\n*** audio_thread: unknown ctlpipe id %d\n\n\n", c);
+            fprintf(stderr, "\n\n*** audio_thread: unknown control message id %d\n\n\n", msg.id);
             pthread_exit(NULL);
             break;
         }
-        if (result)
-            fprintf(stderr, "\n\n*** audio_thread: read incomplete\n\n\n");
     }
+    g_mutex_unlock(&audio_mix_mutex);
 
     for (pl = inputs, i = 1; i < npl; pl = pl->next, i++) {
         pi = pl->data;
@@ -617,26 +836,38 @@ loop:
                 x |= GDK_INPUT_WRITE;
             pi->function(pi->data, pi->fd, x);
 
-            if (playing_noloop & player_looped) {
+            if (playing_noloop & player->looped) {
                 // "noloop" mode for file renderer -- need to flush output buffer
                 // and then stop playing
                 pi->function(pi->data, pi->fd, x);
-                audio_ctlpipe_stop_playing();
+                audio_ctl_stop_playing();
             }
         }
     }
 
+    if (pull_input) {
+        /* A pull driver writes out what it has just mixed, there is
+           nothing left to flush */
+        pull_input->function(pull_input->data, -1, GDK_INPUT_WRITE);
+        if (playing_noloop && player->looped)
+            audio_ctl_stop_playing();
+    }
+
     goto loop;
 }
 
 gboolean
-audio_init(int c,
-    int b)
+audio_init(void)
 {
     int i;
 
-    ctlpipe = c;
-    backpipe = b;
+    gui_threadid = pthread_self();
+    if (!(audio_ctl_queue = msg_queue_new(sizeof(audio_ctl_msg), AUDIO_QUEUE_CAPACITY)))
+        return FALSE;
+    if (!(audio_back_queue = msg_queue_new(sizeof(audio_back_msg), AUDIO_QUEUE_CAPACITY)))
+        return FALSE;
+    if (!(audio_note_queue = msg_queue_new(sizeof(audio_note_event), AUDIO_NOTE_EVENTS_MAX)))
+        return FALSE;
 
     for (i = 0; i < 32; i++) {
         scopebufs[i] = NULL;
@@ -646,11 +877,20 @@ audio_init(int c,
 
     memset(player_mute_channels, 0, sizeof(player_mute_channels));
 
-    if (!(audio_playerpos_tb = time_buffer_new(10.0)))
+    player = xmplayer_new(NULL);
+    player->mute = player_mute_channels;
+    audio_tracer = tracer_new();
+    audio_tracer_index = tracer_index_new();
+
+    /* Room for 10 seconds of feedback; the player ticks up to 102 times
+       per second (at 255 BPM) */
+    if (!(audio_playerpos_tb = time_buffer_new(sizeof(audio_player_pos), 10 * 102)))
         return FALSE;
-    if (!(audio_clipping_indicator_tb = time_buffer_new(10.0)))
+    if (!(audio_clipping_indicator_tb = time_buffer_new(sizeof(audio_clipping_indicator),
+              10 * audio_visual_feedback_updates_per_second)))
         return FALSE;
-    if (!(audio_mixer_position_tb = time_buffer_new(10.0)))
+    if (!(audio_mixer_position_tb = time_buffer_new(sizeof(audio_mixer_position),
+              10 * audio_visual_feedback_updates_per_second)))
         return FALSE;
     if (!(audio_songpos_ew = event_waiter_new()))
         return FALSE;
@@ -665,86 +905,182 @@ audio_init(int c,
     return FALSE;
 }
 
-void audio_set_mixer(st_mixer* newmixer)
+void audio_back_show_message(audio_back_id level,
+    const char* text)
 {
-    audio_ctlpipe_id i = AUDIO_CTLPIPE_SET_MIXER;
+    if (level == AUDIO_BACK_ERROR_MESSAGE) {
+        static GtkWidget* dialog = NULL;
 
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i) || write(audio_ctlpipe, &newmixer, sizeof(newmixer)) != sizeof(newmixer)) {
+        gui_error_dialog(&dialog, text, TRUE);
+    } else {
         static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
+
+        gui_warning_dialog(&dialog, text, TRUE);
     }
 }
 
-static void
-mixer_mix_format(STMixerFormat m, int s)
+static gboolean
+audio_back_message_idle(gpointer data)
 {
-    g_assert(mixer != NULL);
+    audio_back_msg* msg = data;
+
+    audio_back_show_message(msg->id, msg->text);
+    g_free(msg->text);
+    g_free(msg);
+
+    return FALSE;
+}
 
-    mixfmt_conv = 0;
-    mixfmt = 0;
+void audio_ctl_send(const audio_ctl_msg* msg)
+{
+    msg_queue_send(audio_ctl_queue, msg);
+}
+
+void audio_back_message(audio_back_id level,
+    const char* text)
+{
+    g_assert(level == AUDIO_BACK_ERROR_MESSAGE || level == AUDIO_BACK_WARNING_MESSAGE);
+
+    if (audio_back_queue && pthread_equal(pthread_self(), threadid)) {
+        audio_back_msg msg = { level, g_strdup(text) };
+
+        msg_queue_send(audio_back_queue, &msg);
+    } else if (!audio_back_queue || pthread_equal(pthread_self(), gui_threadid)) {
+        audio_back_show_message(level, text);
+    } else {
+        /* Some other thread; the back queue has only one producer */
+        audio_back_msg* msg = g_new(audio_back_msg, 1);
+
+        msg->id = level;
+        msg->text = g_strdup(text);
+        g_idle_add(audio_back_message_idle, msg);
+    }
+}
+
+void audio_set_mixer(st_mixer* newmixer)
+{
+    audio_ctl_msg msg = { AUDIO_CTL_SET_MIXER };
 
+    msg.u.mixer = newmixer;
+    audio_ctl_send(&msg);
+}
+
+void audio_set_dither(audio_dither_mode mode)
+{
+    audio_ctl_msg msg = { AUDIO_CTL_SET_DITHER };
+
+    msg.u.value = mode;
+    audio_ctl_send(&msg);
+}
+
+static format_conv_type
+mixer_format_to_conv_type(STMixerFormat m)
+{
     switch (m) {
+#ifdef WORDS_BIGENDIAN
     case ST_MIXER_FORMAT_S16_BE:
-    case ST_MIXER_FORMAT_S16_LE:
+        return FORMAT_CONV_S16;
     case ST_MIXER_FORMAT_U16_BE:
+        return FORMAT_CONV_U16;
+    case ST_MIXER_FORMAT_S16_LE:
+        return FORMAT_CONV_S16_SWAPPED;
     case ST_MIXER_FORMAT_U16_LE:
-        if (mixer->setmixformat(16)) {
-            mixfmt = MIXFMT_16;
-        } else if (mixer->setmixformat(8)) {
-            mixfmt_conv |= MIXFMT_CONV_TO_16;
-        } else {
-            g_error("Weird mixer. No 8 or 16 bits modes.\n");
-        }
-        break;
+        return FORMAT_CONV_U16_SWAPPED;
+#else
+    case ST_MIXER_FORMAT_S16_LE:
+        return FORMAT_CONV_S16;
+    case ST_MIXER_FORMAT_U16_LE:
+        return FORMAT_CONV_U16;
+    case ST_MIXER_FORMAT_S16_BE:
+        return FORMAT_CONV_S16_SWAPPED;
+    case ST_MIXER_FORMAT_U16_BE:
+        return FORMAT_CONV_U16_SWAPPED;
+#endif
     case ST_MIXER_FORMAT_S8:
+        return FORMAT_CONV_S8;
     case ST_MIXER_FORMAT_U8:
-        if (mixer->setmixformat(8)) {
-        } else if (mixer->setmixformat(16)) {
-            mixfmt = MIXFMT_16;
-            mixfmt_conv |= MIXFMT_CONV_TO_8;
-        } else {
-            g_error("Weird mixer. No 8 or 16 bits modes.\n");
-        }
-        break;
+        return FORMAT_CONV_U8;
+    case ST_MIXER_FORMAT_FLOAT:
+        return FORMAT_CONV_FLOAT;
     default:
         g_error("Unknown argument for STMixerFormat.\n");
-        break;
+        return FORMAT_CONV_S16;
     }
+}
 
-    if (mixfmt & MIXFMT_16) {
-        switch (m) {
-#ifdef WORDS_BIGENDIAN
-        case ST_MIXER_FORMAT_S16_LE:
-        case ST_MIXER_FORMAT_U16_LE:
-#else
-        case ST_MIXER_FORMAT_S16_BE:
-        case ST_MIXER_FORMAT_U16_BE:
-#endif
-            mixfmt_conv |= MIXFMT_CONV_BYTESWAP;
-            break;
-        default:
-            break;
+/* Tries the mixer's output formats in the given order */
+static format_conv_type
+mixer_mix_format_try(st_mixer_ctx* mc,
+    int first,
+    int second,
+    int third)
+{
+    const int bits[3] = { first, second, third };
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (mc->mixer->setmixformat(mc->m, bits[i])) {
+            return bits[i] == 32 ? FORMAT_CONV_FLOAT : (bits[i] == 16 ? FORMAT_CONV_S16 : FORMAT_CONV_S8);
         }
     }
 
-    switch (m) {
-    case ST_MIXER_FORMAT_U16_LE:
-    case ST_MIXER_FORMAT_U16_BE:
-    case ST_MIXER_FORMAT_U8:
-        mixfmt_conv |= MIXFMT_CONV_TO_UNSIGNED;
+    g_error("Weird mixer. No 8 or 16 bits modes.\n");
+    return FORMAT_CONV_S16;
+}
+
+static void
+mixer_mix_format(STMixerFormat m, int s)
+{
+    st_mixer_ctx* const mc = audio_mixer_ctx;
+    int i;
+
+    g_assert(mc != NULL);
+
+    mixfmt_dest_type = mixer_format_to_conv_type(m);
+    mixfmt_dither = FALSE;
+
+    switch (mixfmt_dest_type) {
+    case FORMAT_CONV_S8:
+    case FORMAT_CONV_U8:
+        mixfmt_type = mixer_mix_format_try(mc, 8, 16, 32);
+        break;
+    case FORMAT_CONV_FLOAT:
+        mixfmt_type = mixer_mix_format_try(mc, 32, 16, 8);
         break;
     default:
+        if (audio_dither != AUDIO_DITHER_NONE && mc->mixer->setmixformat(mc->m, 32)) {
+            mixfmt_type = FORMAT_CONV_FLOAT;
+            mixfmt_dither = TRUE;
+        } else {
+            mixfmt_type = mixer_mix_format_try(mc, 16, 8, 32);
+        }
         break;
     }
 
-    mixfmt |= s ? MIXFMT_STEREO : 0;
-    if (!mixer->setstereo(s)) {
-        if (s) {
-            mixfmt &= ~MIXFMT_STEREO;
-            mixfmt_conv |= MIXFMT_CONV_TO_STEREO;
-        } else {
-            mixfmt_conv |= MIXFMT_CONV_TO_MONO;
-        }
+    mixfmt_dest_channels = s ? 2 : 1;
+    mixfmt_channels = mixfmt_dest_channels;
+    if (!mc->mixer->setstereo(mc->m, s)) {
+        mixfmt_channels = s ? 1 : 2;
+    }
+
+    /* The stem mixers are of the same kind and end up the same way */
+    for (i = 0; i < audio_stems; i++) {
+        st_mixer_ctx* const sc = audio_stem_ctxs[i];
+
+        sc->mixer->setmixformat(sc->m, mixfmt_type == FORMAT_CONV_FLOAT ? 32 : (mixfmt_type == FORMAT_CONV_S16 ? 16 : 8));
+        sc->mixer->setstereo(sc->m, mixfmt_channels == 2);
+    }
+
+    /* After dithering the data is in 16 bits */
+    mixfmt_convert = NULL;
+    if ((mixfmt_dither ? FORMAT_CONV_S16 : mixfmt_type) != mixfmt_dest_type || mixfmt_channels != mixfmt_dest_channels) {
+        mixfmt_convert = format_conv_get(mixfmt_dither ? FORMAT_CONV_S16 : mixfmt_type, mixfmt_channels,
+            mixfmt_dest_type, mixfmt_dest_channels);
+    }
+
+    for (i = 0; i < 32; i++) {
+        audio_dither_st[i].seed = i + 1;
+        memset(audio_dither_st[i].err, 0, sizeof(audio_dither_st[i].err));
     }
 }
 
@@ -754,9 +1090,10 @@ void audio_prepare_for_playing(void)
 
     g_assert(mixer != NULL);
 
-    mixer->reset();
+    audio_select_mixer(mixer);
+    audio_mixer_ctx->mixer->reset(audio_mixer_ctx->m);
     mixfmt_req = -666;
-    pitchbend = pitchbend_req;
+    audio_mixer_ctx->pitchbend = pitchbend_req;
 
     playing = 1;
     playing_noloop = FALSE;
@@ -765,6 +1102,7 @@ void audio_prepare_for_playing(void)
     audio_next_tick_time_unbent = 0.0;
     audio_current_playback_time_bent = 0.0;
     audio_mixer_current_time = 0.0;
+    audio_mix_walltime = 0;
 
     time_buffer_clear(audio_playerpos_tb);
     time_buffer_clear(audio_clipping_indicator_tb);
@@ -780,6 +1118,9 @@ void audio_prepare_for_playing(void)
     scopebuf_start.time = 0.0;
     scopebuf_end.offset = 0;
     scopebuf_end.time = 0.0;
+    for (i = 0; i < 32; i++) {
+        scopebuf_sound_end[i] = 0.0;
+    }
     scopebuf_ready = FALSE;
     if (gui_settings.scopes_buffer_size / 32 > scopebuf_length) {
         scopebuf_length = gui_settings.scopes_buffer_size / 32;
@@ -793,11 +1134,18 @@ void audio_prepare_for_playing(void)
     scopebuf_ready = TRUE;
 }
 
-static void*
-mixer_mix_and_handle_scopes(void* dest,
+/* Mixes count frames into dests[], one output per stem mixer or just
+   the one of the current mixer, and advances the pointers */
+static void
+mixer_mix_and_handle_scopes(void* dests[],
     guint32 count)
 {
-    int n;
+    st_mixer_ctx* const mc = audio_mixer_ctx;
+    st_mixer_ctx* const* const ctxs = audio_stems ? audio_stem_ctxs : &audio_mixer_ctx;
+    const int nctxs = audio_stems ? audio_stems : 1;
+    int n, i;
+    gboolean scopes;
+    guint32 mask;
     extern ScopeGroup* scopegroup;
     audio_clipping_indicator* c;
     audio_mixer_position* p;
@@ -813,10 +1161,28 @@ mixer_mix_and_handle_scopes(void* dest,
             n = audio_visual_feedback_counter;
         }
 
-        dest = scopegroup->scopes_on && scopebuf_ready ? mixer->mix(dest, n, scopebufs, scopebuf_end.offset) : mixer->mix(dest, n, NULL, 0);
+        scopes = scopegroup->scopes_on && scopebuf_ready;
+        mask = 0;
+        for (i = 0; i < nctxs; i++) {
+            st_mixer_ctx* const c = ctxs[i];
+
+            /* A stem mixer only plays its own channel, so it fills only
+               that channel's scope buffer */
+            dests[i] = scopes ? c->mixer->mix(c->m, dests[i], n, scopebufs, scopebuf_end.offset) : c->mixer->mix(c->m, dests[i], n, NULL, 0);
+            if (scopes) {
+                mask |= c->mixer->getscopemask(c->m);
+            }
+            if (c->mixer->getclipflag(c->m)) {
+                audio_visual_feedback_clipping = audio_visual_feedback_smear_clipping;
+            }
+        }
 
         scopebuf_end.offset += n;
         scopebuf_end.time += (double)n / scopebuf_freq;
+
+        for (; mask; mask &= mask - 1) {
+            scopebuf_sound_end[g_bit_nth_lsf(mask, -1)] = scopebuf_end.time;
+        }
         audio_mixer_current_time += (double)n / scopebuf_freq;
         count -= n;
         audio_visual_feedback_counter -= n;
@@ -825,23 +1191,29 @@ mixer_mix_and_handle_scopes(void* dest,
             scopebuf_end.offset = 0;
         }
 
-        if (mixer->getclipflag()) {
-            audio_visual_feedback_clipping = audio_visual_feedback_smear_clipping;
-        }
-
         if (audio_visual_feedback_counter == 0) {
             /* Get up-to-date info from mixer about current sample positions */
             audio_visual_feedback_counter = audio_visual_feedback_update_interval;
-            if ((p = g_new(audio_mixer_position, 1))) {
-                mixer->dumpstatus(p->dump);
-                time_buffer_add(audio_mixer_position_tb, p, audio_mixer_current_time);
+            if ((p = time_buffer_reserve(audio_mixer_position_tb))) {
+                if (audio_stems) {
+                    st_mixer_channel_status dump[32];
+
+                    memset(p->dump, 0, sizeof(p->dump));
+                    for (i = 0; i < audio_stems; i++) {
+                        ctxs[i]->mixer->dumpstatus(ctxs[i]->m, dump);
+                        p->dump[i] = dump[i];
+                    }
+                } else {
+                    mc->mixer->dumpstatus(mc->m, p->dump);
+                }
+                time_buffer_commit(audio_mixer_position_tb, audio_mixer_current_time);
             }
-            if ((c = g_new(audio_clipping_indicator, 1))) {
+            if ((c = time_buffer_reserve(audio_clipping_indicator_tb))) {
                 c->clipping = audio_visual_feedback_clipping;
-                if (audio_visual_feedback_clipping) {
-                    audio_visual_feedback_clipping--;
-                }
-                time_buffer_add(audio_clipping_indicator_tb, c, audio_mixer_current_time);
+                time_buffer_commit(audio_clipping_indicator_tb, audio_mixer_current_time);
+            }
+            if (audio_visual_feedback_clipping) {
+                audio_visual_feedback_clipping--;
             }
         }
 
@@ -856,189 +1228,188 @@ mixer_mix_and_handle_scopes(void* dest,
             scopebuf_start.time += (double)d / scopebuf_freq;
         }
     }
-
-    return dest;
 }
 
-static void*
-mixer_mix(void* dest,
+/* Mixes count frames into each of the outputs in dests[] and advances
+   the pointers */
+static void
+mixer_mix(void* dests[],
     guint32 count)
 {
     static int bufsize = 0;
     static void* buf = NULL;
-    int b, i, c, d;
-    void* ende;
+    const int dest_size = count * mixfmt_dest_channels * format_conv_get_size(mixfmt_dest_type);
+    const int nouts = audio_stems ? audio_stems : 1;
+    void* bufs[32];
+    int b, d, i;
 
     if (count == 0)
-        return dest;
+        return;
 
-    g_assert(mixer != NULL);
+    g_assert(audio_mixer_ctx != NULL);
 
     /* The mixer doesn't have to support a format that the driver
-       requires. This routine converts between any formats if
-       necessary: 16 bits / 8 bits, mono / stereo, little endian / big
-       endian, unsigned / signed */
-
-    if (mixfmt_conv == 0) {
-        return mixer_mix_and_handle_scopes(dest, count);
-    }
-
-    b = count;
-    c = 8;
-    d = 1;
-    if (mixfmt & MIXFMT_16) {
-        b *= 2;
-        c = 16;
-    }
-    if ((mixfmt & MIXFMT_STEREO) || (mixfmt_conv & MIXFMT_CONV_TO_MONO)) {
-        b *= 2;
-        d = 2;
-    }
-
-    if (b > bufsize) {
-        g_free(buf);
-        buf = g_new(guint8, b);
-        bufsize = b;
+       requires. The difference is made up for in a single pass by one
+       of the routines in format-conv.c: float / 16 bits / 8 bits, mono /
+       stereo, little endian / big endian, unsigned / signed. A float
+       mix is dithered down to 16 bits first if the driver doesn't take
+       floats. */
+
+    if (!mixfmt_dither && !mixfmt_convert) {
+        mixer_mix_and_handle_scopes(dests, count);
+        return;
     }
 
-    g_assert(buf != NULL);
-    ende = mixer_mix_and_handle_scopes(buf, count);
+    b = count * mixfmt_channels * format_conv_get_size(mixfmt_type);
 
-    if (mixfmt_conv & MIXFMT_CONV_TO_MONO) {
-        if (mixfmt & MIXFMT_16) {
-            gint16 *a = buf, *b = buf;
-            for (i = 0; i < count; i++, a += 2, b += 1)
-                *b = (a[0] + a[1]) / 2;
-        } else {
-            gint8 *a = buf, *b = buf;
-            for (i = 0; i < count; i++, a += 2, b += 1)
-                *b = (a[0] + a[1]) / 2;
+    if (!mixfmt_dither && b == dest_size) {
+        /* The mix fits into the driver's buffer; convert it in place */
+        memcpy(bufs, dests, nouts * sizeof(void*));
+        mixer_mix_and_handle_scopes(dests, count);
+        for (i = 0; i < nouts; i++) {
+            mixfmt_convert(bufs[i], bufs[i], count);
         }
-        d = 1;
+        return;
     }
 
-    if (mixfmt_conv & MIXFMT_CONV_TO_8) {
-        gint16* a = buf;
-        gint8* b = dest;
-        for (i = 0; i < count * d; i++)
-            *b++ = *a++ >> 8;
-        c = 8;
-        ende = b;
-    } else if (mixfmt_conv & MIXFMT_CONV_TO_16) {
-        gint8* a = buf;
-        gint16* b = dest;
-        for (i = 0; i < count * d; i++)
-            *b++ = *a++ << 8;
-        c = 16;
-        ende = b;
-    } else {
-        memcpy(dest, buf, count * d * (c / 8));
-        ende = dest + (count * d * (c / 8));
-    }
+    /* The dithered 16 bit data go behind the mix if they still have to
+       be converted */
+    d = mixfmt_dither && mixfmt_convert ? count * mixfmt_channels * 2 : 0;
 
-    if (mixfmt_conv & MIXFMT_CONV_TO_UNSIGNED) {
-        if (c == 16) {
-            gint16* a = dest;
-            guint16* b = dest;
-            for (i = 0; i < count * d; i++)
-                *b++ = *a++ + 32768;
-        } else {
-            gint8* a = dest;
-            guint8* b = dest;
-            for (i = 0; i < count * d; i++)
-                *b++ = *a++ + 128;
-        }
+    if ((b + d) * nouts > bufsize) {
+        g_free(buf);
+        buf = g_new(guint8, (b + d) * nouts);
+        bufsize = (b + d) * nouts;
     }
 
-    if (mixfmt_conv & MIXFMT_CONV_BYTESWAP) {
-        le_16_array_to_host_order(dest, count * d);
+    g_assert(buf != NULL);
+    for (i = 0; i < nouts; i++) {
+        bufs[i] = buf + i * (b + d);
     }
+    mixer_mix_and_handle_scopes(bufs, count);
 
-    if (mixfmt_conv & MIXFMT_CONV_TO_STEREO) {
-        g_assert(d == 1);
-        if (c == 16) {
-            gint16 *a = dest, *b = dest;
-            ende = b;
-            for (i = 0, a += count, b += 2 * count; i < count; i++, a -= 1, b -= 2)
-                b[-1] = b[-2] = a[-1];
+    for (i = 0; i < nouts; i++) {
+        void* const src = buf + i * (b + d);
+
+        if (!mixfmt_dither) {
+            mixfmt_convert(src, dests[i], count);
+        } else if (!mixfmt_convert) {
+            audio_dither_to_16(src, dests[i], count, mixfmt_channels, audio_dither == AUDIO_DITHER_SHAPED,
+                &audio_dither_st[i]);
         } else {
-            gint8 *a = dest, *b = dest;
-            ende = b;
-            for (i = 0, a += count, b += 2 * count; i < count; i++, a -= 1, b -= 2)
-                b[-1] = b[-2] = a[-1];
+            audio_dither_to_16(src, src + b, count, mixfmt_channels, audio_dither == AUDIO_DITHER_SHAPED,
+                &audio_dither_st[i]);
+            mixfmt_convert(src + b, dests[i], count);
         }
+        dests[i] += dest_size;
     }
+}
 
-    return ende;
+/* The instance mixing the given channel */
+static inline st_mixer_ctx*
+driver_channel_ctx(st_mixer_ctx* mc,
+    int channel)
+{
+    return mc->stems && channel < audio_stems ? mc->stems[channel] : mc;
 }
 
-void driver_setnumch(int numchannels)
+void driver_setnumch(st_mixer_ctx* mc,
+    int numchannels)
 {
+    int i;
+
     g_assert(numchannels >= 1 && numchannels <= 32);
-    audio_numchannels = numchannels;
-    mixer->setnumch(numchannels);
+    mc->numchannels = numchannels;
+    mc->mixer->setnumch(mc->m, numchannels);
+
+    if (mc->stems) {
+        for (i = 0; i < audio_stems; i++) {
+            mc->stems[i]->numchannels = numchannels;
+            mc->stems[i]->mixer->setnumch(mc->stems[i]->m, numchannels);
+        }
+    }
 }
 
-void driver_startnote(int channel,
+void driver_startnote(st_mixer_ctx* mc,
+    int channel,
     st_mixer_sample_info* si)
 {
-    if (si->length != 0) {
-        mixer->startnote(channel, si);
+    /* A note whose data is still being loaded is left out */
+    if (si->length != 0 && st_mixer_sample_prepare(si)) {
+        mc = driver_channel_ctx(mc, channel);
+        mc->mixer->startnote(mc->m, channel, si);
     }
 }
 
-void driver_stopnote(int channel)
+void driver_stopnote(st_mixer_ctx* mc,
+    int channel)
 {
-    mixer->stopnote(channel);
+    mc = driver_channel_ctx(mc, channel);
+    mc->mixer->stopnote(mc->m, channel);
 }
 
-void driver_setsmplpos(int channel,
+void driver_setsmplpos(st_mixer_ctx* mc,
+    int channel,
     guint32 offset)
 {
-    mixer->setsmplpos(channel, offset);
+    mc = driver_channel_ctx(mc, channel);
+    mc->mixer->setsmplpos(mc->m, channel, offset);
 }
 
-void driver_setsmplend(int channel,
+void driver_setsmplend(st_mixer_ctx* mc,
+    int channel,
     guint32 offset)
 {
-    mixer->setsmplend(channel, offset);
+    mc = driver_channel_ctx(mc, channel);
+    mc->mixer->setsmplend(mc->m, channel, offset);
 }
 
-void driver_setfreq(int channel,
+void driver_setfreq(st_mixer_ctx* mc,
+    int channel,
     float frequency)
 {
-    mixer->setfreq(channel, frequency * ((100.0 + pitchbend) / 100.0));
+    st_mixer_ctx* const cc = driver_channel_ctx(mc, channel);
+
+    cc->mixer->setfreq(cc->m, channel, frequency * ((100.0 + mc->pitchbend) / 100.0));
 }
 
-void driver_setvolume(int channel,
+void driver_setvolume(st_mixer_ctx* mc,
+    int channel,
     float volume)
 {
     g_assert(volume >= 0.0 && volume <= 1.0);
 
-    mixer->setvolume(channel, volume);
+    mc = driver_channel_ctx(mc, channel);
+    mc->mixer->setvolume(mc->m, channel, volume);
 }
 
-void driver_setpanning(int channel,
+void driver_setpanning(st_mixer_ctx* mc,
+    int channel,
     float panning)
 {
     g_assert(panning >= -1.0 && panning <= +1.0);
 
-    mixer->setpanning(channel, panning);
+    mc = driver_channel_ctx(mc, channel);
+    mc->mixer->setpanning(mc->m, channel, panning);
 }
 
-void driver_set_ch_filter_freq(int channel,
+void driver_set_ch_filter_freq(st_mixer_ctx* mc,
+    int channel,
     float freq)
 {
-    if (mixer->setchcutoff) {
-        mixer->setchcutoff(channel, freq);
+    mc = driver_channel_ctx(mc, channel);
+    if (mc->mixer->setchcutoff) {
+        mc->mixer->setchcutoff(mc->m, channel, freq);
     }
 }
 
-void driver_set_ch_filter_reso(int channel,
+void driver_set_ch_filter_reso(st_mixer_ctx* mc,
+    int channel,
     float freq)
 {
-    if (mixer->setchreso) {
-        mixer->setchreso(channel, freq);
+    mc = driver_channel_ctx(mc, channel);
+    if (mc->mixer->setchreso) {
+        mc->mixer->setchreso(mc->m, channel, freq);
     }
 }
 
@@ -1069,12 +1440,77 @@ void audio_poll_remove(gpointer input)
     }
 }
 
-void audio_mix(void* dest,
+gpointer
+audio_pull_add(GdkInputFunction func,
+    gpointer data)
+{
+    g_assert(pull_input == NULL);
+
+    pull_input = g_new(PollInput, 1);
+    pull_input->fd = -1;
+    pull_input->condition = GDK_INPUT_WRITE;
+    pull_input->function = func;
+    pull_input->data = data;
+
+    return pull_input;
+}
+
+void audio_pull_remove(gpointer input)
+{
+    if (input) {
+        g_assert(input == pull_input);
+        g_free(pull_input);
+        pull_input = NULL;
+    }
+}
+
+/* Collects the note events that have arrived since the last call and
+   works out where they belong in the buffer to be mixed now. The events
+   are placed at the same distance from the start of this buffer as they
+   had from the previous audio_mix() call; this delays them by one buffer,
+   but by the same amount each time, instead of letting them jitter by up
+   to a whole driver period. */
+static int
+audio_mix_take_notes(audio_note_event* events,
+    guint32* offsets,
+    guint32 count,
+    int mixfreq)
+{
+    gint64 now = audio_get_time();
+    gint generation = g_atomic_int_get(&audio_note_generation);
+    int n = 0;
+
+    while (n < AUDIO_NOTE_EVENTS_MAX && msg_queue_receive(audio_note_queue, &events[n])) {
+        const audio_ctl_msg* msg = &events[n].msg;
+        gint64 t = msg->id == AUDIO_CTL_PLAY_NOTE_FULL ? msg->u.note_full.time : msg->u.note.time;
+        gint64 offset;
+
+        if (events[n].generation != generation)
+            continue;
+
+        offset = audio_mix_walltime ? (t - audio_mix_walltime) * mixfreq / 1000000 : 0;
+        offset = CLAMP(offset, 0, (gint64)count - 1);
+        /* Keep the order in which the events were sent */
+        if (n > 0 && offset < offsets[n - 1])
+            offset = offsets[n - 1];
+        offsets[n++] = offset;
+    }
+
+    audio_mix_walltime = now;
+
+    return n;
+}
+
+static guint32
+audio_mix_outputs(void* dests[],
     guint32 count,
     int mixfreq,
     int mixformat)
 {
-    int nonewtick = FALSE;
+    audio_note_event events[AUDIO_NOTE_EVENTS_MAX];
+    guint32 offsets[AUDIO_NOTE_EVENTS_MAX];
+    guint32 pos = 0, mixed = 0;
+    int nevents, next = 0, i;
 
     // Set mixer parameters
     if (mixfmt_req != mixformat) {
@@ -1082,59 +1518,78 @@ void audio_mix(void* dest,
         mixer_mix_format(mixformat & 15, (mixformat & ST_MIXER_FORMAT_STEREO) != 0);
     }
     scopebuf_freq = mixfreq_req = mixfreq;
-    mixer->setmixfreq(mixfreq);
+    audio_mixer_ctx->mixer->setmixfreq(audio_mixer_ctx->m, mixfreq);
+    for (i = 0; i < audio_stems; i++) {
+        audio_stem_ctxs[i]->mixer->setmixfreq(audio_stem_ctxs[i]->m, mixfreq);
+    }
 
     audio_visual_feedback_update_interval = mixfreq / audio_visual_feedback_updates_per_second;
 
+    nevents = audio_mix_take_notes(events, offsets, count, mixfreq);
+
     while (count) {
         // Mix either until the next time is reached when we should call the XM player,
-        // or until the current mixing buffer is full.
+        // until the next note event is due, or until the current mixing buffer is full.
         int samples_left = (audio_next_tick_time_bent - audio_current_playback_time_bent) * mixfreq;
+        int nonewtick = FALSE;
+
+        while (next < nevents && offsets[next] <= pos)
+            audio_apply_note(&events[next++].msg);
 
         if (samples_left > count) {
             // No new player tick this time...
             samples_left = count;
             nonewtick = TRUE;
         }
+        if (next < nevents && offsets[next] - pos < samples_left) {
+            samples_left = offsets[next] - pos;
+            nonewtick = TRUE;
+        }
 
-        if (playing_noloop && player_looped) {
+        if (playing_noloop && player->looped) {
             // "noloop" mode for file renderer -- make rest of buffer silent
-            memset(dest, 0,
-                samples_left * ((mixfmt & MIXFMT_16) ? 2 : 1)
-                    * ((mixfmt & MIXFMT_STEREO) ? 2 : 1));
+            const int n = samples_left * mixer_get_resolution(mixformat & 15)
+                * ((mixformat & ST_MIXER_FORMAT_STEREO) ? 2 : 1);
+
+            for (i = 0; i < (audio_stems ? audio_stems : 1); i++) {
+                memset(dests[i], 0, n);
+                dests[i] += n;
+            }
         } else {
-            dest = mixer_mix(dest, samples_left);
+            mixer_mix(dests, samples_left);
+            mixed += samples_left;
         }
         count -= samples_left;
+        pos += samples_left;
         audio_current_playback_time_bent += (double)samples_left / mixfreq;
 
         if (!nonewtick) {
             double t;
-            audio_player_pos* p = g_new(audio_player_pos, 1);
+            audio_player_pos* p = time_buffer_reserve(audio_playerpos_tb);
 
             // Pitchbend variable must be updated directly before or after a tick,
             // not in the middle of a filled mixing buffer.
-            if (pitchbend_req != pitchbend) {
-                pitchbend = pitchbend_req;
+            if (pitchbend_req != audio_mixer_ctx->pitchbend) {
+                audio_mixer_ctx->pitchbend = pitchbend_req;
             }
 
             // The following three lines, and the stuff in driver_setfreq() contain all
             // necessary code to handle the pitchbending feature.
-            t = xmplayer_play();
-            audio_next_tick_time_bent += (t - audio_next_tick_time_unbent) * (100.0 / (100.0 + pitchbend));
+            t = xmplayer_play(player);
+            audio_next_tick_time_bent += (t - audio_next_tick_time_unbent) * (100.0 / (100.0 + audio_mixer_ctx->pitchbend));
             audio_next_tick_time_unbent = t;
 
             // Update player position time buffer
             if (p) {
-                p->songpos = player_songpos;
-                p->patpos = player_patpos;
-                p->tempo = player_tempo;
-                p->bpm = player_bpm;
-                time_buffer_add(audio_playerpos_tb, p, audio_current_playback_time_bent);
+                p->songpos = player->songpos;
+                p->patpos = player->patpos;
+                p->tempo = player->tempo;
+                p->bpm = player->bpm;
+                time_buffer_commit(audio_playerpos_tb, audio_current_playback_time_bent);
             }
 
             // Confirm pending event requests
-            if (set_songpos_wait_for != -1 && player_songpos == set_songpos_wait_for) {
+            if (set_songpos_wait_for != -1 && player->songpos == set_songpos_wait_for) {
                 event_waiter_confirm(audio_songpos_ew, audio_current_playback_time_bent);
                 set_songpos_wait_for = -1;
             }
@@ -1148,4 +1603,49 @@ void audio_mix(void* dest,
             }
         }
     }
+
+    return mixed;
+}
+
+gboolean
+audio_mix_trylock(void)
+{
+    return g_mutex_trylock(&audio_mix_mutex);
+}
+
+void
+audio_mix_unlock(void)
+{
+    g_mutex_unlock(&audio_mix_mutex);
+}
+
+guint32
+audio_mix(void* dest,
+    guint32 count,
+    int mixfreq,
+    int mixformat)
+{
+    /* Left over from a stem rendering if the driver has been switched */
+    audio_stems_free();
+
+    return audio_mix_outputs(&dest, count, mixfreq, mixformat);
+}
+
+guint32
+audio_mix_stems(void* dests[],
+    int nstems,
+    guint32 count,
+    int mixfreq,
+    int mixformat)
+{
+    void* outs[32];
+
+    /* Set up lazily, after the player has been (re)started with the
+       current mixer */
+    if (nstems != audio_stems) {
+        audio_stems_setup(nstems);
+    }
+
+    memcpy(outs, dests, nstems * sizeof(void*));
+    return audio_mix_outputs(outs, count, mixfreq, mixformat);
 }
@@ -29,39 +29,101 @@
 #include "driver-inout.h"
 #include "event-waiter.h"
 #include "mixer.h"
+#include "msg-queue.h"
 #include "time-buffer.h"
-
-/* === Thread communication stuff */
-
-typedef enum audio_ctlpipe_id {
-    AUDIO_CTLPIPE_INIT_PLAYER = 2000, /* void */
-    AUDIO_CTLPIPE_RENDER_SONG_TO_FILE, /* int len, string (len+1 bytes) */
-    AUDIO_CTLPIPE_PLAY_SONG, /* int songpos, int patpos */
-    AUDIO_CTLPIPE_PLAY_PATTERN, /* int pattern, int patpos, int only_one_row */
-    AUDIO_CTLPIPE_PLAY_NOTE, /* int channel, int note, int instrument */
-    AUDIO_CTLPIPE_PLAY_NOTE_FULL, /* int channel, int note, STSample *sample, int offset, int count */
-    AUDIO_CTLPIPE_PLAY_NOTE_KEYOFF, /* int channel */
-    AUDIO_CTLPIPE_STOP_PLAYING, /* void */
-    AUDIO_CTLPIPE_SET_SONGPOS, /* int songpos */
-    AUDIO_CTLPIPE_SET_PATTERN, /* int pattern */
-    AUDIO_CTLPIPE_SET_AMPLIFICATION, /* float */
-    AUDIO_CTLPIPE_SET_PITCHBEND, /* float */
-    AUDIO_CTLPIPE_SET_MIXER, /* st_mixer* */
-    AUDIO_CTLPIPE_SET_TEMPO, /* int */
-    AUDIO_CTLPIPE_SET_BPM, /* int */
-} audio_ctlpipe_id;
-
-typedef enum audio_backpipe_id {
-    AUDIO_BACKPIPE_DRIVER_OPEN_FAILED = 1000,
-    AUDIO_BACKPIPE_PLAYING_STARTED,
-    AUDIO_BACKPIPE_PLAYING_PATTERN_STARTED,
-    AUDIO_BACKPIPE_PLAYING_NOTE_STARTED,
-    AUDIO_BACKPIPE_PLAYING_STOPPED,
-    AUDIO_BACKPIPE_ERROR_MESSAGE, /* int len, string (len+1 bytes) */
-    AUDIO_BACKPIPE_WARNING_MESSAGE, /* int len, string (len+1 bytes) */
-} audio_backpipe_id;
-
-extern int audio_ctlpipe, audio_backpipe;
+#include "xm.h"
+
+/* === Thread communication stuff
+
+   The GUI controls the audio thread by audio_ctl_msg messages, and the
+   audio thread reports back by audio_back_msg messages. Both directions
+   are single-producer / single-consumer message queues. */
+
+typedef enum audio_ctl_id {
+    AUDIO_CTL_INIT_PLAYER = 2000,
+    AUDIO_CTL_RENDER_SONG_TO_FILE,
+    AUDIO_CTL_PLAY_SONG,
+    AUDIO_CTL_PLAY_PATTERN,
+    AUDIO_CTL_PLAY_NOTE,
+    AUDIO_CTL_PLAY_NOTE_FULL,
+    AUDIO_CTL_PLAY_NOTE_KEYOFF,
+    AUDIO_CTL_STOP_PLAYING,
+    AUDIO_CTL_SET_SONGPOS,
+    AUDIO_CTL_SET_PATTERN,
+    AUDIO_CTL_SET_AMPLIFICATION,
+    AUDIO_CTL_SET_PITCHBEND,
+    AUDIO_CTL_SET_MIXER,
+    AUDIO_CTL_SET_TEMPO,
+    AUDIO_CTL_SET_BPM,
+    AUDIO_CTL_SET_DITHER,
+} audio_ctl_id;
+
+typedef struct audio_ctl_msg {
+    audio_ctl_id id;
+    union {
+        /* PLAY_SONG */
+        struct {
+            int songpos, patpos;
+        } song;
+        /* PLAY_PATTERN */
+        struct {
+            int pattern, patpos, only1row;
+        } pattern;
+        /* PLAY_NOTE, PLAY_NOTE_KEYOFF (channel and time only) */
+        struct {
+            int channel, note, instrument;
+            gboolean all;
+            gint64 time; /* audio_get_time() when the key was hit */
+        } note;
+        /* PLAY_NOTE_FULL */
+        struct {
+            int channel, note;
+            STSample* sample;
+            guint32 offset, count;
+            gint64 time;
+        } note_full;
+        /* RENDER_SONG_TO_FILE; g_free()d by the audio thread */
+        gchar* filename;
+        /* SET_SONGPOS, SET_PATTERN, SET_TEMPO, SET_BPM, SET_DITHER */
+        int value;
+        /* SET_AMPLIFICATION, SET_PITCHBEND */
+        float fvalue;
+        /* SET_MIXER */
+        st_mixer* mixer;
+    } u;
+} audio_ctl_msg;
+
+typedef enum audio_back_id {
+    AUDIO_BACK_DRIVER_OPEN_FAILED = 1000,
+    AUDIO_BACK_PLAYING_STARTED,
+    AUDIO_BACK_PLAYING_PATTERN_STARTED,
+    AUDIO_BACK_PLAYING_NOTE_STARTED,
+    AUDIO_BACK_PLAYING_STOPPED,
+    AUDIO_BACK_ERROR_MESSAGE,
+    AUDIO_BACK_WARNING_MESSAGE,
+} audio_back_id;
+
+typedef struct audio_back_msg {
+    audio_back_id id;
+    gchar* text; /* ERROR_MESSAGE, WARNING_MESSAGE; to be g_free()d by the receiver */
+} audio_back_msg;
+
+/* Sends a message to the audio thread; GUI thread only */
+void audio_ctl_send(const audio_ctl_msg* msg);
+
+/* Monotonic time in microseconds, for stamping note events. The audio
+   thread starts each note at the sample that corresponds to its time
+   stamp, one mixing buffer later. */
+gint64 audio_get_time(void);
+
+/* Messages from the audio thread; the GUI receives them from here */
+extern msg_queue* audio_back_queue;
+
+/* Passes an error or warning message on to the GUI, from any thread */
+void audio_back_message(audio_back_id level, const char* text);
+
+/* Shows an error or warning message; GUI thread only */
+void audio_back_show_message(audio_back_id level, const char* text);
 
 /* === Oscilloscope stuff
 
@@ -84,6 +146,11 @@ typedef struct scopebuf_endpoint {
 extern scopebuf_endpoint scopebuf_start, scopebuf_end;
 extern int scopebuf_freq;
 
+/* The mixers don't write to the buffers of silent channels. The data of
+   channel i is only valid up to the time scopebuf_sound_end[i] (same
+   scale as scopebuf_end.time); after that, the channel is silent. */
+extern double scopebuf_sound_end[32];
+
 /* === Player position time buffer */
 
 typedef struct audio_player_pos {
@@ -128,11 +195,31 @@ extern event_waiter* audio_bpm_ew;
 
 extern st_mixer* mixer;
 
-gboolean audio_init(int ctlpipe, int backpipe);
+gboolean audio_init(void);
 
 void audio_set_mixer(st_mixer* mixer);
 
-void readpipe(int fd, void* p, int count);
+/* Requantization of the mix for 16 bit drivers. With dithering on, a
+   mixer that can deliver floats mixes in float, and the result is
+   dithered down to 16 bits. Drivers taking floats aren't affected. */
+typedef enum audio_dither_mode {
+    AUDIO_DITHER_NONE = 0,
+    AUDIO_DITHER_TPDF,
+    AUDIO_DITHER_SHAPED, /* TPDF with noise shaping */
+} audio_dither_mode;
+
+void audio_set_dither(audio_dither_mode mode);
+/* Tells the mixer instance in use that a new snapshot of the sample has
+   been published (see st_mixer_sample_publish()); any thread */
+void audio_mixer_updatesample(st_mixer_sample_info* si);
+
+/* The index of checkpoints for starting playback in the middle of the
+   song (see tracer.h). To be called by the GUI thread: the index must be
+   reset whenever the module is changed or replaced, and building it is
+   resumed in idle time when playback has started. */
+void audio_tracer_index_reset(void);
+void audio_tracer_index_build(void);
+
 void audio_file_output_shutdown(void);
 void audio_file_output_save_config(void);
 void audio_file_output_load_config(void);
@@ -140,23 +227,33 @@ GtkWidget* audio_file_output_getwidget(void);
 
 /* --- Functions called by the player */
 
-void driver_setnumch(int numchannels);
-void driver_startnote(int channel,
+void driver_setnumch(st_mixer_ctx* mc,
+    int numchannels);
+void driver_startnote(st_mixer_ctx* mc,
+    int channel,
     st_mixer_sample_info* si);
-void driver_stopnote(int channel);
-void driver_setsmplpos(int channel,
+void driver_stopnote(st_mixer_ctx* mc,
+    int channel);
+void driver_setsmplpos(st_mixer_ctx* mc,
+    int channel,
     guint32 offset);
-void driver_setsmplend(int channel,
+void driver_setsmplend(st_mixer_ctx* mc,
+    int channel,
     guint32 offset);
-void driver_setfreq(int channel,
+void driver_setfreq(st_mixer_ctx* mc,
+    int channel,
     float frequency);
-void driver_setvolume(int channel,
+void driver_setvolume(st_mixer_ctx* mc,
+    int channel,
     float volume);
-void driver_setpanning(int channel,
+void driver_setpanning(st_mixer_ctx* mc,
+    int channel,
     float panning);
-void driver_set_ch_filter_freq(int channel,
+void driver_set_ch_filter_freq(st_mixer_ctx* mc,
+    int channel,
     float freq);
-void driver_set_ch_filter_reso(int channel,
+void driver_set_ch_filter_reso(st_mixer_ctx* mc,
+    int channel,
     float freq);
 
 #endif /* _ST_AUDIO_H */
@@ -46,6 +46,8 @@ GtkWidget* configwindow = NULL;
 static GtkWidget* audioconfig_mixer_list;
 static st_mixer* audioconfig_current_mixer = NULL;
 static gboolean audioconfig_disable_mixer_selection = FALSE;
+static GtkWidget* audioconfig_dither_w[3];
+static audio_dither_mode audioconfig_dither = AUDIO_DITHER_NONE;
 
 typedef struct audio_object {
     const char* title;
@@ -135,6 +137,18 @@ audioconfig_mixer_selected(GtkTreeSelection* sel)
     }
 }
 
+static void
+audioconfig_dither_changed(void)
+{
+    gint mode = find_current_toggle(audioconfig_dither_w,
+        sizeof(audioconfig_dither_w) / sizeof(audioconfig_dither_w[0]));
+
+    if (mode >= 0 && mode != audioconfig_dither) {
+        audioconfig_dither = mode;
+        audio_set_dither(mode);
+    }
+}
+
 static void
 audioconfig_initialize_mixer_list(void)
 {
@@ -224,6 +238,7 @@ void audioconfig_dialog(void)
     GtkWidget *label, *alignment;
 #endif
     static gchar* listtitles2[2];
+    static const char* ditherlabels[] = { N_("None"), N_("TPDF"), N_("TPDF, noise shaped"), NULL };
     int i;
 
     listtitles2[0] = gettext("Mixer Module");
@@ -271,6 +286,11 @@ void audioconfig_dialog(void)
     audioconfig_mixer_list = thing;
     audioconfig_initialize_mixer_list();
 
+    thing = make_labelled_radio_group_box(_("Dithering of 16 bit output:"), ditherlabels,
+        audioconfig_dither_w, audioconfig_dither_changed);
+    gtk_box_pack_start(GTK_BOX(box2), thing, FALSE, TRUE, 0);
+    gui_set_radio_active(audioconfig_dither_w, audioconfig_dither);
+
     gtk_widget_show_all(configwindow);
 }
 
@@ -352,6 +372,12 @@ void audioconfig_load_mixer_config(void)
         mixer = mixers->data;
         audioconfig_current_mixer = mixers->data;
     }
+
+    audioconfig_dither = CLAMP(prefs_get_int("mixer", "dither", AUDIO_DITHER_NONE),
+        AUDIO_DITHER_NONE, AUDIO_DITHER_SHAPED);
+    if (audioconfig_dither != AUDIO_DITHER_NONE) {
+        audio_set_dither(audioconfig_dither);
+    }
 }
 
 void audioconfig_save_config(void)
@@ -379,6 +405,7 @@ void audioconfig_save_config(void)
     }
 
     prefs_put_string("mixer", "mixer", audioconfig_current_mixer->id);
+    prefs_put_int("mixer", "dither", audioconfig_dither);
 #if USE_SNDFILE || AUDIOFILE_VERSION
     audio_file_output_save_config();
 #endif
@@ -0,0 +1,342 @@
+
+/*
+ * The Real SoundTracker - Benchmarks
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+
+#include "audio.h"
+#include "audioconfig.h"
+#include "bench.h"
+#include "gui-settings.h"
+#include "gui-subs.h"
+#include "mixer.h"
+#include "mixers/kb-x86-asm.h"
+#include "mixers/kbfloat-simd.h"
+#include "preferences.h"
+#include "xm.h"
+
+/* The vectorized routines are not built next to the assembler ones */
+#if defined(NO_ASM) || !defined(__i386__)
+#define BENCH_SIMD 1
+#endif
+
+/* Output frames per call of a mixing routine, about one period */
+#define BENCH_FRAMES 1024
+
+/* The sample data; the pitch below reads about 1.4 values per frame,
+   and the interpolation up to 3 more */
+#define BENCH_SAMPLE_LENGTH (2 * BENCH_FRAMES + 8)
+
+/* Each routine is called over and over again for this long */
+#define BENCH_SECONDS 0.25
+
+/* Default number of times each module is loaded by --bench-load; the
+   first run may have to fetch the file from the disk */
+#define BENCH_LOAD_RUNS 5
+
+extern st_mixer mixer_kbfloat;
+
+typedef struct bench_mixers_buffers {
+    gint16 s16[BENCH_SAMPLE_LENGTH];
+    gint8 s8[BENCH_SAMPLE_LENGTH];
+    float mix[2 * BENCH_FRAMES];
+    gint16 scope[BENCH_FRAMES];
+} bench_mixers_buffers;
+
+static void
+bench_mixers_name(gchar* buf,
+    gsize size,
+    guint32 flags)
+{
+    g_snprintf(buf, size, "%s_%s_%s%s%s",
+        flags & KB_X86_MIXER_FLAGS_SCOPES ? "scopes" : "noscopes",
+        flags & KB_X86_MIXER_FLAGS_FILTERED ? "filtered" : "unfiltered",
+        flags & KB_X86_MIXER_FLAGS_BACKWARD ? "backward" : "forward",
+        flags & KB_X86_MIXER_FLAGS_VOLRAMP ? "" : "_noramp",
+        flags & KB_X86_MIXER_FLAGS_8BIT ? "_8" : "");
+}
+
+/* Prepares a call mixing BENCH_FRAMES frames from the middle of the
+   sample, in the direction given by the flags */
+static void
+bench_mixers_setup(kb_x86_mixer_data* md,
+    bench_mixers_buffers* b,
+    guint32 flags)
+{
+    const gint64 freq64 = 0x15f000000LL * (flags & KB_X86_MIXER_FLAGS_BACKWARD ? -1 : 1);
+    const gint32 start = flags & KB_X86_MIXER_FLAGS_BACKWARD ? BENCH_SAMPLE_LENGTH - 5 : 4;
+
+    memset(md, 0, sizeof(*md));
+    md->volleft = 0.7;
+    md->volright = 0.4;
+    md->volrampl = -0.0002;
+    md->volrampr = 0.0003;
+    if (flags & KB_X86_MIXER_FLAGS_8BIT) {
+        md->positioni8 = b->s8 + start;
+    } else {
+        md->positioni = b->s16 + start;
+    }
+    md->positionf = 0x12345678;
+    md->freqi = freq64 >> 32;
+    md->freqf = freq64 & 0xffffffff;
+    md->mixbuffer = b->mix;
+    md->numsamples = BENCH_FRAMES;
+    md->ffreq = 0.3;
+    md->freso = 0.6;
+    md->scopebuf = b->scope;
+    md->flags = flags;
+}
+
+/* Nanoseconds per output frame */
+static double
+bench_mixers_time(bench_mixers_buffers* b,
+    guint32 flags,
+    gboolean (*mix)(kb_x86_mixer_data*))
+{
+    GTimer* timer = g_timer_new();
+    kb_x86_mixer_data md;
+    double elapsed;
+    guint64 calls = 0;
+
+    do {
+        bench_mixers_setup(&md, b, flags);
+        if (!mix(&md)) {
+            g_timer_destroy(timer);
+            return -1.0;
+        }
+        calls++;
+    } while ((elapsed = g_timer_elapsed(timer, NULL)) < BENCH_SECONDS);
+
+    g_timer_destroy(timer);
+
+    return elapsed * 1e9 / (calls * BENCH_FRAMES);
+}
+
+static gboolean
+bench_mixers_c(kb_x86_mixer_data* md)
+{
+    kbfloat_mix(md);
+
+    return TRUE;
+}
+
+#ifdef BENCH_SIMD
+
+/* Mixes once with both routines and compares all of the results */
+static gboolean
+bench_mixers_check(bench_mixers_buffers* b,
+    guint32 flags)
+{
+    bench_mixers_buffers* b2 = g_new(bench_mixers_buffers, 1);
+    kb_x86_mixer_data md, md2;
+    gboolean same;
+
+    memset(b->mix, 0, sizeof(b->mix));
+    memcpy(b2, b, sizeof(*b));
+    bench_mixers_setup(&md, b, flags);
+    bench_mixers_setup(&md2, b2, flags);
+    kbfloat_mix(&md);
+    kbfloat_simd_mix(&md2);
+
+    same = !memcmp(b->mix, b2->mix, sizeof(b->mix))
+        && !memcmp(b->scope, b2->scope, sizeof(b->scope))
+        && md.volleft == md2.volleft && md.volright == md2.volright
+        && md.positionf == md2.positionf && md.fl1 == md2.fl1 && md.fb1 == md2.fb1
+        && md.mixbuffer - b->mix == md2.mixbuffer - b2->mix
+        && (flags & KB_X86_MIXER_FLAGS_8BIT
+                   ? md.positioni8 - b->s8 == md2.positioni8 - b2->s8
+                   : md.positioni - b->s16 == md2.positioni - b2->s16);
+
+    g_free(b2);
+
+    return same;
+}
+
+#endif
+
+int bench_mixers_main(int argc,
+    char* argv[])
+{
+    bench_mixers_buffers* b = g_new0(bench_mixers_buffers, 1);
+    void* m;
+    guint32 i;
+    int failed = 0;
+
+    g_assert(argc >= 2 && !strcmp(argv[1], "--bench-mixers"));
+
+    if (argc != 2) {
+        fprintf(stderr, _("Usage: %s --bench-mixers\n"), argv[0]);
+        return 1;
+    }
+
+    /* Sets up the interpolation tables */
+    m = mixer_kbfloat.new();
+
+    /* Something like a sawtooth with a bit of noise */
+    for (i = 0; i < BENCH_SAMPLE_LENGTH; i++) {
+        b->s16[i] = (gint16)((i * 1031) % 60000 - 30000 + g_random_int_range(-500, 500));
+        b->s8[i] = (gint8)(b->s16[i] >> 8);
+    }
+
+#ifdef BENCH_SIMD
+    printf(_("kbfloat mixing routines, %d frames per call, vectorized with %s\n"),
+        BENCH_FRAMES, kbfloat_simd_name() ? kbfloat_simd_name() : _("nothing"));
+#else
+    printf(_("kbfloat mixing routines, %d frames per call\n"), BENCH_FRAMES);
+#endif
+    printf("%-42s %10s %10s %8s\n", _("variant"), _("C ns/frame"), _("SIMD"), _("speedup"));
+
+    /* Same order as kbfloat_mixers[] */
+    for (i = 0; i < 32; i++) {
+        const guint32 flags = i << 2;
+        gchar name[64];
+        double c, simd = -1.0;
+
+        bench_mixers_name(name, sizeof(name), flags);
+        c = bench_mixers_time(b, flags, bench_mixers_c);
+#ifdef BENCH_SIMD
+        simd = bench_mixers_time(b, flags, kbfloat_simd_mix);
+#endif
+
+        if (simd < 0.0) {
+            printf("%-42s %10.2f %10s %8s\n", name, c, "-", "-");
+#ifdef BENCH_SIMD
+        } else if (!bench_mixers_check(b, flags)) {
+            printf("%-42s %10.2f %10.2f %8s\n", name, c, simd, _("WRONG"));
+            failed = 1;
+#endif
+        } else {
+            printf("%-42s %10.2f %10.2f %7.2fx\n", name, c, simd, c / simd);
+        }
+    }
+
+    mixer_kbfloat.destroy(m);
+    g_free(b);
+
+    return failed;
+}
+
+static void
+bench_load_usage(const char* progname)
+{
+    fprintf(stderr, _("Usage: %s --bench-load [-n runs] [-l] file...\n"), progname);
+}
+
+/* Seconds for the fastest of runs loads, or a negative value if the
+   module can't be loaded */
+static double
+bench_load_module(const char* filename,
+    int runs)
+{
+    double best = -1.0;
+    int i;
+
+    for (i = 0; i < runs; i++) {
+        GTimer* timer = g_timer_new();
+        XM* module = File_Load(filename);
+        double elapsed = g_timer_elapsed(timer, NULL);
+
+        g_timer_destroy(timer);
+        if (!module)
+            return -1.0;
+        XM_Free(module);
+
+        if (best < 0.0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+int bench_load_main(int argc,
+    char* argv[])
+{
+    int runs = BENCH_LOAD_RUNS;
+    gboolean lazy = FALSE;
+    double total = 0.0, total_size = 0.0;
+    int i, failed = 0, nfiles = 0;
+
+    g_assert(argc >= 2 && !strcmp(argv[1], "--bench-load"));
+
+    for (i = 2; i < argc && argv[i][0] == '-'; i++) {
+        if ((!strcmp(argv[i], "-n") || !strcmp(argv[i], "--runs")) && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--lazy")) {
+            lazy = TRUE;
+        } else {
+            bench_load_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (i == argc || runs < 1) {
+        bench_load_usage(argv[0]);
+        return 1;
+    }
+
+    gui_set_headless(TRUE);
+    prefs_init();
+    gui_settings_load_config();
+
+    /* Unless asked for, the time includes decoding all of the samples */
+    gui_settings.lazy_samples = lazy;
+
+    /* XM_Load() checks the sample lengths against this one */
+    mixer = mixers->data;
+
+    printf(_("Fastest of %d loads, %s sample loading\n"), runs, lazy ? _("lazy") : _("full"));
+    printf("%-40s %10s %10s %10s\n", _("module"), _("KiB"), _("ms"), _("MiB/s"));
+
+    for (; i < argc; i++) {
+        struct stat st;
+        double size, t;
+
+        size = stat(argv[i], &st) == 0 ? st.st_size : 0.0;
+        t = bench_load_module(argv[i], runs);
+        if (t < 0.0) {
+            printf("%-40s %10.0f %10s %10s\n", argv[i], size / 1024.0, _("failed"), "-");
+            failed = 1;
+            continue;
+        }
+
+        printf("%-40s %10.0f %10.2f %10.1f\n", argv[i], size / 1024.0, t * 1000.0,
+            t > 0.0 ? size / (1024.0 * 1024.0) / t : 0.0);
+        total += t;
+        total_size += size;
+        nfiles++;
+    }
+
+    if (nfiles > 1) {
+        printf("%-40s %10.0f %10.2f %10.1f\n", _("total"), total_size / 1024.0, total * 1000.0,
+            total > 0.0 ? total_size / (1024.0 * 1024.0) / total : 0.0);
+    }
+
+    prefs_close();
+
+    return failed;
+}
@@ -0,0 +1,34 @@
+
+/*
+ * The Real SoundTracker - Benchmarks (header)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_BENCH_H
+#define _ST_BENCH_H
+
+/* Entry point for "soundtracker --bench-mixers": times each variant of
+   the kbfloat mixing routines, the plain C one against the vectorized
+   one, and checks that both give the same results */
+int bench_mixers_main(int argc, char* argv[]);
+
+/* Entry point for "soundtracker --bench-load [options] file...": loads
+   each module a number of times and reports the fastest load */
+int bench_load_main(int argc, char* argv[]);
+
+#endif /* _ST_BENCH_H */
@@ -0,0 +1,347 @@
+
+/*
+ * The Real SoundTracker - In-memory decompression of modules
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+#if HAVE_LIBBZ2
+#include <bzlib.h>
+#endif
+
+#include "decompress.h"
+#include "endian-conv.h"
+
+#if HAVE_LIBZ || HAVE_LIBBZ2
+
+#define DECOMPRESS_CHUNK 65536
+
+/* Makes room for at least one more chunk at buf + used. The buffer is
+   freed on failure. */
+static gboolean
+decompress_grow(guint8** buf,
+    gsize* size,
+    gsize used)
+{
+    guint8* n;
+
+    if (*size - used >= DECOMPRESS_CHUNK) {
+        return TRUE;
+    }
+
+    n = g_try_realloc(*buf, MAX(*size * 2, used + DECOMPRESS_CHUNK));
+    if (!n) {
+        g_free(*buf);
+        *buf = NULL;
+        return FALSE;
+    }
+    *size = MAX(*size * 2, used + DECOMPRESS_CHUNK);
+    *buf = n;
+
+    return TRUE;
+}
+
+/* Modules usually pack to a quarter or so; this saves most of the
+   reallocations */
+static gsize
+decompress_initial_size(const gchar* filename)
+{
+    struct stat st;
+
+    if (stat(filename, &st) != 0) {
+        return 0;
+    }
+
+    return st.st_size * 4;
+}
+
+#endif
+
+#if HAVE_LIBZ
+
+gboolean
+decompress_gzip(const gchar* filename,
+    guint8** data,
+    gsize* length)
+{
+    gzFile gz;
+    guint8* buf = NULL;
+    gsize size, used = 0;
+    int r;
+
+    gz = gzopen(filename, "rb");
+    if (!gz) {
+        return FALSE;
+    }
+
+    size = decompress_initial_size(filename);
+    buf = g_try_malloc(size);
+    if (!buf) {
+        size = 0;
+    }
+
+    for (;;) {
+        if (!decompress_grow(&buf, &size, used)) {
+            gzclose(gz);
+            return FALSE;
+        }
+
+        r = gzread(gz, buf + used, MIN(size - used, G_MAXINT));
+        if (r < 0) {
+            g_free(buf);
+            gzclose(gz);
+            return FALSE;
+        }
+        if (r == 0) {
+            break;
+        }
+        used += r;
+    }
+
+    gzclose(gz);
+    *data = buf;
+    *length = used;
+
+    return TRUE;
+}
+
+/* Inflates a raw deflate stream whose unpacked size is known from the
+   zip directory */
+static guint8*
+decompress_inflate(guint8* src,
+    gsize src_length,
+    gsize length)
+{
+    z_stream zs;
+    guint8* dest;
+    int r;
+
+    dest = g_try_malloc(length);
+    if (!dest) {
+        return NULL;
+    }
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+        g_free(dest);
+        return NULL;
+    }
+
+    zs.next_in = src;
+    zs.avail_in = src_length;
+    zs.next_out = dest;
+    zs.avail_out = length;
+    r = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+
+    if (r != Z_STREAM_END || zs.total_out != length) {
+        g_free(dest);
+        return NULL;
+    }
+
+    return dest;
+}
+
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_CENTRAL_SIG 0x02014b50
+#define ZIP_END_SIG 0x06054b50
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+
+gboolean
+decompress_zip_foreach(const gchar* filename,
+    decompress_zip_func func,
+    gpointer user_data)
+{
+    gchar* contents;
+    guint8* z;
+    gsize len, end, pos;
+    int i, entries;
+    gboolean stop = FALSE;
+
+    if (!g_file_get_contents(filename, &contents, &len, NULL)) {
+        return FALSE;
+    }
+    z = (guint8*)contents;
+
+    /* The end of central directory record is followed by an archive
+       comment of up to 64k, so we have to search for it backwards */
+    if (len < ZIP_END_SIZE) {
+        g_free(contents);
+        return FALSE;
+    }
+    for (end = len - ZIP_END_SIZE; get_le_32(z + end) != ZIP_END_SIG; end--) {
+        if (end == 0 || len - end > ZIP_END_SIZE + 65535) {
+            g_free(contents);
+            return FALSE;
+        }
+    }
+
+    entries = get_le_16(z + end + 10);
+    pos = get_le_32(z + end + 16);
+
+    for (i = 0; i < entries && !stop; i++) {
+        gsize local, data, packed, unpacked;
+        guint16 flags, method, name_len;
+        gchar* name;
+
+        if (pos + ZIP_CENTRAL_SIZE > end || get_le_32(z + pos) != ZIP_CENTRAL_SIG) {
+            break;
+        }
+
+        flags = get_le_16(z + pos + 8);
+        method = get_le_16(z + pos + 10);
+        packed = get_le_32(z + pos + 20);
+        unpacked = get_le_32(z + pos + 24);
+        name_len = get_le_16(z + pos + 28);
+        local = get_le_32(z + pos + 42);
+        if (pos + ZIP_CENTRAL_SIZE + name_len > end) {
+            break;
+        }
+        name = g_strndup((gchar*)z + pos + ZIP_CENTRAL_SIZE, name_len);
+        pos += ZIP_CENTRAL_SIZE + name_len + get_le_16(z + pos + 30) + get_le_16(z + pos + 32);
+
+        /* Skip directories, empty and encrypted files and damaged entries
+           silently, the next one may be the module */
+        if ((flags & 1) || unpacked == 0 || (name_len && name[name_len - 1] == '/')
+            || local + ZIP_LOCAL_SIZE > len || get_le_32(z + local) != ZIP_LOCAL_SIG) {
+            g_free(name);
+            continue;
+        }
+        data = local + ZIP_LOCAL_SIZE + get_le_16(z + local + 26) + get_le_16(z + local + 28);
+        if (data > len || packed > len - data) {
+            g_free(name);
+            continue;
+        }
+
+        if (method == 0 && packed == unpacked) {
+            stop = func(name, z + data, unpacked, user_data);
+        } else if (method == Z_DEFLATED) {
+            guint8* buf = decompress_inflate(z + data, packed, unpacked);
+
+            if (buf) {
+                stop = func(name, buf, unpacked, user_data);
+                g_free(buf);
+            }
+        }
+        g_free(name);
+    }
+
+    g_free(contents);
+
+    return TRUE;
+}
+
+#endif /* HAVE_LIBZ */
+
+#if HAVE_LIBBZ2
+
+gboolean
+decompress_bzip2(const gchar* filename,
+    guint8** data,
+    gsize* length)
+{
+    FILE* f;
+    BZFILE* bz;
+    guint8* buf = NULL;
+    gsize size, used = 0;
+    char unused[BZ_MAX_UNUSED];
+    int n, err;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        return FALSE;
+    }
+
+    bz = BZ2_bzReadOpen(&err, f, 0, 0, NULL, 0);
+    if (err != BZ_OK) {
+        fclose(f);
+        return FALSE;
+    }
+
+    size = decompress_initial_size(filename);
+    buf = g_try_malloc(size);
+    if (!buf) {
+        size = 0;
+    }
+
+    for (;;) {
+        if (!decompress_grow(&buf, &size, used)) {
+            break;
+        }
+
+        n = BZ2_bzRead(&err, bz, buf + used, MIN(size - used, G_MAXINT));
+        if (err != BZ_OK && err != BZ_STREAM_END) {
+            g_free(buf);
+            buf = NULL;
+            break;
+        }
+        used += n;
+
+        if (err == BZ_STREAM_END) {
+            /* bzip2 -c a b > c produces concatenated streams; read on
+               with the bytes the library has already taken */
+            void* rest;
+            int c;
+
+            BZ2_bzReadGetUnused(&err, bz, &rest, &n);
+            memcpy(unused, rest, n);
+            BZ2_bzReadClose(&err, bz);
+            bz = NULL;
+
+            if (n == 0) {
+                if ((c = getc(f)) == EOF) {
+                    break;
+                }
+                ungetc(c, f);
+            }
+            bz = BZ2_bzReadOpen(&err, f, 0, 0, unused, n);
+            if (err != BZ_OK) {
+                bz = NULL;
+                g_free(buf);
+                buf = NULL;
+                break;
+            }
+        }
+    }
+
+    if (bz) {
+        BZ2_bzReadClose(&err, bz);
+    }
+    fclose(f);
+
+    if (!buf) {
+        return FALSE;
+    }
+
+    *data = buf;
+    *length = used;
+
+    return TRUE;
+}
+
+#endif /* HAVE_LIBBZ2 */
@@ -0,0 +1,58 @@
+
+/*
+ * The Real SoundTracker - In-memory decompression of modules (header)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _DECOMPRESS_H
+#define _DECOMPRESS_H
+
+#include <config.h>
+
+#include <glib.h>
+
+/* Called for each regular file of a zip archive. Returns TRUE to stop
+   the scan. The data is only valid during the call. */
+typedef gboolean (*decompress_zip_func)(const gchar* name,
+    const guint8* data,
+    gsize length,
+    gpointer user_data);
+
+#if HAVE_LIBZ
+/* Unpacks a gzip file into a g_malloc()ed buffer. Uncompressed
+   files are passed through unchanged. */
+gboolean decompress_gzip(const gchar* filename,
+    guint8** data,
+    gsize* length);
+
+/* Unpacks the members of a zip archive one after another (stored or
+   deflated ones; others are skipped) and hands them to func. Returns
+   FALSE if the file is not a readable zip archive. */
+gboolean decompress_zip_foreach(const gchar* filename,
+    decompress_zip_func func,
+    gpointer user_data);
+#endif
+
+#if HAVE_LIBBZ2
+/* Unpacks a bzip2 file into a g_malloc()ed buffer */
+gboolean decompress_bzip2(const gchar* filename,
+    guint8** data,
+    gsize* length);
+#endif
+
+#endif /* _DECOMPRESS_H */
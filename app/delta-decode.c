@@ -0,0 +1,149 @@
+
+/*
+ * The Real SoundTracker - Decoding of delta packed sample data
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* The running sum is computed for a whole vector at once: each lane
+   gets its left neighbour added, then the one two lanes away, four lanes
+   away and so on, which gives the prefix sums within the vector in
+   log2(lanes) steps. The last value of the previous vector is then added
+   to all of them. Everything wraps around, so the result is the same as
+   that of the plain loops, which are used for the tails and on other
+   machines. */
+
+#include <config.h>
+
+#include "delta-decode.h"
+#include "endian-conv.h"
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#if defined(__x86_64__) && defined(__GNUC__)
+#define DELTA_SIMD_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define DELTA_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+void delta_decode_16(gint16* dest,
+    const guint8* src,
+    gsize count)
+{
+    guint16 p = 0;
+    gsize i = 0;
+
+#if defined(DELTA_SIMD_SSE2)
+    __m128i sum = _mm_setzero_si128();
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi16(x, sum);
+        _mm_storeu_si128((__m128i*)(dest + i), x);
+
+        /* Last value into all lanes */
+        sum = _mm_shufflehi_epi16(x, 0xff);
+        sum = _mm_unpackhi_epi64(sum, sum);
+    }
+    if (i) {
+        p = dest[i - 1];
+    }
+#elif defined(DELTA_SIMD_NEON)
+    const int16x8_t zero = vdupq_n_s16(0);
+    int16x8_t sum = zero;
+
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vreinterpretq_s16_u8(vld1q_u8(src + 2 * i));
+
+        x = vaddq_s16(x, vextq_s16(zero, x, 7));
+        x = vaddq_s16(x, vextq_s16(zero, x, 6));
+        x = vaddq_s16(x, vextq_s16(zero, x, 4));
+        x = vaddq_s16(x, sum);
+        vst1q_s16(dest + i, x);
+
+        sum = vdupq_n_s16(vgetq_lane_s16(x, 7));
+    }
+    if (i) {
+        p = dest[i - 1];
+    }
+#endif
+
+    for (; i < count; i++) {
+        p += get_le_16((guint8*)src + 2 * i);
+        dest[i] = p;
+    }
+}
+
+void delta_decode_8(gint8* dest,
+    const guint8* src,
+    gsize count)
+{
+    guint8 p = 0;
+    gsize i = 0;
+
+#if defined(DELTA_SIMD_SSE2)
+    __m128i sum = _mm_setzero_si128();
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi8(x, sum);
+        _mm_storeu_si128((__m128i*)(dest + i), x);
+
+        sum = _mm_unpackhi_epi8(x, x);
+        sum = _mm_shufflehi_epi16(sum, 0xff);
+        sum = _mm_unpackhi_epi64(sum, sum);
+    }
+    if (i) {
+        p = dest[i - 1];
+    }
+#elif defined(DELTA_SIMD_NEON)
+    const int8x16_t zero = vdupq_n_s8(0);
+    int8x16_t sum = zero;
+
+    for (; i + 16 <= count; i += 16) {
+        int8x16_t x = vreinterpretq_s8_u8(vld1q_u8(src + i));
+
+        x = vaddq_s8(x, vextq_s8(zero, x, 15));
+        x = vaddq_s8(x, vextq_s8(zero, x, 14));
+        x = vaddq_s8(x, vextq_s8(zero, x, 12));
+        x = vaddq_s8(x, vextq_s8(zero, x, 8));
+        x = vaddq_s8(x, sum);
+        vst1q_s8(dest + i, x);
+
+        sum = vdupq_n_s8(vgetq_lane_s8(x, 15));
+    }
+    if (i) {
+        p = dest[i - 1];
+    }
+#endif
+
+    for (; i < count; i++) {
+        p += src[i];
+        dest[i] = p;
+    }
+}
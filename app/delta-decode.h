@@ -0,0 +1,41 @@
+
+/*
+ * The Real SoundTracker - Decoding of delta packed sample data (header)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _DELTA_DECODE_H
+#define _DELTA_DECODE_H
+
+#include <glib.h>
+
+/* XM stores the samples as differences between neighbouring values.
+   These turn count of them into sample values (a running sum which
+   wraps around like FastTracker's does). src needn't be aligned. */
+
+/* 16 bit little endian deltas to 16 bit samples in host order */
+void delta_decode_16(gint16* dest,
+    const guint8* src,
+    gsize count);
+
+/* 8 bit deltas to 8 bit samples */
+void delta_decode_8(gint8* dest,
+    const guint8* src,
+    gsize count);
+
+#endif /* _DELTA_DECODE_H */
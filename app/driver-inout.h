@@ -33,6 +33,14 @@ gpointer audio_poll_add(int fd,
     gpointer data);
 void audio_poll_remove(gpointer poll);
 
+/* For drivers which never block, like the file output: func is called
+   over and over again from the audio thread, with the control messages
+   checked in between, until the handler is removed. Only one at a
+   time. */
+gpointer audio_pull_add(GdkInputFunction func,
+    gpointer data);
+void audio_pull_remove(gpointer pull);
+
 /* Called by the driver to indicate that it accepts new data */
 void audio_play(void);
 
@@ -47,11 +55,38 @@ void audio_time(double);
 void audio_sampled(gint16* data,
     int count);
 
-void audio_mix(void* dest,
+/* Returns the number of frames mixed before the song has come to its
+   end when it is rendered to a file, without looping; the rest of the
+   buffer is silent. count otherwise. */
+guint32 audio_mix(void* dest,
+    guint32 count,
+    int mixfreq,
+    int mixformat);
+
+/* Drivers which call audio_mix() from a thread of their own instead
+   of from a poll handler bracket it with these, so that it doesn't run
+   while the audio thread is handling a control request. The lock is
+   held when the request stops the driver, hence there is no blocking
+   variant; on failure retry a bit later, checking for a stop request
+   in between. */
+gboolean audio_mix_trylock(void);
+void audio_mix_unlock(void);
+
+/* Like audio_mix(), but delivers each of the first nstems channels of
+   the song separately, to dests[0] ... dests[nstems - 1] */
+guint32 audio_mix_stems(void* dests[],
+    int nstems,
     guint32 count,
     int mixfreq,
     int mixformat);
 
+/* The file output driver keeps this at the start of its instance; it
+   is filled in by audio.c before the driver is opened */
+typedef struct st_file_driver_params {
+    gchar* filename;
+    int numchannels; /* of the song, for rendering each one to its own file */
+} st_file_driver_params;
+
 gboolean sample_editor_sampled(void* dest,
     guint32 count,
     int mixfreq,
@@ -35,6 +35,8 @@
 
 #include <alsa/asoundlib.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -73,6 +75,9 @@ ts 16 | 2 | 3 |
 #define PARAMS_TO_ADDRESS(d) d->stereo + (d->bits >> 2) - 2
 #define FORMAT_16 (d->bigendian ? (d->signedness16 ? SND_PCM_FORMAT_S16_BE : SND_PCM_FORMAT_U16_BE) \
                                 : (d->signedness16 ? SND_PCM_FORMAT_S16_LE : SND_PCM_FORMAT_U16_LE))
+/* How long the mixing thread waits before trying again while the
+   audio thread handles a control request */
+#define ALSA_MMAP_RETRY_USECS 1000
 
 typedef struct _alsa_driver {
     GtkWidget *configwidget, *devices_dialog;
@@ -81,6 +86,8 @@ typedef struct _alsa_driver {
     GtkWidget* prefs_channels_w[2];
     GtkWidget* prefs_mixfreq;
     GtkWidget *bufsizespin, *bufsizelabel, *periodspin, *periodlabel, *estimatelabel;
+    GtkWidget *mmap_check, *status_label;
+    guint status_timeout;
 
     GtkTreeModel* model;
 
@@ -106,6 +113,17 @@ typedef struct _alsa_driver {
     struct pollfd* pfd;
     gboolean firstpoll;
 
+    /* mmap mode: the mixer writes directly into the DMA buffer, driven
+       by a thread of our own instead of the audio thread's poll loop */
+    gboolean use_mmap; /* preference */
+    gboolean mmap_active; /* for the stream currently open */
+    pthread_t thread;
+    gint thread_running; /* atomic; cleared to stop the thread */
+    gboolean realtime; /* the thread got SCHED_FIFO */
+    gint xruns; /* atomic; underruns since the stream has been opened */
+    gint xruns_shown;
+    gboolean no_rt_shown;
+
     guint p_mixfreq;
     snd_pcm_uframes_t p_fragsize;
     guint mf;
@@ -691,9 +709,17 @@ prefs_periods_changed(GtkWidget* w, alsa_driver* d)
         update_estimate(d);
 }
 
+static void
+prefs_mmap_changed(GtkWidget* w, alsa_driver* d)
+{
+    d->use_mmap = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(w));
+}
+
 static void
 prefs_init_from_structure(alsa_driver* d)
 {
+    if (d->playback)
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(d->mmap_check), d->use_mmap);
     d->hwtest = FALSE;
     gui_combo_box_prepend_text_or_set_active(GTK_COMBO_BOX(d->alsa_device), d->device, TRUE);
     update_controls_a(d);
@@ -938,6 +964,21 @@ alsa_make_config_widgets(alsa_driver* d)
         gtk_box_pack_end(GTK_BOX(box2), thing, TRUE, TRUE, 0);
     }
     gtk_widget_show(thing);
+
+    if (d->playback) {
+        d->mmap_check = thing = gtk_check_button_new_with_label(_("Mix directly into the device buffer (mmap)"));
+        gtk_widget_set_tooltip_text(thing, _("Saves a copy and mixes on a thread of its own, "
+                                             "with realtime priority if permitted"));
+        gtk_widget_show(thing);
+        gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
+        g_signal_connect(thing, "toggled",
+            G_CALLBACK(prefs_mmap_changed), d);
+
+        d->status_label = thing = gtk_label_new(_("Underruns: 0"));
+        gtk_misc_set_alignment(GTK_MISC(thing), 0.0, 0.5);
+        gtk_widget_show(thing);
+        gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
+    }
 }
 
 static GtkWidget*
@@ -962,6 +1003,56 @@ poll_remove(alsa_driver* d)
     }
 }
 
+/* Handles an error returned by a playback function. Returns FALSE if
+   playback can't go on. */
+static gboolean
+alsa_recover(alsa_driver* d,
+    gint err)
+{
+    gint res;
+
+    switch (err) {
+    case -EAGAIN:
+        return TRUE;
+    case -ESTRPIPE:
+        while ((res = snd_pcm_resume(d->soundfd)) == -EAGAIN)
+            usleep(100000); /* wait until suspend flag is released */
+        if (res < 0) {
+            if (d->verbose)
+                fprintf(stderr, "Stream restarting failed\n");
+            if ((res = snd_pcm_prepare(d->soundfd)) < 0) {
+                alsa_error(N_("Unable to restart stream from suspending"), res);
+                return FALSE;
+            }
+        }
+        return TRUE;
+    case -EPIPE:
+        g_atomic_int_inc(&d->xruns);
+        if (d->verbose)
+            fprintf(stderr, "Underrun\n");
+        if ((res = snd_pcm_prepare(d->soundfd)) < 0) {
+            alsa_error(N_("Stream preparation error"), res);
+            return FALSE;
+        }
+        return TRUE;
+    default:
+        alsa_error(N_("Sound playing error"), err);
+        return FALSE;
+    }
+}
+
+static void
+alsa_set_starttime(alsa_driver* d)
+{
+    snd_pcm_status_t* status;
+    snd_timestamp_t tstamp;
+
+    snd_pcm_status_alloca(&status);
+    snd_pcm_status(d->soundfd, status);
+    snd_pcm_status_get_tstamp(status, &tstamp);
+    d->starttime = (double)tstamp.tv_sec + (double)tstamp.tv_usec / 1e6;
+}
+
 static void
 alsa_poll_ready_playing(gpointer data,
     gint source,
@@ -974,39 +1065,14 @@ alsa_poll_ready_playing(gpointer data,
 
     if (!d->firstpoll) {
         while (towrite > 0) {
-            gint res;
             snd_pcm_sframes_t w = snd_pcm_writei(d->soundfd, buffer, towrite);
 
-            switch (w) {
-            case -EAGAIN:
-                continue;
-            case -ESTRPIPE:
-                while ((res = snd_pcm_resume(d->soundfd)) == -EAGAIN)
-                    usleep(100000); /* wait until suspend flag is released */
-                if (res < 0) {
-                    if (d->verbose)
-                        fprintf(stderr, "Stream restarting failed\n");
-                    if ((res = snd_pcm_prepare(d->soundfd)) < 0) {
-                        alsa_error(N_("Unable to restart stream from suspending"), res);
-                        poll_remove(d);
-                        return;
-                    }
-                }
-                continue;
-            case -EPIPE:
-                if ((res = snd_pcm_prepare(d->soundfd)) < 0) {
-                    alsa_error(N_("Stream preparation error"), res);
+            if (w < 0) {
+                if (!alsa_recover(d, w)) {
                     poll_remove(d);
                     return;
                 }
                 continue;
-            default:
-                if (w < 0) {
-                    alsa_error(N_("Sound playing error"), w);
-                    poll_remove(d);
-                    return;
-                }
-                break;
             }
             if (d->verbose)
                 g_print("Written: %li from %li samples\n", w, d->p_fragsize);
@@ -1015,20 +1081,155 @@ alsa_poll_ready_playing(gpointer data,
             buffer += w << size;
         }
     } else {
-        snd_pcm_status_t* status;
-        snd_timestamp_t tstamp;
-
-        snd_pcm_status_alloca(&status);
-        snd_pcm_status(d->soundfd, status);
-        snd_pcm_status_get_tstamp(status, &tstamp);
-        d->starttime = (double)tstamp.tv_sec + (double)tstamp.tv_usec / 1e6;
-
+        alsa_set_starttime(d);
         d->firstpoll = FALSE;
     }
 
     audio_mix(d->sndbuf, d->p_fragsize, d->p_mixfreq, d->mf);
 }
 
+/* Mixes one period directly into the DMA buffer. Returns FALSE if
+   playback can't go on. */
+static gboolean
+alsa_mmap_fill_period(alsa_driver* d)
+{
+    snd_pcm_uframes_t todo = d->p_fragsize;
+
+    while (todo > 0) {
+        const snd_pcm_channel_area_t* areas;
+        snd_pcm_uframes_t offset, frames = todo;
+        snd_pcm_sframes_t committed;
+        gint err;
+
+        if ((err = snd_pcm_mmap_begin(d->soundfd, &areas, &offset, &frames)) < 0)
+            return alsa_recover(d, err);
+
+        if (d->firstpoll) {
+            alsa_set_starttime(d);
+            d->firstpoll = FALSE;
+        }
+
+        /* Interleaved access: a single area holding all channels */
+        audio_mix((guint8*)areas[0].addr + (areas[0].first >> 3) + offset * (areas[0].step >> 3),
+            frames, d->p_mixfreq, d->mf);
+
+        committed = snd_pcm_mmap_commit(d->soundfd, offset, frames);
+        if (committed < 0 || (snd_pcm_uframes_t)committed != frames)
+            return alsa_recover(d, committed >= 0 ? -EPIPE : committed);
+
+        todo -= frames;
+    }
+
+    return TRUE;
+}
+
+static void*
+alsa_mmap_thread(void* data)
+{
+    alsa_driver* const d = data;
+
+    while (g_atomic_int_get(&d->thread_running)) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(d->soundfd);
+        gint err;
+
+        if (avail < 0) {
+            if (!alsa_recover(d, avail))
+                break;
+            continue;
+        }
+
+        if ((snd_pcm_uframes_t)avail >= d->p_fragsize) {
+            gboolean ok;
+
+            /* The audio thread is changing the player state, maybe
+               stopping us; don't block on it */
+            if (!audio_mix_trylock()) {
+                g_usleep(ALSA_MMAP_RETRY_USECS);
+                continue;
+            }
+            ok = alsa_mmap_fill_period(d);
+            audio_mix_unlock();
+            if (!ok)
+                break;
+            continue;
+        }
+
+        /* The start threshold may lie beyond what fits in after an
+           underrun; don't wait for a wakeup that never comes */
+        if (snd_pcm_state(d->soundfd) == SND_PCM_STATE_PREPARED
+            && (err = snd_pcm_start(d->soundfd)) < 0 && !alsa_recover(d, err))
+            break;
+
+        /* With a timeout to notice a stop request */
+        if ((err = snd_pcm_wait(d->soundfd, 100)) < 0 && !alsa_recover(d, err))
+            break;
+    }
+
+    return NULL;
+}
+
+static gboolean
+alsa_mmap_thread_start(alsa_driver* d)
+{
+    pthread_attr_t attr;
+    struct sched_param sp;
+    gint err;
+
+    g_atomic_int_set(&d->thread_running, 1);
+
+    /* Try a realtime thread first; that needs privileges we may lack */
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    sp.sched_priority = MIN(sched_get_priority_min(SCHED_FIFO) + 40, sched_get_priority_max(SCHED_FIFO));
+    pthread_attr_setschedparam(&attr, &sp);
+    err = pthread_create(&d->thread, &attr, alsa_mmap_thread, d);
+    pthread_attr_destroy(&attr);
+
+    d->realtime = err == 0;
+    if (err) {
+        if (d->verbose)
+            fprintf(stderr, "Can't get realtime priority for the mixing thread: %s\n", strerror(err));
+        err = pthread_create(&d->thread, NULL, alsa_mmap_thread, d);
+    }
+
+    if (err) {
+        error_error(_("Unable to start the mixing thread"));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+alsa_mmap_thread_stop(alsa_driver* d)
+{
+    if (g_atomic_int_get(&d->thread_running)) {
+        g_atomic_int_set(&d->thread_running, 0);
+        pthread_join(d->thread, NULL);
+    }
+}
+
+static gboolean
+alsa_update_status(gpointer data)
+{
+    alsa_driver* const d = data;
+    const gint xruns = g_atomic_int_get(&d->xruns);
+    const gboolean no_rt = d->mmap_active && !d->realtime;
+    gchar* text;
+
+    if (xruns != d->xruns_shown || no_rt != d->no_rt_shown) {
+        d->xruns_shown = xruns;
+        d->no_rt_shown = no_rt;
+        text = g_strdup_printf(no_rt ? _("Underruns: %d (no realtime priority)") : _("Underruns: %d"),
+            xruns);
+        gtk_label_set_text(GTK_LABEL(d->status_label), text);
+        g_free(text);
+    }
+
+    return TRUE;
+}
+
 static void
 alsa_poll_ready_sampling(gpointer data,
     gint source,
@@ -1131,6 +1332,14 @@ alsa_new(gboolean playback)
     d->pfd = NULL;
     d->devices_dialog = NULL;
 
+    d->use_mmap = FALSE;
+    d->mmap_active = FALSE;
+    d->thread_running = 0;
+    d->realtime = FALSE;
+    d->xruns = 0;
+    d->xruns_shown = -1;
+    d->no_rt_shown = FALSE;
+
     d->verbose = FALSE;
     d->hwtest = TRUE;
     d->playback = playback;
@@ -1144,6 +1353,8 @@ alsa_new(gboolean playback)
     snd_pcm_sw_params_malloc(&(d->swparams));
 
     alsa_make_config_widgets(d);
+    if (playback)
+        d->status_timeout = g_timeout_add(500, alsa_update_status, d);
     return d;
 }
 
@@ -1164,6 +1375,8 @@ alsa_destroy(void* dp)
 {
     alsa_driver* const d = dp;
 
+    if (d->playback)
+        g_source_remove(d->status_timeout);
     gtk_widget_destroy(d->configwidget);
     snd_pcm_hw_params_free(d->hwparams);
     snd_pcm_sw_params_free(d->swparams);
@@ -1176,6 +1389,9 @@ alsa_release(void* dp)
 {
     alsa_driver* const d = dp;
 
+    /* Before the stream goes away under the thread's feet */
+    alsa_mmap_thread_stop(d);
+
     if (d->sndbuf) {
         free(d->sndbuf);
         d->sndbuf = NULL;
@@ -1208,7 +1424,12 @@ alsa_open(void* dp)
     // --
     // Set channel parameters
     // --
-    if ((err = snd_pcm_hw_params_set_access(d->soundfd, d->hwparams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+    d->mmap_active = d->playback && d->use_mmap
+        && snd_pcm_hw_params_set_access(d->soundfd, d->hwparams, SND_PCM_ACCESS_MMAP_INTERLEAVED) >= 0;
+    if (d->playback && d->use_mmap && !d->mmap_active)
+        error_warning(_("The device doesn't support mmap access, using ordinary writes."));
+    if (!d->mmap_active
+        && (err = snd_pcm_hw_params_set_access(d->soundfd, d->hwparams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
         alsa_error(N_("Unable to set access"), err);
         goto out;
     }
@@ -1338,6 +1559,16 @@ alsa_open(void* dp)
 
     if (d->verbose)
         snd_pcm_dump(d->soundfd, d->output);
+
+    g_atomic_int_set(&d->xruns, 0);
+    d->firstpoll = TRUE;
+
+    if (d->mmap_active) {
+        if (!alsa_mmap_thread_start(d))
+            goto out;
+        return TRUE;
+    }
+
     d->sndbuf = calloc((d->stereo + 1) << (d->bits >> 4), d->p_fragsize);
 
     d->pfd = malloc(sizeof(struct pollfd));
@@ -1360,8 +1591,6 @@ alsa_open(void* dp)
         }
     }
 
-    d->firstpoll = TRUE;
-
     return TRUE;
 
 out:
@@ -1460,6 +1689,7 @@ alsa_loadsettings(void* dp,
         g_free(tmp);
 
     d->verbose = prefs_get_bool(f, "alsa1x-verbose", d->verbose);
+    d->use_mmap = prefs_get_bool(f, "alsa1x-mmap", d->use_mmap);
 
     devlist = prefs_get_str_array(f, "alsa1x-device-list", &size);
     for (i = 0; i < size; i++)
@@ -1525,6 +1755,7 @@ alsa_savesettings(void* dp,
     prefs_put_int_array(f, "alsa1x-maxbufsize", d->maxbufsize, NUM_FORMATS);
 
     prefs_put_bool(f, "alsa1x-verbose", d->verbose);
+    prefs_put_bool(f, "alsa1x-mmap", d->use_mmap);
 
     sdd.counter = 0;
     sdd.str = g_string_new("");
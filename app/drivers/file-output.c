@@ -25,6 +25,7 @@
 
 #include <errno.h>
 #include <glib/gi18n.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,56 +46,202 @@
 #include "preferences.h"
 
 typedef struct file_driver {
-    gchar* filename; /* must be the first entry. is altered by audio.c (hack, hack) */
+    st_file_driver_params params; /* must be the first entry. is altered by audio.c (hack, hack) */
 
+    /* One file, or one per channel of the song when rendering stems.
+       The buffers below hold a block for each of them, one after the
+       other. */
 #if USE_SNDFILE
-    SNDFILE* outfile;
+    SNDFILE* outfiles[32];
     SF_INFO sfinfo;
 #else
-    AFfilehandle outfile;
+    AFfilehandle outfiles[32];
 #endif
-
-    int pipe[2];
-    gpointer polltag;
-    int firstpoll;
-
-    gint16* sndbuf;
-    int sndbuf_size;
+    int numfiles;
+    int block_size; /* bytes per file in a buffer */
+
+    gpointer pulltag;
+
+    /* Double buffering: while the writer thread puts one buffer to disk,
+       the audio thread mixes into the other one */
+    void* sndbuf[2];
+    int sndbuf_frames;
+    int pending[2]; /* frames waiting to be written, 0 if the buffer is free */
+    int current; /* the buffer to be mixed into next */
+    pthread_t writer;
+    pthread_mutex_t mx;
+    pthread_cond_t cv;
+    gboolean writer_running, writer_quit, write_error;
     double playtime;
 
-    int p_resolution;
+    /* Throughput statistics of the current or last rendering; the
+       times are in microseconds */
+    gint64 start_time, end_time, mix_time, write_time, wait_time;
+    guint64 frames_written;
+    gboolean rendering;
+
+    int p_resolution; /* 16 or 32 (float) */
     int p_channels;
     int p_mixfreq;
+    int p_blocksize; /* log2 of the frames mixed at once */
+    gboolean p_stems; /* each channel to its own file */
 
-    GtkWidget *configwidget, *prefs_channels_w[2], *prefs_mixfreq;
+    GtkWidget *configwidget, *prefs_channels_w[2], *prefs_resolution_w[2], *prefs_mixfreq, *prefs_stems_w;
+    GtkWidget *blocksizespin, *blocksizelabel, *statslabel;
+    guint stats_timeout;
     GtkTreeModel* model;
 } file_driver;
 
 static const int mixfreqs[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000, 64000, 88200, 96000 };
 #define NUM_FREQS sizeof(mixfreqs) / sizeof(mixfreqs[0])
 
-static void
-file_poll_ready_playing(gpointer data,
-    gint source,
-    GdkInputCondition condition)
+static gboolean
+file_write_frames(file_driver* d,
+    int file,
+    void* buf,
+    int frames)
 {
-    file_driver* const d = data;
-
-    if (!d->firstpoll) {
 #if USE_SNDFILE
-        sf_writef_short(d->outfile, d->sndbuf, d->sndbuf_size >> d->p_channels);
+    if (d->p_resolution == 32)
+        return sf_writef_float(d->outfiles[file], buf, frames) == frames;
+    else
+        return sf_writef_short(d->outfiles[file], buf, frames) == frames;
 #else
-        afWriteFrames(d->outfile, AF_DEFAULT_TRACK, d->sndbuf, d->sndbuf_size >> d->p_channels);
+    return afWriteFrames(d->outfiles[file], AF_DEFAULT_TRACK, buf, frames) == frames;
 #endif
-        d->playtime += (double)((d->sndbuf_size) >> d->p_channels) / d->p_mixfreq;
+}
+
+static void*
+file_writer_thread(void* data)
+{
+    file_driver* const d = data;
+    int w = 0, i;
+
+    pthread_mutex_lock(&d->mx);
+    for (;;) {
+        gboolean ok = TRUE;
+        gint64 t;
+
+        /* Pending buffers are written out before quitting */
+        while (!d->pending[w] && !d->writer_quit)
+            pthread_cond_wait(&d->cv, &d->mx);
+        if (!d->pending[w])
+            break;
+        pthread_mutex_unlock(&d->mx);
+
+        t = g_get_monotonic_time();
+        for (i = 0; i < d->numfiles && !d->write_error; i++) {
+            ok &= file_write_frames(d, i, d->sndbuf[w] + i * d->block_size, d->pending[w]);
+        }
+        if (!d->write_error && !ok) {
+            /* Reported once; the rendering itself can't be stopped from here */
+            d->write_error = TRUE;
+            error_error(_("Error while writing to the output file. Disk full?"));
+        }
+        t = g_get_monotonic_time() - t;
+
+        pthread_mutex_lock(&d->mx);
+        d->write_time += t;
+        d->frames_written += d->pending[w];
+        d->pending[w] = 0;
+        pthread_cond_signal(&d->cv);
+        w ^= 1;
     }
+    pthread_mutex_unlock(&d->mx);
+
+    return NULL;
+}
 
-    d->firstpoll = FALSE;
+static void
+file_pull(gpointer data,
+    gint source,
+    GdkInputCondition condition)
+{
+    file_driver* const d = data;
+    void* const buf = d->sndbuf[d->current];
+    STMixerFormat mf;
+    guint32 mixed;
+    gint64 t;
+
+    /* Wait until the writer is done with this buffer */
+    t = g_get_monotonic_time();
+    pthread_mutex_lock(&d->mx);
+    while (d->pending[d->current])
+        pthread_cond_wait(&d->cv, &d->mx);
+    pthread_mutex_unlock(&d->mx);
+    d->wait_time += g_get_monotonic_time() - t;
+
+    /* Floats are taken from the mixer as they are, without a 16 bit
+       round trip */
+    if (d->p_resolution == 32)
+        mf = ST_MIXER_FORMAT_FLOAT;
+    else
 #ifdef WORDS_BIGENDIAN
-    audio_mix(d->sndbuf, d->sndbuf_size >> d->p_channels, d->p_mixfreq, ST_MIXER_FORMAT_S16_BE | (d->p_channels == 2 ? ST_MIXER_FORMAT_STEREO : 0));
+        mf = ST_MIXER_FORMAT_S16_BE;
 #else
-    audio_mix(d->sndbuf, d->sndbuf_size >> d->p_channels, d->p_mixfreq, ST_MIXER_FORMAT_S16_LE | (d->p_channels == 2 ? ST_MIXER_FORMAT_STEREO : 0));
+        mf = ST_MIXER_FORMAT_S16_LE;
 #endif
+    if (d->p_channels == 2)
+        mf |= ST_MIXER_FORMAT_STEREO;
+    t = g_get_monotonic_time();
+    /* Nothing plays in real time here; no note may go missing. The
+       thread is shared with the other drivers, though. */
+    st_mixer_sample_allow_waiting(TRUE);
+    if (d->numfiles > 1) {
+        void* dests[32];
+        int i;
+
+        for (i = 0; i < d->numfiles; i++)
+            dests[i] = buf + i * d->block_size;
+        mixed = audio_mix_stems(dests, d->numfiles, d->sndbuf_frames, d->p_mixfreq, mf);
+    } else {
+        mixed = audio_mix(buf, d->sndbuf_frames, d->p_mixfreq, mf);
+    }
+    st_mixer_sample_allow_waiting(FALSE);
+    d->mix_time += g_get_monotonic_time() - t;
+
+    /* The silence after the end of the song isn't written; with big
+       blocks it could last for many seconds */
+    pthread_mutex_lock(&d->mx);
+    d->pending[d->current] = mixed;
+    pthread_cond_signal(&d->cv);
+    pthread_mutex_unlock(&d->mx);
+
+    d->current ^= 1;
+    d->playtime += (double)d->sndbuf_frames / d->p_mixfreq;
+}
+
+static gboolean
+file_update_stats(gpointer data)
+{
+    file_driver* const d = data;
+    gint64 mix_time, write_time, wait_time, elapsed;
+    guint64 frames;
+    gchar* text;
+
+    /* Only a rough picture is needed; don't bother about consistency */
+    if (!d->start_time)
+        return TRUE;
+    pthread_mutex_lock(&d->mx);
+    mix_time = d->mix_time;
+    write_time = d->write_time;
+    wait_time = d->wait_time;
+    frames = d->frames_written;
+    elapsed = (d->rendering ? g_get_monotonic_time() : d->end_time) - d->start_time;
+    pthread_mutex_unlock(&d->mx);
+
+    if (elapsed <= 0)
+        return TRUE;
+    text = g_strdup_printf(_("%s: %.1f s of audio in %.1f s (%.1fx realtime)\n"
+                             "Mixing %.1f s, writing %.1f s, waiting for the disk %.1f s"),
+        d->rendering ? _("Rendering") : _("Last rendering"),
+        (double)frames / d->p_mixfreq, elapsed / 1e6,
+        (double)frames / d->p_mixfreq / (elapsed / 1e6),
+        mix_time / 1e6, write_time / 1e6, wait_time / 1e6);
+    gtk_label_set_text(GTK_LABEL(d->statslabel), text);
+    g_free(text);
+
+    return TRUE;
 }
 
 static void
@@ -109,6 +256,18 @@ prefs_channels_changed(GtkWidget* w, file_driver* d)
     d->p_channels = ++curr;
 }
 
+static void
+prefs_resolution_changed(GtkWidget* w, file_driver* d)
+{
+    gint curr;
+
+    if ((curr = find_current_toggle(d->prefs_resolution_w,
+             sizeof(d->prefs_resolution_w) / sizeof(d->prefs_resolution_w[0])))
+        < 0)
+        return;
+    d->p_resolution = curr ? 32 : 16;
+}
+
 static void
 prefs_mixfreq_changed(GtkWidget* w, file_driver* d)
 {
@@ -119,11 +278,34 @@ prefs_mixfreq_changed(GtkWidget* w, file_driver* d)
     gtk_tree_model_get(d->model, &iter, 0, &d->p_mixfreq, -1);
 }
 
+static void
+prefs_blocksize_changed(GtkWidget* w, file_driver* d)
+{
+    gchar* expression;
+
+    d->p_blocksize = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(d->blocksizespin));
+
+    expression = g_strdup_printf(_(" = %u frames"), 1 << d->p_blocksize);
+    gtk_label_set_text(GTK_LABEL(d->blocksizelabel), expression);
+    g_free(expression);
+}
+
+static void
+prefs_stems_changed(GtkToggleButton* w, file_driver* d)
+{
+    d->p_stems = gtk_toggle_button_get_active(w);
+}
+
 static void
 prefs_init_from_structure(file_driver* d)
 {
     gui_set_radio_active(d->prefs_channels_w, d->p_channels - 1);
+    gui_set_radio_active(d->prefs_resolution_w, d->p_resolution == 32);
     gui_set_active_combo_item(d->prefs_mixfreq, d->model, d->p_mixfreq);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(d->blocksizespin), d->p_blocksize);
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(d->prefs_stems_w), d->p_stems);
+    /* The label is to be set even if the value has not been changed */
+    prefs_blocksize_changed(d->blocksizespin, d);
 }
 
 static void
@@ -136,6 +318,7 @@ file_make_config_widgets(file_driver* d)
     guint i;
 
     static const char* channelslabels[] = { N_("Mono"), N_("Stereo"), NULL };
+    static const char* resolutionlabels[] = { N_("16 bits"), N_("32 bits float"), NULL };
 
     d->configwidget = mainbox = gtk_vbox_new(FALSE, 2);
 
@@ -150,6 +333,14 @@ file_make_config_widgets(file_driver* d)
     box2 = gtk_hbox_new(FALSE, 4);
     gtk_box_pack_start(GTK_BOX(mainbox), box2, FALSE, TRUE, 0);
 
+    thing = gtk_label_new(_("Resolution:"));
+    gtk_box_pack_start(GTK_BOX(box2), thing, FALSE, TRUE, 0);
+    add_empty_hbox(box2);
+    make_radio_group_full(resolutionlabels, box2, d->prefs_resolution_w, FALSE, TRUE, (void (*)())prefs_resolution_changed, d);
+
+    box2 = gtk_hbox_new(FALSE, 4);
+    gtk_box_pack_start(GTK_BOX(mainbox), box2, FALSE, TRUE, 0);
+
     thing = gtk_label_new(_("Frequency [Hz]:"));
     gtk_box_pack_start(GTK_BOX(box2), thing, FALSE, TRUE, 0);
     ls = gtk_list_store_new(1, G_TYPE_UINT);
@@ -167,6 +358,41 @@ file_make_config_widgets(file_driver* d)
     g_signal_connect(thing, "changed",
         G_CALLBACK(prefs_mixfreq_changed), d);
 
+    box2 = gtk_hbox_new(FALSE, 4);
+    gtk_box_pack_start(GTK_BOX(mainbox), box2, FALSE, TRUE, 0);
+
+    thing = gtk_label_new(_("Block Size:"));
+    gtk_box_pack_start(GTK_BOX(box2), thing, FALSE, TRUE, 0);
+    add_empty_hbox(box2);
+
+    thing = gtk_label_new("2^");
+    gtk_box_pack_start(GTK_BOX(box2), thing, FALSE, TRUE, 0);
+
+    d->blocksizespin = thing = gtk_spin_button_new_with_range(12.0, 20.0, 1.0);
+    gtk_widget_set_tooltip_text(thing, _("The number of frames mixed and written at once. "
+                                         "Larger blocks render faster; smaller ones lower the latency, "
+                                         "so that the displays and stopping follow the rendering more closely."));
+    gtk_box_pack_start(GTK_BOX(box2), thing, FALSE, TRUE, 0);
+    g_signal_connect(thing, "value-changed",
+        G_CALLBACK(prefs_blocksize_changed), d);
+
+    d->blocksizelabel = thing = gtk_label_new(" = ");
+    gtk_box_pack_start(GTK_BOX(box2), thing, FALSE, TRUE, 0);
+
+    d->prefs_stems_w = thing = gtk_check_button_new_with_label(_("Render each channel to a file of its own"));
+    gtk_widget_set_tooltip_text(thing, _("The files are named after the given one with the channel number "
+                                         "appended, e.g. song-01.wav, song-02.wav..."));
+    gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
+    g_signal_connect(thing, "toggled",
+        G_CALLBACK(prefs_stems_changed), d);
+
+    thing = gtk_hseparator_new();
+    gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
+
+    d->statslabel = thing = gtk_label_new("");
+    gtk_misc_set_alignment(GTK_MISC(thing), 0.0, 0.5);
+    gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
+
     gtk_widget_show_all(mainbox);
 }
 
@@ -187,13 +413,19 @@ file_new(void)
     d->p_mixfreq = 44100;
     d->p_channels = 2;
     d->p_resolution = 16;
-    d->sndbuf = NULL;
-    d->polltag = NULL;
+    d->p_blocksize = 14;
+    d->p_stems = FALSE;
+    d->numfiles = 0;
+    d->sndbuf[0] = d->sndbuf[1] = NULL;
+    d->pulltag = NULL;
+    d->writer_running = FALSE;
+    d->rendering = FALSE;
+    d->start_time = 0;
+    pthread_mutex_init(&d->mx, NULL);
+    pthread_cond_init(&d->cv, NULL);
 
     file_make_config_widgets(d);
-
-    if (pipe(d->pipe) == -1)
-        perror("File output: pipe()");
+    d->stats_timeout = g_timeout_add(500, file_update_stats, d);
 
     return d;
 }
@@ -203,8 +435,9 @@ file_destroy(void* dp)
 {
     file_driver* const d = dp;
 
-    close(d->pipe[0]);
-    close(d->pipe[1]);
+    g_source_remove(d->stats_timeout);
+    pthread_mutex_destroy(&d->mx);
+    pthread_cond_destroy(&d->cv);
 
     gtk_widget_destroy(d->configwidget);
 
@@ -215,34 +448,66 @@ static void
 file_release(void* dp)
 {
     file_driver* const d = dp;
+    int i;
+
+    audio_pull_remove(d->pulltag);
+    d->pulltag = NULL;
+
+    /* The writer puts the pending buffers to disk before leaving */
+    if (d->writer_running) {
+        pthread_mutex_lock(&d->mx);
+        d->writer_quit = TRUE;
+        pthread_cond_signal(&d->cv);
+        pthread_mutex_unlock(&d->mx);
+        pthread_join(d->writer, NULL);
+        d->writer_running = FALSE;
+    }
 
-    free(d->sndbuf);
-    d->sndbuf = NULL;
+    pthread_mutex_lock(&d->mx);
+    d->rendering = FALSE;
+    d->end_time = g_get_monotonic_time();
+    pthread_mutex_unlock(&d->mx);
 
-    audio_poll_remove(d->polltag);
-    d->polltag = NULL;
+    free(d->sndbuf[0]);
+    free(d->sndbuf[1]);
+    d->sndbuf[0] = d->sndbuf[1] = NULL;
 
-    if (d->outfile != NULL) {
+    for (i = 0; i < d->numfiles; i++) {
+        if (d->outfiles[i] != NULL) {
 #if USE_SNDFILE
-        sf_close(d->outfile);
+            sf_close(d->outfiles[i]);
 #else
-        afCloseFile(d->outfile);
+            afCloseFile(d->outfiles[i]);
 #endif
-        d->outfile = NULL;
+        }
     }
+    d->numfiles = 0;
+}
+
+/* "song.wav" -> "song-01.wav" */
+static gchar*
+file_stem_name(const gchar* filename,
+    int channel)
+{
+    const gchar* base = strrchr(filename, G_DIR_SEPARATOR);
+    const gchar* ext = strrchr(base ? base : filename, '.');
+
+    if (!ext)
+        ext = filename + strlen(filename);
+
+    return g_strdup_printf("%.*s-%02d%s", (int)(ext - filename), filename, channel + 1, ext);
 }
 
 static gboolean
 file_open(void* dp)
 {
     file_driver* const d = dp;
+    int i, n;
 
 #if USE_SNDFILE
     d->sfinfo.channels = d->p_channels;
     d->sfinfo.samplerate = d->p_mixfreq;
-    d->sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
-
-    d->outfile = sf_open(d->filename, SFM_WRITE, &d->sfinfo);
+    d->sfinfo.format = SF_FORMAT_WAV | (d->p_resolution == 32 ? SF_FORMAT_FLOAT : SF_FORMAT_PCM_16);
 #else
     AFfilesetup outfilesetup;
 
@@ -250,31 +515,69 @@ file_open(void* dp)
     afInitFileFormat(outfilesetup, AF_FILE_WAVE);
     afInitChannels(outfilesetup, AF_DEFAULT_TRACK, d->p_channels);
     afInitRate(outfilesetup, AF_DEFAULT_TRACK, d->p_mixfreq);
-    afInitSampleFormat(outfilesetup, AF_DEFAULT_TRACK, AF_SAMPFMT_TWOSCOMP, 16);
-    d->outfile = afOpenFile(d->filename, "w", outfilesetup);
+    if (d->p_resolution == 32)
+        afInitSampleFormat(outfilesetup, AF_DEFAULT_TRACK, AF_SAMPFMT_FLOAT, 32);
+    else
+        afInitSampleFormat(outfilesetup, AF_DEFAULT_TRACK, AF_SAMPFMT_TWOSCOMP, 16);
+#endif
+
+    /* All files are opened up front, so they are written in one pass */
+    n = d->p_stems ? CLAMP(d->params.numchannels, 1, 32) : 1;
+    for (d->numfiles = 0; d->numfiles < n; d->numfiles++) {
+        gchar* name = d->p_stems ? file_stem_name(d->params.filename, d->numfiles) : g_strdup(d->params.filename);
+        gboolean opened;
+
+#if USE_SNDFILE
+        d->outfiles[d->numfiles] = sf_open(name, SFM_WRITE, &d->sfinfo);
+#else
+        d->outfiles[d->numfiles] = afOpenFile(name, "w", outfilesetup);
+#endif
+        opened = d->outfiles[d->numfiles] != NULL;
+
+        /* In case we're running setuid root... */
+        if (opened && chown(name, getuid(), getgid()) == -1)
+            error_warning(_("Can't change file ownership."));
+        g_free(name);
+
+        if (!opened)
+            break;
+    }
+#if !USE_SNDFILE
     afFreeFileSetup(outfilesetup);
 #endif
 
-    if (!d->outfile) {
+    if (d->numfiles < n) {
         error_error(_("Can't open file for writing."));
         goto out;
     }
 
-    /* In case we're running setuid root... */
-    if (chown(d->filename, getuid(), getgid()) == -1)
-        error_warning(_("Can't change file ownership."));
-
-    d->sndbuf_size = 16384;
-    d->sndbuf = malloc(d->sndbuf_size);
-    if (!d->sndbuf) {
+    d->sndbuf_frames = 1 << d->p_blocksize;
+    d->block_size = d->sndbuf_frames * d->p_channels * (d->p_resolution == 32 ? sizeof(float) : sizeof(gint16));
+    for (i = 0; i < 2; i++) {
+        d->sndbuf[i] = malloc(d->block_size * d->numfiles);
+        d->pending[i] = 0;
+    }
+    if (!d->sndbuf[0] || !d->sndbuf[1]) {
         error_error(_("Can't allocate mix buffer."));
         goto out;
     }
-
-    d->polltag = audio_poll_add(d->pipe[1], GDK_INPUT_WRITE, file_poll_ready_playing, d);
-    d->firstpoll = TRUE;
+    d->current = 0;
     d->playtime = 0.0;
 
+    d->writer_quit = FALSE;
+    d->write_error = FALSE;
+    d->mix_time = d->write_time = d->wait_time = 0;
+    d->frames_written = 0;
+    d->start_time = g_get_monotonic_time();
+    d->rendering = TRUE;
+    if (pthread_create(&d->writer, NULL, file_writer_thread, d)) {
+        error_error(_("Can't start the writer thread."));
+        goto out;
+    }
+    d->writer_running = TRUE;
+
+    d->pulltag = audio_pull_add(file_pull, d);
+
     return TRUE;
 
 out:
@@ -298,6 +601,9 @@ file_loadsettings(void* dp,
 
     d->p_channels = prefs_get_int(f, "file-channels", d->p_channels);
     d->p_mixfreq = prefs_get_int(f, "file-mixfreq", d->p_mixfreq);
+    d->p_resolution = prefs_get_int(f, "file-resolution", d->p_resolution) == 32 ? 32 : 16;
+    d->p_blocksize = CLAMP(prefs_get_int(f, "file-blocksize", d->p_blocksize), 12, 20);
+    d->p_stems = prefs_get_bool(f, "file-stems", d->p_stems);
     prefs_init_from_structure(d);
 
     return TRUE;
@@ -311,6 +617,9 @@ file_savesettings(void* dp,
 
     prefs_put_int(f, "file-channels", d->p_channels);
     prefs_put_int(f, "file-mixfreq", d->p_mixfreq);
+    prefs_put_int(f, "file-resolution", d->p_resolution);
+    prefs_put_int(f, "file-blocksize", d->p_blocksize);
+    prefs_put_bool(f, "file-stems", d->p_stems);
 
     return TRUE;
 }
@@ -27,7 +27,6 @@
  * should master transport always work? even for pattern? Can we determine this info anyway?
  * general thread safety: d->state should be wrapped in state_mx locks as a matter of principle
  *                        In practice this is needed only when we are waiting on state_cv.
- * XRUN counter
  */
 
 #include <config.h>
@@ -46,6 +45,8 @@
 #include <unistd.h>
 
 #include <jack/jack.h>
+#include <jack/ringbuffer.h>
+#include <pthread.h>
 
 #include <glib.h>
 #include <glib/gi18n.h>
@@ -58,17 +59,15 @@
 #include "mixer.h"
 #include "preferences.h"
 
-/* suggested by Erik de Castro Lopo */
-#define INT16_MAX_float 32767.0f
-static inline float
-sample_convert_s16_to_float(gint16 inval)
-{
-    return inval * (1.0 / (INT16_MAX_float + 1));
-}
-
 typedef jack_default_audio_sample_t audio_t;
 typedef jack_nframes_t nframes_t;
 
+/* Render-ahead mode: frames mixed by the producer thread at once, and
+   the size of the ring buffer in JACK periods */
+#define JACK_RENDER_BLOCK 256
+#define JACK_RENDER_AHEAD_PERIODS 4
+#define JACK_FRAME_SIZE (2 * sizeof(float))
+
 typedef enum {
     JackDriverStateIsRolling,
     JackDriverStateIsDeclicking,
@@ -91,8 +90,12 @@ typedef struct jack_driver {
     guint transport_check_id, autostart_check_id;
     GtkWidget* declick_check;
     GtkWidget* autostart_check;
+    GtkWidget* ahead_check;
+    GtkWidget* stats_label;
+    guint stats_timeout;
     gboolean do_declick;
     gboolean autostart;
+    gboolean render_ahead;
 
     /* jack + audio stuff */
     nframes_t buffer_size;
@@ -100,7 +103,7 @@ typedef struct jack_driver {
     char* client_name;
     jack_client_t* client;
     jack_port_t *left, *right;
-    void* mix; // passed to audio_mix, big enough for stereo 16 bit nframes = nframes*4
+    float* mix; // passed to audio_mix, big enough for stereo float nframes
     STMixerFormat mf;
 
     /* internal state stuff */
@@ -112,6 +115,20 @@ typedef struct jack_driver {
     gboolean is_active; // jack seems to be running fine
     jack_driver_transport transport; // who do we serve?
 
+    /* render-ahead mode: a normal priority thread mixes into the ring
+       buffer, the process callback only copies from there */
+    gboolean ahead_active; // for the current stream
+    jack_ringbuffer_t* ring; // interleaved stereo frames
+    pthread_t producer;
+    pthread_mutex_t ahead_mx; // the producer waits on ahead_cv for free space
+    pthread_cond_t ahead_cv;
+    gboolean producer_running;
+
+    /* statistics, written by the process thread and read by the GUI */
+    gint xruns;
+    gint underruns; // process callbacks which found the ring buffer short
+    gint cb_time_avg, cb_time_max; // process callback time, usecs
+
 } jack_driver;
 
 static inline float
@@ -122,11 +139,39 @@ jack_driver_declick_coeff(nframes_t total, nframes_t current)
     return (float)current / (float)total;
 }
 
+/* Fills d->mix with nframes frames, either by mixing them right here or
+   by taking them from the ring buffer. Returns the number of frames which
+   are actual output; the rest is silence. */
+static nframes_t
+jack_driver_fetch(jack_driver* d, nframes_t nframes)
+{
+    nframes_t got;
+
+    if (!d->ahead_active) {
+        audio_mix(d->mix, nframes, d->sample_rate, d->mf);
+        return nframes;
+    }
+
+    got = jack_ringbuffer_read(d->ring, (char*)d->mix, nframes * JACK_FRAME_SIZE) / JACK_FRAME_SIZE;
+    if (got < nframes) {
+        g_atomic_int_inc(&d->underruns);
+        memset(d->mix + got * 2, 0, (nframes - got) * JACK_FRAME_SIZE);
+    }
+
+    /* Never block here; if the producer isn't waiting it is busy anyway */
+    if (pthread_mutex_trylock(&d->ahead_mx) == 0) {
+        pthread_cond_signal(&d->ahead_cv);
+        pthread_mutex_unlock(&d->ahead_mx);
+    }
+
+    return got;
+}
+
 static void
 jack_driver_process_core(nframes_t nframes, jack_driver* d)
 {
     audio_t *lbuf, *rbuf;
-    gint16* mix = d->mix;
+    float* mix = d->mix;
     nframes_t cnt = nframes;
     float gain = 1.0f;
     jack_driver_state state = d->state;
@@ -137,21 +182,19 @@ jack_driver_process_core(nframes_t nframes, jack_driver* d)
     switch (state) {
 
     case JackDriverStateIsRolling:
-        audio_mix(mix, nframes, d->sample_rate, d->mf);
-        d->position += nframes;
+        d->position += jack_driver_fetch(d, nframes);
         while (cnt--) {
-            *(lbuf++) = sample_convert_s16_to_float(*mix++);
-            *(rbuf++) = sample_convert_s16_to_float(*mix++);
+            *(lbuf++) = *mix++;
+            *(rbuf++) = *mix++;
         }
         break;
 
     case JackDriverStateIsDeclicking:
-        audio_mix(mix, nframes, d->sample_rate, d->mf);
-        d->position += nframes;
+        d->position += jack_driver_fetch(d, nframes);
         while (cnt--) {
             gain = jack_driver_declick_coeff(nframes, cnt);
-            *(lbuf++) = gain * sample_convert_s16_to_float(*mix++);
-            *(rbuf++) = gain * sample_convert_s16_to_float(*mix++);
+            *(lbuf++) = gain * *mix++;
+            *(rbuf++) = gain * *mix++;
         }
         /* safe because ST shouldn't call open() with pending release() */
         d->state = JackDriverStateIsStopping;
@@ -172,10 +215,21 @@ jack_driver_process_core(nframes_t nframes, jack_driver* d)
     }
 }
 
+/* The process callback mixes right away unless render-ahead is on; it
+   must not wait for the worker threads of parallel mixing then */
+static void
+jack_driver_thread_init(void* arg)
+{
+    st_mixer_forbid_parallel();
+}
+
 static int
 jack_driver_process_wrapper(nframes_t nframes, void* arg)
 {
     jack_driver* d = arg;
+    jack_time_t start = jack_get_time();
+    gint elapsed;
+
     if (pthread_mutex_trylock(d->process_mx) == 0) {
         d->locked = TRUE;
         jack_driver_process_core(nframes, d);
@@ -184,9 +238,104 @@ jack_driver_process_wrapper(nframes_t nframes, void* arg)
         d->locked = FALSE;
         jack_driver_process_core(nframes, d);
     }
+
+    elapsed = jack_get_time() - start;
+    /* Only this thread writes them */
+    g_atomic_int_set(&d->cb_time_avg, d->cb_time_avg + (elapsed - d->cb_time_avg) / 16);
+    if (elapsed > d->cb_time_max)
+        g_atomic_int_set(&d->cb_time_max, elapsed);
+
     return 0;
 }
 
+static int
+jack_driver_xrun_callback(void* arg)
+{
+    jack_driver* d = arg;
+
+    g_atomic_int_inc(&d->xruns);
+    return 0;
+}
+
+static void*
+jack_driver_producer(void* arg)
+{
+    jack_driver* d = arg;
+
+    pthread_mutex_lock(&d->ahead_mx);
+    while (d->producer_running) {
+        jack_ringbuffer_data_t vec[2];
+        nframes_t frames;
+
+        if (jack_ringbuffer_write_space(d->ring) < JACK_RENDER_BLOCK * JACK_FRAME_SIZE) {
+            pthread_cond_wait(&d->ahead_cv, &d->ahead_mx);
+            continue;
+        }
+        pthread_mutex_unlock(&d->ahead_mx);
+
+        /* Mix straight into the ring buffer. Everything is advanced in
+           whole frames, so the first part always holds at least one. */
+        jack_ringbuffer_get_write_vector(d->ring, vec);
+        frames = MIN(vec[0].len / JACK_FRAME_SIZE, JACK_RENDER_BLOCK);
+        audio_mix(vec[0].buf, frames, d->sample_rate, d->mf);
+        jack_ringbuffer_write_advance(d->ring, frames * JACK_FRAME_SIZE);
+
+        pthread_mutex_lock(&d->ahead_mx);
+    }
+    pthread_mutex_unlock(&d->ahead_mx);
+
+    return NULL;
+}
+
+static gboolean
+jack_driver_start_ahead(jack_driver* d)
+{
+    jack_ringbuffer_data_t vec[2];
+    nframes_t frames;
+    int i;
+
+    d->ring = jack_ringbuffer_create(d->buffer_size * JACK_RENDER_AHEAD_PERIODS * JACK_FRAME_SIZE);
+    if (!d->ring) {
+        error_error(_("Unable to allocate the render-ahead buffer"));
+        return FALSE;
+    }
+    jack_ringbuffer_mlock(d->ring);
+
+    /* Fill it up before the process callback starts reading */
+    jack_ringbuffer_get_write_vector(d->ring, vec);
+    for (i = 0; i < 2; i++) {
+        frames = vec[i].len / JACK_FRAME_SIZE;
+        if (frames) {
+            audio_mix(vec[i].buf, frames, d->sample_rate, d->mf);
+            jack_ringbuffer_write_advance(d->ring, frames * JACK_FRAME_SIZE);
+        }
+    }
+
+    d->producer_running = TRUE;
+    if (pthread_create(&d->producer, NULL, jack_driver_producer, d)) {
+        error_error(_("Unable to start the mixing thread"));
+        jack_ringbuffer_free(d->ring);
+        d->ring = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+jack_driver_stop_ahead(jack_driver* d)
+{
+    pthread_mutex_lock(&d->ahead_mx);
+    d->producer_running = FALSE;
+    pthread_cond_signal(&d->ahead_cv);
+    pthread_mutex_unlock(&d->ahead_mx);
+    pthread_join(d->producer, NULL);
+
+    d->ahead_active = FALSE;
+    jack_ringbuffer_free(d->ring);
+    d->ring = NULL;
+}
+
 static void
 jack_driver_prefs_transport_callback(void* a, jack_driver* d)
 { //!!! Revise
@@ -212,6 +361,34 @@ jack_driver_prefs_declick_callback(GtkToggleButton* widget, jack_driver* d)
     d->do_declick = gtk_toggle_button_get_active(widget);
 }
 
+static void
+jack_driver_prefs_ahead_callback(GtkToggleButton* widget, jack_driver* d)
+{
+    d->render_ahead = gtk_toggle_button_get_active(widget);
+}
+
+static gboolean
+jack_driver_stats_update(gpointer data)
+{
+    jack_driver* d = data;
+    gchar* text;
+
+    if (!d->is_active) {
+        gtk_label_set_text(GTK_LABEL(d->stats_label), "");
+        return TRUE;
+    }
+
+    text = g_strdup_printf(_("Xruns: %d, late buffers: %d\n"
+                             "Process time: %d us average, %d us peak of %d us"),
+        g_atomic_int_get(&d->xruns), g_atomic_int_get(&d->underruns),
+        g_atomic_int_get(&d->cb_time_avg), g_atomic_int_get(&d->cb_time_max),
+        (int)(d->buffer_size * G_GINT64_CONSTANT(1000000) / d->sample_rate));
+    gtk_label_set_text(GTK_LABEL(d->stats_label), text);
+    g_free(text);
+
+    return TRUE;
+}
+
 static int
 jack_driver_sample_rate_callback(nframes_t nframes, void* arg)
 {
@@ -226,7 +403,7 @@ jack_driver_buffer_size_callback(nframes_t nframes, void* arg)
     jack_driver* d = arg;
     if (nframes > d->buffer_size) {
         d->buffer_size = nframes;
-        d->mix = realloc(d->mix, d->buffer_size * 4);
+        d->mix = realloc(d->mix, d->buffer_size * 2 * sizeof(float));
     }
     return 0;
 }
@@ -273,14 +450,16 @@ jack_driver_activate(void* dp)
         d->sample_rate = jack_get_sample_rate(d->client);
         d->buffer_size = jack_get_buffer_size(d->client);
         if (!d->mix)
-            d->mix = calloc(1, d->buffer_size * 4);
+            d->mix = calloc(d->buffer_size * 2, sizeof(float));
 
         d->left = jack_port_register(d->client, "out_1", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
         d->right = jack_port_register(d->client, "out_2", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 
+        jack_set_thread_init_callback(d->client, jack_driver_thread_init, d);
         jack_set_process_callback(d->client, jack_driver_process_wrapper, d);
         jack_set_sample_rate_callback(d->client, jack_driver_sample_rate_callback, d);
         jack_set_buffer_size_callback(d->client, jack_driver_buffer_size_callback, d);
+        jack_set_xrun_callback(d->client, jack_driver_xrun_callback, d);
         jack_on_shutdown(d->client, jack_driver_server_has_shutdown, d);
 
         if (jack_activate(d->client)) {
@@ -345,6 +524,21 @@ jack_driver_make_config_widgets(jack_driver* d)
     gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
     g_signal_connect(thing, "clicked", G_CALLBACK(jack_driver_prefs_declick_callback), d);
     gtk_widget_show(thing);
+
+    thing = d->ahead_check = gtk_check_button_new_with_label(_("render ahead"));
+    gtk_widget_set_tooltip_text(thing, _("Mix in a separate thread some periods in advance. "
+                                         "Safer against xruns, but adds latency."));
+    gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
+    g_signal_connect(thing, "clicked", G_CALLBACK(jack_driver_prefs_ahead_callback), d);
+    gtk_widget_show(thing);
+
+    thing = gtk_hseparator_new();
+    gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
+    gtk_widget_show(thing);
+
+    d->stats_label = thing = gtk_label_new("");
+    gtk_box_pack_start(GTK_BOX(mainbox), thing, FALSE, TRUE, 0);
+    gtk_widget_show(thing);
 }
 
 static void
@@ -361,8 +555,8 @@ jack_driver_new(void)
     jack_driver* d = g_new(jack_driver, 1);
 
     d->mix = NULL;
-    d->mf = ST_MIXER_FORMAT_S16_LE | ST_MIXER_FORMAT_STEREO;
-    // d->mf = ST_MIXER_FORMAT_S16_BE | ST_MIXER_FORMAT_STEREO;
+    /* The mixer delivers floats directly; no 16 bit round trip */
+    d->mf = ST_MIXER_FORMAT_FLOAT | ST_MIXER_FORMAT_STEREO;
     d->state = JackDriverStateIsStopped;
     d->transport = JackDriverTransportIsInternal;
     d->position = 0;
@@ -370,9 +564,17 @@ jack_driver_new(void)
     d->process_mx = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
     d->state_cv = (pthread_cond_t*)malloc(sizeof(pthread_cond_t));
     d->do_declick = TRUE;
+    d->render_ahead = FALSE;
+    d->ahead_active = FALSE;
+    d->ring = NULL;
+    d->xruns = d->underruns = 0;
+    d->cb_time_avg = d->cb_time_max = 0;
     pthread_mutex_init(d->process_mx, NULL);
     pthread_cond_init(d->state_cv, NULL);
+    pthread_mutex_init(&d->ahead_mx, NULL);
+    pthread_cond_init(&d->ahead_cv, NULL);
     jack_driver_make_config_widgets(d);
+    d->stats_timeout = g_timeout_add(500, jack_driver_stats_update, d);
 
     jack_set_error_function(jack_driver_error);
 
@@ -388,6 +590,15 @@ jack_driver_open(void* dp)
         return FALSE;
     }
     d->position = 0;
+    g_atomic_int_set(&d->underruns, 0);
+    g_atomic_int_set(&d->cb_time_max, 0);
+
+    if (d->render_ahead) {
+        if (!jack_driver_start_ahead(d))
+            return FALSE;
+        d->ahead_active = TRUE;
+    }
+
     d->state = JackDriverStateIsRolling;
     return TRUE;
 }
@@ -406,6 +617,10 @@ jack_driver_release(void* dp)
     pthread_cond_wait(d->state_cv, d->process_mx);
     /* at this point process() has set state to stopped */
     pthread_mutex_unlock(d->process_mx);
+
+    /* ...and doesn't touch the ring buffer any longer */
+    if (d->ahead_active)
+        jack_driver_stop_ahead(d);
 }
 
 static void
@@ -423,6 +638,7 @@ static void
 jack_driver_destroy(void* dp)
 {
     jack_driver* d = dp;
+    g_source_remove(d->stats_timeout);
     gtk_widget_destroy(d->configwidget);
     if (d->mix != NULL) {
         free(d->mix);
@@ -430,6 +646,8 @@ jack_driver_destroy(void* dp)
     }
     pthread_mutex_destroy(d->process_mx);
     pthread_cond_destroy(d->state_cv);
+    pthread_mutex_destroy(&d->ahead_mx);
+    pthread_cond_destroy(&d->ahead_cv);
     g_free(d);
 }
 
@@ -454,6 +672,8 @@ jack_driver_loadsettings(void* dp, const gchar* f)
     g_signal_handler_block(G_OBJECT(d->autostart_check), d->autostart_check_id);
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(d->autostart_check), d->autostart);
     g_signal_handler_unblock(G_OBJECT(d->autostart_check), d->autostart_check_id);
+    d->render_ahead = prefs_get_bool(f, "jack-render-ahead", FALSE);
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(d->ahead_check), d->render_ahead);
 
     return TRUE;
 }
@@ -465,6 +685,7 @@ jack_driver_savesettings(void* dp, const gchar* f)
     //	prefs_put_string (f, "jack-client_name", d->client_name);
     prefs_put_bool(f, "jack-declick", d->do_declick);
     prefs_put_bool(f, "jack-autostart", d->autostart);
+    prefs_put_bool(f, "jack-render-ahead", d->render_ahead);
     return TRUE;
 }
 
@@ -23,8 +23,8 @@
 #define _ERRORS_H
 
 /* Routines related to error messages and status bars -- these are
-   thread-safe and non-blocking; dialogs are displayed within
-   read_mixer_pipe(). More complicated dialogs (OK/Cancel questions
+   thread-safe and non-blocking; dialogs are displayed by the GUI
+   thread (see audio_back_message()). More complicated dialogs (OK/Cancel questions
    etc.) have to be hacked up manually. */
 
 void error_error(const char* text);
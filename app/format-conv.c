@@ -0,0 +1,256 @@
+
+/*
+ * The Real SoundTracker - Conversion of the mixer output for the drivers
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* All conversions are instances of format_conv_generic() with constant
+   arguments. Since it is always inlined, the compiler throws away the
+   branches which don't apply and is left with a simple loop it can
+   vectorize. GCC doesn't vectorize at -O2 before version 12, and
+   from then on it skips loops that need a runtime check for
+   overlapping buffers, as nearly all of these do; so the conversion
+   functions ask for it explicitly. Clang vectorizes at -O2 anyway. */
+
+#include <config.h>
+
+#include "format-conv.h"
+
+#if defined(__GNUC__)
+#define FORMAT_CONV_INLINE static inline __attribute__((always_inline))
+#else
+#define FORMAT_CONV_INLINE static inline
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define FORMAT_CONV_VECTORIZE __attribute__((optimize("tree-vectorize")))
+#else
+#define FORMAT_CONV_VECTORIZE
+#endif
+
+/* Integers are handled with 16 bit scale in between, floats stay floats
+   if the destination wants them */
+
+FORMAT_CONV_INLINE gint32
+format_conv_read_int(const void* src,
+    gsize i,
+    const format_conv_type t)
+{
+    float f;
+
+    switch (t) {
+    case FORMAT_CONV_S8:
+        return ((const gint8*)src)[i] * 256;
+    case FORMAT_CONV_S16:
+        return ((const gint16*)src)[i];
+    default:
+        f = ((const float*)src)[i] * 32768.0f;
+        return (gint32)(f < -32768.0f ? -32768.0f : (f > 32767.0f ? 32767.0f : f));
+    }
+}
+
+FORMAT_CONV_INLINE float
+format_conv_read_float(const void* src,
+    gsize i,
+    const format_conv_type t)
+{
+    switch (t) {
+    case FORMAT_CONV_S8:
+        return ((const gint8*)src)[i] * (1.0f / 128.0f);
+    case FORMAT_CONV_S16:
+        return ((const gint16*)src)[i] * (1.0f / 32768.0f);
+    default:
+        return ((const float*)src)[i];
+    }
+}
+
+FORMAT_CONV_INLINE guint16
+format_conv_swap(guint16 v)
+{
+    return (v << 8) | (v >> 8);
+}
+
+FORMAT_CONV_INLINE void
+format_conv_write_int(void* dest,
+    gsize i,
+    gint32 v,
+    const format_conv_type t)
+{
+    switch (t) {
+    case FORMAT_CONV_S8:
+        ((gint8*)dest)[i] = v >> 8;
+        break;
+    case FORMAT_CONV_U8:
+        ((guint8*)dest)[i] = (v >> 8) ^ 0x80;
+        break;
+    case FORMAT_CONV_S16:
+        ((gint16*)dest)[i] = v;
+        break;
+    case FORMAT_CONV_U16:
+        ((guint16*)dest)[i] = v ^ 0x8000;
+        break;
+    case FORMAT_CONV_S16_SWAPPED:
+        ((guint16*)dest)[i] = format_conv_swap(v);
+        break;
+    case FORMAT_CONV_U16_SWAPPED:
+        ((guint16*)dest)[i] = format_conv_swap(v ^ 0x8000);
+        break;
+    default:
+        break;
+    }
+}
+
+FORMAT_CONV_INLINE void
+format_conv_generic(const void* src,
+    void* dest,
+    guint32 count,
+    const format_conv_type st,
+    const int sc,
+    const format_conv_type dt,
+    const int dc)
+{
+    gsize i;
+
+    if (dt == FORMAT_CONV_FLOAT) {
+        float* const d = dest;
+
+        for (i = 0; i < count; i++) {
+            float v = format_conv_read_float(src, i * sc, st);
+
+            if (sc == 2) {
+                float r = format_conv_read_float(src, i * 2 + 1, st);
+                if (dc == 2) {
+                    d[i * 2] = v;
+                    d[i * 2 + 1] = r;
+                    continue;
+                }
+                v = (v + r) * 0.5f;
+            }
+            d[i * dc] = v;
+            if (dc == 2) {
+                d[i * 2 + 1] = v;
+            }
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            gint32 v = format_conv_read_int(src, i * sc, st);
+
+            if (sc == 2) {
+                gint32 r = format_conv_read_int(src, i * 2 + 1, st);
+                if (dc == 2) {
+                    format_conv_write_int(dest, i * 2, v, dt);
+                    format_conv_write_int(dest, i * 2 + 1, r, dt);
+                    continue;
+                }
+                v = (v + r) / 2;
+            }
+            format_conv_write_int(dest, i * dc, v, dt);
+            if (dc == 2) {
+                format_conv_write_int(dest, i * 2 + 1, v, dt);
+            }
+        }
+    }
+}
+
+#define FORMAT_CONV_FUNC(st, sc, dt, dc)                               \
+    static FORMAT_CONV_VECTORIZE void                                  \
+    format_conv_##st##_##sc##_##dt##_##dc(const void* src,             \
+        void* dest,                                                    \
+        guint32 count)                                                 \
+    {                                                                  \
+        format_conv_generic(src, dest, count,                          \
+            FORMAT_CONV_##st, sc, FORMAT_CONV_##dt, dc);               \
+    }
+
+#define FORMAT_CONV_FUNCS_DEST(st, sc)       \
+    FORMAT_CONV_FUNC(st, sc, S8, 1)          \
+    FORMAT_CONV_FUNC(st, sc, S8, 2)          \
+    FORMAT_CONV_FUNC(st, sc, U8, 1)          \
+    FORMAT_CONV_FUNC(st, sc, U8, 2)          \
+    FORMAT_CONV_FUNC(st, sc, S16, 1)         \
+    FORMAT_CONV_FUNC(st, sc, S16, 2)         \
+    FORMAT_CONV_FUNC(st, sc, U16, 1)         \
+    FORMAT_CONV_FUNC(st, sc, U16, 2)         \
+    FORMAT_CONV_FUNC(st, sc, S16_SWAPPED, 1) \
+    FORMAT_CONV_FUNC(st, sc, S16_SWAPPED, 2) \
+    FORMAT_CONV_FUNC(st, sc, U16_SWAPPED, 1) \
+    FORMAT_CONV_FUNC(st, sc, U16_SWAPPED, 2) \
+    FORMAT_CONV_FUNC(st, sc, FLOAT, 1)       \
+    FORMAT_CONV_FUNC(st, sc, FLOAT, 2)
+
+FORMAT_CONV_FUNCS_DEST(S8, 1)
+FORMAT_CONV_FUNCS_DEST(S8, 2)
+FORMAT_CONV_FUNCS_DEST(S16, 1)
+FORMAT_CONV_FUNCS_DEST(S16, 2)
+FORMAT_CONV_FUNCS_DEST(FLOAT, 1)
+FORMAT_CONV_FUNCS_DEST(FLOAT, 2)
+
+#define FORMAT_CONV_TABLE_DEST(st, sc)                                                           \
+    {                                                                                            \
+        { format_conv_##st##_##sc##_S8_1, format_conv_##st##_##sc##_S8_2 },                      \
+        { format_conv_##st##_##sc##_U8_1, format_conv_##st##_##sc##_U8_2 },                      \
+        { format_conv_##st##_##sc##_S16_1, format_conv_##st##_##sc##_S16_2 },                    \
+        { format_conv_##st##_##sc##_U16_1, format_conv_##st##_##sc##_U16_2 },                    \
+        { format_conv_##st##_##sc##_S16_SWAPPED_1, format_conv_##st##_##sc##_S16_SWAPPED_2 },    \
+        { format_conv_##st##_##sc##_U16_SWAPPED_1, format_conv_##st##_##sc##_U16_SWAPPED_2 },    \
+        { format_conv_##st##_##sc##_FLOAT_1, format_conv_##st##_##sc##_FLOAT_2 }                 \
+    }
+
+/* [source type][source channels - 1][destination type][destination channels - 1] */
+static const format_conv_func format_conv_funcs[3][2][FORMAT_CONV_NUM_TYPES][2] = {
+    { FORMAT_CONV_TABLE_DEST(S8, 1), FORMAT_CONV_TABLE_DEST(S8, 2) },
+    { FORMAT_CONV_TABLE_DEST(S16, 1), FORMAT_CONV_TABLE_DEST(S16, 2) },
+    { FORMAT_CONV_TABLE_DEST(FLOAT, 1), FORMAT_CONV_TABLE_DEST(FLOAT, 2) },
+};
+
+format_conv_func
+format_conv_get(format_conv_type src_type,
+    int src_channels,
+    format_conv_type dest_type,
+    int dest_channels)
+{
+    int s;
+
+    g_assert(src_channels == 1 || src_channels == 2);
+    g_assert(dest_channels == 1 || dest_channels == 2);
+    g_assert(dest_type >= 0 && dest_type < FORMAT_CONV_NUM_TYPES);
+
+    switch (src_type) {
+    case FORMAT_CONV_S8:
+        s = 0;
+        break;
+    case FORMAT_CONV_S16:
+        s = 1;
+        break;
+    case FORMAT_CONV_FLOAT:
+        s = 2;
+        break;
+    default:
+        g_assert_not_reached();
+        return NULL;
+    }
+
+    return format_conv_funcs[s][src_channels - 1][dest_type][dest_channels - 1];
+}
+
+int format_conv_get_size(format_conv_type type)
+{
+    static const int sizes[FORMAT_CONV_NUM_TYPES] = { 1, 1, 2, 2, 2, 2, sizeof(float) };
+
+    return sizes[type];
+}
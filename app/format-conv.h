@@ -0,0 +1,59 @@
+
+/*
+ * The Real SoundTracker - Conversion of the mixer output for the drivers (header)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _FORMAT_CONV_H
+#define _FORMAT_CONV_H
+
+#include <glib.h>
+
+/* Sample types; 16 bit ones are in host order unless SWAPPED, float
+   has full scale at -1.0 ... 1.0 */
+typedef enum format_conv_type {
+    FORMAT_CONV_S8 = 0,
+    FORMAT_CONV_U8,
+    FORMAT_CONV_S16,
+    FORMAT_CONV_U16,
+    FORMAT_CONV_S16_SWAPPED,
+    FORMAT_CONV_U16_SWAPPED,
+    FORMAT_CONV_FLOAT,
+    FORMAT_CONV_NUM_TYPES
+} format_conv_type;
+
+/* Converts count frames from src to dest in a single pass, including
+   the mono / stereo conversion. src may be the same as dest if the
+   frame sizes of both formats are equal. */
+typedef void (*format_conv_func)(const void* src,
+    void* dest,
+    guint32 count);
+
+/* Returns the routine for the given combination. There is one for
+   each of them, specialized and vectorized by the compiler. src_type
+   must be one that a mixer can deliver: S8, S16 or FLOAT. Floats are
+   clipped when converted to integers. */
+format_conv_func format_conv_get(format_conv_type src_type,
+    int src_channels,
+    format_conv_type dest_type,
+    int dest_channels);
+
+/* Size of a single value in bytes */
+int format_conv_get_size(format_conv_type type);
+
+#endif /* _FORMAT_CONV_H */
@@ -30,6 +30,7 @@
 #include "gui-settings.h"
 #include "gui-subs.h"
 #include "gui.h"
+#include "mixer.h"
 #include "preferences.h"
 #include "scope-group.h"
 #include "track-editor.h"
@@ -138,6 +139,21 @@ gui_settings_scopebufsize_changed(GtkSpinButton* spin)
     gui_settings.scopes_buffer_size = n * 1000000;
 }
 
+static void
+gui_settings_lazy_samples_toggled(GtkWidget* widget)
+{
+    /* Takes effect with the next module */
+    gui_settings.lazy_samples = GTK_TOGGLE_BUTTON(widget)->active;
+}
+
+static void
+gui_settings_lazy_cache_changed(GtkSpinButton* spin)
+{
+    gui_settings.lazy_samples_cache = gtk_spin_button_get_value_as_int(spin);
+    st_mixer_sample_set_cache_size((gsize)gui_settings.lazy_samples_cache << 20);
+    st_mixer_sample_evict();
+}
+
 static void
 gui_settings_bh_toggled(GtkWidget* widget)
 {
@@ -473,6 +489,20 @@ void gui_settings_dialog(void)
     g_signal_connect(thing, "value-changed",
         G_CALLBACK(gui_settings_scopebufsize_changed), NULL);
 
+    box1 = gtk_hbox_new(FALSE, 4);
+    gtk_box_pack_start(GTK_BOX(vbox1), box1, FALSE, TRUE, 0);
+
+    thing = gtk_check_button_new_with_label(_("Load samples on demand, keep at most [MB]"));
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(thing), gui_settings.lazy_samples);
+    gtk_box_pack_start(GTK_BOX(box1), thing, FALSE, TRUE, 0);
+    g_signal_connect(thing, "toggled",
+        G_CALLBACK(gui_settings_lazy_samples_toggled), NULL);
+    add_empty_hbox(box1);
+    thing = extspinbutton_new(GTK_ADJUSTMENT(gtk_adjustment_new(gui_settings.lazy_samples_cache, 0, 4096, 1, 16, 0.0)), 0, 0, FALSE);
+    gtk_box_pack_start(GTK_BOX(box1), thing, FALSE, TRUE, 0);
+    g_signal_connect(thing, "value-changed",
+        G_CALLBACK(gui_settings_lazy_cache_changed), NULL);
+
     thing = gtk_hseparator_new();
     gtk_box_pack_start(GTK_BOX(vbox1), thing, FALSE, TRUE, 0);
 
@@ -572,6 +602,9 @@ void gui_settings_load_config(void)
     gui_settings.tracker_update_freq = prefs_get_int(SECTION, "tracker-update-frequency", 50);
     gui_settings.scopes_update_freq = prefs_get_int(SECTION, "scopes-update-frequency", 40);
     gui_settings.scopes_buffer_size = prefs_get_int(SECTION, "scopes-buffer-size", 500000);
+    gui_settings.lazy_samples = prefs_get_bool(SECTION, "lazy-sample-loading", FALSE);
+    gui_settings.lazy_samples_cache = prefs_get_int(SECTION, "lazy-sample-cache-size", 64);
+    st_mixer_sample_set_cache_size((gsize)gui_settings.lazy_samples_cache << 20);
     gui_settings.sharp = prefs_get_bool(SECTION, "sharp", TRUE);
     gui_settings.bh = prefs_get_bool(SECTION, "bh", FALSE);
     gui_settings.store_perm = prefs_get_bool(SECTION, "store-permanent", TRUE);
@@ -638,6 +671,8 @@ void gui_settings_save_config(void)
     prefs_put_int(SECTION, "tracker-update-frequency", gui_settings.tracker_update_freq);
     prefs_put_int(SECTION, "scopes-update-frequency", gui_settings.scopes_update_freq);
     prefs_put_int(SECTION, "scopes-buffer-size", gui_settings.scopes_buffer_size);
+    prefs_put_bool(SECTION, "lazy-sample-loading", gui_settings.lazy_samples);
+    prefs_put_int(SECTION, "lazy-sample-cache-size", gui_settings.lazy_samples_cache);
     prefs_put_bool(SECTION, "sharp", gui_settings.sharp);
     prefs_put_bool(SECTION, "bh", gui_settings.bh);
     prefs_put_bool(SECTION, "store-permanent", gui_settings.store_perm);
@@ -55,6 +55,9 @@ typedef struct gui_prefs {
     int scopes_update_freq;
     int scopes_buffer_size;
 
+    gboolean lazy_samples;
+    int lazy_samples_cache; /* MB */
+
     int st_window_x;
     int st_window_y;
     int st_window_w;
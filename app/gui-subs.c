@@ -24,12 +24,15 @@
 
 #include <gdk/gdkkeysyms.h>
 #include <glib/gi18n.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "extspinbutton.h"
 #include "gui-subs.h"
 #include "gui.h"
 
+static gboolean gui_headless = FALSE;
+
 static const char* status_messages[] = {
     N_("Ready."),
     N_("Playing song..."),
@@ -439,8 +442,58 @@ gui_button(GtkWidget* win, char* stock,
     return button;
 }
 
+void gui_set_headless(gboolean headless)
+{
+    gui_headless = headless;
+}
+
+/* Set for threads whose messages are to be shown later */
+static GPrivate gui_messages_deferred = G_PRIVATE_INIT(NULL);
+
+typedef struct gui_deferred_message {
+    GtkWidget** dialog;
+    gchar* text;
+    GtkMessageType type;
+    const gchar* title;
+    gboolean need_update;
+} gui_deferred_message;
+
+void gui_defer_messages(gboolean defer)
+{
+    g_private_set(&gui_messages_deferred, defer ? GINT_TO_POINTER(1) : NULL);
+}
+
+static gboolean
+gui_deferred_message_show(gpointer data)
+{
+    gui_deferred_message* m = data;
+
+    gui_message_dialog(m->dialog, m->text, m->type, m->title, m->need_update);
+    g_free(m->text);
+    g_free(m);
+
+    return FALSE;
+}
+
 void gui_message_dialog(GtkWidget** dialog, const gchar* text, GtkMessageType type, const gchar* title, gboolean need_update)
 {
+    if (gui_headless) {
+        fprintf(stderr, "%s: %s\n", _(title), text);
+        return;
+    }
+
+    if (g_private_get(&gui_messages_deferred)) {
+        gui_deferred_message* m = g_new(gui_deferred_message, 1);
+
+        m->dialog = dialog;
+        m->text = g_strdup(text);
+        m->type = type;
+        m->title = title;
+        m->need_update = need_update;
+        g_idle_add(gui_deferred_message_show, m);
+        return;
+    }
+
     if (!*dialog) {
         *dialog = gtk_message_dialog_new(GTK_WINDOW(mainwindow), GTK_DIALOG_MODAL, type,
             GTK_BUTTONS_CLOSE, "%s", text);
@@ -459,6 +512,9 @@ gui_ok_cancel_modal(GtkWidget* parent, const gchar* text)
     gint response;
     static GtkWidget* dialog = NULL;
 
+    if (gui_headless)
+        return FALSE;
+
     if (!dialog) {
         dialog = gtk_message_dialog_new(GTK_WINDOW(parent), GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_OK_CANCEL,
             NULL);
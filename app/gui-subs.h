@@ -201,6 +201,13 @@ GtkWidget* gui_button(GtkWidget* win,
 
 gboolean gui_delete_noop(void);
 void gui_set_escape_close(GtkWidget* window);
+/* Without a display (soundtracker --render) messages go to stderr and
+   questions are answered with "Cancel" */
+void gui_set_headless(gboolean headless);
+/* Message dialogs of the calling thread are shown by the GUI thread
+   when it gets to it, for threads that must not touch GTK+ (loading
+   modules in the background) */
+void gui_defer_messages(gboolean defer);
 gboolean gui_ok_cancel_modal(GtkWidget* window, const gchar* text);
 void gui_message_dialog(GtkWidget** dialog, const gchar* text, GtkMessageType type, const gchar* title, gboolean need_update);
 #define gui_warning_dialog(dialog, text, need_update) gui_message_dialog(dialog, text, GTK_MESSAGE_WARNING, N_("Warning"), need_update)
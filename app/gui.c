@@ -22,6 +22,7 @@
 #include <config.h>
 
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -354,45 +355,38 @@ gui_mixer_play_pattern(int pattern,
     int row,
     int stop_after_row)
 {
-    audio_ctlpipe_id i = AUDIO_CTLPIPE_PLAY_PATTERN;
+    audio_ctl_msg msg = { AUDIO_CTL_PLAY_PATTERN };
 
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i) || write(audio_ctlpipe, &pattern, sizeof(pattern)) != sizeof(pattern) || write(audio_ctlpipe, &row, sizeof(row)) != sizeof(row) || write(audio_ctlpipe, &stop_after_row, sizeof(stop_after_row)) != sizeof(stop_after_row)) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.pattern.pattern = pattern;
+    msg.u.pattern.patpos = row;
+    msg.u.pattern.only1row = stop_after_row;
+    audio_ctl_send(&msg);
 }
 
 static void
 gui_mixer_stop_playing(void)
 {
-    audio_ctlpipe_id i = AUDIO_CTLPIPE_STOP_PLAYING;
+    audio_ctl_msg msg = { AUDIO_CTL_STOP_PLAYING };
 
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i)) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    audio_ctl_send(&msg);
 }
 
 static void
 gui_mixer_set_songpos(int songpos)
 {
-    audio_ctlpipe_id i = AUDIO_CTLPIPE_SET_SONGPOS;
+    audio_ctl_msg msg = { AUDIO_CTL_SET_SONGPOS };
 
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i) || write(audio_ctlpipe, &songpos, sizeof(songpos)) != sizeof(songpos)) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.value = songpos;
+    audio_ctl_send(&msg);
 }
 
 static void
 gui_mixer_set_pattern(int pattern)
 {
-    audio_ctlpipe_id i = AUDIO_CTLPIPE_SET_PATTERN;
+    audio_ctl_msg msg = { AUDIO_CTL_SET_PATTERN };
 
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i) || write(audio_ctlpipe, &pattern, sizeof(pattern)) != sizeof(pattern)) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.value = pattern;
+    audio_ctl_send(&msg);
 }
 
 static void
@@ -438,19 +432,14 @@ void gui_save_current(void)
 static void
 save_wav(const gchar* fn, const gchar* path)
 {
-    int l;
-
-    l = strlen(path);
+    audio_ctl_msg msg = { AUDIO_CTL_RENDER_SONG_TO_FILE };
 
     file_selection_save_path(fn, &gui_settings.savemodaswav_path);
-    audio_ctlpipe_id i = AUDIO_CTLPIPE_RENDER_SONG_TO_FILE;
 
     gui_play_stop();
 
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i) || write(audio_ctlpipe, &l, sizeof(l)) != sizeof(l) || write(audio_ctlpipe, path, l + 1) != l + 1) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.filename = g_strdup(path);
+    audio_ctl_send(&msg);
     wait_for_player();
 }
 #endif
@@ -1003,61 +992,47 @@ gui_numchans_changed(GtkSpinButton* spin)
 static void
 gui_tempo_changed(int value)
 {
-    audio_ctlpipe_id i;
+    audio_ctl_msg msg = { AUDIO_CTL_SET_TEMPO };
+
     xm->tempo = value;
     gui_xm_set_modified(1);
     if (gui_playing_mode) {
         event_waiter_start(audio_tempo_ew);
     }
-    i = AUDIO_CTLPIPE_SET_TEMPO;
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i) || write(audio_ctlpipe, &value, sizeof(value)) != sizeof(value)) {
-        static GtkWidget* dialog = NULL;
-
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.value = value;
+    audio_ctl_send(&msg);
 }
 
 static void
 gui_bpm_changed(int value)
 {
-    audio_ctlpipe_id i;
+    audio_ctl_msg msg = { AUDIO_CTL_SET_BPM };
+
     xm->bpm = value;
     gui_xm_set_modified(1);
     if (gui_playing_mode) {
         event_waiter_start(audio_bpm_ew);
     }
-    i = AUDIO_CTLPIPE_SET_BPM;
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i) || write(audio_ctlpipe, &value, sizeof(value)) != sizeof(value)) {
-        static GtkWidget* dialog = NULL;
-
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.value = value;
+    audio_ctl_send(&msg);
 }
 
 static void
 gui_adj_amplification_changed(GtkAdjustment* adj)
 {
-    audio_ctlpipe_id a = AUDIO_CTLPIPE_SET_AMPLIFICATION;
-    float b = 8.0 - adj->value;
-
-    if (write(audio_ctlpipe, &a, sizeof(a)) != sizeof(a) || write(audio_ctlpipe, &b, sizeof(b)) != sizeof(b)) {
-        static GtkWidget* dialog = NULL;
+    audio_ctl_msg msg = { AUDIO_CTL_SET_AMPLIFICATION };
 
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.fvalue = 8.0 - adj->value;
+    audio_ctl_send(&msg);
 }
 
 static void
 gui_adj_pitchbend_changed(GtkAdjustment* adj)
 {
-    audio_ctlpipe_id a = AUDIO_CTLPIPE_SET_PITCHBEND;
-    float b = adj->value;
+    audio_ctl_msg msg = { AUDIO_CTL_SET_PITCHBEND };
 
-    if (write(audio_ctlpipe, &a, sizeof(a)) != sizeof(a) || write(audio_ctlpipe, &b, sizeof(b)) != sizeof(b)) {
-        static GtkWidget* dialog = NULL;
-
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.fvalue = adj->value;
+    audio_ctl_send(&msg);
 }
 
 static void
@@ -1149,111 +1124,90 @@ read_mixer_pipe(gpointer data,
     gint source,
     GdkInputCondition condition)
 {
-    audio_backpipe_id a;
-    struct pollfd pfd = { source, POLLIN, 0 };
-    int x;
+    audio_back_msg msg;
+    audio_back_id a;
 
-    static char* msgbuf = NULL;
-    static int msgbuflen = 0;
-
-loop:
-    if (poll(&pfd, 1, 0) <= 0)
-        return;
-
-    if (read(source, &a, sizeof(a)) != sizeof(a)) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
-    //    printf("read %d\n", a);
+    msg_queue_ack(audio_back_queue);
 
-    switch (a) {
-    case AUDIO_BACKPIPE_PLAYING_STOPPED:
-        statusbar_update(STATUS_IDLE, FALSE);
-        clock_stop(CLOCK(st_clock));
+    while (msg_queue_receive(audio_back_queue, &msg)) {
+        a = msg.id;
 
-        if (gui_ewc_startstop > 0) {
-            /* can be equal to zero when the audio subsystem decides to stop playing on its own. */
-            gui_ewc_startstop--;
-        }
-        gui_playing_mode = 0;
-        scope_group_stop_updating(scopegroup);
-        tracker_stop_updating();
-        sample_editor_stop_updating();
-        gui_enable(1);
-        break;
+        switch (a) {
+        case AUDIO_BACK_PLAYING_STOPPED:
+            statusbar_update(STATUS_IDLE, FALSE);
+            clock_stop(CLOCK(st_clock));
 
-    case AUDIO_BACKPIPE_PLAYING_STARTED:
-        statusbar_update(STATUS_PLAYING_SONG, FALSE);
-        /* fall through */
+            if (gui_ewc_startstop > 0) {
+                /* can be equal to zero when the audio subsystem decides to stop playing on its own. */
+                gui_ewc_startstop--;
+            }
+            gui_playing_mode = 0;
+            scope_group_stop_updating(scopegroup);
+            tracker_stop_updating();
+            sample_editor_stop_updating();
+            gui_enable(1);
+            break;
 
-    case AUDIO_BACKPIPE_PLAYING_PATTERN_STARTED:
-        if (a == AUDIO_BACKPIPE_PLAYING_PATTERN_STARTED)
-            statusbar_update(STATUS_PLAYING_PATTERN, FALSE);
-        clock_set_seconds(CLOCK(st_clock), 0);
-        clock_start(CLOCK(st_clock));
+        case AUDIO_BACK_PLAYING_STARTED:
+            statusbar_update(STATUS_PLAYING_SONG, FALSE);
+            audio_tracer_index_build();
+            /* fall through */
 
-        gui_ewc_startstop--;
-        gui_playing_mode = (a == AUDIO_BACKPIPE_PLAYING_STARTED) ? PLAYING_SONG : PLAYING_PATTERN;
-        if (!ASYNCEDIT) {
-            gtk_toggle_button_set_mode(GTK_TOGGLE_BUTTON(editing_toggle), FALSE);
-        }
-        gui_enable(0);
-        scope_group_start_updating(scopegroup);
-        tracker_start_updating();
-        sample_editor_start_updating();
-        break;
+        case AUDIO_BACK_PLAYING_PATTERN_STARTED:
+            if (a == AUDIO_BACK_PLAYING_PATTERN_STARTED)
+                statusbar_update(STATUS_PLAYING_PATTERN, FALSE);
+            clock_set_seconds(CLOCK(st_clock), 0);
+            clock_start(CLOCK(st_clock));
 
-    case AUDIO_BACKPIPE_PLAYING_NOTE_STARTED:
-        gui_ewc_startstop--;
-        if (!gui_playing_mode) {
-            gui_playing_mode = PLAYING_NOTE;
+            gui_ewc_startstop--;
+            gui_playing_mode = (a == AUDIO_BACK_PLAYING_STARTED) ? PLAYING_SONG : PLAYING_PATTERN;
+            if (!ASYNCEDIT) {
+                gtk_toggle_button_set_mode(GTK_TOGGLE_BUTTON(editing_toggle), FALSE);
+            }
+            gui_enable(0);
             scope_group_start_updating(scopegroup);
             tracker_start_updating();
             sample_editor_start_updating();
-        }
-        break;
+            break;
 
-    case AUDIO_BACKPIPE_DRIVER_OPEN_FAILED:
-        gui_ewc_startstop--;
-        break;
+        case AUDIO_BACK_PLAYING_NOTE_STARTED:
+            gui_ewc_startstop--;
+            if (!gui_playing_mode) {
+                gui_playing_mode = PLAYING_NOTE;
+                scope_group_start_updating(scopegroup);
+                tracker_start_updating();
+                sample_editor_start_updating();
+            }
+            break;
 
-    case AUDIO_BACKPIPE_ERROR_MESSAGE:
-    case AUDIO_BACKPIPE_WARNING_MESSAGE:
-        statusbar_update(STATUS_IDLE, FALSE);
-        readpipe(source, &x, sizeof(x));
-        if (msgbuflen < x + 1) {
-            g_free(msgbuf);
-            msgbuf = g_new(char, x + 1);
-            msgbuflen = x + 1;
-        }
-        readpipe(source, msgbuf, x + 1);
-        if (a == AUDIO_BACKPIPE_ERROR_MESSAGE) {
-            static GtkWidget* dialog = NULL;
-            gui_error_dialog(&dialog, msgbuf, TRUE);
-        } else {
-            static GtkWidget* dialog = NULL;
-            gui_warning_dialog(&dialog, msgbuf, TRUE);
-        }
-        break;
+        case AUDIO_BACK_DRIVER_OPEN_FAILED:
+            gui_ewc_startstop--;
+            break;
 
-    default:
-        fprintf(stderr, "\n\n*** read_mixer_pipe: unexpected backpipe id %d\n\n\n", a);
-        g_assert_not_reached();
-        break;
-    }
+        case AUDIO_BACK_ERROR_MESSAGE:
+        case AUDIO_BACK_WARNING_MESSAGE:
+            statusbar_update(STATUS_IDLE, FALSE);
+            audio_back_show_message(a, msg.text);
+            g_free(msg.text);
+            break;
 
-    goto loop;
+        default:
+            fprintf(stderr, "\n\n*** read_mixer_pipe: unexpected message id %d\n\n\n", a);
+            g_assert_not_reached();
+            break;
+        }
+    }
 }
 
 static void
 wait_for_player(void)
 {
-    struct pollfd pfd = { audio_backpipe, POLLIN, 0 };
+    struct pollfd pfd = { msg_queue_get_fd(audio_back_queue), POLLIN, 0 };
 
     gui_ewc_startstop++;
     while (gui_ewc_startstop != 0) {
         g_return_if_fail(poll(&pfd, 1, -1) > 0);
-        read_mixer_pipe(NULL, audio_backpipe, 0);
+        read_mixer_pipe(NULL, pfd.fd, 0);
     }
 }
 
@@ -1261,16 +1215,15 @@ void play_song(void)
 {
     int sp = playlist_get_position(playlist);
     int pp = 0;
-    audio_ctlpipe_id i = AUDIO_CTLPIPE_PLAY_SONG;
+    audio_ctl_msg msg = { AUDIO_CTL_PLAY_SONG };
 
     g_assert(xm != NULL);
 
     gui_play_stop();
 
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i) || write(audio_ctlpipe, &sp, sizeof(sp)) != sizeof(sp) || write(audio_ctlpipe, &pp, sizeof(pp)) != sizeof(pp)) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.song.songpos = sp;
+    msg.u.song.patpos = pp;
+    audio_ctl_send(&msg);
     wait_for_player();
 }
 
@@ -1298,14 +1251,11 @@ void gui_play_stop(void)
 
 void gui_init_xm(int new_xm, gboolean updatechspin, gboolean is_modified)
 {
-    audio_ctlpipe_id i;
+    audio_ctl_msg msg = { AUDIO_CTL_INIT_PLAYER };
 
-    i = AUDIO_CTLPIPE_INIT_PLAYER;
-    if (write(audio_ctlpipe, &i, sizeof(i)) != sizeof(i)) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    audio_ctl_send(&msg);
     tracker_reset(tracker);
+    audio_tracer_index_reset();
     if (new_xm) {
         gui_playlist_initialize();
         editing_pat = -1;
@@ -1331,12 +1281,14 @@ void gui_init_xm(int new_xm, gboolean updatechspin, gboolean is_modified)
 
 void gui_free_xm(void)
 {
+    gui_cancel_loading();
     gui_play_stop();
     instrument_editor_set_instrument(NULL, 0);
     sample_editor_set_sample(NULL);
     tracker_set_pattern(tracker, NULL);
     XM_Free(xm);
     xm = NULL;
+    audio_tracer_index_reset();
 }
 
 void gui_new_xm(void)
@@ -1350,30 +1302,230 @@ void gui_new_xm(void)
     gui_init_xm(1, TRUE, FALSE);
 }
 
+/* --- Loading modules in the background --- */
+
+/* The progress dialog only shows up if loading takes longer (ms) */
+#define GUI_LOADER_DIALOG_DELAY 300
+#define GUI_LOADER_UPDATE_INTERVAL 100
+
+typedef struct gui_loader {
+    gchar* filename; /* UTF-8, for the title */
+    gchar* localname; /* in the file system's encoding */
+    XMLoadControl ctl;
+    XM* xm; /* the result */
+    gboolean discarded; /* the changes to the current module have been given up for this one */
+} gui_loader;
+
+/* The loader whose module is going to replace the current one. Loaders
+   that have been cancelled go on until they notice it and are cleaned
+   up then. */
+static gui_loader* gui_current_loader = NULL;
+static GtkWidget *gui_loader_dialog = NULL, *gui_loader_progress;
+static guint gui_loader_timer = 0, gui_loader_ticks;
+
+static void
+gui_loader_free(gui_loader* l)
+{
+    g_free(l->filename);
+    g_free(l->localname);
+    g_free(l);
+}
+
 static void
-gui_load_xm(const char* filename, const char* localname)
+gui_loader_stop_feedback(void)
 {
-    gchar* newname;
-    statusbar_update(STATUS_LOADING_MODULE, TRUE);
-
-    gui_free_xm();
-    if (localname)
-        xm = File_Load(localname);
-    else {
-        newname = gui_filename_from_utf8(filename);
-        if (newname) {
-            xm = File_Load(newname);
-            g_free(newname);
-        }
+    if (gui_loader_timer) {
+        g_source_remove(gui_loader_timer);
+        gui_loader_timer = 0;
+    }
+    if (gui_loader_dialog) {
+        gtk_widget_hide(gui_loader_dialog);
     }
 
-    if (!xm) {
-        gui_new_xm();
+    switch (gui_playing_mode) {
+    case PLAYING_SONG:
+        statusbar_update(STATUS_PLAYING_SONG, FALSE);
+        break;
+    case PLAYING_PATTERN:
+        statusbar_update(STATUS_PLAYING_PATTERN, FALSE);
+        break;
+    default:
         statusbar_update(STATUS_IDLE, FALSE);
+        break;
+    }
+}
+
+/* The current module is marked as modified again if it was before */
+static void
+gui_loader_cancel(void)
+{
+    if (gui_current_loader) {
+        g_atomic_int_set(&gui_current_loader->ctl.cancel, TRUE);
+        if (gui_current_loader->discarded) {
+            xm_set_modified(1);
+            gui_update_title(NULL);
+        }
+        gui_current_loader = NULL;
+    }
+}
+
+void gui_cancel_loading(void)
+{
+    if (gui_current_loader) {
+        gui_loader_cancel();
+        gui_loader_stop_feedback();
+    }
+}
+
+static void
+gui_loader_response(GtkWidget* dialog,
+    gint response)
+{
+    gui_loader_cancel();
+    gui_loader_stop_feedback();
+}
+
+static gboolean
+gui_loader_update(gpointer data)
+{
+    gint progress;
+
+    if (!gui_current_loader) {
+        gui_loader_timer = 0;
+        return FALSE;
+    }
+
+    if (++gui_loader_ticks * GUI_LOADER_UPDATE_INTERVAL < GUI_LOADER_DIALOG_DELAY) {
+        return TRUE;
+    }
+
+    if (!gui_loader_dialog) {
+        GtkWidget* vbox;
+
+        gui_loader_dialog = gtk_dialog_new_with_buttons(_("Loading module"), GTK_WINDOW(mainwindow), 0,
+            GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, NULL);
+        gui_dialog_connect(gui_loader_dialog, G_CALLBACK(gui_loader_response));
+        gui_dialog_adjust(gui_loader_dialog, GTK_RESPONSE_CANCEL);
+        vbox = gtk_dialog_get_content_area(GTK_DIALOG(gui_loader_dialog));
+
+        gui_loader_progress = gtk_progress_bar_new();
+        gtk_widget_set_size_request(gui_loader_progress, 300, -1);
+        gtk_box_pack_start(GTK_BOX(vbox), gui_loader_progress, FALSE, TRUE, 4);
+        gtk_widget_show_all(vbox);
+    }
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(gui_loader_progress), gui_current_loader->filename);
+
+    /* Nothing is known while an archive is being unpacked */
+    progress = g_atomic_int_get(&gui_current_loader->ctl.progress);
+    if (progress < 0) {
+        gtk_progress_bar_pulse(GTK_PROGRESS_BAR(gui_loader_progress));
     } else {
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(gui_loader_progress), progress / 1000.0);
+    }
+    gtk_window_present(GTK_WINDOW(gui_loader_dialog));
+
+    return TRUE;
+}
+
+/* Swaps the new module in, in the GUI thread */
+static gboolean
+gui_loader_finished(gpointer data)
+{
+    gui_loader* l = data;
+
+    if (l != gui_current_loader) {
+        /* Cancelled, or another module was chosen meanwhile */
+        XM_Free(l->xm);
+        gui_loader_free(l);
+        return FALSE;
+    }
+
+    gui_current_loader = NULL;
+    gui_loader_stop_feedback();
+
+    /* The modified flag has been cleared when loading started, so it
+       tells about changes made meanwhile */
+    if (l->xm && xm_get_modified()
+        && (!gui_ok_cancel_modal(mainwindow,
+                _("The current module has been changed while the new one was being loaded.\n"
+                  "Do you want to discard these changes?"))
+            || gui_current_loader)) {
+        /* Kept, or another module has been chosen in the meantime */
+        XM_Free(l->xm);
+        l->xm = NULL;
+    } else if (!l->xm && l->discarded) {
+        xm_set_modified(1);
+        gui_update_title(NULL);
+    }
+
+    /* The current module stays if the new one couldn't be loaded */
+    if (l->xm) {
+        XM_Publish(l->xm);
+        gui_free_xm();
+        xm = l->xm;
         gui_init_xm(1, TRUE, FALSE);
         statusbar_update(STATUS_MODULE_LOADED, FALSE);
-        gui_update_title(filename);
+        gui_update_title(l->filename);
+    }
+    gui_loader_free(l);
+
+    return FALSE;
+}
+
+static void*
+gui_loader_thread(void* data)
+{
+    gui_loader* l = data;
+
+    gui_defer_messages(TRUE);
+    l->xm = File_Load_Controlled(l->localname, &l->ctl);
+    g_idle_add(gui_loader_finished, l);
+
+    return NULL;
+}
+
+/* The module is loaded by a thread of its own and replaces the current
+   one only when it is complete; until then the old one can be played
+   and edited */
+static void
+gui_load_xm(const char* filename, const char* localname)
+{
+    gui_loader* l;
+    pthread_t thread;
+
+    l = g_new0(gui_loader, 1);
+    l->filename = g_strdup(filename);
+    l->localname = localname ? g_strdup(localname) : gui_filename_from_utf8(filename);
+    if (!l->localname) {
+        gui_loader_free(l);
+        return;
+    }
+
+    /* A module that is still being loaded isn't wanted any more */
+    gui_loader_cancel();
+
+    if (pthread_create(&thread, NULL, gui_loader_thread, l)) {
+        static GtkWidget* dialog = NULL;
+
+        gui_error_dialog(&dialog, _("Can't start the loader thread"), FALSE);
+        gui_loader_free(l);
+        gui_loader_stop_feedback();
+        return;
+    }
+    pthread_detach(thread);
+    gui_current_loader = l;
+
+    /* load_xm() has asked before giving up the changes. Changes made
+       from now on are checked for in gui_loader_finished(), which
+       only runs in this thread later on. */
+    if ((l->discarded = xm_get_modified())) {
+        gui_xm_set_modified(0);
+    }
+
+    statusbar_update(STATUS_LOADING_MODULE, FALSE);
+    gui_loader_ticks = 0;
+    if (!gui_loader_timer) {
+        gui_loader_timer = g_timeout_add(GUI_LOADER_UPDATE_INTERVAL, gui_loader_update, NULL);
     }
 }
 
@@ -1382,12 +1534,14 @@ void gui_play_note(int channel,
     gboolean all)
 {
     int instrument = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(curins_spin));
-    audio_ctlpipe_id a = AUDIO_CTLPIPE_PLAY_NOTE;
-
-    if (write(audio_ctlpipe, &a, sizeof(a)) != sizeof(a) || write(audio_ctlpipe, &channel, sizeof(channel)) != sizeof(channel) || write(audio_ctlpipe, &note, sizeof(note)) != sizeof(note) || write(audio_ctlpipe, &instrument, sizeof(instrument)) != sizeof(instrument) || write(audio_ctlpipe, &all, sizeof(all)) != sizeof(all)) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    audio_ctl_msg msg = { AUDIO_CTL_PLAY_NOTE };
+
+    msg.u.note.channel = channel;
+    msg.u.note.note = note;
+    msg.u.note.instrument = instrument;
+    msg.u.note.all = all;
+    msg.u.note.time = audio_get_time();
+    audio_ctl_send(&msg);
     gui_ewc_startstop++;
 }
 
@@ -1397,32 +1551,25 @@ void gui_play_note_full(unsigned channel,
     guint32 offset,
     guint32 count)
 {
-    int x;
-    gboolean result;
-    audio_ctlpipe_id a = AUDIO_CTLPIPE_PLAY_NOTE_FULL;
-
-    g_assert(sizeof(int) == sizeof(unsigned));
+    audio_ctl_msg msg = { AUDIO_CTL_PLAY_NOTE_FULL };
 
-    result = write(audio_ctlpipe, &a, sizeof(a)) != sizeof(a) || write(audio_ctlpipe, &channel, sizeof(channel)) != sizeof(channel) || write(audio_ctlpipe, &note, sizeof(note)) != sizeof(note) || write(audio_ctlpipe, &sample, sizeof(sample)) != sizeof(sample);
-    x = offset;
-    result |= write(audio_ctlpipe, &x, sizeof(x)) != sizeof(x);
-    x = count;
-    result |= write(audio_ctlpipe, &x, sizeof(x)) != sizeof(x);
-    if (result) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.note_full.channel = channel;
+    msg.u.note_full.note = note;
+    msg.u.note_full.sample = sample;
+    msg.u.note_full.offset = offset;
+    msg.u.note_full.count = count;
+    msg.u.note_full.time = audio_get_time();
+    audio_ctl_send(&msg);
     gui_ewc_startstop++;
 }
 
 void gui_play_note_keyoff(int channel)
 {
-    audio_ctlpipe_id a = AUDIO_CTLPIPE_PLAY_NOTE_KEYOFF;
+    audio_ctl_msg msg = { AUDIO_CTL_PLAY_NOTE_KEYOFF };
 
-    if (write(audio_ctlpipe, &a, sizeof(a)) != sizeof(a) || write(audio_ctlpipe, &channel, sizeof(channel)) != sizeof(channel)) {
-        static GtkWidget* dialog = NULL;
-        gui_error_dialog(&dialog, _("Connection with audio thread failed!"), FALSE);
-    }
+    msg.u.note.channel = channel;
+    msg.u.note.time = audio_get_time();
+    audio_ctl_send(&msg);
 }
 
 static void
@@ -1844,6 +1991,19 @@ quit_requested(void)
     return TRUE;
 }
 
+/* How often it is looked whether the cache of the samples loaded on
+   demand has overflowed (ms) */
+#define GUI_EVICT_INTERVAL 1000
+
+static gboolean
+gui_evict_samples(gpointer data)
+{
+    if (st_mixer_sample_evict_pending())
+        st_mixer_sample_evict();
+
+    return TRUE;
+}
+
 static gboolean
 is_sep(GtkTreeModel* model, GtkTreeIter* iter, gpointer data)
 {
@@ -1905,7 +2065,8 @@ int gui_final(int argc,
     static const gchar* xp_f[] = { N_("Extended pattern (*.xp)"), "*.[xX][pP]", NULL };
     static const gchar** xp_formats[] = { xp_f, NULL };
 
-    pipetag = gdk_input_add(audio_backpipe, GDK_INPUT_READ, read_mixer_pipe, NULL);
+    pipetag = gdk_input_add(msg_queue_get_fd(audio_back_queue), GDK_INPUT_READ, read_mixer_pipe, NULL);
+    g_timeout_add(GUI_EVICT_INTERVAL, gui_evict_samples, NULL);
 
     builder = gtk_builder_new();
     if (!gtk_builder_add_from_file(builder, XML_FILE, &error)) {
@@ -2370,14 +2531,15 @@ int gui_final(int argc,
             g_signal_connect_swapped(w, "activate", G_CALLBACK(cb[i].fn), cb[i].data);
     }
 
+    /* A module given on the command line replaces the empty one as soon
+       as it is loaded */
+    gui_new_xm();
     if (argc == 2) {
         gchar* utfname = gui_filename_to_utf8(argv[1]);
         if (utfname) {
             gui_load_xm(utfname, argv[1]);
             g_free(utfname);
         }
-    } else {
-        gui_new_xm();
     }
 
     menubar_init_prefs();
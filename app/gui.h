@@ -104,6 +104,9 @@ void gui_clipping_indicator_update(double songtime);
 void gui_init_xm(int new_xm, gboolean updatechspin, gboolean is_modified);
 void gui_free_xm(void);
 void gui_new_xm(void);
+/* Stops loading a module in the background, so that it doesn't replace
+   the current one */
+void gui_cancel_loading(void);
 
 void gui_direction_clicked(GtkWidget* widget,
     gpointer data);
@@ -134,6 +137,8 @@ static inline void
 gui_xm_set_modified(gboolean is_modified)
 {
     xm_set_modified(is_modified);
+    if (is_modified)
+        audio_tracer_index_reset();
     gui_update_title(NULL);
 }
 #endif /* _GUI_H */
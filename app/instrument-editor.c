@@ -33,6 +33,7 @@
 #include "gui.h"
 #include "instrument-editor.h"
 #include "keys.h"
+#include "main.h"
 #include "module-info.h"
 #include "sample-editor.h"
 #include "st-subs.h"
@@ -178,7 +179,8 @@ instrument_editor_save_instrument(const gchar* fn, gchar* localname)
     g_assert(instr != NULL);
 
     file_selection_save_path(fn, &gui_settings.saveinstr_path);
-    f = fopen(localname, "wb");
+    /* Nothing keeps anyone from saving the instrument over the module */
+    f = xm_release_file(xm, localname) ? fopen(localname, "wb") : NULL;
     g_free(localname);
     if (f) {
         statusbar_update(STATUS_SAVING_INSTRUMENT, TRUE);
@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <glib/gi18n.h>
 #include <signal.h>
@@ -31,12 +32,14 @@
 
 #include "audio.h"
 #include "audioconfig.h"
+#include "bench.h"
 #include "file-operations.h"
 #include "gui-settings.h"
 #include "gui.h"
 #include "keys.h"
 #include "midi-settings.h"
 #include "midi.h"
+#include "render.h"
 #include "tips-dialog.h"
 #include "track-editor.h"
 #include "xm.h"
@@ -45,7 +48,6 @@
 #include <gtk/gtk.h>
 
 XM* xm = NULL;
-int pipea[2], pipeb[2];
 
 static void
 sigsegv_handler(int parameter)
@@ -59,6 +61,36 @@ sigsegv_handler(int parameter)
     }
 }
 
+static void
+main_drop_privileges(void)
+{
+    /* The setresuid() stuff is for gtk+-1.2.10 on Linux. */
+#ifdef HAVE_SETRESUID
+    /* These aren't in the header files, so we prototype them here.
+     */
+    {
+        int setresuid(uid_t ruid, uid_t euid, uid_t suid);
+        int setresgid(gid_t rgid, gid_t egid, gid_t sgid);
+        setresuid(getuid(), getuid(), getuid());
+        setresgid(getgid(), getgid(), getgid());
+    }
+#else
+    seteuid(getuid());
+    setegid(getgid());
+#endif
+}
+
+static void
+main_init_nls(void)
+{
+#if ENABLE_NLS
+    gtk_set_locale();
+    bindtextdomain(PACKAGE, LOCALEDIR);
+    bind_textdomain_codeset(PACKAGE, "UTF-8");
+    textdomain(PACKAGE);
+#endif
+}
+
 int main(int argc,
     char* argv[])
 {
@@ -96,41 +128,44 @@ int main(int argc,
         driver_out_dsound,
 #endif
         mixer_kbfloat,
+        mixer_sinc,
         mixer_integer32;
 
-    if (pipe(pipea) || pipe(pipeb)) {
-        fprintf(stderr, "Crnk. Can't pipe().\n");
-        return 1;
+    mixers = g_list_append(mixers,
+        &mixer_kbfloat);
+    mixers = g_list_append(mixers,
+        &mixer_sinc);
+    mixers = g_list_append(mixers,
+        &mixer_integer32);
+
+    if (argc >= 2 && !strcmp(argv[1], "--render")) {
+        /* Headless rendering: neither audio thread nor display needed */
+        main_drop_privileges();
+        main_init_nls();
+        return render_main(argc, argv);
+    }
+
+    if (argc >= 2 && !strcmp(argv[1], "--bench-mixers")) {
+        main_drop_privileges();
+        main_init_nls();
+        return bench_mixers_main(argc, argv);
     }
 
-    if (!audio_init(pipea[0], pipeb[1])) {
+    if (argc >= 2 && !strcmp(argv[1], "--bench-load")) {
+        main_drop_privileges();
+        main_init_nls();
+        return bench_load_main(argc, argv);
+    }
+
+    if (!audio_init()) {
         fprintf(stderr, "Can't init audio thread.\n");
         return 1;
     }
 
     /* In case we run setuid root, the main thread must not have root
-       privileges -- it must be set back to the calling user ID!  The
-       setresuid() stuff is for gtk+-1.2.10 on Linux. */
-#ifdef HAVE_SETRESUID
-    /* These aren't in the header files, so we prototype them here.
-     */
-    {
-        int setresuid(uid_t ruid, uid_t euid, uid_t suid);
-        int setresgid(gid_t rgid, gid_t egid, gid_t sgid);
-        setresuid(getuid(), getuid(), getuid());
-        setresgid(getgid(), getgid(), getgid());
-    }
-#else
-    seteuid(getuid());
-    setegid(getgid());
-#endif
-
-#if ENABLE_NLS
-    gtk_set_locale();
-    bindtextdomain(PACKAGE, LOCALEDIR);
-    bind_textdomain_codeset(PACKAGE, "UTF-8");
-    textdomain(PACKAGE);
-#endif
+       privileges -- it must be set back to the calling user ID! */
+    main_drop_privileges();
+    main_init_nls();
 
     gtk_init(&argc, &argv);
     prefs_init();
@@ -148,14 +183,6 @@ int main(int argc,
                         "style \"list\" {GtkComboBox::appears-as-list = 1}\n"
                         "widget \"*.keyconfig_combo\" style \"list\"");
 
-    audio_ctlpipe = pipea[1];
-    audio_backpipe = pipeb[0];
-
-    mixers = g_list_append(mixers,
-        &mixer_kbfloat);
-    mixers = g_list_append(mixers,
-        &mixer_integer32);
-
 #if 0
     drivers[DRIVER_OUTPUT] = g_list_append(drivers[DRIVER_OUTPUT],
 					   &driver_out_test);
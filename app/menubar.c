@@ -69,6 +69,8 @@ void about_dialog(void)
 static void
 menubar_clear(gboolean all)
 {
+    /* A module which is still being loaded would replace the cleared one */
+    gui_cancel_loading();
     if (all) {
         gui_free_xm();
         gui_new_xm();
@@ -24,13 +24,61 @@
 
 #include <glib.h>
 
+/* The mixers don't play the st_mixer_sample_info below, which the GUI
+   changes at will, but reference counted snapshots of it. A snapshot is
+   never changed after it has been published; the GUI publishes a new
+   one instead, and the mixers switch over to it at their next mix()
+   call. The sample data is shared by all snapshots having the same
+   data pointer and is freed together with the last of them. Nothing
+   on the mixing side ever blocks or frees memory; deferred data it
+   asks for is loaded by a thread of its own (see
+   st_mixer_sample_prepare()). */
+typedef struct st_mixer_sample_buffer {
+    gint ref_count;
+    guint32 looptype;
+    guint32 length;
+    guint32 loopstart;
+    guint32 loopend;
+    guint32 format;
+    void* data;
+    struct st_mixer_sample_buffer* data_owner; /* snapshot data belongs to, NULL if this one */
+    struct st_mixer_sample_buffer* next; /* in the list of dead snapshots */
+} st_mixer_sample_buffer;
+
+/* Sample data which is only loaded when it is needed for the first
+   time (see st_mixer_sample_load()). The module loader embeds this in
+   its own record, which knows where the data is to be found, and hands
+   it over with st_mixer_sample_defer(). */
+struct st_mixer_sample_info;
+
+typedef struct st_mixer_sample_deferred {
+    /* Puts the data into si->data, in si->format; FALSE if that's impossible */
+    gboolean (*load)(struct st_mixer_sample_info* si);
+    void (*free)(struct st_mixer_sample_deferred* d);
+
+    /* Used by sample-buffer.c for the eviction */
+    struct st_mixer_sample_info* si;
+    gint last_used; /* monotonic time in seconds, set without the lock */
+    gsize size; /* bytes accounted for in the cache */
+    struct st_mixer_sample_deferred *prev, *next; /* in the list of loaded ones */
+
+    /* Used by sample-buffer.c for the loader thread */
+    gint queued; /* waiting for the loader thread, set without the lock */
+    gboolean orphaned; /* the sample has been freed meanwhile */
+    struct st_mixer_sample_info* queue_si;
+    struct st_mixer_sample_deferred* queue_next;
+} st_mixer_sample_deferred;
+
 typedef struct st_mixer_sample_info {
     guint32 looptype; /* see ST_MIXER_SAMPLE_LOOPTYPE_ defines below */
     guint32 length; /* length in samples, not in bytes */
     guint32 loopstart; /* offset in samples, not in bytes */
     guint32 loopend; /* offset to first sample not being played */
-    gint16* data; /* pointer to sample data */
-    GMutex lock;
+    gint16* data; /* pointer to sample data; really gint8* for 8 bit data */
+    guint32 format; /* see ST_MIXER_SAMPLE_FORMAT_ defines below */
+    st_mixer_sample_buffer* buffer; /* last published snapshot, or NULL */
+    gint readers; /* threads inside st_mixer_sample_acquire() */
+    st_mixer_sample_deferred* deferred; /* where data can be (re)loaded from, or NULL */
 } st_mixer_sample_info;
 
 /* values for st_mixer_sample_info.looptype */
@@ -38,80 +86,124 @@ typedef struct st_mixer_sample_info {
 #define ST_MIXER_SAMPLE_LOOPTYPE_AMIGA 1
 #define ST_MIXER_SAMPLE_LOOPTYPE_PINGPONG 2
 
+/* values for st_mixer_sample_info.format. 8 bit values count as if
+   they were multiplied by 256. Code that changes the data gets it as 16
+   bit values from st_mixer_sample_claim(). */
+#define ST_MIXER_SAMPLE_FORMAT_16 0
+#define ST_MIXER_SAMPLE_FORMAT_8 1
+
+static inline gsize
+st_mixer_sample_size(guint32 format,
+    guint32 length)
+{
+    return format == ST_MIXER_SAMPLE_FORMAT_8 ? length : 2 * (gsize)length;
+}
+
 typedef struct st_mixer_channel_status {
     st_mixer_sample_info* current_sample;
     guint32 current_position;
 } st_mixer_channel_status;
 
+struct tracer_channel;
+
+/* All mixer state lives in instances created by new(), so several
+   mixers of the same kind can run in parallel (one per thread). All
+   functions except new() take such an instance as first argument. */
+
 typedef struct st_mixer {
     const char* id;
     const char* description;
 
+    /* create new instance of this mixer */
+    void* (*new)(void);
+
+    /* destroy instance of this mixer */
+    void (*destroy)(void* m);
+
     /* set number of channels to be mixed */
-    void (*setnumch)(int numchannels);
+    void (*setnumch)(void* m, int numchannels);
 
-    /* notify sample update (sample must be locked by caller!) */
-    void (*updatesample)(st_mixer_sample_info* si);
+    /* notify that a new snapshot of the sample has been published; may be
+       called from any thread. The mixer only takes note and switches its
+       channels over at the next mix() call. */
+    void (*updatesample)(void* m, st_mixer_sample_info* si);
 
-    /* set mixer output format -- signed 16 or 8 (in machine endianness) */
-    gboolean (*setmixformat)(int format);
+    /* set mixer output format -- signed 16 or 8 (in machine endianness),
+       or 32 for native floats (full scale is -1.0 ... 1.0, not clipped) */
+    gboolean (*setmixformat)(void* m, int format);
 
     /* toggle stereo mixing -- interleaved left / right samples */
-    gboolean (*setstereo)(int on);
+    gboolean (*setstereo)(void* m, int on);
 
     /* set mixing frequency */
-    void (*setmixfreq)(guint32 frequency);
+    void (*setmixfreq)(void* m, guint32 frequency);
 
     /* set final amplification factor (0.0 = mute ... 1.0 = normal ... +inf = REAL LOUD! :D)*/
-    void (*setampfactor)(float amplification);
+    void (*setampfactor)(void* m, float amplification);
 
     /* returns true if last mix() call had to clip the signal */
-    gboolean (*getclipflag)(void);
+    gboolean (*getclipflag)(void* m);
+
+    /* returns a bit mask of the channels whose scope buffers the last
+       mix() call has filled; mix() leaves the buffers of the silent
+       channels alone */
+    guint32 (*getscopemask)(void* m);
 
     /* reset internal playing state */
-    void (*reset)(void);
+    void (*reset)(void* m);
 
     /* play sample from the beginning, initialize nothing else */
-    void (*startnote)(int channel, st_mixer_sample_info* si);
+    void (*startnote)(void* m, int channel, st_mixer_sample_info* si);
 
     /* stop note */
-    void (*stopnote)(int channel);
+    void (*stopnote)(void* m, int channel);
 
     /* set curent sample play position */
-    void (*setsmplpos)(int channel, guint32 offset);
+    void (*setsmplpos)(void* m, int channel, guint32 offset);
 
     /* set curent sample play end position */
-    void (*setsmplend)(int channel, guint32 offset);
+    void (*setsmplend)(void* m, int channel, guint32 offset);
 
     /* set replay frequency (Hz) */
-    void (*setfreq)(int channel, float frequency);
+    void (*setfreq)(void* m, int channel, float frequency);
 
     /* set sample volume (0.0 ... 1.0) */
-    void (*setvolume)(int channel, float volume);
+    void (*setvolume)(void* m, int channel, float volume);
 
     /* set sample panning (-1.0 ... +1.0) */
-    void (*setpanning)(int channel, float panning);
+    void (*setpanning)(void* m, int channel, float panning);
 
     /* set channel filter cutoff frequency (-1.0 for off, or 0.0 ... +1.0) */
-    void (*setchcutoff)(int channel, float freq);
+    void (*setchcutoff)(void* m, int channel, float freq);
 
     /* set channel filter resonance (0.0 ... +1.0) */
-    void (*setchreso)(int channel, float reso);
+    void (*setchreso)(void* m, int channel, float reso);
 
     /* do the mix, return pointer to end of dest */
-    void* (*mix)(void* dest, guint32 count, gint16* scopebufs[], int scopebuf_offset);
+    void* (*mix)(void* m, void* dest, guint32 count, gint16* scopebufs[], int scopebuf_offset);
 
     /* get status information */
-    void (*dumpstatus)(st_mixer_channel_status array[]);
+    void (*dumpstatus)(void* m, st_mixer_channel_status array[]);
 
     /* load channel settings from tracer */
-    void (*loadchsettings)(int channel);
+    void (*loadchsettings)(void* m, int channel, const struct tracer_channel* tch);
 
     guint32 max_sample_length;
 
     struct st_mixer* next;
 } st_mixer;
 
+/* A mixer instance as driven by the XM player through the driver_*()
+   functions in audio.c, together with the settings applied on the way */
+typedef struct st_mixer_ctx {
+    st_mixer* mixer;
+    void* m; /* instance created by mixer->new() */
+    int numchannels;
+    double pitchbend; /* in percent, 0.0 = none */
+    struct st_mixer_ctx** stems; /* per channel instances the commands go to when
+                                    rendering the channels separately, or NULL */
+} st_mixer_ctx;
+
 typedef enum {
     ST_MIXER_FORMAT_S16_LE = 1,
     ST_MIXER_FORMAT_S16_BE,
@@ -119,10 +211,99 @@ typedef enum {
     ST_MIXER_FORMAT_U16_LE,
     ST_MIXER_FORMAT_U16_BE,
     ST_MIXER_FORMAT_U8,
+    ST_MIXER_FORMAT_FLOAT, /* native endianness, full scale is -1.0 ... 1.0 */
     ST_MIXER_FORMAT_STEREO = 16,
 } STMixerFormat;
 
-static const guint res[] = { 1, 2, 2, 1, 2, 2, 1, 1 }; /* In bytes, first and last ones for safety */
+/* Keeps the calling thread from splitting its mixing over the worker
+   threads of mixers/mix-pool.c, which it would have to wait for. For
+   real-time threads; call it once from the thread itself. */
+void st_mixer_forbid_parallel(void);
+
+/* Returns a new reference to the current snapshot of si, or NULL if
+   there is none. Any thread; never blocks. */
+st_mixer_sample_buffer* st_mixer_sample_acquire(st_mixer_sample_info* si);
+
+/* Drops a reference (b may be NULL). Any thread; a snapshot that is no
+   longer used is only queued here and freed by the GUI thread later. */
+void st_mixer_sample_buffer_unref(st_mixer_sample_buffer* b);
+
+/* Publishes the current state of si as its new snapshot. The sample
+   data is owned by the snapshots from now on: if si->data is replaced
+   later, the old array must be released by st_mixer_sample_free_data()
+   instead of free(). Only the sample values may still be changed in
+   place. GUI thread only; a module loaded by another thread is
+   published when the GUI takes it over. The functions below free the
+   snapshots dropped meanwhile, which is also left to the GUI thread. */
+void st_mixer_sample_publish(st_mixer_sample_info* si);
+
+/* Releases si->data; it is freed right away unless it is in use by a
+   snapshot. GUI thread only, or the thread loading a module which
+   hasn't been published yet. */
+void st_mixer_sample_free_data(st_mixer_sample_info* si);
+
+/* Withdraws the snapshot and releases the data of a sample that is
+   cleared or freed; si->buffer and si->data are NULL afterwards. GUI
+   thread only, or the thread loading a module which hasn't been
+   published yet. */
+void st_mixer_sample_retire(st_mixer_sample_info* si);
+
+/* Deferred sample data. A sample with si->deferred set and no data is
+   loaded and published when it's needed. The mixing side doesn't wait
+   for that: st_mixer_sample_prepare() hands the sample over to the
+   loader thread, and the note is left out if the data isn't there yet.
+   The player asks for the samples of the next rows in advance, so this
+   only happens when a sample is needed right after it has been
+   evicted, or at the very start. Data which has been loaded this way
+   may be dropped again by st_mixer_sample_evict() while it isn't
+   played. Publishing new data for the sample turns it into an ordinary
+   one. */
+
+/* Makes d the deferred data of si, which has none yet. The thread
+   loading the module; starts the loader thread the first time. */
+void st_mixer_sample_defer(st_mixer_sample_info* si,
+    st_mixer_sample_deferred* d);
+
+/* Loads the data if it is deferred and not there, and waits for it.
+   Any thread but a mixing one; FALSE if loading failed. */
+gboolean st_mixer_sample_load(st_mixer_sample_info* si);
+
+/* TRUE if the data is there for a note to be started. Otherwise asks
+   the loader thread for it and returns FALSE, unless the calling thread
+   may wait (see st_mixer_sample_allow_waiting()); then it's the same as
+   st_mixer_sample_load(). Any thread; doesn't block by default. */
+gboolean st_mixer_sample_prepare(st_mixer_sample_info* si);
+
+/* Asks the loader thread for the data if it isn't there, and keeps it
+   from being evicted soon if it is. Any thread; never blocks. */
+void st_mixer_sample_prefetch(st_mixer_sample_info* si);
+
+/* Lets st_mixer_sample_prepare() wait for the data in the calling
+   thread. For threads which don't play in real time, like rendering to
+   a file; their notes must not go missing. */
+void st_mixer_sample_allow_waiting(gboolean allow);
+
+/* Loads the data for good, in the format it has; it won't be evicted
+   after this. GUI thread only. */
+gboolean st_mixer_sample_detach(st_mixer_sample_info* si);
+
+/* Like st_mixer_sample_detach(), and 8 bit data is widened to 16 bit;
+   for code that changes si->data. GUI thread only. */
+gboolean st_mixer_sample_claim(st_mixer_sample_info* si);
+
+/* Size of the loaded deferred data above which the least recently used
+   samples are dropped, 0 for no limit */
+void st_mixer_sample_set_cache_size(gsize bytes);
+
+/* Drops loaded deferred data which is not in use, until the cache size
+   is kept. GUI thread only. */
+void st_mixer_sample_evict(void);
+
+/* TRUE if the cache has overflowed since the last
+   st_mixer_sample_evict(). The GUI thread polls this; any thread. */
+gboolean st_mixer_sample_evict_pending(void);
+
+static const guint res[] = { 1, 2, 2, 1, 2, 2, 1, 4 }; /* In bytes, the first one for safety */
 
 static inline guint
 mixer_get_resolution(STMixerFormat f)
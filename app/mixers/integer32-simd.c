@@ -0,0 +1,705 @@
+
+/*
+ * The Real SoundTracker - Vectorized routines for the integer32 mixer
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* These are the counterparts of the i386 routines in integer32-asm.S
+   for x86-64 (SSE2) and ARM (NEON). The results are identical to the
+   plain C loops in integer32.c, which remain the reference.
+
+   The sample data are fetched one by one (the positions aren't
+   contiguous), the multiplications, the shifts and the stores are done
+   for 8 (SSE2) or 4 (NEON) output samples at once. 8 bit sample data
+   is scaled up to 16 bit while it is fetched, the rest is the same.
+   Since the product of a 16 bit sample and the volume factor always
+   fits into 32 bits, the volume factors are premultiplied and applied
+   with 16x16->32 bit multiplications. If they don't fit into 16 bits
+   (which doesn't happen with the normal volume range), the plain C
+   loops are used.
+
+   The final clamping divides each mixed value by a constant; here the
+   division is replaced by a multiplication with a precomputed
+   reciprocal, which gives exactly the same quotient (see
+   integer32_simd_divisor()). */
+
+#include <config.h>
+
+#include "integer32-simd.h"
+
+#ifdef MIX_SIMD
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#else
+#include <arm_neon.h>
+#endif
+
+#define ACCURACY 12 /* must be the same as in integer32.c */
+
+#define COEF_OK(c) ((c) <= G_MAXINT16)
+
+/* The sample value at position j. 8 bit data counts as multiplied by
+   256 (see ST_MIXER_SAMPLE_FORMAT_8); bits is a constant wherever this
+   is inlined, so there is no test in the loops. */
+static inline int
+integer32_fetch(const void* data, gint32 j, const int bits)
+{
+    if (bits == 8) {
+        return ((const gint8*)data)[j >> ACCURACY] * 256;
+    }
+
+    return ((const gint16*)data)[j >> ACCURACY];
+}
+
+/* Plain C fallbacks, copies of the reference loops in integer32.c */
+
+static inline gint32
+integer32_stereo_scopes_c(gint32 j, gint32 s, const void* data, const int bits,
+    gint32* m, gint16* scopedata, int v, int vl, int vr, guint32 done)
+{
+    int val;
+
+    for (; done; done--, j += s) {
+        val = v * integer32_fetch(data, j, bits);
+        *m++ += vl * val >> 6;
+        *m++ += vr * val >> 6;
+        *scopedata++ = val >> 6;
+    }
+
+    return j;
+}
+
+static inline gint32
+integer32_mono_scopes_c(gint32 j, gint32 s, const void* data, const int bits,
+    gint32* m, gint16* scopedata, int v, guint32 done)
+{
+    int val;
+
+    for (; done; done--, j += s) {
+        val = v * integer32_fetch(data, j, bits);
+        *m++ += val;
+        *scopedata++ = val >> 6;
+    }
+
+    return j;
+}
+
+static inline gint32
+integer32_stereo_c(gint32 j, gint32 s, const void* data, const int bits,
+    gint32* m, int vl, int vr, guint32 done)
+{
+    int val;
+
+    for (; done; done--, j += s) {
+        val = integer32_fetch(data, j, bits);
+        *m++ += vl * val >> 6;
+        *m++ += vr * val >> 6;
+    }
+
+    return j;
+}
+
+static inline gint32
+integer32_mono_c(gint32 j, gint32 s, const void* data, const int bits,
+    gint32* m, int v, guint32 done)
+{
+    for (; done; done--, j += s) {
+        *m++ += v * integer32_fetch(data, j, bits);
+    }
+
+    return j;
+}
+
+/* Division of 0 <= n < 2^31 by div is replaced by (n * mul) >> shift
+   (Granlund / Montgomery, "Division by invariant integers using
+   multiplication", theorem 4.2). mul fits into 32 bits. */
+static void
+integer32_simd_divisor(guint32 div,
+    guint32* mul,
+    int* shift)
+{
+    int l = 0;
+
+    while ((1U << l) < div) {
+        l++;
+    }
+    *shift = 31 + l;
+    *mul = (((guint64)1 << *shift) + div - 1) / div;
+}
+
+/* Mixed values outside [lo, hi] are clipped; all values inside give
+   quotients within the 16 bit range. The limits don't overflow for
+   div <= G_MAXUINT16 - 1. */
+#define CLAMP_HI(div) (32768 * (div) - 1)
+#define CLAMP_LO(div) (-32769 * (div) + 1)
+
+static gboolean
+integer32_clamp_16_c(const gint32* mixed, gint16* dest, guint32 count,
+    gint32 amp, gint32 div)
+{
+    gboolean clipped = FALSE;
+
+    for (; count; count--) {
+        gint32 a, b;
+
+        a = (guint32)*mixed++ * amp; /* wraps around like in integer32.c */
+        a /= div;
+
+        b = CLAMP(a, -32768, 32767);
+        if (a != b) {
+            clipped = TRUE;
+        }
+
+        *dest++ = b;
+    }
+
+    return clipped;
+}
+
+#if defined(__x86_64__)
+
+/* --- SSE2 --- */
+
+static inline __m128i
+integer32_sse2_gather8(const void* data, gint32* pos, gint32 inc, const int bits)
+{
+    gint32 p = *pos;
+    gint16 s0, s1, s2, s3, s4, s5, s6, s7;
+
+    s0 = integer32_fetch(data, p, bits);
+    p += inc;
+    s1 = integer32_fetch(data, p, bits);
+    p += inc;
+    s2 = integer32_fetch(data, p, bits);
+    p += inc;
+    s3 = integer32_fetch(data, p, bits);
+    p += inc;
+    s4 = integer32_fetch(data, p, bits);
+    p += inc;
+    s5 = integer32_fetch(data, p, bits);
+    p += inc;
+    s6 = integer32_fetch(data, p, bits);
+    p += inc;
+    s7 = integer32_fetch(data, p, bits);
+    p += inc;
+    *pos = p;
+
+    return _mm_set_epi16(s7, s6, s5, s4, s3, s2, s1, s0);
+}
+
+static inline void
+integer32_sse2_add(gint32* m, __m128i v)
+{
+    _mm_storeu_si128((__m128i*)m, _mm_add_epi32(_mm_loadu_si128((__m128i*)m), v));
+}
+
+/* Full 32 bit products of 8 16 bit values */
+#define MUL_LO(a, b) _mm_unpacklo_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epi16(a, b))
+#define MUL_HI(a, b) _mm_unpackhi_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epi16(a, b))
+
+/* m[0..15] += (s[k] * vl) >> 6, (s[k] * vr) >> 6 interleaved */
+static inline void
+integer32_sse2_stereo8(gint32* m, __m128i s, __m128i lr)
+{
+    const __m128i a = _mm_unpacklo_epi16(s, s);
+    const __m128i b = _mm_unpackhi_epi16(s, s);
+
+    integer32_sse2_add(m, _mm_srai_epi32(MUL_LO(a, lr), 6));
+    integer32_sse2_add(m + 4, _mm_srai_epi32(MUL_HI(a, lr), 6));
+    integer32_sse2_add(m + 8, _mm_srai_epi32(MUL_LO(b, lr), 6));
+    integer32_sse2_add(m + 12, _mm_srai_epi32(MUL_HI(b, lr), 6));
+}
+
+/* Store the low 16 bits of 8 32 bit values, like a C cast does */
+static inline void
+integer32_sse2_store_trunc(gint16* d, __m128i a, __m128i b)
+{
+    a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    _mm_storeu_si128((__m128i*)d, _mm_packs_epi32(a, b));
+}
+
+static inline gint32
+integer32_sse2_stereo_scopes(gint32 current, gint32 increment,
+    const void* data, const int bits, gint32* mixed, gint16* scopedata,
+    guint32 volume, guint32 leftvol, guint32 rightvol, guint32 count)
+{
+    __m128i lr, v;
+
+    if (!COEF_OK(volume) || !COEF_OK(volume * leftvol) || !COEF_OK(volume * rightvol)) {
+        return integer32_stereo_scopes_c(current, increment, data, bits, mixed,
+            scopedata, volume, leftvol, rightvol, count);
+    }
+
+    /* vl * (v * s) == (vl * v) * s, no overflows in this range */
+    lr = _mm_set1_epi32((volume * rightvol) << 16 | (volume * leftvol));
+    v = _mm_set1_epi16(volume);
+
+    for (; count >= 8; count -= 8) {
+        const __m128i s = integer32_sse2_gather8(data, &current, increment, bits);
+
+        integer32_sse2_stereo8(mixed, s, lr);
+        integer32_sse2_store_trunc(scopedata,
+            _mm_srai_epi32(MUL_LO(s, v), 6), _mm_srai_epi32(MUL_HI(s, v), 6));
+        mixed += 16;
+        scopedata += 8;
+    }
+
+    return integer32_stereo_scopes_c(current, increment, data, bits, mixed,
+        scopedata, volume, leftvol, rightvol, count);
+}
+
+static inline gint32
+integer32_sse2_mono_scopes(gint32 current, gint32 increment,
+    const void* data, const int bits, gint32* mixed, gint16* scopedata,
+    guint32 volume, guint32 count)
+{
+    __m128i v;
+
+    if (!COEF_OK(volume)) {
+        return integer32_mono_scopes_c(current, increment, data, bits, mixed,
+            scopedata, volume, count);
+    }
+
+    v = _mm_set1_epi16(volume);
+
+    for (; count >= 8; count -= 8) {
+        const __m128i s = integer32_sse2_gather8(data, &current, increment, bits);
+        const __m128i lo = MUL_LO(s, v);
+        const __m128i hi = MUL_HI(s, v);
+
+        integer32_sse2_add(mixed, lo);
+        integer32_sse2_add(mixed + 4, hi);
+        integer32_sse2_store_trunc(scopedata, _mm_srai_epi32(lo, 6), _mm_srai_epi32(hi, 6));
+        mixed += 8;
+        scopedata += 8;
+    }
+
+    return integer32_mono_scopes_c(current, increment, data, bits, mixed,
+        scopedata, volume, count);
+}
+
+static inline gint32
+integer32_sse2_stereo(gint32 current, gint32 increment,
+    const void* data, const int bits, gint32* mixed,
+    guint32 leftvol, guint32 rightvol, guint32 count)
+{
+    __m128i lr;
+
+    if (!COEF_OK(leftvol) || !COEF_OK(rightvol)) {
+        return integer32_stereo_c(current, increment, data, bits, mixed,
+            leftvol, rightvol, count);
+    }
+
+    lr = _mm_set1_epi32(rightvol << 16 | leftvol);
+
+    for (; count >= 8; count -= 8) {
+        integer32_sse2_stereo8(mixed, integer32_sse2_gather8(data, &current, increment, bits), lr);
+        mixed += 16;
+    }
+
+    return integer32_stereo_c(current, increment, data, bits, mixed,
+        leftvol, rightvol, count);
+}
+
+static inline gint32
+integer32_sse2_mono(gint32 current, gint32 increment,
+    const void* data, const int bits, gint32* mixed,
+    guint32 volume, guint32 count)
+{
+    __m128i v;
+
+    if (!COEF_OK(volume)) {
+        return integer32_mono_c(current, increment, data, bits, mixed, volume, count);
+    }
+
+    v = _mm_set1_epi16(volume);
+
+    for (; count >= 8; count -= 8) {
+        const __m128i s = integer32_sse2_gather8(data, &current, increment, bits);
+
+        integer32_sse2_add(mixed, MUL_LO(s, v));
+        integer32_sse2_add(mixed + 4, MUL_HI(s, v));
+        mixed += 8;
+    }
+
+    return integer32_mono_c(current, increment, data, bits, mixed, volume, count);
+}
+
+#define integer32_simd_stereo_scopes integer32_sse2_stereo_scopes
+#define integer32_simd_mono_scopes integer32_sse2_mono_scopes
+#define integer32_simd_stereo integer32_sse2_stereo
+#define integer32_simd_mono integer32_sse2_mono
+
+/* Low 32 bits of 32x32 bit products; SSE2 has no pmulld */
+static inline __m128i
+integer32_sse2_mullo32(__m128i a, __m128i b)
+{
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+        _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i
+integer32_sse2_clamp4(__m128i a, __m128i vamp, __m128i lo, __m128i hi,
+    __m128i mul, __m128i shift, __m128i* clip)
+{
+    __m128i gt, lt, sign, q;
+
+    a = integer32_sse2_mullo32(a, vamp);
+
+    gt = _mm_cmpgt_epi32(a, hi);
+    lt = _mm_cmplt_epi32(a, lo);
+    *clip = _mm_or_si128(*clip, _mm_or_si128(gt, lt));
+    a = _mm_or_si128(_mm_andnot_si128(gt, a), _mm_and_si128(gt, hi));
+    a = _mm_or_si128(_mm_andnot_si128(lt, a), _mm_and_si128(lt, lo));
+
+    /* Division of the absolute values, the quotient is truncated
+       towards zero like in C */
+    sign = _mm_srai_epi32(a, 31);
+    a = _mm_sub_epi32(_mm_xor_si128(a, sign), sign);
+    q = _mm_or_si128(_mm_srl_epi64(_mm_mul_epu32(a, mul), shift),
+        _mm_slli_epi64(_mm_srl_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), mul), shift), 32));
+
+    return _mm_sub_epi32(_mm_xor_si128(q, sign), sign);
+}
+
+gboolean
+mixersimd_clamp_16(const gint32* mixed,
+    gint16* dest,
+    guint32 count,
+    gint32 amp,
+    gint32 div)
+{
+    __m128i vamp, lo, hi, mul, shift, clip;
+    guint32 m;
+    int sh;
+
+    if (div < 1 || div >= G_MAXUINT16) {
+        return integer32_clamp_16_c(mixed, dest, count, amp, div);
+    }
+
+    integer32_simd_divisor(div, &m, &sh);
+    vamp = _mm_set1_epi32(amp);
+    lo = _mm_set1_epi32(CLAMP_LO(div));
+    hi = _mm_set1_epi32(CLAMP_HI(div));
+    mul = _mm_set1_epi32(m);
+    shift = _mm_cvtsi32_si128(sh);
+    clip = _mm_setzero_si128();
+
+    for (; count >= 8; count -= 8) {
+        const __m128i a = integer32_sse2_clamp4(_mm_loadu_si128((const __m128i*)mixed),
+            vamp, lo, hi, mul, shift, &clip);
+        const __m128i b = integer32_sse2_clamp4(_mm_loadu_si128((const __m128i*)(mixed + 4)),
+            vamp, lo, hi, mul, shift, &clip);
+
+        _mm_storeu_si128((__m128i*)dest, _mm_packs_epi32(a, b));
+        mixed += 8;
+        dest += 8;
+    }
+
+    return integer32_clamp_16_c(mixed, dest, count, amp, div)
+        || _mm_movemask_epi8(clip) != 0;
+}
+
+#else /* NEON */
+
+static inline int16x4_t
+integer32_neon_gather4(const void* data, gint32* pos, gint32 inc, const int bits)
+{
+    gint32 p = *pos;
+    int16x4_t s = vdup_n_s16(0);
+
+    s = vset_lane_s16(integer32_fetch(data, p, bits), s, 0);
+    p += inc;
+    s = vset_lane_s16(integer32_fetch(data, p, bits), s, 1);
+    p += inc;
+    s = vset_lane_s16(integer32_fetch(data, p, bits), s, 2);
+    p += inc;
+    s = vset_lane_s16(integer32_fetch(data, p, bits), s, 3);
+    p += inc;
+    *pos = p;
+
+    return s;
+}
+
+/* m[0..7] += (s[k] * vl) >> 6, (s[k] * vr) >> 6 interleaved */
+static inline void
+integer32_neon_stereo4(gint32* m, int16x4_t s, gint16 vl, gint16 vr)
+{
+    int32x4x2_t d = vld2q_s32(m);
+
+    d.val[0] = vaddq_s32(d.val[0], vshrq_n_s32(vmull_n_s16(s, vl), 6));
+    d.val[1] = vaddq_s32(d.val[1], vshrq_n_s32(vmull_n_s16(s, vr), 6));
+    vst2q_s32(m, d);
+}
+
+static inline gint32
+integer32_neon_stereo_scopes(gint32 current, gint32 increment,
+    const void* data, const int bits, gint32* mixed, gint16* scopedata,
+    guint32 volume, guint32 leftvol, guint32 rightvol, guint32 count)
+{
+    if (!COEF_OK(volume) || !COEF_OK(volume * leftvol) || !COEF_OK(volume * rightvol)) {
+        return integer32_stereo_scopes_c(current, increment, data, bits, mixed,
+            scopedata, volume, leftvol, rightvol, count);
+    }
+
+    for (; count >= 4; count -= 4) {
+        const int16x4_t s = integer32_neon_gather4(data, &current, increment, bits);
+
+        /* vl * (v * s) == (vl * v) * s, no overflows in this range */
+        integer32_neon_stereo4(mixed, s, volume * leftvol, volume * rightvol);
+        vst1_s16(scopedata, vmovn_s32(vshrq_n_s32(vmull_n_s16(s, volume), 6)));
+        mixed += 8;
+        scopedata += 4;
+    }
+
+    return integer32_stereo_scopes_c(current, increment, data, bits, mixed,
+        scopedata, volume, leftvol, rightvol, count);
+}
+
+static inline gint32
+integer32_neon_mono_scopes(gint32 current, gint32 increment,
+    const void* data, const int bits, gint32* mixed, gint16* scopedata,
+    guint32 volume, guint32 count)
+{
+    if (!COEF_OK(volume)) {
+        return integer32_mono_scopes_c(current, increment, data, bits, mixed,
+            scopedata, volume, count);
+    }
+
+    for (; count >= 4; count -= 4) {
+        const int32x4_t val = vmull_n_s16(integer32_neon_gather4(data, &current, increment, bits), volume);
+
+        vst1q_s32(mixed, vaddq_s32(vld1q_s32(mixed), val));
+        vst1_s16(scopedata, vmovn_s32(vshrq_n_s32(val, 6)));
+        mixed += 4;
+        scopedata += 4;
+    }
+
+    return integer32_mono_scopes_c(current, increment, data, bits, mixed,
+        scopedata, volume, count);
+}
+
+static inline gint32
+integer32_neon_stereo(gint32 current, gint32 increment,
+    const void* data, const int bits, gint32* mixed,
+    guint32 leftvol, guint32 rightvol, guint32 count)
+{
+    if (!COEF_OK(leftvol) || !COEF_OK(rightvol)) {
+        return integer32_stereo_c(current, increment, data, bits, mixed,
+            leftvol, rightvol, count);
+    }
+
+    for (; count >= 4; count -= 4) {
+        integer32_neon_stereo4(mixed, integer32_neon_gather4(data, &current, increment, bits),
+            leftvol, rightvol);
+        mixed += 8;
+    }
+
+    return integer32_stereo_c(current, increment, data, bits, mixed,
+        leftvol, rightvol, count);
+}
+
+static inline gint32
+integer32_neon_mono(gint32 current, gint32 increment,
+    const void* data, const int bits, gint32* mixed,
+    guint32 volume, guint32 count)
+{
+    if (!COEF_OK(volume)) {
+        return integer32_mono_c(current, increment, data, bits, mixed, volume, count);
+    }
+
+    for (; count >= 4; count -= 4) {
+        const int16x4_t s = integer32_neon_gather4(data, &current, increment, bits);
+
+        vst1q_s32(mixed, vaddq_s32(vld1q_s32(mixed), vmull_n_s16(s, volume)));
+        mixed += 4;
+    }
+
+    return integer32_mono_c(current, increment, data, bits, mixed, volume, count);
+}
+
+#define integer32_simd_stereo_scopes integer32_neon_stereo_scopes
+#define integer32_simd_mono_scopes integer32_neon_mono_scopes
+#define integer32_simd_stereo integer32_neon_stereo
+#define integer32_simd_mono integer32_neon_mono
+
+gboolean
+mixersimd_clamp_16(const gint32* mixed,
+    gint16* dest,
+    guint32 count,
+    gint32 amp,
+    gint32 div)
+{
+    int32x4_t lo, hi;
+    uint32x4_t clip;
+    uint32x2_t mul;
+    int64x2_t shift;
+    guint32 m, c[4];
+    int sh;
+
+    if (div < 1 || div >= G_MAXUINT16) {
+        return integer32_clamp_16_c(mixed, dest, count, amp, div);
+    }
+
+    integer32_simd_divisor(div, &m, &sh);
+    lo = vdupq_n_s32(CLAMP_LO(div));
+    hi = vdupq_n_s32(CLAMP_HI(div));
+    mul = vdup_n_u32(m);
+    shift = vdupq_n_s64(-sh);
+    clip = vdupq_n_u32(0);
+
+    for (; count >= 4; count -= 4) {
+        int32x4_t a = vmulq_s32(vld1q_s32(mixed), vdupq_n_s32(amp));
+        int32x4_t sign;
+        uint32x4_t q;
+
+        clip = vorrq_u32(clip, vorrq_u32(vcgtq_s32(a, hi), vcltq_s32(a, lo)));
+        a = vminq_s32(vmaxq_s32(a, lo), hi);
+
+        /* Division of the absolute values, the quotient is truncated
+           towards zero like in C */
+        sign = vshrq_n_s32(a, 31);
+        q = vreinterpretq_u32_s32(vabsq_s32(a));
+        q = vcombine_u32(vmovn_u64(vshlq_u64(vmull_u32(vget_low_u32(q), mul), shift)),
+            vmovn_u64(vshlq_u64(vmull_u32(vget_high_u32(q), mul), shift)));
+        a = vsubq_s32(veorq_s32(vreinterpretq_s32_u32(q), sign), sign);
+
+        vst1_s16(dest, vmovn_s32(a));
+        mixed += 4;
+        dest += 4;
+    }
+
+    vst1q_u32(c, clip);
+    return integer32_clamp_16_c(mixed, dest, count, amp, div)
+        || (c[0] | c[1] | c[2] | c[3]) != 0;
+}
+
+#endif /* NEON */
+
+/* --- Entry points --- */
+
+gint32
+mixersimd_stereo_16_scopes(gint32 current,
+    gint32 increment,
+    gint16* data,
+    gint32* mixed,
+    gint16* scopedata,
+    guint32 volume,
+    guint32 leftvol,
+    guint32 rightvol,
+    guint32 count)
+{
+    return integer32_simd_stereo_scopes(current, increment, data, 16, mixed,
+        scopedata, volume, leftvol, rightvol, count);
+}
+
+gint32
+mixersimd_mono_16_scopes(gint32 current,
+    gint32 increment,
+    gint16* data,
+    gint32* mixed,
+    gint16* scopedata,
+    guint32 volume,
+    guint32 count)
+{
+    return integer32_simd_mono_scopes(current, increment, data, 16, mixed,
+        scopedata, volume, count);
+}
+
+gint32
+mixersimd_stereo_16(gint32 current,
+    gint32 increment,
+    gint16* data,
+    gint32* mixed,
+    guint32 leftvol,
+    guint32 rightvol,
+    guint32 count)
+{
+    return integer32_simd_stereo(current, increment, data, 16, mixed,
+        leftvol, rightvol, count);
+}
+
+gint32
+mixersimd_mono_16(gint32 current,
+    gint32 increment,
+    gint16* data,
+    gint32* mixed,
+    guint32 volume,
+    guint32 count)
+{
+    return integer32_simd_mono(current, increment, data, 16, mixed, volume, count);
+}
+
+gint32
+mixersimd_stereo_8_scopes(gint32 current,
+    gint32 increment,
+    gint8* data,
+    gint32* mixed,
+    gint16* scopedata,
+    guint32 volume,
+    guint32 leftvol,
+    guint32 rightvol,
+    guint32 count)
+{
+    return integer32_simd_stereo_scopes(current, increment, data, 8, mixed,
+        scopedata, volume, leftvol, rightvol, count);
+}
+
+gint32
+mixersimd_mono_8_scopes(gint32 current,
+    gint32 increment,
+    gint8* data,
+    gint32* mixed,
+    gint16* scopedata,
+    guint32 volume,
+    guint32 count)
+{
+    return integer32_simd_mono_scopes(current, increment, data, 8, mixed,
+        scopedata, volume, count);
+}
+
+gint32
+mixersimd_stereo_8(gint32 current,
+    gint32 increment,
+    gint8* data,
+    gint32* mixed,
+    guint32 leftvol,
+    guint32 rightvol,
+    guint32 count)
+{
+    return integer32_simd_stereo(current, increment, data, 8, mixed,
+        leftvol, rightvol, count);
+}
+
+gint32
+mixersimd_mono_8(gint32 current,
+    gint32 increment,
+    gint8* data,
+    gint32* mixed,
+    guint32 volume,
+    guint32 count)
+{
+    return integer32_simd_mono(current, increment, data, 8, mixed, volume, count);
+}
+
+#endif /* MIX_SIMD */
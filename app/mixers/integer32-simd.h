@@ -0,0 +1,120 @@
+
+/*
+ * The Real SoundTracker - Vectorized routines for the integer32 mixer (header)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_MIXERSIMD_H
+#define _ST_MIXERSIMD_H
+
+#include <glib.h>
+
+/* SSE2 is always present on x86-64, NEON on aarch64, so no runtime
+   detection is needed here. */
+#if (defined(__x86_64__) && defined(__GNUC__)) \
+    || defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define MIX_SIMD 1
+#else
+#undef MIX_SIMD
+#endif
+
+#ifdef MIX_SIMD
+
+/* Same interface and results as the routines in integer32-asm.S:
+   the new fixed-point sample position is returned. */
+
+gint32 mixersimd_stereo_16_scopes(gint32 current,
+    gint32 increment,
+    gint16* data,
+    gint32* mixed,
+    gint16* scopedata,
+    guint32 volume,
+    guint32 leftvol,
+    guint32 rightvol,
+    guint32 count);
+
+gint32 mixersimd_mono_16_scopes(gint32 current,
+    gint32 increment,
+    gint16* data,
+    gint32* mixed,
+    gint16* scopedata,
+    guint32 volume,
+    guint32 count);
+
+gint32 mixersimd_stereo_16(gint32 current,
+    gint32 increment,
+    gint16* data,
+    gint32* mixed,
+    guint32 leftvol,
+    guint32 rightvol,
+    guint32 count);
+
+gint32 mixersimd_mono_16(gint32 current,
+    gint32 increment,
+    gint16* data,
+    gint32* mixed,
+    guint32 volume,
+    guint32 count);
+
+/* The same for 8 bit sample data (see ST_MIXER_SAMPLE_FORMAT_8); the
+   results are those of the 16 bit routines for the widened data */
+
+gint32 mixersimd_stereo_8_scopes(gint32 current,
+    gint32 increment,
+    gint8* data,
+    gint32* mixed,
+    gint16* scopedata,
+    guint32 volume,
+    guint32 leftvol,
+    guint32 rightvol,
+    guint32 count);
+
+gint32 mixersimd_mono_8_scopes(gint32 current,
+    gint32 increment,
+    gint8* data,
+    gint32* mixed,
+    gint16* scopedata,
+    guint32 volume,
+    guint32 count);
+
+gint32 mixersimd_stereo_8(gint32 current,
+    gint32 increment,
+    gint8* data,
+    gint32* mixed,
+    guint32 leftvol,
+    guint32 rightvol,
+    guint32 count);
+
+gint32 mixersimd_mono_8(gint32 current,
+    gint32 increment,
+    gint8* data,
+    gint32* mixed,
+    guint32 volume,
+    guint32 count);
+
+/* Amplifies the mixed data, divides it by div and clamps it to 16 bit.
+   Returns TRUE if any value had to be clipped. */
+gboolean mixersimd_clamp_16(const gint32* mixed,
+    gint16* dest,
+    guint32 count,
+    gint32 amp,
+    gint32 div);
+
+#endif /* MIX_SIMD */
+
+#endif /* _ST_MIXERSIMD_H */
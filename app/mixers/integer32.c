@@ -38,17 +38,15 @@
 
 #ifdef MIX_ASM
 #include "integer32-asm.h"
+#else
+#include "integer32-simd.h" /* defines MIX_SIMD if available */
 #endif
 
-static int num_channels, mixfreq, amp = 8;
-static gint32* mixbuf = NULL;
-static int mixbufsize = 0, clipflag;
-static int stereo;
-
 typedef struct integer32_channel {
     st_mixer_sample_info* sample;
+    st_mixer_sample_buffer* buffer; /* snapshot being played, a reference of its own or NULL */
 
-    void* data; /* copy of sample->data */
+    void* data; /* copy of buffer->data */
     guint32 length; /* length of sample (converted) */
     guint32 playend; /* for a forced premature end of the sample */
 
@@ -65,43 +63,120 @@ typedef struct integer32_channel {
     float panning; /* -1.0 .. +1.0 */
 } integer32_channel;
 
-static integer32_channel channels[32];
+typedef struct integer32_mixer {
+    int num_channels, mixfreq, amp;
+    gint32* mixbuf;
+    int mixbufsize, clipflag;
+    int stereo;
+
+    guint32 active; /* channels that may be running */
+    guint32 scopemask; /* channels whose scopes the last mix() has filled */
+    gint samples_changed; /* set by updatesample() */
+
+    integer32_channel channels[32];
+} integer32_mixer;
 
-#define ACCURACY 12 /* accuracy of the fixed point stuff, ALSO HARDCODED in the assembly routines!! */
+#define ACCURACY 12 /* accuracy of the fixed point stuff, ALSO HARDCODED in the assembly and SIMD routines!! */
 
 #define MAX_SAMPLE_LENGTH ((1 << (32 - ACCURACY)) - 1)
 
+static void*
+integer32_new(void)
+{
+    integer32_mixer* im = g_new0(integer32_mixer, 1);
+
+    im->amp = 8;
+
+    return im;
+}
+
+static void
+integer32_destroy(void* mp)
+{
+    integer32_mixer* const im = mp;
+    int i;
+
+    for (i = 0; i < 32; i++) {
+        st_mixer_sample_buffer_unref(im->channels[i].buffer);
+    }
+    g_free(im->mixbuf);
+    g_free(im);
+}
+
 static void
-integer32_setnumch(int n)
+integer32_setnumch(void* mp,
+    int n)
 {
+    integer32_mixer* const im = mp;
+
     g_assert(n >= 1 && n <= 32);
 
-    num_channels = n;
+    im->num_channels = n;
 }
 
 static void
-integer32_updatesample(st_mixer_sample_info* si)
+integer32_updatesample(void* mp,
+    st_mixer_sample_info* si)
 {
-    int i;
+    integer32_mixer* const im = mp;
+
+    g_atomic_int_set(&im->samples_changed, 1);
+}
+
+static void
+integer32_release(integer32_channel* c)
+{
+    st_mixer_sample_buffer_unref(c->buffer);
+    c->buffer = NULL;
+}
+
+static void
+integer32_set_loop(integer32_channel* c)
+{
+    c->loopstart = MIN(c->buffer->loopstart, MAX_SAMPLE_LENGTH) << ACCURACY;
+    c->loopend = MIN(c->buffer->loopend, MAX_SAMPLE_LENGTH) << ACCURACY;
+    c->loopflags = c->buffer->looptype;
+}
+
+/* Switch the channels over to the latest snapshots of their samples
+   after updatesample(). Called before mixing. */
+static void
+integer32_sync_samples(integer32_mixer* im)
+{
+    guint32 mask;
     integer32_channel* c;
+    st_mixer_sample_buffer* b;
 
-    for (i = 0; i < 32; i++) {
-        c = &channels[i];
-        if (c->sample != si || !c->running) {
+    if (!g_atomic_int_compare_and_exchange(&im->samples_changed, 1, 0)) {
+        return;
+    }
+
+    for (mask = im->active; mask; mask &= mask - 1) {
+        c = &im->channels[g_bit_nth_lsf(mask, -1)];
+        if (!c->running) {
             continue;
         }
 
-        if (c->data != si->data
-            || c->length != MIN(si->length, MAX_SAMPLE_LENGTH) << ACCURACY
-            || c->loopflags != si->looptype) {
+        b = st_mixer_sample_acquire(c->sample);
+        if (b == c->buffer) {
+            st_mixer_sample_buffer_unref(b);
+            continue;
+        }
+
+        if (!b
+            || b->data != c->data
+            || (MIN(b->length, MAX_SAMPLE_LENGTH) << ACCURACY) != c->length
+            || b->looptype != c->loopflags) {
+            st_mixer_sample_buffer_unref(b);
             c->running = 0;
+            continue;
         }
 
         /* No relevant data has changed. Don't stop the sample, but update
 	   our local loop data instead. */
-        c->loopstart = MIN(si->loopstart, MAX_SAMPLE_LENGTH) << ACCURACY;
-        c->loopend = MIN(si->loopend, MAX_SAMPLE_LENGTH) << ACCURACY;
-        c->loopflags = si->looptype;
+        st_mixer_sample_buffer_unref(c->buffer);
+        c->buffer = b;
+        integer32_set_loop(c);
         if (c->loopflags != ST_MIXER_SAMPLE_LOOPTYPE_NONE) {
             // we can be more clever here...
             c->current = c->loopstart;
@@ -111,7 +186,8 @@ integer32_updatesample(st_mixer_sample_info* si)
 }
 
 static gboolean
-integer32_setmixformat(int format)
+integer32_setmixformat(void* mp,
+    int format)
 {
     if (format != 16)
         return FALSE;
@@ -120,68 +196,109 @@ integer32_setmixformat(int format)
 }
 
 static gboolean
-integer32_setstereo(int on)
+integer32_setstereo(void* mp,
+    int on)
 {
-    stereo = on;
+    integer32_mixer* const im = mp;
+
+    im->stereo = on;
     return TRUE;
 }
 
 static void
-integer32_setmixfreq(guint32 frequency)
+integer32_setmixfreq(void* mp,
+    guint32 frequency)
 {
-    mixfreq = frequency;
+    integer32_mixer* const im = mp;
+
+    im->mixfreq = frequency;
 }
 
 static void
-integer32_setampfactor(float amplification)
+integer32_setampfactor(void* mp,
+    float amplification)
 {
-    amp = 8 * amplification;
+    integer32_mixer* const im = mp;
+
+    im->amp = 8 * amplification;
 }
 
 static gboolean
-integer32_getclipflag(void)
+integer32_getclipflag(void* mp)
+{
+    integer32_mixer* const im = mp;
+
+    return im->clipflag;
+}
+
+static guint32
+integer32_getscopemask(void* mp)
 {
-    return clipflag;
+    integer32_mixer* const im = mp;
+
+    return im->scopemask;
 }
 
 static void
-integer32_reset(void)
+integer32_reset(void* mp)
 {
-    memset(channels, 0, sizeof(channels));
+    integer32_mixer* const im = mp;
+    int i;
+
+    for (i = 0; i < 32; i++) {
+        st_mixer_sample_buffer_unref(im->channels[i].buffer);
+    }
+    memset(im->channels, 0, sizeof(im->channels));
+    im->active = 0;
 }
 
 static void
-integer32_startnote(int channel,
+integer32_startnote(void* mp,
+    int channel,
     st_mixer_sample_info* s)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const im = mp;
+    integer32_channel* c = &im->channels[channel];
 
     c->sample = s;
-    c->data = s->data;
-    c->length = MIN(s->length, MAX_SAMPLE_LENGTH) << ACCURACY;
+    st_mixer_sample_buffer_unref(c->buffer);
+    c->buffer = st_mixer_sample_acquire(s);
+    if (!c->buffer) {
+        c->running = 0;
+        im->active &= ~(1 << channel);
+        return;
+    }
+
+    c->data = c->buffer->data;
+    c->length = MIN(c->buffer->length, MAX_SAMPLE_LENGTH) << ACCURACY;
     c->playend = 0;
     c->running = 1;
     c->speed = 1;
     c->current = 0;
-    c->loopstart = MIN(s->loopstart, MAX_SAMPLE_LENGTH) << ACCURACY;
-    c->loopend = MIN(s->loopend, MAX_SAMPLE_LENGTH) << ACCURACY;
-    c->loopflags = s->looptype;
+    integer32_set_loop(c);
     c->direction = 1;
+    im->active |= 1 << channel;
 }
 
 static void
-integer32_stopnote(int channel)
+integer32_stopnote(void* mp,
+    int channel)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const im = mp;
+    integer32_channel* c = &im->channels[channel];
 
     c->running = 0;
+    integer32_release(c);
+    im->active &= ~(1 << channel);
 }
 
 static void
-integer32_setsmplpos(int channel,
+integer32_setsmplpos(void* mp,
+    int channel,
     guint32 offset)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const im = mp;
+    integer32_channel* c = &im->channels[channel];
 
     if (offset<c->length>> ACCURACY) {
         c->current = offset << ACCURACY;
@@ -192,10 +309,12 @@ integer32_setsmplpos(int channel,
 }
 
 static void
-integer32_setsmplend(int channel,
+integer32_setsmplend(void* mp,
+    int channel,
     guint32 offset)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const im = mp;
+    integer32_channel* c = &im->channels[channel];
 
     if (c->current != 0 || offset<c->length>> ACCURACY) {
         c->playend = MIN(offset, MAX_SAMPLE_LENGTH) << ACCURACY;
@@ -203,84 +322,161 @@ integer32_setsmplend(int channel,
 }
 
 static void
-integer32_setfreq(int channel,
+integer32_setfreq(void* mp,
+    int channel,
     float frequency)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const im = mp;
+    integer32_channel* c = &im->channels[channel];
 
     if (frequency > (0x7fffffff >> ACCURACY)) {
         frequency = (0x7fffffff >> ACCURACY);
     }
 
-    c->speed = frequency * (1 << ACCURACY) / mixfreq;
+    c->speed = frequency * (1 << ACCURACY) / im->mixfreq;
     if (c->speed == 0) {
         c->speed = 1;
     }
 }
 
 static void
-integer32_setvolume(int channel,
+integer32_setvolume(void* mp,
+    int channel,
     float volume)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const im = mp;
+    integer32_channel* c = &im->channels[channel];
 
     c->volume = 64 * volume;
 }
 
 static void
-integer32_setpanning(int channel,
+integer32_setpanning(void* mp,
+    int channel,
     float panning)
 {
-    integer32_channel* c = &channels[channel];
+    integer32_mixer* const im = mp;
+    integer32_channel* c = &im->channels[channel];
 
     c->panning = panning;
 }
 
+/* Mixes done output samples of 8 bit data (see ST_MIXER_SAMPLE_FORMAT_8),
+   with the same results as the 16 bit code in integer32_mix() for the
+   widened data. scopedata may be NULL. Returns the new position. */
+static gint32
+integer32_mix_8(integer32_mixer* im,
+    integer32_channel* c,
+    gint8* data,
+    gint32* m,
+    gint16* scopedata,
+    int v,
+    int vl,
+    int vr,
+    int done)
+{
+    gint32 j = c->current;
+    const gint32 s = c->speed * c->direction;
+#ifdef MIX_SIMD
+    if (scopedata) {
+        return im->stereo
+            ? mixersimd_stereo_8_scopes(j, s, data, m, scopedata, v, vl, vr, done)
+            : mixersimd_mono_8_scopes(j, s, data, m, scopedata, v, done);
+    }
+
+    return im->stereo
+        ? mixersimd_stereo_8(j, s, data, m, vl * v, vr * v, done)
+        : mixersimd_mono_8(j, s, data, m, v, done);
+#else
+    int val;
+
+    /* Also used instead of the assembler routines, which only know 16
+       bit data */
+    if (scopedata) {
+        for (; done; done--, j += s) {
+            val = v * (data[j >> ACCURACY] * 256);
+            if (im->stereo) {
+                *m++ += vl * val >> 6;
+                *m++ += vr * val >> 6;
+            } else {
+                *m++ += val;
+            }
+            *scopedata++ = val >> 6;
+        }
+    } else if (im->stereo) {
+        vl *= v;
+        vr *= v;
+        for (; done; done--, j += s) {
+            val = data[j >> ACCURACY] * 256;
+            *m++ += vl * val >> 6;
+            *m++ += vr * val >> 6;
+        }
+    } else {
+        for (; done; done--, j += s) {
+            *m++ += v * (data[j >> ACCURACY] * 256);
+        }
+    }
+
+    return j;
+#endif
+}
+
 static void*
-integer32_mix(void* dest,
+integer32_mix(void* mp,
+    void* dest,
     guint32 count,
     gint16* scopebufs[],
     int scopebuf_offset)
 {
-    int todo;
+    integer32_mixer* const im = mp;
+    guint32 mask;
     int i, j, t, *m, v;
     integer32_channel* c;
     int done;
     int offs2end, oflcnt, looplen;
-    gint16* sndbuf;
     gint16* scopedata = NULL;
     int vl = 0;
     int vr = 0;
     gint16* data;
-#ifndef MIX_ASM
+#if !defined(MIX_ASM) && !defined(MIX_SIMD)
     int s, val;
 #endif
+#ifndef MIX_SIMD
+    int todo;
+    gint16* sndbuf;
+#endif
+
+    if ((im->stereo + 1) * count > im->mixbufsize) {
+        g_free(im->mixbuf);
+        im->mixbuf = g_new(gint32, (im->stereo + 1) * count);
+        im->mixbufsize = (im->stereo + 1) * count;
+    }
+    memset(im->mixbuf, 0, (im->stereo + 1) * 4 * count);
+
+    integer32_sync_samples(im);
 
-    if ((stereo + 1) * count > mixbufsize) {
-        g_free(mixbuf);
-        mixbuf = g_new(gint32, (stereo + 1) * count);
-        mixbufsize = (stereo + 1) * count;
+    /* Channels which have stopped since the last call are dropped
+       here; the scopes of idle channels are left alone. */
+    for (mask = im->active; mask; mask &= mask - 1) {
+        i = g_bit_nth_lsf(mask, -1);
+        if (!im->channels[i].running) {
+            integer32_release(&im->channels[i]);
+            im->active &= ~(1 << i);
+        }
     }
-    memset(mixbuf, 0, (stereo + 1) * 4 * count);
+    mask = im->active & (guint32)(((guint64)1 << im->num_channels) - 1);
+    im->scopemask = scopebufs ? mask : 0;
 
-    for (i = 0; i < num_channels; i++) {
-        c = &channels[i];
+    for (; mask; mask &= mask - 1) {
+        i = g_bit_nth_lsf(mask, -1);
+        c = &im->channels[i];
         t = count;
-        m = mixbuf;
+        m = im->mixbuf;
         v = c->volume;
 
         if (scopebufs)
             scopedata = scopebufs[i] + scopebuf_offset;
 
-        if (!c->running) {
-            if (scopebufs)
-                memset(scopedata, 0, 2 * count);
-            continue;
-        }
-
-        g_assert(&c->sample->lock);
-        g_mutex_lock(&c->sample->lock);
-
         while (t) {
             /* Check how much of the sample we can fill in one run */
             if (c->loopflags && c->playend == 0) {
@@ -334,21 +530,35 @@ integer32_mix(void* dest,
 
             g_assert(c->current >= 0 && (c->current >> ACCURACY) < c->length);
 
-            if (stereo) {
+            if (im->stereo) {
                 vl = 64 - ((c->panning + 1.0) * 32);
                 vr = (c->panning + 1.0) * 32;
             }
 
             /* This one does the actual mixing */
             data = c->data;
-            if (scopebufs) {
-                if (stereo) {
+            if (c->buffer->format == ST_MIXER_SAMPLE_FORMAT_8) {
+                j = integer32_mix_8(im, c, c->data, m, scopebufs ? scopedata : NULL,
+                    v, vl, vr, done);
+                m += (im->stereo + 1) * done;
+                if (scopebufs)
+                    scopedata += done;
+            } else if (scopebufs) {
+                if (im->stereo) {
 #ifdef MIX_ASM
                     j = mixerasm_stereo_16_scopes(c->current, c->speed * c->direction,
                         data, m, scopedata,
                         v, vl, vr,
                         done);
 
+                    m += 2 * done;
+                    scopedata += done;
+#elif defined(MIX_SIMD)
+                    j = mixersimd_stereo_16_scopes(c->current, c->speed * c->direction,
+                        data, m, scopedata,
+                        v, vl, vr,
+                        done);
+
                     m += 2 * done;
                     scopedata += done;
 #else
@@ -366,6 +576,14 @@ integer32_mix(void* dest,
                         v,
                         done);
 
+                    m += done;
+                    scopedata += done;
+#elif defined(MIX_SIMD)
+                    j = mixersimd_mono_16_scopes(c->current, c->speed * c->direction,
+                        data, m, scopedata,
+                        v,
+                        done);
+
                     m += done;
                     scopedata += done;
 #else
@@ -377,7 +595,7 @@ integer32_mix(void* dest,
 #endif
                 }
             } else {
-                if (stereo) {
+                if (im->stereo) {
                     vl *= v;
                     vr *= v;
 #ifdef MIX_ASM
@@ -388,6 +606,13 @@ integer32_mix(void* dest,
 
                     m += 2 * done;
                     scopedata += done;
+#elif defined(MIX_SIMD)
+                    j = mixersimd_stereo_16(c->current, c->speed * c->direction,
+                        data, m,
+                        vl, vr,
+                        done);
+
+                    m += 2 * done;
 #else
                     for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
                         val = data[j >> ACCURACY];
@@ -404,6 +629,13 @@ integer32_mix(void* dest,
 
                     m += done;
                     scopedata += done;
+#elif defined(MIX_SIMD)
+                    j = mixersimd_mono_16(c->current, c->speed * c->direction,
+                        data, m,
+                        v,
+                        done);
+
+                    m += done;
 #else
                     for (j = c->current, s = c->speed * c->direction; done; done--, j += s) {
                         val = v * data[j >> ACCURACY];
@@ -416,38 +648,51 @@ integer32_mix(void* dest,
             c->current = j;
         }
 
-        g_mutex_unlock(&c->sample->lock);
+        if (t) {
+            /* The sample has ended */
+            if (scopebufs)
+                memset(scopedata, 0, 2 * t);
+            integer32_release(c);
+            im->active &= ~(1 << i);
+        }
     }
 
     /* modules with many channels get additional amplification here */
-    t = (4 * log(num_channels) / log(4)) * 64 * 8;
+    t = (4 * log(im->num_channels) / log(4)) * 64 * 8;
 
-    for (sndbuf = dest, clipflag = 0, todo = 0; todo < (stereo + 1) * count; todo++) {
+#ifdef MIX_SIMD
+    im->clipflag = mixersimd_clamp_16(im->mixbuf, dest, (im->stereo + 1) * count, im->amp, t);
+#else
+    for (sndbuf = dest, im->clipflag = 0, todo = 0; todo < (im->stereo + 1) * count; todo++) {
         gint32 a, b;
 
-        a = mixbuf[todo];
-        a *= amp; /* amplify */
+        a = im->mixbuf[todo];
+        a *= im->amp; /* amplify */
         a /= t;
 
         b = CLAMP(a, -32768, 32767);
         if (a != b) {
-            clipflag = 1;
+            im->clipflag = 1;
         }
 
         *sndbuf++ = b;
     }
+#endif
 
-    return dest + (stereo + 1) * 2 * count;
+    return dest + (im->stereo + 1) * 2 * count;
 }
 
-void integer32_dumpstatus(st_mixer_channel_status array[])
+static void
+integer32_dumpstatus(void* mp,
+    st_mixer_channel_status array[])
 {
+    integer32_mixer* const im = mp;
     int i;
 
     for (i = 0; i < 32; i++) {
-        if (channels[i].running) {
-            array[i].current_sample = channels[i].sample;
-            array[i].current_position = channels[i].current >> ACCURACY;
+        if (im->channels[i].running) {
+            array[i].current_sample = im->channels[i].sample;
+            array[i].current_position = im->channels[i].current >> ACCURACY;
         } else {
             array[i].current_sample = NULL;
         }
@@ -455,24 +700,25 @@ void integer32_dumpstatus(st_mixer_channel_status array[])
 }
 
 static void
-integer32_loadchsettings(int ch)
+integer32_loadchsettings(void* mp,
+    int ch,
+    const tracer_channel* tch)
 {
-    tracer_channel* tch;
+    integer32_mixer* const im = mp;
     integer32_channel* c;
     guint64 tmp64;
 
-    g_assert(ch < num_channels);
+    g_assert(ch < im->num_channels);
 
-    tch = tracer_return_channel(ch);
-    c = &channels[ch];
+    c = &im->channels[ch];
 
     c->sample = tch->sample;
     c->data = tch->data;
+    st_mixer_sample_buffer_unref(c->buffer);
+    c->buffer = tch->sample ? st_mixer_sample_acquire(tch->sample) : NULL;
 
-    if (tch->sample) {
-        c->loopflags = tch->sample->looptype;
-        c->loopstart = MIN(tch->sample->loopstart, MAX_SAMPLE_LENGTH) << ACCURACY;
-        c->loopend = MIN(tch->sample->loopend, MAX_SAMPLE_LENGTH) << ACCURACY;
+    if (c->buffer) {
+        integer32_set_loop(c);
     }
     c->length = MIN(tch->length, MAX_SAMPLE_LENGTH) << ACCURACY;
     c->volume = tch->volume * 64;
@@ -485,12 +731,24 @@ integer32_loadchsettings(int ch)
     c->speed = MIN(tmp64, MAX_SAMPLE_LENGTH << ACCURACY);
 
     c->running = tch->flags & TR_FLAG_SAMPLE_RUNNING;
+
+    /* The sample may have been changed since it was traced */
+    if (!c->buffer || c->buffer->data != tch->data || c->buffer->length != tch->length) {
+        c->running = 0;
+    }
+    if (c->running) {
+        im->active |= 1 << ch;
+    } else {
+        integer32_release(c);
+    }
 }
 
 st_mixer mixer_integer32 = {
     "integer32",
     N_("Integers mixer, no interpolation, no filters, maximum sample length 1M"),
 
+    integer32_new,
+    integer32_destroy,
     integer32_setnumch,
     integer32_updatesample,
     integer32_setmixformat,
@@ -498,6 +756,7 @@ st_mixer mixer_integer32 = {
     integer32_setmixfreq,
     integer32_setampfactor,
     integer32_getclipflag,
+    integer32_getscopemask,
     integer32_reset,
     integer32_startnote,
     integer32_stopnote,
@@ -33,7 +33,10 @@ typedef struct kb_x86_mixer_data {
     float volright; // right volume (1.0=normal)           4
     float volrampl; // left volramp (dvol/sample)          8
     float volrampr; // right volramp (dvol/sample)         12
-    gint16* positioni; // pointer to sample data              16
+    union {
+        gint16* positioni; // pointer to sample data              16
+        gint8* positioni8; // same for 8 bit samples
+    };
     guint32 positionf; // fractional part of pointer          20
     gint32 freqi; // integer part of delta               24
     guint32 freqf; // fractional part of delta            28
@@ -52,14 +55,25 @@ typedef struct kb_x86_mixer_data {
 #define KB_X86_MIXER_FLAGS_FILTERED (1 << 3)
 #define KB_X86_MIXER_FLAGS_SCOPES (1 << 4)
 #define KB_X86_MIXER_FLAGS_VOLRAMP (1 << 5)
+#define KB_X86_MIXER_FLAGS_8BIT (1 << 6)
 
 void kbasm_mix(kb_x86_mixer_data* data);
 
+/* The plain C mixing routines. Unlike the assembler ones they handle
+   KB_X86_MIXER_FLAGS_8BIT, so they are built in any case. */
+void kbfloat_mix(kb_x86_mixer_data* data);
+
 gboolean kbasm_post_mixing(float* mixbuffer,
     gint16* outbuffer,
     unsigned numsamples,
     float amplification);
 
+/* Same for native float output (-1.0 ... 1.0, not clipped) */
+gboolean kbasm_post_mixing_float(float* mixbuffer,
+    float* outbuffer,
+    unsigned numsamples,
+    float amplification);
+
 extern float kb_x86_ct0[256];
 extern float kb_x86_ct1[256];
 extern float kb_x86_ct2[256];
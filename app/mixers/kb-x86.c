@@ -32,16 +32,16 @@
 #include <string.h>
 
 #include "kb-x86-asm.h"
+#include "kbfloat-simd.h"
+#include "mix-pool.h"
 #include "mixer.h"
 #include "tracer.h"
 
-static int num_channels, mixfreq;
-static int clipflag;
-
-static float* kb_x86_tempbuf = NULL;
-static int kb_x86_tempbufsize = 0;
-
-static float kb_x86_amplification = 0.25;
+/* The assembly routines keep their state in global variables, so
+   channels can only be mixed in parallel by the C versions. */
+#if defined(NO_ASM) || !defined(__i386__)
+#define KB_X86_PARALLEL 1
+#endif
 
 float kb_x86_ct0[256];
 float kb_x86_ct1[256];
@@ -50,10 +50,7 @@ float kb_x86_ct3[256];
 
 typedef struct kb_x86_channel {
     st_mixer_sample_info* sample;
-
-    void* data; // for updatesample() to see if sample has changed
-    int looptype;
-    guint32 length;
+    st_mixer_sample_buffer* buffer; // snapshot being played, a reference of its own or NULL
 
     guint32 flags; // see below
     float volume; // 0.0 ... 1.0
@@ -79,18 +76,52 @@ typedef struct kb_x86_channel {
     float freso; // filter resonance (0<=x<1)
     float fl1; // filter lp buffer
     float fb1; // filter bp buffer
+
+    int channel; // pattern channel this voice is (or was) playing on
 } kb_x86_channel;
 
 #define KB_FLAG_LOOP_UNIDIRECTIONAL 1
 #define KB_FLAG_LOOP_BIDIRECTIONAL 2
 #define KB_FLAG_SAMPLE_RUNNING 4
 #define KB_FLAG_JUST_STARTED 8
-#define KB_FLAG_UPPER_ACTIVE 16
+#define KB_FLAG_ACTIVE 16 // voice is in the active list
 #define KB_FLAG_STOP_AFTER_VOLRAMP 32
 #define KB_FLAG_DO_SAMPLE_START_DECLICK 64
 
-// This is an artificial limit. The code can do more channels.
-static kb_x86_channel channels[2 * 32];
+// Number of virtual channels ("voices") shared by all pattern channels
+#define KB_X86_NUM_VOICES 256
+
+typedef struct kb_x86_mixer {
+    int num_channels, mixfreq;
+    int clipflag;
+    guint32 scopemask; // channels whose scopes the last mix() has filled
+    gint samples_changed; // set by updatesample()
+
+    float* tempbuf;
+    int tempbufsize;
+
+    // Private accumulators of the parallel parts 1, 2, ..., each
+    // KB_X86_PART_FRAMES long; allocated along with the mixer
+    float* partbufs;
+
+    float amplification;
+    gboolean float_output; // setmixformat(32)
+
+    kb_x86_channel voices[KB_X86_NUM_VOICES];
+
+    // The voice each pattern channel currently controls. This is an
+    // artificial limit. The code can do more channels.
+    int current[32];
+
+    // Voices that may be running, in the order they were started.
+    // Nothing else is looked at while mixing.
+    int active[KB_X86_NUM_VOICES];
+    int num_active;
+
+    // Voices neither current nor active
+    int free[KB_X86_NUM_VOICES];
+    int num_free;
+} kb_x86_mixer;
 
 // Number of samples the mixer needs in advance
 #define KB_X86_SAMPLE_PADDING 3
@@ -98,74 +129,295 @@ static kb_x86_channel channels[2 * 32];
 // A ramp from 32768 to 0 should take RAMP_MAX_DURATION seconds
 #define RAMP_MAX_DURATION 0.001
 
+// Waking up the mixing threads costs some time; every part of a
+// parallel mix call should get at least this many voices...
+#define KB_X86_PARALLEL_MIN_VOICES 2
+// ...and at least this many output samples times voices.
+#define KB_X86_PARALLEL_MIN_WORK 4096
+// Longer mix calls are done in pieces of this many output samples
+#define KB_X86_PART_FRAMES 1024
+
 static void
-kb_x86_setnumch(int n)
+kb_x86_init_tables(void)
 {
-    g_assert(n >= 1 && n <= 32);
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        float x1 = i / 256.0;
+        float x2 = x1 * x1;
+        float x3 = x1 * x1 * x1;
+        kb_x86_ct0[i] = -0.5 * x3 + x2 - 0.5 * x1;
+        kb_x86_ct1[i] = 1.5 * x3 - 2.5 * x2 + 1;
+        kb_x86_ct2[i] = -1.5 * x3 + 2 * x2 + 0.5 * x1;
+        kb_x86_ct3[i] = 0.5 * x3 - 0.5 * x2;
+    }
+}
+
+static void
+kb_x86_reset(void* mp)
+{
+    kb_x86_mixer* const m = mp;
+    int i;
+
+    for (i = 0; i < KB_X86_NUM_VOICES; i++) {
+        st_mixer_sample_buffer_unref(m->voices[i].buffer);
+    }
+    memset(m->voices, 0, sizeof(m->voices));
+    m->num_active = 0;
+    m->num_free = 0;
+
+    for (i = 0; i < 32; i++) {
+        m->current[i] = i;
+        m->voices[i].channel = i;
+    }
+    for (i = KB_X86_NUM_VOICES - 1; i >= 32; i--) {
+        m->free[m->num_free++] = i;
+    }
+
+    m->clipflag = 0;
+}
+
+static void*
+kb_x86_new(void)
+{
+    static gsize tables_done = 0;
+    kb_x86_mixer* m;
+
+    /* The interpolation tables are shared by all instances */
+    if (g_once_init_enter(&tables_done)) {
+        kb_x86_init_tables();
+        g_once_init_leave(&tables_done, 1);
+    }
+
+    m = g_new0(kb_x86_mixer, 1);
+    m->amplification = 0.25;
+    kb_x86_reset(m);
 
-    num_channels = n;
+#ifdef KB_X86_PARALLEL
+    /* NULL just means that this instance always mixes serially */
+    m->partbufs = g_try_new(float, 2 * KB_X86_PART_FRAMES * (MIX_POOL_MAX_PARTS - 1));
+#endif
+
+    return m;
 }
 
-/* This is just a quick hack to implement sample-change declicking
-   without coding full virtual channel support. But this will come
-   sooner or later so that hack is only temporary.
+static void
+kb_x86_destroy(void* mp)
+{
+    kb_x86_mixer* const m = mp;
+
+    kb_x86_reset(m);
+    free(m->tempbuf);
+    g_free(m->partbufs);
+    g_free(m);
+}
 
-   It works like this: When a sample is stopped and a new one is
-   immediately started, there usually results a little click. In order
-   to avoid it, we let the old sample continue, but start a quick
-   volume downramp on it towards 0 (so that the click gets a linear
-   ramp and it's not that disturbing). It's obvious that for the time
-   of the volume ramp, we need to store the kb_x86_channel data blocks
-   of both the old channel and the new channel. Because of this, our
-   channels[] array is twice as large, and in the lower copy, the
-   KB_FLAG_UPPER_ACTIVE flag is active when the upper copy is the
-   one with the currently running main sample and the lower copy is
-   only the fading out old sample.
+static void
+kb_x86_setnumch(void* mp,
+    int n)
+{
+    kb_x86_mixer* const m = mp;
 
-   Alle Klarheiten beseitigt? :-) As I said before, full
-   virtual-channel support will make this superfluous.
+    g_assert(n >= 1 && n <= 32);
+
+    m->num_channels = n;
+}
+
+/* Virtual channels.
+
+   When a sample is stopped and a new one is immediately started,
+   there usually results a little click. In order to avoid it, we let
+   the old sample continue, but start a quick volume downramp on it
+   towards 0 (so that the click gets a linear ramp and it's not that
+   disturbing).
+
+   To this end the pattern channels don't own their kb_x86_channel
+   data blocks ("voices"); they are taken from a pool of
+   KB_X86_NUM_VOICES. current[] tells which voice a pattern channel
+   controls at the moment. When a running note is stopped or replaced,
+   its voice is detached from the pattern channel and fades out on its
+   own, and the pattern channel gets a fresh voice with the same
+   settings. If the pool runs dry, the quietest of the fading voices
+   is taken away.
+
+   All voices that may produce sound are kept in active[], so mixing
+   doesn't have to look at the idle ones.
 */
 static kb_x86_channel*
-kb_x86_get_channel_struct(int channel)
+kb_x86_get_channel_struct(kb_x86_mixer* m,
+    int channel)
 {
-    kb_x86_channel* c = &channels[channel];
+    return &m->voices[m->current[channel]];
+}
 
-    if (c->flags & KB_FLAG_UPPER_ACTIVE) {
-        c = &channels[channel + 32];
+static gboolean
+kb_x86_is_current(kb_x86_mixer* m,
+    kb_x86_channel* v)
+{
+    return m->current[v->channel] == v - m->voices;
+}
+
+static void
+kb_x86_activate(kb_x86_mixer* m,
+    kb_x86_channel* v)
+{
+    if (!(v->flags & KB_FLAG_ACTIVE)) {
+        v->flags |= KB_FLAG_ACTIVE;
+        m->active[m->num_active++] = v - m->voices;
+    }
+}
+
+/* Drop the voices which have stopped from the active list and put
+   the detached ones back into the pool */
+static void
+kb_x86_cleanup_voices(kb_x86_mixer* m)
+{
+    int i, k;
+
+    for (i = 0, k = 0; i < m->num_active; i++) {
+        kb_x86_channel* v = m->voices + m->active[i];
+
+        if (v->flags & KB_FLAG_SAMPLE_RUNNING) {
+            m->active[k++] = m->active[i];
+        } else {
+            v->flags &= ~KB_FLAG_ACTIVE;
+            st_mixer_sample_buffer_unref(v->buffer);
+            v->buffer = NULL;
+            if (!kb_x86_is_current(m, v)) {
+                m->free[m->num_free++] = m->active[i];
+            }
+        }
+    }
+    m->num_active = k;
+}
+
+static kb_x86_channel*
+kb_x86_get_free_voice(kb_x86_mixer* m)
+{
+    int i, quietest = -1;
+    float vol, minvol = 0.0;
+
+    if (m->num_free) {
+        return &m->voices[m->free[--m->num_free]];
     }
 
-    return c;
+    /* Voice stealing. Only up to 32 voices are current, so all the
+       others are active and fading out. */
+    for (i = 0; i < m->num_active; i++) {
+        kb_x86_channel* v = m->voices + m->active[i];
+
+        if (kb_x86_is_current(m, v)) {
+            continue;
+        }
+        vol = MAX(v->volleft, v->volright);
+        if (quietest == -1 || vol < minvol) {
+            quietest = i;
+            minvol = vol;
+        }
+    }
+    g_assert(quietest != -1);
+
+    i = m->active[quietest];
+    m->num_active--;
+    memmove(m->active + quietest, m->active + quietest + 1, (m->num_active - quietest) * sizeof(m->active[0]));
+    m->voices[i].flags = 0;
+    st_mixer_sample_buffer_unref(m->voices[i].buffer);
+    m->voices[i].buffer = NULL;
+
+    return &m->voices[i];
 }
 
+/* Let the note playing on the pattern channel fade out in the
+   background */
 static void
-kb_x86_updatesample(st_mixer_sample_info* si)
+kb_x86_detach_voice(kb_x86_mixer* m,
+    int channel)
+{
+    kb_x86_channel* c = kb_x86_get_channel_struct(m, channel);
+    kb_x86_channel* n;
+
+    if (!(c->flags & KB_FLAG_SAMPLE_RUNNING)) {
+        return;
+    }
+
+    if (c->flags & KB_FLAG_JUST_STARTED) {
+        /* Not a single sample of it has been mixed, so it can't click */
+        c->flags &= KB_FLAG_ACTIVE;
+        return;
+    }
+
+    n = kb_x86_get_free_voice(m);
+    *n = *c;
+    n->flags = 0;
+    n->buffer = NULL; // stays with the fading voice
+    m->current[channel] = n - m->voices;
+
+    c->flags |= KB_FLAG_STOP_AFTER_VOLRAMP;
+
+    c->ramp_num_samples = RAMP_MAX_DURATION * m->mixfreq;
+    if (c->ramp_num_samples == 0) {
+        c->ramp_num_samples = 1;
+    }
+    c->rampdestleft = 0;
+    c->rampdestright = 0;
+    c->rampleft = (c->rampdestleft - c->volleft) / c->ramp_num_samples;
+    c->rampright = (c->rampdestright - c->volright) / c->ramp_num_samples;
+}
+
+static void
+kb_x86_updatesample(void* mp,
+    st_mixer_sample_info* si)
+{
+    kb_x86_mixer* const m = mp;
+
+    g_atomic_int_set(&m->samples_changed, 1);
+}
+
+/* Switch the voices over to the latest snapshots of their samples
+   after updatesample(). Called before mixing. */
+static void
+kb_x86_sync_samples(kb_x86_mixer* m)
 {
     int i;
     kb_x86_channel* c;
+    st_mixer_sample_buffer* b;
 
-    for (i = 0; i < 2 * 32; i++) {
-        c = &channels[i];
+    if (!g_atomic_int_compare_and_exchange(&m->samples_changed, 1, 0)) {
+        return;
+    }
+
+    for (i = 0; i < m->num_active; i++) {
+        c = &m->voices[m->active[i]];
 
-        if (c->sample != si || !(c->flags & KB_FLAG_SAMPLE_RUNNING)) {
+        if (!(c->flags & KB_FLAG_SAMPLE_RUNNING)) {
             continue;
         }
 
-        if (c->data != si->data
-            || c->length != si->length
-            || c->looptype != si->looptype) {
+        b = st_mixer_sample_acquire(c->sample);
+        if (b == c->buffer) {
+            st_mixer_sample_buffer_unref(b);
+            continue;
+        }
+
+        if (!b
+            || b->data != c->buffer->data
+            || b->length != c->buffer->length
+            || b->looptype != c->buffer->looptype) {
+            st_mixer_sample_buffer_unref(b);
             c->flags &= ~KB_FLAG_SAMPLE_RUNNING;
             continue;
         }
 
-        /* No relevant data has changed. Don't stop the sample, but update
-	   our local loop data instead. */
-        c->looptype = si->looptype;
-        if (c->looptype != ST_MIXER_SAMPLE_LOOPTYPE_NONE) {
-            if (c->positionw < si->loopstart) {
-                c->positionw = si->loopstart;
+        /* No relevant data has changed. Don't stop the sample, but
+	   switch over to the new loop instead. */
+        st_mixer_sample_buffer_unref(c->buffer);
+        c->buffer = b;
+        if (b->looptype != ST_MIXER_SAMPLE_LOOPTYPE_NONE) {
+            if (c->positionw < b->loopstart) {
+                c->positionw = b->loopstart;
                 c->positionf = 0x7fffffff;
-            } else if (c->positionw >= si->loopend) {
-                c->positionw = si->loopend - 1;
+            } else if (c->positionw >= b->loopend) {
+                c->positionw = b->loopend - 1;
                 c->positionf = 0x7fffffff;
             }
         }
@@ -173,16 +425,22 @@ kb_x86_updatesample(st_mixer_sample_info* si)
 }
 
 static gboolean
-kb_x86_setmixformat(int format)
+kb_x86_setmixformat(void* mp,
+    int format)
 {
-    if (format != 16)
+    kb_x86_mixer* const m = mp;
+
+    if (format != 16 && format != 32)
         return FALSE;
 
+    m->float_output = format == 32;
+
     return TRUE;
 }
 
 static gboolean
-kb_x86_setstereo(int on)
+kb_x86_setstereo(void* mp,
+    int on)
 {
     if (!on)
         return FALSE;
@@ -191,63 +449,66 @@ kb_x86_setstereo(int on)
 }
 
 static void
-kb_x86_setmixfreq(guint32 frequency)
+kb_x86_setmixfreq(void* mp,
+    guint32 frequency)
 {
-    mixfreq = frequency;
+    kb_x86_mixer* const m = mp;
+
+    m->mixfreq = frequency;
 }
 
 static void
-kb_x86_setampfactor(float amplification)
+kb_x86_setampfactor(void* mp,
+    float amplification)
 {
-    kb_x86_amplification = 0.25 * amplification;
+    kb_x86_mixer* const m = mp;
+
+    m->amplification = 0.25 * amplification;
 }
 
 static gboolean
-kb_x86_getclipflag(void)
+kb_x86_getclipflag(void* mp)
 {
-    return clipflag;
+    kb_x86_mixer* const m = mp;
+
+    return m->clipflag;
 }
 
-static void
-kb_x86_reset(void)
+static guint32
+kb_x86_getscopemask(void* mp)
 {
-    int i;
-
-    memset(channels, 0, sizeof(channels));
-    clipflag = 0;
+    kb_x86_mixer* const m = mp;
 
-    for (i = 0; i < 256; i++) {
-        float x1 = i / 256.0;
-        float x2 = x1 * x1;
-        float x3 = x1 * x1 * x1;
-        kb_x86_ct0[i] = -0.5 * x3 + x2 - 0.5 * x1;
-        kb_x86_ct1[i] = 1.5 * x3 - 2.5 * x2 + 1;
-        kb_x86_ct2[i] = -1.5 * x3 + 2 * x2 + 0.5 * x1;
-        kb_x86_ct3[i] = 0.5 * x3 - 0.5 * x2;
-    }
+    return m->scopemask;
 }
 
 static void
-kb_x86_startnote(int channel,
+kb_x86_startnote(void* mp,
+    int channel,
     st_mixer_sample_info* s)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const m = mp;
+    kb_x86_channel* c;
 
-    c->flags &= KB_FLAG_UPPER_ACTIVE;
+    /* New note action: the previous note is faded out */
+    kb_x86_detach_voice(m, channel);
+    c = kb_x86_get_channel_struct(m, channel);
 
-    c->sample = s;
+    c->flags &= KB_FLAG_ACTIVE;
 
-    // The following three for update_sample()
-    c->data = s->data;
-    c->length = s->length;
-    c->looptype = s->looptype;
+    c->sample = s;
+    st_mixer_sample_buffer_unref(c->buffer);
+    c->buffer = st_mixer_sample_acquire(s);
+    if (!c->buffer) {
+        return;
+    }
 
     c->positionw = 0;
     c->positionf = 0;
     c->playend = 0;
-    if (s->looptype == ST_MIXER_SAMPLE_LOOPTYPE_AMIGA) {
+    if (c->buffer->looptype == ST_MIXER_SAMPLE_LOOPTYPE_AMIGA) {
         c->flags |= KB_FLAG_LOOP_UNIDIRECTIONAL;
-    } else if (s->looptype == ST_MIXER_SAMPLE_LOOPTYPE_PINGPONG) {
+    } else if (c->buffer->looptype == ST_MIXER_SAMPLE_LOOPTYPE_PINGPONG) {
         c->flags |= KB_FLAG_LOOP_BIDIRECTIONAL;
     }
     c->direction = 1;
@@ -257,44 +518,28 @@ kb_x86_startnote(int channel,
     c->fl1 = 0.0;
     c->fb1 = 0.0;
     c->flags |= KB_FLAG_SAMPLE_RUNNING | KB_FLAG_JUST_STARTED;
+    kb_x86_activate(m, c);
 }
 
 static void
-kb_x86_stopnote(int channel)
+kb_x86_stopnote(void* mp,
+    int channel)
 {
-    kb_x86_channel* c = &channels[channel];
-    kb_x86_channel* current_used_chan = kb_x86_get_channel_struct(channel);
-
-    if (current_used_chan->flags & KB_FLAG_SAMPLE_RUNNING) {
-        if (current_used_chan != c) {
-            c->flags &= ~KB_FLAG_UPPER_ACTIVE;
-        } else {
-            c->flags |= KB_FLAG_UPPER_ACTIVE;
-        }
-
-        c = current_used_chan;
+    kb_x86_mixer* const m = mp;
 
-        c->flags |= KB_FLAG_STOP_AFTER_VOLRAMP;
-
-        c->ramp_num_samples = RAMP_MAX_DURATION * mixfreq;
-        if (c->ramp_num_samples == 0) {
-            c->ramp_num_samples = 1;
-        }
-        c->rampdestleft = 0;
-        c->rampdestright = 0;
-        c->rampleft = (c->rampdestleft - c->volleft) / c->ramp_num_samples;
-        c->rampright = (c->rampdestright - c->volright) / c->ramp_num_samples;
-    }
+    kb_x86_detach_voice(m, channel);
 }
 
 static void
-kb_x86_setsmplpos(int channel,
+kb_x86_setsmplpos(void* mp,
+    int channel,
     guint32 offset)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const m = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(m, channel);
 
-    if (c->sample && c->flags != 0) {
-        if (offset < c->sample->length) {
+    if (c->buffer && (c->flags & ~KB_FLAG_ACTIVE) != 0) {
+        if (offset < c->buffer->length) {
             c->positionw = offset;
             c->positionf = 0;
             c->direction = 1;
@@ -304,19 +549,21 @@ kb_x86_setsmplpos(int channel,
                 c->flags |= KB_FLAG_DO_SAMPLE_START_DECLICK;
             }
         } else {
-            c->flags &= KB_FLAG_UPPER_ACTIVE;
+            c->flags &= KB_FLAG_ACTIVE;
         }
     }
 }
 
 static void
-kb_x86_setsmplend(int channel,
+kb_x86_setsmplend(void* mp,
+    int channel,
     guint32 offset)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const m = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(m, channel);
 
-    if (c->sample && c->flags != 0) {
-        if (c->positionw != 0 || offset < c->sample->length) {
+    if (c->buffer && (c->flags & ~KB_FLAG_ACTIVE) != 0) {
+        if (c->positionw != 0 || offset < c->buffer->length) {
             // only end if the selection is not the whole sample
             c->playend = offset;
         }
@@ -324,19 +571,22 @@ kb_x86_setsmplend(int channel,
 }
 
 static void
-kb_x86_setfreq(int channel,
+kb_x86_setfreq(void* mp,
+    int channel,
     float frequency)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const m = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(m, channel);
 
-    frequency /= mixfreq;
+    frequency /= m->mixfreq;
 
     c->freqw = (guint32)floor(frequency);
     c->freqf = (guint32)((frequency - c->freqw) * 4294967296.0 /* this is pow(2,32) */);
 }
 
 static void
-kb_x86_redo_vol_fields(kb_x86_channel* c)
+kb_x86_redo_vol_fields(kb_x86_mixer* m,
+    kb_x86_channel* c)
 {
     c->rampdestleft = c->volume * (1.0 - c->panning);
     c->rampdestright = c->volume * c->panning;
@@ -347,7 +597,7 @@ kb_x86_redo_vol_fields(kb_x86_channel* c)
         c->volleft = c->rampdestleft;
         c->volright = c->rampdestright;
     } else {
-        c->ramp_num_samples = RAMP_MAX_DURATION * mixfreq;
+        c->ramp_num_samples = RAMP_MAX_DURATION * m->mixfreq;
         if (c->ramp_num_samples == 0) {
             c->ramp_num_samples = 1;
         }
@@ -357,30 +607,36 @@ kb_x86_redo_vol_fields(kb_x86_channel* c)
 }
 
 static void
-kb_x86_setvolume(int channel,
+kb_x86_setvolume(void* mp,
+    int channel,
     float volume)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const m = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(m, channel);
 
     c->volume = volume;
-    kb_x86_redo_vol_fields(c);
+    kb_x86_redo_vol_fields(m, c);
 }
 
 static void
-kb_x86_setpanning(int channel,
+kb_x86_setpanning(void* mp,
+    int channel,
     float panning)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const m = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(m, channel);
 
     c->panning = 0.5 * (panning + 1.0);
-    kb_x86_redo_vol_fields(c);
+    kb_x86_redo_vol_fields(m, c);
 }
 
 static void
-kb_x86_setchcutoff(int channel,
+kb_x86_setchcutoff(void* mp,
+    int channel,
     float freq)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const m = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(m, channel);
 
     if (freq < 0.0) {
         c->ffreq = 1.0;
@@ -394,10 +650,12 @@ kb_x86_setchcutoff(int channel,
 }
 
 static void
-kb_x86_setchreso(int channel,
+kb_x86_setchreso(void* mp,
+    int channel,
     float reso)
 {
-    kb_x86_channel* c = kb_x86_get_channel_struct(channel);
+    kb_x86_mixer* const m = mp;
+    kb_x86_channel* c = kb_x86_get_channel_struct(m, channel);
 
     g_assert(0.0 <= reso);
     g_assert(reso <= 1.0);
@@ -422,6 +680,17 @@ kb_x86_debug_dump_buffer(gint16* buffer,
 }
 #endif
 
+/* Sample value j, 8 bit data scaled to 16 bit */
+static inline gint16
+kb_x86_sample_value(st_mixer_sample_buffer* b,
+    gint32 j)
+{
+    if (b->format == ST_MIXER_SAMPLE_FORMAT_8) {
+        return ((gint8*)b->data)[j] * 256;
+    }
+    return ((gint16*)b->data)[j];
+}
+
 static void
 kb_x86_call_mixer(kb_x86_channel* ch,
     kb_x86_mixer_data* md,
@@ -430,11 +699,44 @@ kb_x86_call_mixer(kb_x86_channel* ch,
     if (!forward) {
         md->flags |= KB_X86_MIXER_FLAGS_BACKWARD;
     }
+#if !defined(NO_ASM) && defined(__i386__)
+    /* The assembler routines know 16 bit samples only */
+    if (md->flags & KB_X86_MIXER_FLAGS_8BIT) {
+        kbfloat_mix(md);
+    } else {
+        kbasm_mix(md);
+    }
+#else
     kbasm_mix(md);
+#endif
     ch->volleft = md->volleft;
     ch->volright = md->volright;
 }
 
+/* Points the mixer right into the sample data */
+static inline void
+kb_x86_set_position(kb_x86_mixer_data* md,
+    st_mixer_sample_buffer* b,
+    gint32 pos)
+{
+    if (b->format == ST_MIXER_SAMPLE_FORMAT_8) {
+        md->flags |= KB_X86_MIXER_FLAGS_8BIT;
+        md->positioni8 = (gint8*)b->data + pos;
+    } else {
+        md->positioni = (gint16*)b->data + pos;
+    }
+}
+
+static inline gint32
+kb_x86_get_position(kb_x86_mixer_data* md,
+    st_mixer_sample_buffer* b)
+{
+    if (md->flags & KB_X86_MIXER_FLAGS_8BIT) {
+        return md->positioni8 - (gint8*)b->data;
+    }
+    return md->positioni - (gint16*)b->data;
+}
+
 static guint32
 kb_x86_mix_sub(kb_x86_channel* ch,
     guint32 num_samples_left,
@@ -447,11 +749,11 @@ kb_x86_mix_sub(kb_x86_channel* ch,
     const gboolean loopit = (ch->playend == 0) && (ch->flags & (KB_FLAG_LOOP_UNIDIRECTIONAL | KB_FLAG_LOOP_BIDIRECTIONAL));
     const gboolean gonnapingpong = loopit && (ch->flags & KB_FLAG_LOOP_BIDIRECTIONAL);
 
-    const gint64 lstart64 = ((guint64)ch->sample->loopstart) << 32;
+    const gint64 lstart64 = ((guint64)ch->buffer->loopstart) << 32;
     const gint32 pos = ch->positionw;
     const gint64 freq64 = (((guint64)ch->freqw) << 32) + (guint64)ch->freqf;
     const gint64 pos64 = ((guint64)(ch->positionw) << 32) + (guint64)ch->positionf;
-    const gint32 ende = (ch->playend != 0) ? (ch->playend) : (loopit ? ch->sample->loopend : ch->length);
+    const gint32 ende = (ch->playend != 0) ? (ch->playend) : (loopit ? ch->buffer->loopend : ch->buffer->length);
     const gint64 ende64 = (guint64)ende << 32;
 
     int num_samples;
@@ -494,7 +796,7 @@ kb_x86_mix_sub(kb_x86_channel* ch,
     }
 
     if ((ch->direction == 1 && pos >= ende - KB_X86_SAMPLE_PADDING)
-        || (ch->direction == -1 && pos < (gint32)(ch->sample->loopstart + KB_X86_SAMPLE_PADDING))) {
+        || (ch->direction == -1 && pos < (gint32)(ch->buffer->loopstart + KB_X86_SAMPLE_PADDING))) {
         /* This is the dangerous case. We are near one of the ends of
 	   a loop or sample (we might even have crossed it
 	   already!). We have to take care of handling the looping and
@@ -516,7 +818,7 @@ kb_x86_mix_sub(kb_x86_channel* ch,
 	       frequencies. */
             gboolean touched = FALSE;
             gint64 mypos64 = ((guint64)(ch->positionw) << 32) + (guint64)ch->positionf;
-            gint64 lend64 = (((guint64)ch->sample->loopend) << 32) - 1;
+            gint64 lend64 = (((guint64)ch->buffer->loopend) << 32) - 1;
 
             while (1) {
                 if (ch->direction == 1 && mypos64 >= lend64) {
@@ -545,9 +847,9 @@ kb_x86_mix_sub(kb_x86_channel* ch,
         } else if (loopit) {
             /* The unidirectional ("Amiga") loop case. */
             gboolean touched = FALSE;
-            guint32 looplen = ch->sample->loopend - ch->sample->loopstart;
+            guint32 looplen = ch->buffer->loopend - ch->buffer->loopstart;
 
-            while (ch->positionw >= ch->sample->loopend) {
+            while (ch->positionw >= ch->buffer->loopend) {
                 ch->positionw -= looplen;
                 touched = TRUE;
             }
@@ -559,15 +861,16 @@ kb_x86_mix_sub(kb_x86_channel* ch,
         } else {
             if (ch->positionw >= ende) {
                 /* A sample without loop has just ended. */
-                ch->flags &= KB_FLAG_UPPER_ACTIVE;
+                ch->flags &= KB_FLAG_ACTIVE;
                 return num_samples_left;
             }
         }
 
         /* The following code is concerned with doing the fake sample
-	   stuff for correct handling of the loop incontinuities. */
+	   stuff for correct handling of the loop incontinuities. The
+	   copy is always 16 bit. */
         if (loopit || gonnapingpong) {
-            g_assert(pos < ch->sample->loopend);
+            g_assert(pos < ch->buffer->loopend);
         }
 
         if (gonnapingpong) {
@@ -579,14 +882,14 @@ kb_x86_mix_sub(kb_x86_channel* ch,
                 bufferpt += (sizeof(buffer) / sizeof(buffer[0])) - 1;
             }
             for (i = 0, j = pos; i < sizeof(buffer) / sizeof(buffer[0]); i++) {
-                *bufferpt = ((gint16*)ch->sample->data)[j];
+                *bufferpt = kb_x86_sample_value(ch->buffer, j);
                 if (dir == +1) {
-                    if (++j >= ch->sample->loopend) {
+                    if (++j >= ch->buffer->loopend) {
                         dir = -1;
                         j--;
                     }
                 } else {
-                    if (--j < (gint32)ch->sample->loopstart) {
+                    if (--j < (gint32)ch->buffer->loopstart) {
                         j++;
                         dir = +1;
                     }
@@ -595,10 +898,10 @@ kb_x86_mix_sub(kb_x86_channel* ch,
             }
         } else {
             for (i = 0, j = pos; i < sizeof(buffer) / sizeof(buffer[0]); i++) {
-                buffer[i] = ((gint16*)ch->sample->data)[j];
+                buffer[i] = kb_x86_sample_value(ch->buffer, j);
                 if (++j >= ende) {
                     if (loopit) {
-                        j -= (ch->sample->loopend - ch->sample->loopstart);
+                        j -= (ch->buffer->loopend - ch->buffer->loopstart);
                     } else {
                         j--;
                     }
@@ -654,7 +957,7 @@ kb_x86_mix_sub(kb_x86_channel* ch,
                 num_samples = num_samples_left;
             }
 
-            md.positioni = (gint16*)ch->sample->data + pos;
+            kb_x86_set_position(&md, ch->buffer, pos);
             md.numsamples = num_samples;
             kb_x86_call_mixer(ch, &md, TRUE);
         } else {
@@ -662,22 +965,22 @@ kb_x86_mix_sub(kb_x86_channel* ch,
             const gint64 wieweit64 = pos64 - freq64 * num_samples_left;
             const gint32 wieweit = wieweit64 >> 32;
 
-            if (wieweit < (gint32)(ch->sample->loopstart + KB_X86_SAMPLE_PADDING)) {
-                num_samples = 1 + (pos64 - (((guint64)KB_X86_SAMPLE_PADDING + ch->sample->loopstart) << 32)) / freq64;
+            if (wieweit < (gint32)(ch->buffer->loopstart + KB_X86_SAMPLE_PADDING)) {
+                num_samples = 1 + (pos64 - (((guint64)KB_X86_SAMPLE_PADDING + ch->buffer->loopstart) << 32)) / freq64;
                 g_assert(num_samples > 0);
-                g_assert(pos64 - freq64 * (gint64)(num_samples) < ((gint64)(ch->sample->loopstart + KB_X86_SAMPLE_PADDING) << 32));
-                g_assert(pos64 - freq64 * (gint64)(num_samples - 1) >= ((gint64)(ch->sample->loopstart + KB_X86_SAMPLE_PADDING) << 32));
+                g_assert(pos64 - freq64 * (gint64)(num_samples) < ((gint64)(ch->buffer->loopstart + KB_X86_SAMPLE_PADDING) << 32));
+                g_assert(pos64 - freq64 * (gint64)(num_samples - 1) >= ((gint64)(ch->buffer->loopstart + KB_X86_SAMPLE_PADDING) << 32));
                 num_samples = MIN(num_samples_left, num_samples);
             } else {
                 num_samples = num_samples_left;
             }
 
-            md.positioni = (gint16*)ch->sample->data + pos;
+            kb_x86_set_position(&md, ch->buffer, pos);
             md.numsamples = num_samples;
             kb_x86_call_mixer(ch, &md, FALSE);
         }
 
-        ch->positionw = md.positioni - (gint16*)ch->sample->data;
+        ch->positionw = kb_x86_get_position(&md, ch->buffer);
         ch->positionf = md.positionf;
         ch->volleft = md.volleft;
         ch->volright = md.volright;
@@ -688,112 +991,241 @@ kb_x86_mix_sub(kb_x86_channel* ch,
     }
 }
 
-static void*
-kb_x86_mix(void* dest,
+static void
+kb_x86_mix_voice(kb_x86_mixer* m,
+    kb_x86_channel* ch,
+    float* tempbuf,
     guint32 count,
     gint16* scopebufs[],
     int scopebuf_offset)
 {
-    int chnr;
+    int num_samples_left = count;
+    gint16* scopedata = NULL;
 
-    if (count > kb_x86_tempbufsize) {
-        free(kb_x86_tempbuf);
-        kb_x86_tempbufsize = count;
-        kb_x86_tempbuf = malloc(2 * sizeof(float) * kb_x86_tempbufsize);
+    if (ch->channel >= m->num_channels || !(ch->flags & KB_FLAG_SAMPLE_RUNNING))
+        return;
+
+    // Only the current voice of a pattern channel is shown in its scope
+    if (scopebufs && kb_x86_is_current(m, ch)) {
+        scopedata = scopebufs[ch->channel] + scopebuf_offset;
     }
 
-    memset(kb_x86_tempbuf, 0, 2 * sizeof(float) * count);
+    if (ch->flags & KB_FLAG_JUST_STARTED) {
+        if (ch->flags & KB_FLAG_DO_SAMPLE_START_DECLICK) {
+            ch->ramp_num_samples = RAMP_MAX_DURATION * m->mixfreq;
+            if (ch->ramp_num_samples == 0) {
+                ch->ramp_num_samples = 1;
+            }
+            ch->volleft = 0.0;
+            ch->volright = 0.0;
+            ch->rampleft = (ch->rampdestleft - ch->volleft) / ch->ramp_num_samples;
+            ch->rampright = (ch->rampdestright - ch->volright) / ch->ramp_num_samples;
+        }
 
-    for (chnr = 0; chnr < 2 * 32; chnr++) {
-        kb_x86_channel* ch = channels + chnr;
-        float* tempbuf = kb_x86_tempbuf;
-        int num_samples_left = count;
-        gint16* scopedata = NULL;
+        ch->flags &= ~KB_FLAG_JUST_STARTED;
+    }
 
-        if ((chnr & 31) >= num_channels)
-            continue;
+    while (num_samples_left && (ch->flags & KB_FLAG_SAMPLE_RUNNING)) {
+        int num_samples = 0;
+        gboolean vol_ramping = (ch->ramp_num_samples != 0);
+        int max_samples_this_time = vol_ramping ? MIN(ch->ramp_num_samples, num_samples_left) : num_samples_left;
+
+        num_samples = kb_x86_mix_sub(ch,
+            max_samples_this_time, vol_ramping,
+            tempbuf, scopedata);
+
+        if (vol_ramping) {
+            ch->ramp_num_samples -= num_samples;
+            if (ch->ramp_num_samples == 0) {
+                /* Volume ramping finished. */
+                ch->volleft = ch->rampdestleft;
+                ch->volright = ch->rampdestright;
+                if (ch->flags & KB_FLAG_STOP_AFTER_VOLRAMP) {
+                    /* This was only a declicking voice. Stop sample. */
+                    ch->flags &= KB_FLAG_ACTIVE;
+                }
+            }
+        }
 
-        if (scopebufs && (chnr < 32 || (channels[chnr - 32].flags & KB_FLAG_UPPER_ACTIVE))) {
-            scopedata = scopebufs[chnr & 31] + scopebuf_offset;
+        num_samples_left -= num_samples;
+        tempbuf += (num_samples * 2);
+        if (scopedata) {
+            scopedata += num_samples;
         }
+    }
 
-        if (!(ch->flags & KB_FLAG_SAMPLE_RUNNING)) {
-            if (scopedata) {
-                memset(scopedata, 0, 2 * num_samples_left);
-            }
-            continue;
+    if (scopedata) {
+        memset(scopedata, 0, 2 * num_samples_left);
+    }
+}
+
+#ifdef KB_X86_PARALLEL
+
+typedef struct kb_x86_job {
+    kb_x86_mixer* m;
+    float* dest; // accumulator of part 0
+    guint32 count;
+    gint16** scopebufs;
+    int scopebuf_offset;
+    int num_parts;
+} kb_x86_job;
+
+static void
+kb_x86_mix_part(void* jp,
+    int part)
+{
+    kb_x86_job* const j = jp;
+    kb_x86_mixer* const m = j->m;
+    float* buf = part ? m->partbufs + (part - 1) * 2 * KB_X86_PART_FRAMES : j->dest;
+    int i;
+
+    memset(buf, 0, 2 * sizeof(float) * j->count);
+
+    /* Every pattern channel has only one voice writing to its scope,
+       so the voices can be distributed freely. */
+    for (i = part; i < m->num_active; i += j->num_parts) {
+        kb_x86_mix_voice(m, m->voices + m->active[i], buf, j->count, j->scopebufs, j->scopebuf_offset);
+    }
+}
+
+static void
+kb_x86_add_buffer(float* dest,
+    const float* src,
+    guint32 count)
+{
+    if (!kbfloat_simd_add(dest, src, count)) {
+        guint32 i;
+
+        for (i = 0; i < 2 * count; i++) {
+            dest[i] += src[i];
         }
+    }
+}
 
-        if (ch->flags & KB_FLAG_JUST_STARTED) {
-            if (ch->flags & KB_FLAG_DO_SAMPLE_START_DECLICK) {
-                ch->ramp_num_samples = RAMP_MAX_DURATION * mixfreq;
-                if (ch->ramp_num_samples == 0) {
-                    ch->ramp_num_samples = 1;
-                }
-                ch->volleft = 0.0;
-                ch->volright = 0.0;
-                ch->rampleft = (ch->rampdestleft - ch->volleft) / ch->ramp_num_samples;
-                ch->rampright = (ch->rampdestright - ch->volright) / ch->ramp_num_samples;
-            }
+/* Distributes the active voices over the mixing threads; each part is
+   mixed into its own buffer, the buffers are summed up afterwards.
+   This is done KB_X86_PART_FRAMES output samples at a time, so the
+   buffers never have to grow while mixing. Returns the number of
+   samples mixed into m->tempbuf; the caller mixes the rest on its
+   own, which is all of them if parallel mixing doesn't pay off. The
+   result differs from serial mixing in the order of the floating
+   point additions only. */
+static guint32
+kb_x86_mix_parallel(kb_x86_mixer* m,
+    guint32 count,
+    gint16* scopebufs[],
+    int scopebuf_offset)
+{
+    mix_pool* pool = mix_pool_get();
+    kb_x86_job j;
+    guint32 done;
+    int i;
+
+    if (!pool || !m->partbufs) {
+        return 0;
+    }
 
-            ch->flags &= ~KB_FLAG_JUST_STARTED;
+    j.num_parts = MIN(mix_pool_get_num_parts(pool), m->num_active / KB_X86_PARALLEL_MIN_VOICES);
+    j.num_parts = MIN(j.num_parts, (int)((guint64)m->num_active * MIN(count, KB_X86_PART_FRAMES) / KB_X86_PARALLEL_MIN_WORK));
+    if (j.num_parts < 2) {
+        return 0;
+    }
+
+    j.m = m;
+    j.scopebufs = scopebufs;
+
+    for (done = 0; done < count; done += j.count) {
+        j.dest = m->tempbuf + 2 * done;
+        j.count = MIN(count - done, KB_X86_PART_FRAMES);
+        j.scopebuf_offset = scopebuf_offset + done;
+
+        if (!mix_pool_run(pool, kb_x86_mix_part, &j, j.num_parts)) {
+            break;
         }
 
-        g_assert(&ch->sample->lock);
-        g_mutex_lock(&ch->sample->lock);
-
-        while (num_samples_left && (ch->flags & KB_FLAG_SAMPLE_RUNNING)) {
-            int num_samples = 0;
-            gboolean vol_ramping = (ch->ramp_num_samples != 0);
-            int max_samples_this_time = vol_ramping ? MIN(ch->ramp_num_samples, num_samples_left) : num_samples_left;
-
-            num_samples = kb_x86_mix_sub(ch,
-                max_samples_this_time, vol_ramping,
-                tempbuf, scopedata);
-
-            if (vol_ramping) {
-                ch->ramp_num_samples -= num_samples;
-                if (ch->ramp_num_samples == 0) {
-                    /* Volume ramping finished. */
-                    ch->volleft = ch->rampdestleft;
-                    ch->volright = ch->rampdestright;
-                    if (ch->flags & KB_FLAG_STOP_AFTER_VOLRAMP) {
-                        /* This was only a declicking channel. Stop sample. */
-                        ch->flags &= KB_FLAG_UPPER_ACTIVE;
-                    }
-                }
-            }
+        for (i = 1; i < j.num_parts; i++) {
+            kb_x86_add_buffer(j.dest, m->partbufs + (i - 1) * 2 * KB_X86_PART_FRAMES, j.count);
+        }
+    }
+
+    return done;
+}
+
+#endif /* KB_X86_PARALLEL */
+
+static void*
+kb_x86_mix(void* mp,
+    void* dest,
+    guint32 count,
+    gint16* scopebufs[],
+    int scopebuf_offset)
+{
+    kb_x86_mixer* const m = mp;
+    guint32 done = 0;
+    int i;
+
+    if (count > m->tempbufsize) {
+        free(m->tempbuf);
+        m->tempbufsize = count;
+        m->tempbuf = malloc(2 * sizeof(float) * m->tempbufsize);
+    }
+
+    kb_x86_sync_samples(m);
+
+    /* The scopes of the silent channels are left alone */
+    m->scopemask = 0;
+    if (scopebufs) {
+        for (i = 0; i < m->num_active; i++) {
+            kb_x86_channel* v = m->voices + m->active[i];
 
-            num_samples_left -= num_samples;
-            tempbuf += (num_samples * 2);
-            if (scopedata) {
-                scopedata += num_samples;
+            if ((v->flags & KB_FLAG_SAMPLE_RUNNING) && v->channel < m->num_channels && kb_x86_is_current(m, v)) {
+                m->scopemask |= 1 << v->channel;
             }
         }
+    }
+
+#ifdef KB_X86_PARALLEL
+    done = kb_x86_mix_parallel(m, count, scopebufs, scopebuf_offset);
+#endif
+
+    if (done < count) {
+        memset(m->tempbuf + 2 * done, 0, 2 * sizeof(float) * (count - done));
+
+        for (i = 0; i < m->num_active; i++) {
+            kb_x86_mix_voice(m, m->voices + m->active[i], m->tempbuf + 2 * done, count - done, scopebufs, scopebuf_offset + done);
+        }
+    }
 
-        g_mutex_unlock(&ch->sample->lock);
+    kb_x86_cleanup_voices(m);
+
+    if (m->float_output) {
+        m->clipflag = kbasm_post_mixing_float(m->tempbuf, (float*)dest, count, m->amplification);
+        return dest + count * 2 * sizeof(float);
     }
 
-    clipflag = kbasm_post_mixing(kb_x86_tempbuf, (gint16*)dest, count, kb_x86_amplification);
+    m->clipflag = kbasm_post_mixing(m->tempbuf, (gint16*)dest, count, m->amplification);
 
     return dest + count * 2 * 2;
 }
 
-void kb_x86_dumpstatus(st_mixer_channel_status array[])
+static void
+kb_x86_dumpstatus(void* mp,
+    st_mixer_channel_status array[])
 {
+    kb_x86_mixer* const m = mp;
     int i;
     gint32 pos;
 
     for (i = 0; i < 32; i++) {
-        kb_x86_channel* c = kb_x86_get_channel_struct(i);
+        kb_x86_channel* c = kb_x86_get_channel_struct(m, i);
 
         if (c->flags & KB_FLAG_SAMPLE_RUNNING) {
             array[i].current_sample = c->sample;
             pos = c->positionw;
             if (pos < 0) {
                 pos = 0;
-            } else if (pos >= c->sample->length) {
-                pos = c->sample->length - 1;
+            } else if (pos >= c->buffer->length) {
+                pos = c->buffer->length - 1;
             }
             array[i].current_position = pos;
         } else {
@@ -803,20 +1235,20 @@ void kb_x86_dumpstatus(st_mixer_channel_status array[])
 }
 
 static void
-kb_x86_loadchsettings(int ch)
+kb_x86_loadchsettings(void* mp,
+    int ch,
+    const tracer_channel* tch)
 {
-    tracer_channel* tch;
+    kb_x86_mixer* const m = mp;
     kb_x86_channel* kbch;
 
-    g_assert(ch < num_channels);
+    g_assert(ch < m->num_channels);
 
-    tch = tracer_return_channel(ch);
-    kbch = kb_x86_get_channel_struct(ch);
+    kbch = kb_x86_get_channel_struct(m, ch);
 
     kbch->sample = tch->sample;
-    kbch->data = tch->data;
-    kbch->looptype = tch->looptype;
-    kbch->length = tch->length;
+    st_mixer_sample_buffer_unref(kbch->buffer);
+    kbch->buffer = tch->sample ? st_mixer_sample_acquire(tch->sample) : NULL;
     kbch->volume = tch->volume;
     kbch->panning = tch->panning;
     kbch->direction = tch->direction;
@@ -828,15 +1260,30 @@ kb_x86_loadchsettings(int ch)
     kbch->ffreq = tch->ffreq;
     kbch->freso = tch->freso;
 
-    kbch->flags = (kbch->flags & KB_FLAG_UPPER_ACTIVE) | KB_FLAG_JUST_STARTED | ((tch->flags & TR_FLAG_LOOP_UNIDIRECTIONAL) ? KB_FLAG_LOOP_UNIDIRECTIONAL : 0) | ((tch->flags & TR_FLAG_LOOP_BIDIRECTIONAL) ? KB_FLAG_LOOP_BIDIRECTIONAL : 0) | ((tch->flags & TR_FLAG_SAMPLE_RUNNING) ? KB_FLAG_SAMPLE_RUNNING : 0);
+    kbch->flags = (kbch->flags & KB_FLAG_ACTIVE) | KB_FLAG_JUST_STARTED | ((tch->flags & TR_FLAG_LOOP_UNIDIRECTIONAL) ? KB_FLAG_LOOP_UNIDIRECTIONAL : 0) | ((tch->flags & TR_FLAG_LOOP_BIDIRECTIONAL) ? KB_FLAG_LOOP_BIDIRECTIONAL : 0) | ((tch->flags & TR_FLAG_SAMPLE_RUNNING) ? KB_FLAG_SAMPLE_RUNNING : 0);
 
-    kb_x86_redo_vol_fields(kbch);
+    /* The sample may have been changed since it was traced */
+    if (!kbch->buffer || kbch->buffer->data != tch->data || kbch->buffer->length != tch->length) {
+        kbch->flags &= KB_FLAG_ACTIVE;
+    }
+    if (!(kbch->flags & KB_FLAG_SAMPLE_RUNNING)) {
+        st_mixer_sample_buffer_unref(kbch->buffer);
+        kbch->buffer = NULL;
+    }
+
+    kb_x86_redo_vol_fields(m, kbch);
+
+    if (kbch->flags & KB_FLAG_SAMPLE_RUNNING) {
+        kb_x86_activate(m, kbch);
+    }
 }
 
 st_mixer mixer_kbfloat = {
     "kbfloat",
     N_("High-quality FPU mixer, cubic interpolation, IT filters, unlimited length samples"),
 
+    kb_x86_new,
+    kb_x86_destroy,
     kb_x86_setnumch,
     kb_x86_updatesample,
     kb_x86_setmixformat,
@@ -844,6 +1291,7 @@ st_mixer mixer_kbfloat = {
     kb_x86_setmixfreq,
     kb_x86_setampfactor,
     kb_x86_getclipflag,
+    kb_x86_getscopemask,
     kb_x86_reset,
     kb_x86_startnote,
     kb_x86_stopnote,
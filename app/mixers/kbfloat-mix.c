@@ -26,8 +26,19 @@
 
 #include "kb-x86-asm.h"
 
+/* The vectorized routines in kbfloat-simd.c have to produce exactly
+   the same results as the code below, so the compiler must not fuse
+   multiplications and additions here on its own. */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
 #if defined(NO_ASM) || !defined(__i386__)
 
+#include "kbfloat-simd.h"
+
 gboolean
 kbasm_post_mixing(float* tempbuf,
     gint16* outbuf,
@@ -36,6 +47,10 @@ kbasm_post_mixing(float* tempbuf,
 {
     gboolean clipped = FALSE;
 
+    if (kbfloat_simd_post_mixing(tempbuf, outbuf, n, amp, &clipped)) {
+        return clipped;
+    }
+
     n *= 2;
 
     while (n--) {
@@ -54,8 +69,17 @@ kbasm_post_mixing(float* tempbuf,
     return clipped;
 }
 
-#define CUBICMIXER_COMMON_HEAD           \
-    gint16* positioni = data->positioni; \
+void kbasm_mix(kb_x86_mixer_data* data)
+{
+    if (!kbfloat_simd_mix(data)) {
+        kbfloat_mix(data);
+    }
+}
+
+#endif
+
+#define CUBICMIXER_COMMON_HEAD(type, field) \
+    type* positioni = data->field;       \
     guint32 positionf = data->positionf; \
     float* mixbuffer = data->mixbuffer;  \
     float fl1 = data->fl1;               \
@@ -64,22 +88,30 @@ kbasm_post_mixing(float* tempbuf,
     float volr = data->volright;         \
     unsigned n = data->numsamples;
 
+#define CUBICMIXER_SCOPES_HEAD \
+    gint16* scopebuf = data->scopebuf;
+
 #define CUBICMIXER_COMMON_LOOP_START \
     while (n--) {                    \
         float s0;                    \
         guint32 positionf_new;
 
-#define CUBICMIXER_LOOP_FORWARD                       \
-    s0 = positioni[0] * kb_x86_ct0[positionf >> 24];  \
-    s0 += positioni[1] * kb_x86_ct1[positionf >> 24]; \
-    s0 += positioni[2] * kb_x86_ct2[positionf >> 24]; \
-    s0 += positioni[3] * kb_x86_ct3[positionf >> 24];
+#define CUBICMIXER_COMMON_LOOP_END \
+    }
+
+/* 8 bit samples are scaled to 16 bit before the interpolation, which
+   gives the same results as mixing the widened data */
+#define CUBICMIXER_LOOP_FORWARD                                   \
+    s0 = (positioni[0] * scale) * kb_x86_ct0[positionf >> 24];  \
+    s0 += (positioni[1] * scale) * kb_x86_ct1[positionf >> 24]; \
+    s0 += (positioni[2] * scale) * kb_x86_ct2[positionf >> 24]; \
+    s0 += (positioni[3] * scale) * kb_x86_ct3[positionf >> 24];
 
-#define CUBICMIXER_LOOP_BACKWARD                        \
-    s0 = positioni[0] * kb_x86_ct0[-positionf >> 24];   \
-    s0 += positioni[-1] * kb_x86_ct1[-positionf >> 24]; \
-    s0 += positioni[-2] * kb_x86_ct2[-positionf >> 24]; \
-    s0 += positioni[-3] * kb_x86_ct3[-positionf >> 24];
+#define CUBICMIXER_LOOP_BACKWARD                                    \
+    s0 = (positioni[0] * scale) * kb_x86_ct0[-positionf >> 24];   \
+    s0 += (positioni[-1] * scale) * kb_x86_ct1[-positionf >> 24]; \
+    s0 += (positioni[-2] * scale) * kb_x86_ct2[-positionf >> 24]; \
+    s0 += (positioni[-3] * scale) * kb_x86_ct3[-positionf >> 24];
 
 #define CUBICMIXER_ADVANCE_POINTER           \
     positionf_new = positionf + data->freqf; \
@@ -105,268 +137,151 @@ kbasm_post_mixing(float* tempbuf,
     voll += data->volrampl; \
     volr += data->volrampr;
 
-#define CUBICMIXER_COMMON_FOOT   \
-    data->volleft = voll;        \
-    data->volright = volr;       \
-    data->positioni = positioni; \
-    data->positionf = positionf; \
-    data->mixbuffer = mixbuffer; \
-    data->fl1 = fl1;             \
+#define CUBICMIXER_COMMON_FOOT(field) \
+    data->volleft = voll;             \
+    data->volright = volr;            \
+    data->field = positioni;          \
+    data->positionf = positionf;      \
+    data->mixbuffer = mixbuffer;      \
+    data->fl1 = fl1;                  \
     data->fb1 = fb1;
 
-/* --- 0 --- */
-static void
-kbfloat_mix_cubic_noscopes_unfiltered_forward_noramp(kb_x86_mixer_data* data) {
-    CUBICMIXER_COMMON_HEAD
-
-        CUBICMIXER_COMMON_LOOP_START
-            CUBICMIXER_LOOP_FORWARD
-                CUBICMIXER_ADVANCE_POINTER
-                    CUBICMIXER_WRITE_OUT
-}
-
-CUBICMIXER_COMMON_FOOT
-}
-
-static void
-kbfloat_mix_cubic_noscopes_unfiltered_backward_noramp(kb_x86_mixer_data* data) {
-    CUBICMIXER_COMMON_HEAD
-
-        CUBICMIXER_COMMON_LOOP_START
-            CUBICMIXER_LOOP_BACKWARD
-                CUBICMIXER_ADVANCE_POINTER
-                    CUBICMIXER_WRITE_OUT
-}
-
-CUBICMIXER_COMMON_FOOT
-}
-
-static void
-kbfloat_mix_cubic_noscopes_filtered_forward_noramp(kb_x86_mixer_data* data) {
-    CUBICMIXER_COMMON_HEAD
-
-        CUBICMIXER_COMMON_LOOP_START
-            CUBICMIXER_LOOP_FORWARD
-                CUBICMIXER_ADVANCE_POINTER
-                    CUBICMIXER_FILTER
-                        CUBICMIXER_WRITE_OUT
-}
+/* Defines the mixing routine name for 16 bit samples and name_8 for
+   8 bit ones */
+#define CUBICMIXER(name, head, body)              \
+    static void                                   \
+    name(kb_x86_mixer_data* data)                 \
+    {                                             \
+        const int scale = 1;                      \
+        CUBICMIXER_COMMON_HEAD(gint16, positioni) \
+        head                                      \
+        CUBICMIXER_COMMON_LOOP_START              \
+        body                                      \
+        CUBICMIXER_COMMON_LOOP_END                \
+        CUBICMIXER_COMMON_FOOT(positioni)         \
+    }                                             \
+                                                  \
+    static void                                   \
+    name##_8(kb_x86_mixer_data* data)             \
+    {                                             \
+        const int scale = 256;                    \
+        CUBICMIXER_COMMON_HEAD(gint8, positioni8) \
+        head                                      \
+        CUBICMIXER_COMMON_LOOP_START              \
+        body                                      \
+        CUBICMIXER_COMMON_LOOP_END                \
+        CUBICMIXER_COMMON_FOOT(positioni8)        \
+    }
 
-CUBICMIXER_COMMON_FOOT
-}
+/* --- 0 --- */
+CUBICMIXER(kbfloat_mix_cubic_noscopes_unfiltered_forward_noramp,,
+    CUBICMIXER_LOOP_FORWARD
+    CUBICMIXER_ADVANCE_POINTER
+    CUBICMIXER_WRITE_OUT)
 
-static void
-kbfloat_mix_cubic_noscopes_filtered_backward_noramp(kb_x86_mixer_data* data) {
-    CUBICMIXER_COMMON_HEAD
+CUBICMIXER(kbfloat_mix_cubic_noscopes_unfiltered_backward_noramp,,
+    CUBICMIXER_LOOP_BACKWARD
+    CUBICMIXER_ADVANCE_POINTER
+    CUBICMIXER_WRITE_OUT)
 
-        CUBICMIXER_COMMON_LOOP_START
-            CUBICMIXER_LOOP_BACKWARD
-                CUBICMIXER_ADVANCE_POINTER
-                    CUBICMIXER_FILTER
-                        CUBICMIXER_WRITE_OUT
-}
+CUBICMIXER(kbfloat_mix_cubic_noscopes_filtered_forward_noramp,,
+    CUBICMIXER_LOOP_FORWARD
+    CUBICMIXER_ADVANCE_POINTER
+    CUBICMIXER_FILTER
+    CUBICMIXER_WRITE_OUT)
 
-CUBICMIXER_COMMON_FOOT
-}
+CUBICMIXER(kbfloat_mix_cubic_noscopes_filtered_backward_noramp,,
+    CUBICMIXER_LOOP_BACKWARD
+    CUBICMIXER_ADVANCE_POINTER
+    CUBICMIXER_FILTER
+    CUBICMIXER_WRITE_OUT)
 
 /* --- 4 --- */
-static void
-kbfloat_mix_cubic_scopes_unfiltered_forward_noramp(kb_x86_mixer_data* data)
-{
-    CUBICMIXER_COMMON_HEAD
-    gint16* scopebuf = data->scopebuf;
-
-    CUBICMIXER_COMMON_LOOP_START
+CUBICMIXER(kbfloat_mix_cubic_scopes_unfiltered_forward_noramp, CUBICMIXER_SCOPES_HEAD,
     CUBICMIXER_LOOP_FORWARD
     CUBICMIXER_ADVANCE_POINTER
     CUBICMIXER_SCOPES
-    CUBICMIXER_WRITE_OUT
-}
-
-CUBICMIXER_COMMON_FOOT
-}
+    CUBICMIXER_WRITE_OUT)
 
-static void
-kbfloat_mix_cubic_scopes_unfiltered_backward_noramp(kb_x86_mixer_data* data)
-{
-    CUBICMIXER_COMMON_HEAD
-    gint16* scopebuf = data->scopebuf;
-
-    CUBICMIXER_COMMON_LOOP_START
+CUBICMIXER(kbfloat_mix_cubic_scopes_unfiltered_backward_noramp, CUBICMIXER_SCOPES_HEAD,
     CUBICMIXER_LOOP_BACKWARD
     CUBICMIXER_ADVANCE_POINTER
     CUBICMIXER_SCOPES
-    CUBICMIXER_WRITE_OUT
-}
-
-CUBICMIXER_COMMON_FOOT
-}
+    CUBICMIXER_WRITE_OUT)
 
-static void
-kbfloat_mix_cubic_scopes_filtered_forward_noramp(kb_x86_mixer_data* data)
-{
-    CUBICMIXER_COMMON_HEAD
-    gint16* scopebuf = data->scopebuf;
-
-    CUBICMIXER_COMMON_LOOP_START
+CUBICMIXER(kbfloat_mix_cubic_scopes_filtered_forward_noramp, CUBICMIXER_SCOPES_HEAD,
     CUBICMIXER_LOOP_FORWARD
     CUBICMIXER_ADVANCE_POINTER
     CUBICMIXER_FILTER
     CUBICMIXER_SCOPES
-    CUBICMIXER_WRITE_OUT
-}
+    CUBICMIXER_WRITE_OUT)
 
-CUBICMIXER_COMMON_FOOT
-}
-
-static void
-kbfloat_mix_cubic_scopes_filtered_backward_noramp(kb_x86_mixer_data* data)
-{
-    CUBICMIXER_COMMON_HEAD
-    gint16* scopebuf = data->scopebuf;
-
-    CUBICMIXER_COMMON_LOOP_START
+CUBICMIXER(kbfloat_mix_cubic_scopes_filtered_backward_noramp, CUBICMIXER_SCOPES_HEAD,
     CUBICMIXER_LOOP_BACKWARD
     CUBICMIXER_ADVANCE_POINTER
     CUBICMIXER_FILTER
     CUBICMIXER_SCOPES
-    CUBICMIXER_WRITE_OUT
-}
-
-CUBICMIXER_COMMON_FOOT
-}
+    CUBICMIXER_WRITE_OUT)
 
 /* --- 8 --- */
-static void
-kbfloat_mix_cubic_noscopes_unfiltered_forward(kb_x86_mixer_data* data) {
-    CUBICMIXER_COMMON_HEAD
-
-        CUBICMIXER_COMMON_LOOP_START
-            CUBICMIXER_LOOP_FORWARD
-                CUBICMIXER_ADVANCE_POINTER
-                    CUBICMIXER_WRITE_OUT
-                        CUBICMIXER_VOLRAMP
-}
-
-CUBICMIXER_COMMON_FOOT
-}
-
-static void
-kbfloat_mix_cubic_noscopes_unfiltered_backward(kb_x86_mixer_data* data) {
-    CUBICMIXER_COMMON_HEAD
-
-        CUBICMIXER_COMMON_LOOP_START
-            CUBICMIXER_LOOP_BACKWARD
-                CUBICMIXER_ADVANCE_POINTER
-                    CUBICMIXER_WRITE_OUT
-                        CUBICMIXER_VOLRAMP
-}
-
-CUBICMIXER_COMMON_FOOT
-}
-
-static void
-kbfloat_mix_cubic_noscopes_filtered_forward(kb_x86_mixer_data* data) {
-    CUBICMIXER_COMMON_HEAD
-
-        CUBICMIXER_COMMON_LOOP_START
-            CUBICMIXER_LOOP_FORWARD
-                CUBICMIXER_ADVANCE_POINTER
-                    CUBICMIXER_FILTER
-                        CUBICMIXER_WRITE_OUT
-                            CUBICMIXER_VOLRAMP
-}
-
-CUBICMIXER_COMMON_FOOT
-}
+CUBICMIXER(kbfloat_mix_cubic_noscopes_unfiltered_forward,,
+    CUBICMIXER_LOOP_FORWARD
+    CUBICMIXER_ADVANCE_POINTER
+    CUBICMIXER_WRITE_OUT
+    CUBICMIXER_VOLRAMP)
 
-static void
-kbfloat_mix_cubic_noscopes_filtered_backward(kb_x86_mixer_data* data) {
-    CUBICMIXER_COMMON_HEAD
+CUBICMIXER(kbfloat_mix_cubic_noscopes_unfiltered_backward,,
+    CUBICMIXER_LOOP_BACKWARD
+    CUBICMIXER_ADVANCE_POINTER
+    CUBICMIXER_WRITE_OUT
+    CUBICMIXER_VOLRAMP)
 
-        CUBICMIXER_COMMON_LOOP_START
-            CUBICMIXER_LOOP_BACKWARD
-                CUBICMIXER_ADVANCE_POINTER
-                    CUBICMIXER_FILTER
-                        CUBICMIXER_WRITE_OUT
-                            CUBICMIXER_VOLRAMP
-}
+CUBICMIXER(kbfloat_mix_cubic_noscopes_filtered_forward,,
+    CUBICMIXER_LOOP_FORWARD
+    CUBICMIXER_ADVANCE_POINTER
+    CUBICMIXER_FILTER
+    CUBICMIXER_WRITE_OUT
+    CUBICMIXER_VOLRAMP)
 
-CUBICMIXER_COMMON_FOOT
-}
+CUBICMIXER(kbfloat_mix_cubic_noscopes_filtered_backward,,
+    CUBICMIXER_LOOP_BACKWARD
+    CUBICMIXER_ADVANCE_POINTER
+    CUBICMIXER_FILTER
+    CUBICMIXER_WRITE_OUT
+    CUBICMIXER_VOLRAMP)
 
 /* --- 12 --- */
-static void
-kbfloat_mix_cubic_scopes_unfiltered_forward(kb_x86_mixer_data* data)
-{
-    CUBICMIXER_COMMON_HEAD
-    gint16* scopebuf = data->scopebuf;
-
-    CUBICMIXER_COMMON_LOOP_START
+CUBICMIXER(kbfloat_mix_cubic_scopes_unfiltered_forward, CUBICMIXER_SCOPES_HEAD,
     CUBICMIXER_LOOP_FORWARD
     CUBICMIXER_ADVANCE_POINTER
     CUBICMIXER_SCOPES
     CUBICMIXER_WRITE_OUT
-    CUBICMIXER_VOLRAMP
-}
-
-CUBICMIXER_COMMON_FOOT
-}
+    CUBICMIXER_VOLRAMP)
 
-static void
-kbfloat_mix_cubic_scopes_unfiltered_backward(kb_x86_mixer_data* data)
-{
-    CUBICMIXER_COMMON_HEAD
-    gint16* scopebuf = data->scopebuf;
-
-    CUBICMIXER_COMMON_LOOP_START
+CUBICMIXER(kbfloat_mix_cubic_scopes_unfiltered_backward, CUBICMIXER_SCOPES_HEAD,
     CUBICMIXER_LOOP_BACKWARD
     CUBICMIXER_ADVANCE_POINTER
     CUBICMIXER_SCOPES
     CUBICMIXER_WRITE_OUT
-    CUBICMIXER_VOLRAMP
-}
-
-CUBICMIXER_COMMON_FOOT
-}
+    CUBICMIXER_VOLRAMP)
 
-static void
-kbfloat_mix_cubic_scopes_filtered_forward(kb_x86_mixer_data* data)
-{
-    CUBICMIXER_COMMON_HEAD
-    gint16* scopebuf = data->scopebuf;
-
-    CUBICMIXER_COMMON_LOOP_START
+CUBICMIXER(kbfloat_mix_cubic_scopes_filtered_forward, CUBICMIXER_SCOPES_HEAD,
     CUBICMIXER_LOOP_FORWARD
     CUBICMIXER_ADVANCE_POINTER
     CUBICMIXER_FILTER
     CUBICMIXER_SCOPES
     CUBICMIXER_WRITE_OUT
-    CUBICMIXER_VOLRAMP
-}
+    CUBICMIXER_VOLRAMP)
 
-CUBICMIXER_COMMON_FOOT
-}
-
-static void
-kbfloat_mix_cubic_scopes_filtered_backward(kb_x86_mixer_data* data)
-{
-    CUBICMIXER_COMMON_HEAD
-    gint16* scopebuf = data->scopebuf;
-
-    CUBICMIXER_COMMON_LOOP_START
+CUBICMIXER(kbfloat_mix_cubic_scopes_filtered_backward, CUBICMIXER_SCOPES_HEAD,
     CUBICMIXER_LOOP_BACKWARD
     CUBICMIXER_ADVANCE_POINTER
     CUBICMIXER_FILTER
     CUBICMIXER_SCOPES
     CUBICMIXER_WRITE_OUT
-    CUBICMIXER_VOLRAMP
-}
-
-CUBICMIXER_COMMON_FOOT
-}
+    CUBICMIXER_VOLRAMP)
 
-static void (*kbfloat_mixers[16])(kb_x86_mixer_data*) = {
+static void (*kbfloat_mixers[32])(kb_x86_mixer_data*) = {
     kbfloat_mix_cubic_noscopes_unfiltered_forward_noramp,
     kbfloat_mix_cubic_noscopes_unfiltered_backward_noramp,
     kbfloat_mix_cubic_noscopes_filtered_forward_noramp,
@@ -382,12 +297,52 @@ static void (*kbfloat_mixers[16])(kb_x86_mixer_data*) = {
     kbfloat_mix_cubic_scopes_unfiltered_forward,
     kbfloat_mix_cubic_scopes_unfiltered_backward,
     kbfloat_mix_cubic_scopes_filtered_forward,
-    kbfloat_mix_cubic_scopes_filtered_backward
+    kbfloat_mix_cubic_scopes_filtered_backward,
+    kbfloat_mix_cubic_noscopes_unfiltered_forward_noramp_8,
+    kbfloat_mix_cubic_noscopes_unfiltered_backward_noramp_8,
+    kbfloat_mix_cubic_noscopes_filtered_forward_noramp_8,
+    kbfloat_mix_cubic_noscopes_filtered_backward_noramp_8,
+    kbfloat_mix_cubic_scopes_unfiltered_forward_noramp_8,
+    kbfloat_mix_cubic_scopes_unfiltered_backward_noramp_8,
+    kbfloat_mix_cubic_scopes_filtered_forward_noramp_8,
+    kbfloat_mix_cubic_scopes_filtered_backward_noramp_8,
+    kbfloat_mix_cubic_noscopes_unfiltered_forward_8,
+    kbfloat_mix_cubic_noscopes_unfiltered_backward_8,
+    kbfloat_mix_cubic_noscopes_filtered_forward_8,
+    kbfloat_mix_cubic_noscopes_filtered_backward_8,
+    kbfloat_mix_cubic_scopes_unfiltered_forward_8,
+    kbfloat_mix_cubic_scopes_unfiltered_backward_8,
+    kbfloat_mix_cubic_scopes_filtered_forward_8,
+    kbfloat_mix_cubic_scopes_filtered_backward_8
 };
 
-void kbasm_mix(kb_x86_mixer_data* data)
+void kbfloat_mix(kb_x86_mixer_data* data)
 {
     kbfloat_mixers[data->flags >> 2](data);
 }
 
-#endif
+/* The counterpart of kbasm_post_mixing() for float output; there is no
+   assembler version of it. The signal is scaled to -1.0 ... 1.0 but not
+   clipped, so the clip flag only tells that a 16 bit target would have
+   been overdriven. */
+gboolean
+kbasm_post_mixing_float(float* tempbuf,
+    float* outbuf,
+    unsigned n,
+    float amp)
+{
+    gboolean clipped = FALSE;
+
+    amp *= 1.0 / 32768.0;
+    n *= 2;
+
+    while (n--) {
+        float a = *tempbuf++ * amp;
+        if (a < -1.0 || a > 32767.0 / 32768.0) {
+            clipped = TRUE;
+        }
+        *outbuf++ = a;
+    }
+
+    return clipped;
+}
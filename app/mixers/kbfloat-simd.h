@@ -0,0 +1,58 @@
+
+/*
+ * The Real SoundTracker - Cubically interpolating mixing routines
+ *                         with IT style filter support
+ *
+ *                         Vectorized versions (header)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_KBFLOAT_SIMD_H
+#define _ST_KBFLOAT_SIMD_H
+
+#include <glib.h>
+
+#include "kb-x86-asm.h"
+
+/* The following routines are drop-in replacements for the portable C
+   routines in kbfloat-mix.c. The instruction set (SSE2 / AVX2 on x86-64,
+   NEON on ARM) is chosen at runtime on the first call. Results are
+   bit-identical to the plain C code.
+
+   All functions return FALSE if they didn't do anything (no suitable
+   instruction set, or too little work to pay off); the caller then
+   has to use the plain C routine. */
+
+gboolean kbfloat_simd_mix(kb_x86_mixer_data* data);
+
+gboolean kbfloat_simd_post_mixing(float* tempbuf,
+    gint16* outbuf,
+    unsigned n,
+    float amp,
+    gboolean* clipped);
+
+/* Adds the stereo buffer src (n frames) to dst; used to merge the
+   partial sums of parallel mixing. */
+gboolean kbfloat_simd_add(float* dst,
+    const float* src,
+    unsigned n);
+
+/* Name of the instruction set in use, or NULL if none */
+const char* kbfloat_simd_name(void);
+
+#endif /* _ST_KBFLOAT_SIMD_H */
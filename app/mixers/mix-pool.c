@@ -0,0 +1,211 @@
+
+/*
+ * The Real SoundTracker - Worker threads for parallel mixing
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mix-pool.h"
+
+typedef struct mix_pool_worker {
+    mix_pool* pool;
+    int part;
+} mix_pool_worker;
+
+struct mix_pool {
+    GMutex busy; /* held by the mixer currently using the pool */
+
+    GMutex lock; /* protects the fields below */
+    GCond start, done;
+    guint generation; /* incremented for every job */
+    int pending; /* number of workers still busy with the current job */
+    mix_pool_func func;
+    void* data;
+    int num_parts; /* of the current job */
+
+    int max_parts;
+    mix_pool_worker workers[MIX_POOL_MAX_PARTS - 1];
+};
+
+/* Set in threads which have called st_mixer_forbid_parallel() */
+static GPrivate mix_pool_forbidden;
+
+static gpointer
+mix_pool_thread(gpointer wp)
+{
+    mix_pool_worker* const w = wp;
+    mix_pool* const p = w->pool;
+    guint seen = 0;
+
+    g_mutex_lock(&p->lock);
+    for (;;) {
+        mix_pool_func func;
+        void* data;
+
+        while (p->generation == seen) {
+            g_cond_wait(&p->start, &p->lock);
+        }
+        seen = p->generation;
+
+        /* Not needed for this job */
+        if (w->part >= p->num_parts) {
+            continue;
+        }
+
+        func = p->func;
+        data = p->data;
+        g_mutex_unlock(&p->lock);
+
+        func(data, w->part);
+
+        g_mutex_lock(&p->lock);
+        if (--p->pending == 0) {
+            g_cond_signal(&p->done);
+        }
+    }
+
+    return NULL;
+}
+
+static int
+mix_pool_get_wanted_parts(void)
+{
+    const gchar* env = g_getenv("SOUNDTRACKER_MIX_THREADS");
+    long n = 1;
+
+    if (!env) {
+        return 1;
+    }
+
+    if (!g_ascii_strcasecmp(env, "auto")) {
+#ifdef _SC_NPROCESSORS_ONLN
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    } else {
+        n = strtol(env, NULL, 10);
+    }
+
+    return CLAMP(n, 1, MIX_POOL_MAX_PARTS);
+}
+
+static mix_pool*
+mix_pool_new(int num_parts)
+{
+    mix_pool* p = g_new0(mix_pool, 1);
+    int i;
+
+    g_mutex_init(&p->busy);
+    g_mutex_init(&p->lock);
+    g_cond_init(&p->start);
+    g_cond_init(&p->done);
+
+    for (i = 0; i < num_parts - 1; i++) {
+        GThread* t;
+
+        p->workers[i].pool = p;
+        p->workers[i].part = i + 1;
+        t = g_thread_try_new("mixer", mix_pool_thread, &p->workers[i], NULL);
+        if (!t) {
+            break;
+        }
+        /* The workers live as long as the program */
+        g_thread_unref(t);
+    }
+    p->max_parts = i + 1;
+
+    return p;
+}
+
+mix_pool*
+mix_pool_get(void)
+{
+    static mix_pool* pool = NULL;
+    static gsize initialized = 0;
+
+    if (g_private_get(&mix_pool_forbidden)) {
+        return NULL;
+    }
+
+    if (g_once_init_enter(&initialized)) {
+        const int n = mix_pool_get_wanted_parts();
+
+        if (n > 1) {
+            pool = mix_pool_new(n);
+            if (pool->max_parts < 2) {
+                /* Not a single worker could be started */
+                g_free(pool);
+                pool = NULL;
+            }
+        }
+        g_once_init_leave(&initialized, 1);
+    }
+
+    return pool;
+}
+
+void st_mixer_forbid_parallel(void)
+{
+    g_private_set(&mix_pool_forbidden, GINT_TO_POINTER(1));
+}
+
+int mix_pool_get_num_parts(mix_pool* p)
+{
+    return p->max_parts;
+}
+
+gboolean
+mix_pool_run(mix_pool* p,
+    mix_pool_func func,
+    void* data,
+    int num_parts)
+{
+    g_assert(num_parts >= 1 && num_parts <= p->max_parts);
+
+    if (!g_mutex_trylock(&p->busy)) {
+        return FALSE;
+    }
+
+    if (num_parts > 1) {
+        g_mutex_lock(&p->lock);
+        p->func = func;
+        p->data = data;
+        p->num_parts = num_parts;
+        p->pending = num_parts - 1;
+        p->generation++;
+        g_cond_broadcast(&p->start);
+        g_mutex_unlock(&p->lock);
+    }
+
+    func(data, 0);
+
+    if (num_parts > 1) {
+        g_mutex_lock(&p->lock);
+        while (p->pending) {
+            g_cond_wait(&p->done, &p->lock);
+        }
+        g_mutex_unlock(&p->lock);
+    }
+
+    g_mutex_unlock(&p->busy);
+
+    return TRUE;
+}
@@ -0,0 +1,63 @@
+
+/*
+ * The Real SoundTracker - Worker threads for parallel mixing (header)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_MIX_POOL_H
+#define _ST_MIX_POOL_H
+
+#include <glib.h>
+
+/* A set of persistent worker threads shared by all mixer instances.
+   A mixer splits its work into a number of parts; part 0 is done by
+   the calling thread itself, the other ones by the workers. Nothing
+   is allocated while mixing.
+
+   The calling thread waits for the workers, which run at normal
+   priority, so parallel mixing is off unless it is asked for by the
+   environment variable SOUNDTRACKER_MIX_THREADS: either the number of
+   threads used for mixing (including the calling one) or "auto" for
+   the number of processors, at most MIX_POOL_MAX_PARTS. Threads that
+   must never wait, like the JACK process callback, opt out with
+   st_mixer_forbid_parallel(). */
+
+#define MIX_POOL_MAX_PARTS 8
+
+typedef struct mix_pool mix_pool;
+
+typedef void (*mix_pool_func)(void* data, int part);
+
+/* Returns the pool, creating the threads on the first call. NULL if
+   parallel mixing is not available, disabled or forbidden for the
+   calling thread. */
+mix_pool* mix_pool_get(void);
+
+/* Maximum number of parts the work may be split into */
+int mix_pool_get_num_parts(mix_pool* p);
+
+/* Calls func(data, part) for part = 0 ... num_parts - 1 in parallel
+   and waits until all of them are done. Returns FALSE without doing
+   anything if the pool is busy with another mixer; the caller then
+   has to do the work on its own. */
+gboolean mix_pool_run(mix_pool* p,
+    mix_pool_func func,
+    void* data,
+    int num_parts);
+
+#endif /* _ST_MIX_POOL_H */
@@ -0,0 +1,591 @@
+
+/*
+ * The Real SoundTracker - Sample snapshots shared with the mixers
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "mixer.h"
+
+/* Snapshots whose last reference has been dropped, waiting for the GUI
+   thread to free them. A lock-free stack; it is only ever emptied as a
+   whole, so there is no ABA problem. */
+static st_mixer_sample_buffer* dead = NULL;
+
+/* Since deferred data is also loaded and published by the loader
+   thread, all changes of snapshots and of the deferred state are done
+   under this lock. The mixing threads never take it (see
+   st_mixer_sample_renew()). */
+static GMutex sample_lock;
+
+/* Deferred data the mixers have asked for, waiting for the loader
+   thread. A lock-free stack like the dead one. */
+static st_mixer_sample_deferred* requests = NULL;
+static GMutex loader_lock;
+static GCond loader_cond;
+static gboolean loader_running = FALSE;
+
+/* The loader thread looks for requests at least this often, in case it
+   couldn't be woken up; in microseconds */
+#define LOADER_POLL 20000
+
+/* Set in threads which have called st_mixer_sample_allow_waiting() */
+static GPrivate sample_waiting_allowed;
+
+/* Samples whose deferred data has been loaded, in the order of loading.
+   st_mixer_sample_evict() sorts it by last_used. */
+static st_mixer_sample_deferred *loaded_head = NULL, *loaded_tail = NULL;
+static gsize loaded_bytes = 0, cache_size = 0;
+static gint evict_wanted = 0;
+
+/* Data which has been used during this time isn't evicted, so that a
+   note which is just being started doesn't lose it. In seconds, like
+   st_mixer_sample_deferred.last_used. */
+#define EVICT_DELAY 5
+
+/* last_used of data which st_mixer_sample_evict() is dropping */
+#define EVICTING -1
+
+static inline gint
+st_mixer_sample_clock(void)
+{
+    return g_get_monotonic_time() / G_USEC_PER_SEC;
+}
+
+st_mixer_sample_buffer*
+st_mixer_sample_acquire(st_mixer_sample_info* si)
+{
+    st_mixer_sample_buffer* b;
+
+    /* While we are counted as a reader, st_mixer_sample_publish() doesn't
+       drop its reference to the snapshot it has just replaced. */
+    g_atomic_int_inc(&si->readers);
+    b = g_atomic_pointer_get(&si->buffer);
+    if (b) {
+        g_atomic_int_inc(&b->ref_count);
+    }
+    g_atomic_int_add(&si->readers, -1);
+
+    return b;
+}
+
+void st_mixer_sample_buffer_unref(st_mixer_sample_buffer* b)
+{
+    st_mixer_sample_buffer* head;
+
+    if (!b || !g_atomic_int_dec_and_test(&b->ref_count)) {
+        return;
+    }
+
+    do {
+        head = g_atomic_pointer_get(&dead);
+        b->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&dead, head, b));
+}
+
+static void
+st_mixer_sample_collect(void)
+{
+    st_mixer_sample_buffer *b, *next;
+
+    for (;;) {
+        do {
+            b = g_atomic_pointer_get(&dead);
+        } while (b && !g_atomic_pointer_compare_and_exchange(&dead, b, NULL));
+
+        if (!b) {
+            break;
+        }
+
+        for (; b; b = next) {
+            next = b->next;
+            if (b->data_owner) {
+                /* May put the owner onto the list; the next round frees it */
+                st_mixer_sample_buffer_unref(b->data_owner);
+            } else {
+                free(b->data);
+            }
+            g_free(b);
+        }
+    }
+}
+
+static void
+st_mixer_sample_replace(st_mixer_sample_info* si,
+    st_mixer_sample_buffer* b,
+    gboolean collect)
+{
+    st_mixer_sample_buffer* const old = si->buffer;
+
+    g_atomic_pointer_set(&si->buffer, b);
+
+    /* A mixer may have fetched the old pointer just before and not yet
+       taken its reference. That is a matter of a few instructions. */
+    while (g_atomic_int_get(&si->readers)) {
+        g_thread_yield();
+    }
+
+    st_mixer_sample_buffer_unref(old);
+    if (collect) {
+        st_mixer_sample_collect();
+    }
+}
+
+static void
+st_mixer_sample_unlink(st_mixer_sample_deferred* d)
+{
+    if (d->prev) {
+        d->prev->next = d->next;
+    } else {
+        loaded_head = d->next;
+    }
+    if (d->next) {
+        d->next->prev = d->prev;
+    } else {
+        loaded_tail = d->prev;
+    }
+    d->prev = d->next = NULL;
+    loaded_bytes -= d->size;
+}
+
+static void
+st_mixer_sample_append(st_mixer_sample_deferred* d)
+{
+    d->prev = loaded_tail;
+    d->next = NULL;
+    if (loaded_tail) {
+        loaded_tail->next = d;
+    } else {
+        loaded_head = d;
+    }
+    loaded_tail = d;
+    loaded_bytes += d->size;
+}
+
+/* Puts the list in the order of last use. It's short and mostly
+   sorted already, so insertion sort does. */
+static void
+st_mixer_sample_sort_loaded(void)
+{
+    st_mixer_sample_deferred *d, *next, *pos;
+
+    for (d = loaded_head ? loaded_head->next : NULL; d; d = next) {
+        const gint used = g_atomic_int_get(&d->last_used);
+
+        next = d->next;
+        for (pos = d->prev; pos && g_atomic_int_get(&pos->last_used) > used; pos = pos->prev)
+            ;
+        if (pos == d->prev) {
+            continue;
+        }
+
+        /* Move d right behind pos */
+        d->prev->next = d->next;
+        if (d->next) {
+            d->next->prev = d->prev;
+        } else {
+            loaded_tail = d->prev;
+        }
+        d->prev = pos;
+        d->next = pos ? pos->next : loaded_head;
+        d->next->prev = d;
+        if (pos) {
+            pos->next = d;
+        } else {
+            loaded_head = d;
+        }
+    }
+}
+
+/* Turns the sample into an ordinary one */
+static void
+st_mixer_sample_forget(st_mixer_sample_info* si)
+{
+    st_mixer_sample_deferred* const d = si->deferred;
+
+    if (!d) {
+        return;
+    }
+    if (d->si) {
+        st_mixer_sample_unlink(d);
+    }
+    g_atomic_pointer_set(&si->deferred, NULL);
+
+    /* st_mixer_sample_renew() may be looking at it without the lock */
+    while (g_atomic_int_get(&si->readers)) {
+        g_thread_yield();
+    }
+
+    if (g_atomic_int_get(&d->queued)) {
+        /* The loader thread frees it when it gets to the request */
+        d->orphaned = TRUE;
+    } else {
+        d->free(d);
+    }
+}
+
+static void
+st_mixer_sample_publish_unlocked(st_mixer_sample_info* si,
+    gboolean collect)
+{
+    st_mixer_sample_buffer* const old = si->buffer;
+    st_mixer_sample_buffer* b = NULL;
+
+    if (si->data) {
+        b = g_new(st_mixer_sample_buffer, 1);
+        b->ref_count = 1;
+        b->looptype = si->looptype;
+        b->length = si->length;
+        b->loopstart = si->loopstart;
+        b->loopend = si->loopend;
+        b->format = si->format;
+        b->data = si->data;
+        b->data_owner = NULL;
+        b->next = NULL;
+
+        if (old && old->data == si->data) {
+            /* Only the loop has changed; share the data */
+            b->data_owner = old->data_owner ? old->data_owner : old;
+            g_atomic_int_inc(&b->data_owner->ref_count);
+        }
+    }
+
+    st_mixer_sample_replace(si, b, collect);
+}
+
+void st_mixer_sample_publish(st_mixer_sample_info* si)
+{
+    g_mutex_lock(&sample_lock);
+    if (si->data && (!si->buffer || si->buffer->data != si->data)) {
+        /* New data from the GUI, the deferred one is stale */
+        st_mixer_sample_forget(si);
+    }
+    st_mixer_sample_publish_unlocked(si, FALSE);
+    g_mutex_unlock(&sample_lock);
+    st_mixer_sample_collect();
+}
+
+void st_mixer_sample_free_data(st_mixer_sample_info* si)
+{
+    if (!si->buffer || si->buffer->data != si->data) {
+        free(si->data);
+    }
+}
+
+void st_mixer_sample_retire(st_mixer_sample_info* si)
+{
+    const gboolean published = si->buffer != NULL;
+
+    g_mutex_lock(&sample_lock);
+    st_mixer_sample_forget(si);
+    st_mixer_sample_free_data(si);
+    si->data = NULL;
+    si->format = ST_MIXER_SAMPLE_FORMAT_16;
+    st_mixer_sample_replace(si, NULL, FALSE);
+    g_mutex_unlock(&sample_lock);
+
+    /* A sample of a module which is still being loaded has never been
+       published; the loader thread leaves the snapshots alone */
+    if (published) {
+        st_mixer_sample_collect();
+    }
+}
+
+static gboolean
+st_mixer_sample_load_locked(st_mixer_sample_info* si)
+{
+    st_mixer_sample_deferred* const d = si->deferred;
+    gboolean ok = TRUE;
+
+    if (d) {
+        g_atomic_int_set(&d->last_used, st_mixer_sample_clock());
+        if (!si->data && (ok = d->load(si))) {
+            /* We may be in the loader thread, the GUI collects */
+            st_mixer_sample_publish_unlocked(si, FALSE);
+            d->si = si;
+            d->size = st_mixer_sample_size(si->format, si->length);
+            st_mixer_sample_append(d);
+
+            if (cache_size && loaded_bytes > cache_size) {
+                g_atomic_int_set(&evict_wanted, 1);
+            }
+        }
+    }
+
+    return ok;
+}
+
+static gpointer
+st_mixer_sample_loader(gpointer data)
+{
+    for (;;) {
+        st_mixer_sample_deferred *d, *next, *list = NULL;
+
+        do {
+            d = g_atomic_pointer_get(&requests);
+        } while (d && !g_atomic_pointer_compare_and_exchange(&requests, d, NULL));
+
+        if (!d) {
+            g_mutex_lock(&loader_lock);
+            g_cond_wait_until(&loader_cond, &loader_lock, g_get_monotonic_time() + LOADER_POLL);
+            g_mutex_unlock(&loader_lock);
+            continue;
+        }
+
+        /* Served in the order of the requests */
+        for (; d; d = next) {
+            next = d->queue_next;
+            d->queue_next = list;
+            list = d;
+        }
+
+        for (d = list; d; d = next) {
+            next = d->queue_next;
+            g_mutex_lock(&sample_lock);
+            g_atomic_int_set(&d->queued, 0);
+            if (d->orphaned) {
+                d->free(d);
+            } else {
+                st_mixer_sample_load_locked(d->queue_si);
+            }
+            g_mutex_unlock(&sample_lock);
+        }
+    }
+
+    return NULL;
+}
+
+/* Hands d over to the loader thread unless it's waiting for it already */
+static void
+st_mixer_sample_request(st_mixer_sample_info* si,
+    st_mixer_sample_deferred* d)
+{
+    st_mixer_sample_deferred* head;
+
+    if (!g_atomic_int_compare_and_exchange(&d->queued, 0, 1)) {
+        return;
+    }
+
+    d->queue_si = si;
+    do {
+        head = g_atomic_pointer_get(&requests);
+        d->queue_next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&requests, head, d));
+
+    /* Waking it up mustn't block either; if the lock is taken, the
+       loader thread finds the request at its next look */
+    if (g_mutex_trylock(&loader_lock)) {
+        g_cond_signal(&loader_cond);
+        g_mutex_unlock(&loader_lock);
+    }
+}
+
+/* TRUE if si isn't deferred or its data is there; the time stamp is
+   renewed then. Otherwise the data is asked for if request is set.
+   Never blocks. */
+static gboolean
+st_mixer_sample_renew(st_mixer_sample_info* si,
+    gboolean request)
+{
+    st_mixer_sample_deferred* d;
+    gboolean loaded = FALSE;
+
+    /* Counted as a reader, d isn't freed under our feet. Loaded data
+       stays until the time stamp has been replaced by EVICTING, so if
+       we manage to renew it, the data is ours. */
+    g_atomic_int_inc(&si->readers);
+    if ((d = g_atomic_pointer_get(&si->deferred))) {
+        const gint used = g_atomic_int_get(&d->last_used);
+
+        loaded = used != EVICTING
+            && g_atomic_pointer_get(&si->buffer)
+            && g_atomic_int_compare_and_exchange(&d->last_used, used, st_mixer_sample_clock());
+        if (!loaded && request) {
+            st_mixer_sample_request(si, d);
+        }
+    }
+    g_atomic_int_add(&si->readers, -1);
+
+    return !d || loaded;
+}
+
+void st_mixer_sample_defer(st_mixer_sample_info* si,
+    st_mixer_sample_deferred* d)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+        GThread* t = g_thread_try_new("sample loader", st_mixer_sample_loader, NULL, NULL);
+
+        /* Without it, st_mixer_sample_prepare() loads by itself */
+        if (t) {
+            loader_running = TRUE;
+            g_thread_unref(t);
+        }
+        g_once_init_leave(&initialized, 1);
+    }
+
+    d->queued = 0;
+    d->orphaned = FALSE;
+    si->deferred = d;
+}
+
+gboolean
+st_mixer_sample_load(st_mixer_sample_info* si)
+{
+    gboolean ok;
+
+    if (st_mixer_sample_renew(si, FALSE)) {
+        return TRUE;
+    }
+
+    g_mutex_lock(&sample_lock);
+    ok = st_mixer_sample_load_locked(si);
+    g_mutex_unlock(&sample_lock);
+
+    return ok;
+}
+
+gboolean
+st_mixer_sample_prepare(st_mixer_sample_info* si)
+{
+    if (!loader_running || g_private_get(&sample_waiting_allowed)) {
+        return st_mixer_sample_load(si);
+    }
+
+    return st_mixer_sample_renew(si, TRUE);
+}
+
+void st_mixer_sample_prefetch(st_mixer_sample_info* si)
+{
+    if (loader_running) {
+        st_mixer_sample_renew(si, TRUE);
+    }
+}
+
+void st_mixer_sample_allow_waiting(gboolean allow)
+{
+    g_private_set(&sample_waiting_allowed, allow ? GINT_TO_POINTER(1) : NULL);
+}
+
+/* Replaces 8 bit data by 16 bit data; the old snapshot keeps the old
+   data for the mixers which are still playing it. The sample isn't
+   deferred any more, so nobody else touches si->data meanwhile and only
+   publishing the result needs the lock. */
+static gboolean
+st_mixer_sample_widen(st_mixer_sample_info* si)
+{
+    const gint8* src = (const gint8*)si->data;
+    gint16* dest;
+    guint32 i;
+
+    if (si->format == ST_MIXER_SAMPLE_FORMAT_16 || !src) {
+        return TRUE;
+    }
+
+    if (!(dest = malloc(st_mixer_sample_size(ST_MIXER_SAMPLE_FORMAT_16, si->length)))) {
+        return FALSE;
+    }
+    for (i = 0; i < si->length; i++) {
+        dest[i] = src[i] * 256;
+    }
+
+    st_mixer_sample_free_data(si);
+    g_mutex_lock(&sample_lock);
+    si->data = dest;
+    si->format = ST_MIXER_SAMPLE_FORMAT_16;
+    st_mixer_sample_publish_unlocked(si, FALSE);
+    g_mutex_unlock(&sample_lock);
+    st_mixer_sample_collect();
+
+    return TRUE;
+}
+
+gboolean
+st_mixer_sample_detach(st_mixer_sample_info* si)
+{
+    if (g_atomic_pointer_get(&si->deferred)) {
+        if (!st_mixer_sample_load(si)) {
+            return FALSE;
+        }
+        g_mutex_lock(&sample_lock);
+        st_mixer_sample_forget(si);
+        g_mutex_unlock(&sample_lock);
+    }
+
+    return TRUE;
+}
+
+gboolean
+st_mixer_sample_claim(st_mixer_sample_info* si)
+{
+    return st_mixer_sample_detach(si) && st_mixer_sample_widen(si);
+}
+
+void st_mixer_sample_set_cache_size(gsize bytes)
+{
+    cache_size = bytes;
+}
+
+void st_mixer_sample_evict(void)
+{
+    st_mixer_sample_deferred *d, *next;
+    const gint now = st_mixer_sample_clock();
+
+    g_mutex_lock(&sample_lock);
+    g_atomic_int_set(&evict_wanted, 0);
+    st_mixer_sample_sort_loaded();
+    for (d = loaded_head; d && cache_size && loaded_bytes > cache_size; d = next) {
+        st_mixer_sample_info* const si = d->si;
+        st_mixer_sample_buffer* const b = si->buffer;
+        const gint used = g_atomic_int_get(&d->last_used);
+
+        next = d->next;
+        /* A snapshot which is referenced by someone else is being played.
+           A note started from now on either has renewed the time stamp,
+           then the exchange fails, or finds EVICTING and waits for the
+           lock. */
+        if (now - used < EVICT_DELAY
+            || (b && g_atomic_int_get(&b->ref_count) > 1)
+            || !g_atomic_int_compare_and_exchange(&d->last_used, used, EVICTING)) {
+            continue;
+        }
+
+        st_mixer_sample_unlink(d);
+        d->si = NULL;
+        /* The data belongs to the snapshot */
+        si->data = NULL;
+        st_mixer_sample_replace(si, NULL, FALSE);
+    }
+
+    /* What is being played is tried again at the next poll */
+    if (cache_size && loaded_bytes > cache_size) {
+        g_atomic_int_set(&evict_wanted, 1);
+    }
+    g_mutex_unlock(&sample_lock);
+    st_mixer_sample_collect();
+}
+
+gboolean
+st_mixer_sample_evict_pending(void)
+{
+    return g_atomic_int_get(&evict_wanted);
+}
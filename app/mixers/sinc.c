@@ -0,0 +1,1151 @@
+/*
+ * The Real SoundTracker - Windowed-sinc interpolating mixer
+ *                         with IT style filter support
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Each output sample is the dot product of the sample data around the
+   current position with one row of a precomputed polyphase table of
+   Kaiser-windowed sinc coefficients. The rows are 1/256 sample apart;
+   positions in between use a linear blend of the two neighbouring
+   rows, which is computed in the same pass over the sample data.
+
+   A note played faster than the mixing frequency has to be lowpass
+   filtered below its own Nyquist frequency, so there is one kernel per
+   range of pitch ratios, with a lower cutoff and proportionally more
+   taps for the higher ratios. Notes played at or below the mixing
+   frequency use 16 taps, notes played four times as fast 64 taps.
+   Beyond that the kernel is not widened any further and some aliasing
+   remains.
+
+   The volume ramps, the voices used for declicking and the IT filter
+   work exactly like in the kbfloat mixer; its final conversion routine
+   is shared. */
+
+#include <config.h>
+
+#include <glib/gi18n.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kb-x86-asm.h"
+#include "mixer.h"
+#include "tracer.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SINC_SIMD_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define SINC_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define SINC_PHASE_BITS 8
+#define SINC_PHASES (1 << SINC_PHASE_BITS)
+#define SINC_FRAC_BITS (32 - SINC_PHASE_BITS)
+
+/* Kaiser window parameter; about 90 dB stopband attenuation */
+#define SINC_KAISER_BETA 8.6
+
+/* Cutoff relative to the Nyquist frequency of the played sample, a bit
+   below 1 to leave room for the transition band */
+#define SINC_CUTOFF 0.95
+
+/* The tap counts must be multiples of 8 for the vectorized dot product */
+#define SINC_MAX_TAPS 64
+
+typedef struct sinc_kernel {
+    double ratio; /* used for pitch ratios (sample frames per output frame) up to this one */
+    int taps;
+    float* coeffs; /* SINC_PHASES + 1 rows of taps coefficients each */
+} sinc_kernel;
+
+static sinc_kernel sinc_kernels[] = {
+    { 1.0, 16, NULL },
+    { 1.25, 24, NULL },
+    { 1.5, 24, NULL },
+    { 2.0, 32, NULL },
+    { 2.5, 40, NULL },
+    { 3.0, 48, NULL },
+    { 4.0, 64, NULL },
+};
+
+#define SINC_NUM_KERNELS (sizeof(sinc_kernels) / sizeof(sinc_kernels[0]))
+
+typedef struct sinc_channel {
+    st_mixer_sample_info* sample;
+    st_mixer_sample_buffer* buffer; // snapshot being played, a reference of its own or NULL
+    void* data; // copy of buffer->data
+    guint32 length; // copy of buffer->length
+
+    guint32 flags; // see below
+    float volume; // 0.0 ... 1.0
+    float panning; // 0.0 ... 1.0
+    int direction; // +1 for forward, -1 for backward
+    guint32 playend; // for a forced premature end of the sample
+
+    float volleft; // left volume (1.0 = no change)
+    float volright; // rite volume (1.0 = no change)
+
+    guint32 ramp_num_samples; // number of mixer output samples during which ramping is active
+    float rampleft; // left volramp (delta_vol per sample)
+    float rampright; // rite volramp (delta_vol per sample)
+    float rampdestleft; // ramp destination volume left
+    float rampdestright; // ramp destination volume right
+
+    gint64 position; // current sample position (32.32)
+    gint64 freq; // frequency (32.32)
+    const sinc_kernel* kernel;
+
+    float ffreq; // filter frequency (0<=x<=1)
+    float freso; // filter resonance (0<=x<1)
+    float fl1; // filter lp buffer
+    float fb1; // filter bp buffer
+
+    int channel; // pattern channel this voice is (or was) playing on
+} sinc_channel;
+
+#define SINC_FLAG_LOOP_UNIDIRECTIONAL 1
+#define SINC_FLAG_LOOP_BIDIRECTIONAL 2
+#define SINC_FLAG_SAMPLE_RUNNING 4
+#define SINC_FLAG_JUST_STARTED 8
+#define SINC_FLAG_LOOPED 16
+#define SINC_FLAG_STOP_AFTER_VOLRAMP 32
+#define SINC_FLAG_DO_SAMPLE_START_DECLICK 64
+#define SINC_FLAG_ACTIVE 128 // voice is in the active list
+
+// Number of virtual channels ("voices") shared by all pattern channels
+#define SINC_NUM_VOICES 256
+
+typedef struct sinc_mixer {
+    int num_channels, mixfreq;
+    int clipflag;
+    guint32 scopemask; // channels whose scopes the last mix() has filled
+    gint samples_changed; // set by updatesample()
+
+    float* tempbuf;
+    int tempbufsize;
+
+    float amplification;
+    gboolean float_output; // setmixformat(32)
+
+    sinc_channel voices[SINC_NUM_VOICES];
+
+    // The voice each pattern channel currently controls
+    int current[32];
+
+    // Voices that may be running, in the order they were started.
+    // Nothing else is looked at while mixing.
+    int active[SINC_NUM_VOICES];
+    int num_active;
+
+    // Voices neither current nor active
+    int free[SINC_NUM_VOICES];
+    int num_free;
+} sinc_mixer;
+
+// A ramp from 32768 to 0 should take RAMP_MAX_DURATION seconds
+#define RAMP_MAX_DURATION 0.001
+
+static double
+sinc_bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    int k;
+
+    for (k = 1; k < 100 && term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+static void
+sinc_init_kernel(sinc_kernel* k)
+{
+    const double cutoff = SINC_CUTOFF / k->ratio;
+    const double i0beta = sinc_bessel_i0(SINC_KAISER_BETA);
+    const int half = k->taps / 2;
+    double h[SINC_MAX_TAPS];
+    int p, t;
+
+    g_assert(k->taps % 8 == 0 && k->taps <= SINC_MAX_TAPS);
+
+    k->coeffs = g_new(float, (SINC_PHASES + 1) * k->taps);
+
+    /* Tap t of row p weighs the sample at t - half + 1 relative to the
+       integer part of the position, the fractional part being p / SINC_PHASES */
+    for (p = 0; p <= SINC_PHASES; p++) {
+        double sum = 0.0;
+
+        for (t = 0; t < k->taps; t++) {
+            const double d = t - half + 1 - (double)p / SINC_PHASES;
+            const double x = d / half;
+            const double a = G_PI * cutoff * d;
+            double w = 0.0;
+
+            if (fabs(x) < 1.0)
+                w = sinc_bessel_i0(SINC_KAISER_BETA * sqrt(1.0 - x * x)) / i0beta;
+
+            h[t] = (a == 0.0 ? 1.0 : sin(a) / a) * w;
+            sum += h[t];
+        }
+
+        /* Normalize for unity gain at DC */
+        for (t = 0; t < k->taps; t++)
+            k->coeffs[p * k->taps + t] = h[t] / sum;
+    }
+}
+
+static void
+sinc_init_tables(void)
+{
+    unsigned i;
+
+    for (i = 0; i < SINC_NUM_KERNELS; i++)
+        sinc_init_kernel(&sinc_kernels[i]);
+}
+
+static const sinc_kernel*
+sinc_get_kernel(gint64 freq)
+{
+    const double ratio = freq / 4294967296.0;
+    unsigned i;
+
+    for (i = 0; i < SINC_NUM_KERNELS - 1; i++) {
+        if (ratio <= sinc_kernels[i].ratio)
+            break;
+    }
+
+    return &sinc_kernels[i];
+}
+
+/* Computes the dot products of the taps samples at s with two
+   successive coefficient rows c and c + taps, and blends them */
+#if defined(SINC_SIMD_SSE2)
+
+static inline float
+sinc_dot(const gint16* s,
+    const float* c,
+    int taps,
+    float blend)
+{
+    const float* c1 = c + taps;
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+    int k;
+
+    for (k = 0; k < taps; k += 8) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(s + k));
+        const __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+        const __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+
+        a0 = _mm_add_ps(a0, _mm_mul_ps(lo, _mm_loadu_ps(c + k)));
+        a0 = _mm_add_ps(a0, _mm_mul_ps(hi, _mm_loadu_ps(c + k + 4)));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(lo, _mm_loadu_ps(c1 + k)));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(hi, _mm_loadu_ps(c1 + k + 4)));
+    }
+
+    a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_sub_ps(a1, a0), _mm_set1_ps(blend)));
+    a0 = _mm_add_ps(a0, _mm_movehl_ps(a0, a0));
+    a0 = _mm_add_ss(a0, _mm_shuffle_ps(a0, a0, 1));
+
+    return _mm_cvtss_f32(a0);
+}
+
+#elif defined(SINC_SIMD_NEON)
+
+static inline float
+sinc_dot(const gint16* s,
+    const float* c,
+    int taps,
+    float blend)
+{
+    const float* c1 = c + taps;
+    float32x4_t a0 = vdupq_n_f32(0.0), a1 = vdupq_n_f32(0.0);
+    float32x2_t r;
+    int k;
+
+    for (k = 0; k < taps; k += 8) {
+        const int16x8_t x = vld1q_s16(s + k);
+        const float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+        const float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+
+        a0 = vmlaq_f32(a0, lo, vld1q_f32(c + k));
+        a0 = vmlaq_f32(a0, hi, vld1q_f32(c + k + 4));
+        a1 = vmlaq_f32(a1, lo, vld1q_f32(c1 + k));
+        a1 = vmlaq_f32(a1, hi, vld1q_f32(c1 + k + 4));
+    }
+
+    a0 = vmlaq_n_f32(a0, vsubq_f32(a1, a0), blend);
+    r = vadd_f32(vget_low_f32(a0), vget_high_f32(a0));
+
+    return vget_lane_f32(vpadd_f32(r, r), 0);
+}
+
+#else
+
+static inline float
+sinc_dot(const gint16* s,
+    const float* c,
+    int taps,
+    float blend)
+{
+    const float* c1 = c + taps;
+    float a0 = 0.0, a1 = 0.0;
+    int k;
+
+    for (k = 0; k < taps; k++) {
+        a0 += s[k] * c[k];
+        a1 += s[k] * c1[k];
+    }
+
+    return a0 + (a1 - a0) * blend;
+}
+
+#endif
+
+static void
+sinc_reset(void* mp)
+{
+    sinc_mixer* const m = mp;
+    int i;
+
+    for (i = 0; i < SINC_NUM_VOICES; i++) {
+        st_mixer_sample_buffer_unref(m->voices[i].buffer);
+    }
+    memset(m->voices, 0, sizeof(m->voices));
+    m->num_active = 0;
+    m->num_free = 0;
+
+    for (i = 0; i < 32; i++) {
+        m->current[i] = i;
+        m->voices[i].channel = i;
+    }
+    for (i = SINC_NUM_VOICES - 1; i >= 32; i--) {
+        m->free[m->num_free++] = i;
+    }
+
+    m->clipflag = 0;
+}
+
+static void*
+sinc_new(void)
+{
+    static gsize tables_done = 0;
+    sinc_mixer* m;
+
+    /* The kernels are shared by all instances */
+    if (g_once_init_enter(&tables_done)) {
+        sinc_init_tables();
+        g_once_init_leave(&tables_done, 1);
+    }
+
+    m = g_new0(sinc_mixer, 1);
+    m->amplification = 0.25;
+    sinc_reset(m);
+
+    return m;
+}
+
+static void
+sinc_destroy(void* mp)
+{
+    sinc_mixer* const m = mp;
+
+    sinc_reset(m);
+    free(m->tempbuf);
+    g_free(m);
+}
+
+static void
+sinc_setnumch(void* mp,
+    int n)
+{
+    sinc_mixer* const m = mp;
+
+    g_assert(n >= 1 && n <= 32);
+
+    m->num_channels = n;
+}
+
+static void
+sinc_start_ramp(sinc_mixer* m,
+    sinc_channel* c)
+{
+    c->ramp_num_samples = RAMP_MAX_DURATION * m->mixfreq;
+    if (c->ramp_num_samples == 0) {
+        c->ramp_num_samples = 1;
+    }
+    c->rampleft = (c->rampdestleft - c->volleft) / c->ramp_num_samples;
+    c->rampright = (c->rampdestright - c->volright) / c->ramp_num_samples;
+}
+
+/* Virtual channels, the same as in the kbfloat mixer (see kb-x86.c):
+   a note which is stopped or replaced fades out on a voice of its own,
+   taken from a pool of SINC_NUM_VOICES. current[] tells which voice a
+   pattern channel controls at the moment; all voices that may produce
+   sound are kept in active[]. */
+static sinc_channel*
+sinc_get_channel_struct(sinc_mixer* m,
+    int channel)
+{
+    return &m->voices[m->current[channel]];
+}
+
+static gboolean
+sinc_is_current(sinc_mixer* m,
+    sinc_channel* v)
+{
+    return m->current[v->channel] == v - m->voices;
+}
+
+static void
+sinc_activate(sinc_mixer* m,
+    sinc_channel* v)
+{
+    if (!(v->flags & SINC_FLAG_ACTIVE)) {
+        v->flags |= SINC_FLAG_ACTIVE;
+        m->active[m->num_active++] = v - m->voices;
+    }
+}
+
+/* Drop the voices which have stopped from the active list and put
+   the detached ones back into the pool */
+static void
+sinc_cleanup_voices(sinc_mixer* m)
+{
+    int i, k;
+
+    for (i = 0, k = 0; i < m->num_active; i++) {
+        sinc_channel* v = m->voices + m->active[i];
+
+        if (v->flags & SINC_FLAG_SAMPLE_RUNNING) {
+            m->active[k++] = m->active[i];
+        } else {
+            v->flags &= ~SINC_FLAG_ACTIVE;
+            st_mixer_sample_buffer_unref(v->buffer);
+            v->buffer = NULL;
+            if (!sinc_is_current(m, v)) {
+                m->free[m->num_free++] = m->active[i];
+            }
+        }
+    }
+    m->num_active = k;
+}
+
+static sinc_channel*
+sinc_get_free_voice(sinc_mixer* m)
+{
+    int i, quietest = -1;
+    float vol, minvol = 0.0;
+
+    if (m->num_free) {
+        return &m->voices[m->free[--m->num_free]];
+    }
+
+    /* Voice stealing. Only up to 32 voices are current, so all the
+       others are active and fading out. */
+    for (i = 0; i < m->num_active; i++) {
+        sinc_channel* v = m->voices + m->active[i];
+
+        if (sinc_is_current(m, v)) {
+            continue;
+        }
+        vol = MAX(v->volleft, v->volright);
+        if (quietest == -1 || vol < minvol) {
+            quietest = i;
+            minvol = vol;
+        }
+    }
+    g_assert(quietest != -1);
+
+    i = m->active[quietest];
+    m->num_active--;
+    memmove(m->active + quietest, m->active + quietest + 1, (m->num_active - quietest) * sizeof(m->active[0]));
+    m->voices[i].flags = 0;
+    st_mixer_sample_buffer_unref(m->voices[i].buffer);
+    m->voices[i].buffer = NULL;
+
+    return &m->voices[i];
+}
+
+/* Let the note playing on the pattern channel fade out in the
+   background */
+static void
+sinc_detach_voice(sinc_mixer* m,
+    int channel)
+{
+    sinc_channel* c = sinc_get_channel_struct(m, channel);
+    sinc_channel* n;
+
+    if (!(c->flags & SINC_FLAG_SAMPLE_RUNNING)) {
+        return;
+    }
+
+    if (c->flags & SINC_FLAG_JUST_STARTED) {
+        /* Not a single sample of it has been mixed, so it can't click */
+        c->flags &= SINC_FLAG_ACTIVE;
+        return;
+    }
+
+    n = sinc_get_free_voice(m);
+    *n = *c;
+    n->flags = 0;
+    n->buffer = NULL; // stays with the fading voice
+    m->current[channel] = n - m->voices;
+
+    c->flags |= SINC_FLAG_STOP_AFTER_VOLRAMP;
+    c->rampdestleft = 0.0;
+    c->rampdestright = 0.0;
+    sinc_start_ramp(m, c);
+}
+
+static void
+sinc_updatesample(void* mp,
+    st_mixer_sample_info* si)
+{
+    sinc_mixer* const m = mp;
+
+    g_atomic_int_set(&m->samples_changed, 1);
+}
+
+/* Switch the voices over to the latest snapshots of their samples
+   after updatesample(). Called before mixing. */
+static void
+sinc_sync_samples(sinc_mixer* m)
+{
+    int i;
+    sinc_channel* c;
+    st_mixer_sample_buffer* b;
+
+    if (!g_atomic_int_compare_and_exchange(&m->samples_changed, 1, 0)) {
+        return;
+    }
+
+    for (i = 0; i < m->num_active; i++) {
+        c = &m->voices[m->active[i]];
+
+        if (!(c->flags & SINC_FLAG_SAMPLE_RUNNING)) {
+            continue;
+        }
+
+        b = st_mixer_sample_acquire(c->sample);
+        if (b == c->buffer) {
+            st_mixer_sample_buffer_unref(b);
+            continue;
+        }
+
+        if (!b
+            || b->data != c->data
+            || b->length != c->length
+            || b->looptype != c->buffer->looptype) {
+            st_mixer_sample_buffer_unref(b);
+            c->flags &= SINC_FLAG_ACTIVE;
+            continue;
+        }
+
+        /* No relevant data has changed. Don't stop the sample, but
+	   keep the position inside the new loop. */
+        st_mixer_sample_buffer_unref(c->buffer);
+        c->buffer = b;
+        if (b->looptype != ST_MIXER_SAMPLE_LOOPTYPE_NONE) {
+            if ((c->position >> 32) < b->loopstart) {
+                c->position = ((gint64)b->loopstart << 32) + 0x7fffffff;
+            } else if ((c->position >> 32) >= b->loopend) {
+                c->position = ((gint64)(b->loopend - 1) << 32) + 0x7fffffff;
+            }
+        }
+    }
+}
+
+static gboolean
+sinc_setmixformat(void* mp,
+    int format)
+{
+    sinc_mixer* const m = mp;
+
+    if (format != 16 && format != 32)
+        return FALSE;
+
+    m->float_output = format == 32;
+
+    return TRUE;
+}
+
+static gboolean
+sinc_setstereo(void* mp,
+    int on)
+{
+    if (!on)
+        return FALSE;
+
+    return TRUE;
+}
+
+static void
+sinc_setmixfreq(void* mp,
+    guint32 frequency)
+{
+    sinc_mixer* const m = mp;
+
+    m->mixfreq = frequency;
+}
+
+static void
+sinc_setampfactor(void* mp,
+    float amplification)
+{
+    sinc_mixer* const m = mp;
+
+    m->amplification = 0.25 * amplification;
+}
+
+static gboolean
+sinc_getclipflag(void* mp)
+{
+    sinc_mixer* const m = mp;
+
+    return m->clipflag;
+}
+
+static guint32
+sinc_getscopemask(void* mp)
+{
+    sinc_mixer* const m = mp;
+
+    return m->scopemask;
+}
+
+static void
+sinc_startnote(void* mp,
+    int channel,
+    st_mixer_sample_info* s)
+{
+    sinc_mixer* const m = mp;
+    sinc_channel* c;
+
+    /* New note action: the previous note is faded out */
+    sinc_detach_voice(m, channel);
+    c = sinc_get_channel_struct(m, channel);
+
+    c->flags &= SINC_FLAG_ACTIVE;
+
+    c->sample = s;
+    st_mixer_sample_buffer_unref(c->buffer);
+    c->buffer = st_mixer_sample_acquire(s);
+    if (!c->buffer) {
+        return;
+    }
+    c->data = c->buffer->data;
+    c->length = c->buffer->length;
+
+    c->position = 0;
+    c->playend = 0;
+    if (c->buffer->looptype == ST_MIXER_SAMPLE_LOOPTYPE_AMIGA) {
+        c->flags |= SINC_FLAG_LOOP_UNIDIRECTIONAL;
+    } else if (c->buffer->looptype == ST_MIXER_SAMPLE_LOOPTYPE_PINGPONG) {
+        c->flags |= SINC_FLAG_LOOP_BIDIRECTIONAL;
+    }
+    c->direction = 1;
+    c->ramp_num_samples = 0;
+    c->freso = 0.0;
+    c->ffreq = 1.0;
+    c->fl1 = 0.0;
+    c->fb1 = 0.0;
+    c->flags |= SINC_FLAG_SAMPLE_RUNNING | SINC_FLAG_JUST_STARTED;
+    sinc_activate(m, c);
+}
+
+static void
+sinc_stopnote(void* mp,
+    int channel)
+{
+    sinc_mixer* const m = mp;
+
+    sinc_detach_voice(m, channel);
+}
+
+static void
+sinc_setsmplpos(void* mp,
+    int channel,
+    guint32 offset)
+{
+    sinc_mixer* const m = mp;
+    sinc_channel* c = sinc_get_channel_struct(m, channel);
+
+    if (c->buffer && (c->flags & ~SINC_FLAG_ACTIVE) != 0) {
+        if (offset < c->length) {
+            c->position = (gint64)offset << 32;
+            c->direction = 1;
+            c->flags &= ~SINC_FLAG_LOOPED;
+
+            if (c->flags & SINC_FLAG_JUST_STARTED && offset > 0) {
+                /* User has used 9xx command - declick sample start */
+                c->flags |= SINC_FLAG_DO_SAMPLE_START_DECLICK;
+            }
+        } else {
+            c->flags &= SINC_FLAG_ACTIVE;
+        }
+    }
+}
+
+static void
+sinc_setsmplend(void* mp,
+    int channel,
+    guint32 offset)
+{
+    sinc_mixer* const m = mp;
+    sinc_channel* c = sinc_get_channel_struct(m, channel);
+
+    if (c->buffer && (c->flags & ~SINC_FLAG_ACTIVE) != 0) {
+        if ((c->position >> 32) != 0 || offset < c->length) {
+            // only end if the selection is not the whole sample
+            c->playend = offset;
+        }
+    }
+}
+
+static void
+sinc_setfreq(void* mp,
+    int channel,
+    float frequency)
+{
+    sinc_mixer* const m = mp;
+    sinc_channel* c = sinc_get_channel_struct(m, channel);
+
+    c->freq = (gint64)((double)frequency / m->mixfreq * 4294967296.0 /* this is pow(2,32) */);
+    c->kernel = sinc_get_kernel(c->freq);
+}
+
+static void
+sinc_redo_vol_fields(sinc_mixer* m,
+    sinc_channel* c)
+{
+    c->rampdestleft = c->volume * (1.0 - c->panning);
+    c->rampdestright = c->volume * c->panning;
+    g_assert(c->rampdestleft >= 0.0 && c->rampdestleft <= 1.0);
+    g_assert(c->rampdestright >= 0.0 && c->rampdestright <= 1.0);
+
+    if (c->flags & SINC_FLAG_JUST_STARTED) {
+        c->volleft = c->rampdestleft;
+        c->volright = c->rampdestright;
+    } else {
+        sinc_start_ramp(m, c);
+    }
+}
+
+static void
+sinc_setvolume(void* mp,
+    int channel,
+    float volume)
+{
+    sinc_mixer* const m = mp;
+    sinc_channel* c = sinc_get_channel_struct(m, channel);
+
+    c->volume = volume;
+    sinc_redo_vol_fields(m, c);
+}
+
+static void
+sinc_setpanning(void* mp,
+    int channel,
+    float panning)
+{
+    sinc_mixer* const m = mp;
+    sinc_channel* c = sinc_get_channel_struct(m, channel);
+
+    c->panning = 0.5 * (panning + 1.0);
+    sinc_redo_vol_fields(m, c);
+}
+
+static void
+sinc_setchcutoff(void* mp,
+    int channel,
+    float freq)
+{
+    sinc_mixer* const m = mp;
+    sinc_channel* c = sinc_get_channel_struct(m, channel);
+
+    if (freq < 0.0) {
+        c->ffreq = 1.0;
+        c->freso = 0.0;
+    } else {
+        g_assert(0.0 <= freq);
+        g_assert(freq <= 1.0);
+        c->ffreq = freq;
+        c->freso = 0.0;
+    }
+}
+
+static void
+sinc_setchreso(void* mp,
+    int channel,
+    float reso)
+{
+    sinc_mixer* const m = mp;
+    sinc_channel* c = sinc_get_channel_struct(m, channel);
+
+    g_assert(0.0 <= reso);
+    g_assert(reso <= 1.0);
+    c->freso = reso;
+}
+
+/* Brings the position back into the loop if it has run past one of
+   its ends. Returns FALSE if the sample has ended. */
+static gboolean
+sinc_wrap_position(sinc_channel* c)
+{
+    const st_mixer_sample_buffer* si = c->buffer;
+
+    if (c->playend != 0 || !(c->flags & (SINC_FLAG_LOOP_UNIDIRECTIONAL | SINC_FLAG_LOOP_BIDIRECTIONAL))) {
+        const guint32 ende = c->playend ? c->playend : c->length;
+
+        return c->position >= 0 && (c->position >> 32) < ende;
+    }
+
+    g_assert(si->loopend > si->loopstart);
+
+    if (c->flags & SINC_FLAG_LOOP_BIDIRECTIONAL) {
+        /* The sample data is mirrored half a sample outside the loop
+	   ends (see sinc_get_sample()), so that's where we turn */
+        const gint64 lstart64 = ((gint64)si->loopstart << 32) - 0x80000000LL;
+        const gint64 lend64 = ((gint64)si->loopend << 32) - 0x80000000LL;
+
+        while (1) {
+            if (c->direction == 1 && c->position >= lend64) {
+                c->position = 2 * lend64 - c->position;
+                c->direction = -1;
+                c->flags |= SINC_FLAG_LOOPED;
+            } else if (c->direction == -1 && c->position < lstart64) {
+                c->position = 2 * lstart64 - c->position;
+                c->direction = 1;
+            } else {
+                break;
+            }
+        }
+    } else {
+        const gint64 looplen64 = (gint64)(si->loopend - si->loopstart) << 32;
+        const gint64 lend64 = (gint64)si->loopend << 32;
+
+        if (c->position >= lend64) {
+            c->position -= ((c->position - lend64) / looplen64 + 1) * looplen64;
+            c->flags |= SINC_FLAG_LOOPED;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Sample value i, 8 bit data scaled to 16 bit */
+static inline gint16
+sinc_data(const sinc_channel* c,
+    gint32 i)
+{
+    if (c->buffer->format == ST_MIXER_SAMPLE_FORMAT_8) {
+        return ((gint8*)c->data)[i] * 256;
+    }
+    return ((gint16*)c->data)[i];
+}
+
+/* The sample as the interpolation sees it: silence before the start
+   and after the end, the loop repeated or mirrored after the loop
+   end, and also before the loop start once the loop has been entered */
+static inline gint16
+sinc_get_sample(const sinc_channel* c,
+    gint32 i)
+{
+    const st_mixer_sample_buffer* si = c->buffer;
+
+    if (c->playend == 0 && (c->flags & (SINC_FLAG_LOOP_UNIDIRECTIONAL | SINC_FLAG_LOOP_BIDIRECTIONAL))
+        && (i >= (gint32)si->loopend || ((c->flags & SINC_FLAG_LOOPED) && i < (gint32)si->loopstart))) {
+        const gint32 len = si->loopend - si->loopstart;
+
+        if (c->flags & SINC_FLAG_LOOP_BIDIRECTIONAL) {
+            gint32 k = (i - (gint32)si->loopstart) % (2 * len);
+
+            if (k < 0)
+                k += 2 * len;
+            if (k >= len)
+                k = 2 * len - 1 - k;
+            return sinc_data(c, si->loopstart + k);
+        } else {
+            gint32 k = (i - (gint32)si->loopstart) % len;
+
+            if (k < 0)
+                k += len;
+            return sinc_data(c, si->loopstart + k);
+        }
+    }
+
+    if (i < 0 || i >= (gint32)c->length)
+        return 0;
+
+    return sinc_data(c, i);
+}
+
+static void
+sinc_mix_channel(sinc_channel* c,
+    float* mixbuf,
+    gint16* scopebuf,
+    guint32 count)
+{
+    const sinc_kernel* k = c->kernel ? c->kernel : &sinc_kernels[0];
+    const int taps = k->taps;
+    const gboolean filtered = !(c->ffreq == 1.0 && c->freso == 0.0);
+    gint16 buffer[SINC_MAX_TAPS];
+    guint32 i;
+
+    for (i = 0; i < count; i++) {
+        const gboolean loopit = (c->playend == 0) && (c->flags & (SINC_FLAG_LOOP_UNIDIRECTIONAL | SINC_FLAG_LOOP_BIDIRECTIONAL));
+        const gint32 lo = (loopit && (c->flags & SINC_FLAG_LOOPED)) ? c->buffer->loopstart : 0;
+        const gint32 hi = loopit ? c->buffer->loopend : c->length;
+        const gint16* s;
+        gint32 first;
+        guint32 frac;
+        float s0;
+
+        if (!sinc_wrap_position(c)) {
+            /* A sample without loop has just ended. */
+            c->flags &= SINC_FLAG_ACTIVE;
+            break;
+        }
+
+        frac = (guint32)c->position;
+        first = (gint32)(c->position >> 32) - taps / 2 + 1;
+
+        if (first >= lo && first + taps <= hi && c->buffer->format != ST_MIXER_SAMPLE_FORMAT_8) {
+            s = (gint16*)c->data + first;
+        } else if (first >= lo && first + taps <= hi) {
+            /* sinc_dot() wants 16 bit values */
+            const gint8* s8 = (gint8*)c->data + first;
+            int j;
+
+            for (j = 0; j < taps; j++)
+                buffer[j] = s8[j] * 256;
+            s = buffer;
+        } else {
+            /* Near the start, the end or the loop ends */
+            int j;
+
+            for (j = 0; j < taps; j++)
+                buffer[j] = sinc_get_sample(c, first + j);
+            s = buffer;
+        }
+
+        s0 = sinc_dot(s, k->coeffs + (frac >> SINC_FRAC_BITS) * taps, taps,
+            (frac & ((1 << SINC_FRAC_BITS) - 1)) * (1.0f / (1 << SINC_FRAC_BITS)));
+
+        if (filtered) {
+            c->fb1 = c->freso * c->fb1 + c->ffreq * (s0 - c->fl1);
+            c->fl1 += c->ffreq * c->fb1;
+            s0 = c->fl1;
+        }
+
+        if (scopebuf) {
+            *scopebuf++ = (gint16)(s0 * (c->volleft + c->volright));
+        }
+        *mixbuf++ += s0 * c->volleft;
+        *mixbuf++ += s0 * c->volright;
+
+        c->position += c->direction == 1 ? c->freq : -c->freq;
+
+        if (c->ramp_num_samples) {
+            c->volleft += c->rampleft;
+            c->volright += c->rampright;
+            if (--c->ramp_num_samples == 0) {
+                /* Volume ramping finished. */
+                c->volleft = c->rampdestleft;
+                c->volright = c->rampdestright;
+                if (c->flags & SINC_FLAG_STOP_AFTER_VOLRAMP) {
+                    /* This was only a declicking voice. Stop sample. */
+                    c->flags &= SINC_FLAG_ACTIVE;
+                    i++;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (scopebuf && i < count) {
+        memset(scopebuf, 0, 2 * (count - i));
+    }
+}
+
+static void*
+sinc_mix(void* mp,
+    void* dest,
+    guint32 count,
+    gint16* scopebufs[],
+    int scopebuf_offset)
+{
+    sinc_mixer* const m = mp;
+    int i;
+
+    if (count > m->tempbufsize) {
+        free(m->tempbuf);
+        m->tempbufsize = count;
+        m->tempbuf = malloc(2 * sizeof(float) * m->tempbufsize);
+    }
+
+    sinc_sync_samples(m);
+
+    memset(m->tempbuf, 0, 2 * sizeof(float) * count);
+    m->scopemask = 0;
+
+    for (i = 0; i < m->num_active; i++) {
+        sinc_channel* c = m->voices + m->active[i];
+        gint16* scopedata = NULL;
+
+        if (c->channel >= m->num_channels || !(c->flags & SINC_FLAG_SAMPLE_RUNNING)) {
+            continue;
+        }
+
+        // Only the current voice of a pattern channel is shown in its scope
+        if (scopebufs && sinc_is_current(m, c)) {
+            scopedata = scopebufs[c->channel] + scopebuf_offset;
+            m->scopemask |= 1 << c->channel;
+        }
+
+        if (c->flags & SINC_FLAG_JUST_STARTED) {
+            if (c->flags & SINC_FLAG_DO_SAMPLE_START_DECLICK) {
+                c->volleft = 0.0;
+                c->volright = 0.0;
+                sinc_start_ramp(m, c);
+            }
+
+            c->flags &= ~(SINC_FLAG_JUST_STARTED | SINC_FLAG_DO_SAMPLE_START_DECLICK);
+        }
+
+        sinc_mix_channel(c, m->tempbuf, scopedata, count);
+    }
+
+    sinc_cleanup_voices(m);
+
+    if (m->float_output) {
+        m->clipflag = kbasm_post_mixing_float(m->tempbuf, (float*)dest, count, m->amplification);
+        return dest + count * 2 * sizeof(float);
+    }
+
+    m->clipflag = kbasm_post_mixing(m->tempbuf, (gint16*)dest, count, m->amplification);
+
+    return dest + count * 2 * 2;
+}
+
+static void
+sinc_dumpstatus(void* mp,
+    st_mixer_channel_status array[])
+{
+    sinc_mixer* const m = mp;
+    int i;
+    gint64 pos;
+
+    for (i = 0; i < 32; i++) {
+        sinc_channel* c = sinc_get_channel_struct(m, i);
+
+        if (c->flags & SINC_FLAG_SAMPLE_RUNNING) {
+            array[i].current_sample = c->sample;
+            pos = c->position >> 32;
+            if (pos < 0) {
+                pos = 0;
+            } else if (pos >= c->length) {
+                pos = c->length - 1;
+            }
+            array[i].current_position = pos;
+        } else {
+            array[i].current_sample = NULL;
+        }
+    }
+}
+
+static void
+sinc_loadchsettings(void* mp,
+    int ch,
+    const tracer_channel* tch)
+{
+    sinc_mixer* const m = mp;
+    sinc_channel* c;
+
+    g_assert(ch < m->num_channels);
+
+    c = sinc_get_channel_struct(m, ch);
+
+    c->sample = tch->sample;
+    st_mixer_sample_buffer_unref(c->buffer);
+    c->buffer = tch->sample ? st_mixer_sample_acquire(tch->sample) : NULL;
+    c->data = tch->data;
+    c->length = tch->length;
+    c->volume = tch->volume;
+    c->panning = tch->panning;
+    c->direction = tch->direction;
+    c->playend = tch->playend;
+    c->position = ((gint64)tch->positionw << 32) + tch->positionf;
+    c->freq = ((gint64)tch->freqw << 32) + tch->freqf;
+    c->kernel = sinc_get_kernel(c->freq);
+    c->ffreq = tch->ffreq;
+    c->freso = tch->freso;
+
+    c->flags = (c->flags & SINC_FLAG_ACTIVE) | SINC_FLAG_JUST_STARTED | ((tch->flags & TR_FLAG_LOOP_UNIDIRECTIONAL) ? SINC_FLAG_LOOP_UNIDIRECTIONAL : 0) | ((tch->flags & TR_FLAG_LOOP_BIDIRECTIONAL) ? SINC_FLAG_LOOP_BIDIRECTIONAL : 0) | ((tch->flags & TR_FLAG_SAMPLE_RUNNING) ? SINC_FLAG_SAMPLE_RUNNING : 0);
+
+    sinc_redo_vol_fields(m, c);
+
+    /* The sample may have been changed since it was traced */
+    if (!c->buffer || c->buffer->data != tch->data || c->buffer->length != tch->length) {
+        c->flags &= SINC_FLAG_ACTIVE;
+    }
+    if (c->flags & SINC_FLAG_SAMPLE_RUNNING) {
+        sinc_activate(m, c);
+    } else {
+        st_mixer_sample_buffer_unref(c->buffer);
+        c->buffer = NULL;
+    }
+}
+
+st_mixer mixer_sinc = {
+    "sinc",
+    N_("Windowed-sinc interpolation with 16 to 64 taps, IT filters; slow, for high-quality rendering"),
+
+    sinc_new,
+    sinc_destroy,
+    sinc_setnumch,
+    sinc_updatesample,
+    sinc_setmixformat,
+    sinc_setstereo,
+    sinc_setmixfreq,
+    sinc_setampfactor,
+    sinc_getclipflag,
+    sinc_getscopemask,
+    sinc_reset,
+    sinc_startnote,
+    sinc_stopnote,
+    sinc_setsmplpos,
+    sinc_setsmplend,
+    sinc_setfreq,
+    sinc_setvolume,
+    sinc_setpanning,
+    sinc_setchcutoff,
+    sinc_setchreso,
+    sinc_mix,
+    sinc_dumpstatus,
+    sinc_loadchsettings,
+
+    0x7fffffff,
+
+    NULL
+};
@@ -0,0 +1,174 @@
+
+/*
+ * The Real SoundTracker - message queue
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include "msg-queue.h"
+
+/* The slot of message i is i & mask; head and tail are free-running
+   counters, head only written by the sender, tail only by the
+   receiver. */
+
+struct msg_queue {
+    gchar* slots;
+    gsize msgsize;
+    guint mask;
+
+    gint head; /* next slot to be written */
+    gint tail; /* next slot to be read */
+    gint signalled; /* the receiver has been woken up and hasn't looked yet */
+
+    int fd[2]; /* eventfd (both the same) or pipe: [0] for reading, [1] for writing */
+};
+
+#define SLOT(q, i) ((q)->slots + (gsize)((guint)(i) & (q)->mask) * (q)->msgsize)
+
+msg_queue*
+msg_queue_new(gsize msgsize,
+    guint capacity)
+{
+    msg_queue* q = g_new0(msg_queue, 1);
+    guint size = 1;
+
+    while (size < capacity)
+        size <<= 1;
+
+#if HAVE_SYS_EVENTFD_H
+    q->fd[0] = q->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->fd[0] == -1) {
+        perror("msg_queue: eventfd()");
+        g_free(q);
+        return NULL;
+    }
+#else
+    if (pipe(q->fd) == -1) {
+        perror("msg_queue: pipe()");
+        g_free(q);
+        return NULL;
+    }
+    fcntl(q->fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(q->fd[1], F_SETFL, O_NONBLOCK);
+#endif
+
+    q->msgsize = msgsize;
+    q->mask = size - 1;
+    q->slots = g_malloc0(size * msgsize);
+
+    return q;
+}
+
+void msg_queue_destroy(msg_queue* q)
+{
+    if (q) {
+        close(q->fd[0]);
+        if (q->fd[1] != q->fd[0])
+            close(q->fd[1]);
+        g_free(q->slots);
+        g_free(q);
+    }
+}
+
+gboolean
+msg_queue_try_send(msg_queue* q,
+    const void* msg)
+{
+    guint head = g_atomic_int_get(&q->head);
+
+    if (head - (guint)g_atomic_int_get(&q->tail) > q->mask)
+        return FALSE;
+
+    memcpy(SLOT(q, head), msg, q->msgsize);
+    g_atomic_int_set(&q->head, head + 1);
+
+    /* Only the first message after the receiver has looked needs a
+       wakeup; it picks up everything that follows anyway. */
+    if (g_atomic_int_compare_and_exchange(&q->signalled, 0, 1)) {
+#if HAVE_SYS_EVENTFD_H
+        eventfd_write(q->fd[1], 1);
+#else
+        char c = 0;
+
+        if (write(q->fd[1], &c, 1) == -1 && errno != EAGAIN)
+            perror("msg_queue: write()");
+#endif
+    }
+
+    return TRUE;
+}
+
+void msg_queue_send(msg_queue* q,
+    const void* msg)
+{
+    /* Full -- this is where a pipe would block, too */
+    while (!msg_queue_try_send(q, msg))
+        g_usleep(1000);
+}
+
+int msg_queue_get_fd(msg_queue* q)
+{
+    return q->fd[0];
+}
+
+void msg_queue_ack(msg_queue* q)
+{
+#if HAVE_SYS_EVENTFD_H
+    eventfd_t v;
+#else
+    char buf[64];
+#endif
+
+#if HAVE_SYS_EVENTFD_H
+    eventfd_read(q->fd[0], &v);
+#else
+    while (read(q->fd[0], buf, sizeof(buf)) > 0)
+        ;
+#endif
+
+    /* Only now reset the flag: a message sent from here on wakes us
+       again, and everything sent before is seen by the caller, which
+       empties the queue after this. */
+    g_atomic_int_set(&q->signalled, 0);
+}
+
+gboolean
+msg_queue_receive(msg_queue* q,
+    void* msg)
+{
+    guint tail = g_atomic_int_get(&q->tail);
+
+    if (tail == (guint)g_atomic_int_get(&q->head))
+        return FALSE;
+
+    memcpy(msg, SLOT(q, tail), q->msgsize);
+    g_atomic_int_set(&q->tail, tail + 1);
+
+    return TRUE;
+}
@@ -0,0 +1,51 @@
+
+/*
+ * The Real SoundTracker - message queue (header)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MSG_QUEUE_H
+#define _MSG_QUEUE_H
+
+#include <glib.h>
+
+/* A queue of fixed-size messages from one thread to another one,
+   without locking and without allocation after creation. The
+   receiving thread can wait for messages by polling a file
+   descriptor (an eventfd where available, otherwise a pipe). */
+
+typedef struct msg_queue msg_queue;
+
+msg_queue* msg_queue_new(gsize msgsize, guint capacity);
+void msg_queue_destroy(msg_queue* q);
+
+/* Sending side. The message is copied; if the queue is full, this waits
+   until the receiver has made room. */
+void msg_queue_send(msg_queue* q, const void* msg);
+
+/* Same, but returns FALSE instead of waiting if the queue is full */
+gboolean msg_queue_try_send(msg_queue* q, const void* msg);
+
+/* Receiving side. The fd becomes readable when messages are waiting.
+   After waking up, call msg_queue_ack() and then msg_queue_receive()
+   until it returns FALSE. */
+int msg_queue_get_fd(msg_queue* q);
+void msg_queue_ack(msg_queue* q);
+gboolean msg_queue_receive(msg_queue* q, void* msg);
+
+#endif /* _MSG_QUEUE_H */
@@ -0,0 +1,345 @@
+
+/*
+ * The Real SoundTracker - Headless rendering of modules to files
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+
+#if USE_SNDFILE
+#include <sndfile.h>
+#elif AUDIOFILE_VERSION
+#include <audiofile.h>
+#endif
+
+#include "audio.h"
+#include "audioconfig.h"
+#include "gui-settings.h"
+#include "gui-subs.h"
+#include "main.h"
+#include "preferences.h"
+#include "render.h"
+#include "xm-player.h"
+#include "xm.h"
+
+/* Number of frames mixed and written in one go */
+#define RENDER_BUFSIZE 16384
+
+/* The player only tells us when the song loops; modules that never
+   do so must not keep us busy forever. */
+#define RENDER_MAX_SECONDS 3600
+
+#if USE_SNDFILE || AUDIOFILE_VERSION
+
+typedef struct render_file {
+#if USE_SNDFILE
+    SNDFILE* outfile;
+    SF_INFO sfinfo;
+#else
+    AFfilehandle outfile;
+#endif
+    int channels;
+} render_file;
+
+static gboolean
+render_file_open(render_file* f,
+    const gchar* filename,
+    int mixfreq,
+    int channels,
+    int bits)
+{
+    f->channels = channels;
+
+    /* The mixer always delivers 16 bit; the file library converts if
+       a different resolution is wanted in the file. */
+#if USE_SNDFILE
+    f->sfinfo.channels = channels;
+    f->sfinfo.samplerate = mixfreq;
+    f->sfinfo.format = SF_FORMAT_WAV | (bits == 8 ? SF_FORMAT_PCM_U8 : SF_FORMAT_PCM_16);
+
+    f->outfile = sf_open(filename, SFM_WRITE, &f->sfinfo);
+#else
+    AFfilesetup outfilesetup;
+
+    outfilesetup = afNewFileSetup();
+    afInitFileFormat(outfilesetup, AF_FILE_WAVE);
+    afInitChannels(outfilesetup, AF_DEFAULT_TRACK, channels);
+    afInitRate(outfilesetup, AF_DEFAULT_TRACK, mixfreq);
+    afInitSampleFormat(outfilesetup, AF_DEFAULT_TRACK,
+        bits == 8 ? AF_SAMPFMT_UNSIGNED : AF_SAMPFMT_TWOSCOMP, bits);
+    f->outfile = afOpenFile(filename, "w", outfilesetup);
+    afFreeFileSetup(outfilesetup);
+    if (f->outfile)
+        afSetVirtualSampleFormat(f->outfile, AF_DEFAULT_TRACK, AF_SAMPFMT_TWOSCOMP, 16);
+#endif
+
+    return f->outfile != NULL;
+}
+
+static gboolean
+render_file_write(render_file* f,
+    gint16* buf,
+    guint32 frames)
+{
+#if USE_SNDFILE
+    return sf_writef_short(f->outfile, buf, frames) == frames;
+#else
+    return afWriteFrames(f->outfile, AF_DEFAULT_TRACK, buf, frames) == frames;
+#endif
+}
+
+static void
+render_file_close(render_file* f)
+{
+#if USE_SNDFILE
+    sf_close(f->outfile);
+#else
+    afCloseFile(f->outfile);
+#endif
+    f->outfile = NULL;
+}
+
+gboolean
+render_module(XM* xm,
+    const gchar* filename,
+    st_mixer* mixer,
+    int mixfreq,
+    int bits,
+    double* seconds)
+{
+    st_mixer_ctx mc = { mixer, NULL, 0, 0.0 };
+    XMPlayer* p;
+    render_file f;
+    gint16 *buf, *bufpos;
+    int channels = 2;
+    double previous = 0.0, rest = 0.0; /* Fractional part of the samples */
+    guint32 buffered = 0;
+    guint64 frames = 0, max_frames = (guint64)mixfreq * RENDER_MAX_SECONDS;
+    gboolean clipped = FALSE, success = TRUE;
+
+    g_assert(xm != NULL);
+    g_assert(mixer != NULL);
+
+    mc.m = mixer->new();
+    mixer->reset(mc.m);
+    if (!mixer->setmixformat(mc.m, 16)) {
+        fprintf(stderr, _("Mixer %s doesn't support 16 bit output.\n"), mixer->id);
+        mixer->destroy(mc.m);
+        return FALSE;
+    }
+    if (!mixer->setstereo(mc.m, 1))
+        channels = 1;
+    mixer->setmixfreq(mc.m, mixfreq);
+    mixer->setampfactor(mc.m, 1.0);
+
+    if (!render_file_open(&f, filename, mixfreq, channels, bits)) {
+        fprintf(stderr, _("Can't open %s for writing.\n"), filename);
+        mixer->destroy(mc.m);
+        return FALSE;
+    }
+
+    buf = g_new(gint16, RENDER_BUFSIZE * channels);
+    bufpos = buf;
+
+    p = xmplayer_new(&mc);
+    xmplayer_init_module(p, xm);
+    xmplayer_init_play_song(p, 0, 0, TRUE);
+
+    /* Same scheme as in audio_mix(): the player tells when its next
+       tick is due, and the mixer fills the gap up to that time. */
+    while (frames < max_frames) {
+        double time, current;
+        guint32 samples;
+
+        current = xmplayer_play(p);
+        if (p->looped)
+            break;
+
+        time = current - previous + rest;
+        previous = current;
+        samples = time * mixfreq;
+        rest = time - (double)samples / (double)mixfreq;
+
+        if (frames + samples > max_frames)
+            samples = max_frames - frames;
+        frames += samples;
+
+        while (samples) {
+            guint32 n = MIN(samples, RENDER_BUFSIZE - buffered);
+
+            bufpos = mixer->mix(mc.m, bufpos, n, NULL, 0);
+            clipped |= mixer->getclipflag(mc.m);
+            buffered += n;
+            samples -= n;
+
+            if (buffered == RENDER_BUFSIZE) {
+                if (!render_file_write(&f, buf, buffered)) {
+                    success = FALSE;
+                    goto out;
+                }
+                bufpos = buf;
+                buffered = 0;
+            }
+        }
+    }
+
+    if (buffered && !render_file_write(&f, buf, buffered))
+        success = FALSE;
+
+out:
+    if (!success)
+        fprintf(stderr, _("Error writing %s.\n"), filename);
+    if (clipped)
+        fprintf(stderr, _("Warning: the output has been clipped.\n"));
+
+    xmplayer_destroy(p);
+    g_free(buf);
+    render_file_close(&f);
+    mixer->destroy(mc.m);
+
+    if (seconds)
+        *seconds = (double)frames / mixfreq;
+
+    return success;
+}
+
+#else /* USE_SNDFILE || AUDIOFILE_VERSION */
+
+gboolean
+render_module(XM* xm,
+    const gchar* filename,
+    st_mixer* mixer,
+    int mixfreq,
+    int bits,
+    double* seconds)
+{
+    fprintf(stderr, _("This SoundTracker was built without sndfile or audiofile support; can't render.\n"));
+    return FALSE;
+}
+
+#endif /* USE_SNDFILE || AUDIOFILE_VERSION */
+
+static void
+render_usage(const char* progname)
+{
+    GList* l;
+
+    fprintf(stderr, _("Usage: %s --render [-m mixer] [-r rate] [-b 8|16] in.xm out.wav\n"), progname);
+    fprintf(stderr, _("Available mixers:\n"));
+    for (l = mixers; l; l = l->next) {
+        st_mixer* m = l->data;
+
+        fprintf(stderr, "  %-12s %s\n", m->id, m->description);
+    }
+}
+
+static st_mixer*
+render_find_mixer(const char* id)
+{
+    GList* l;
+
+    for (l = mixers; l; l = l->next) {
+        st_mixer* m = l->data;
+
+        if (!strcmp(m->id, id))
+            return m;
+    }
+
+    return NULL;
+}
+
+int render_main(int argc,
+    char* argv[])
+{
+    st_mixer* m = mixers->data;
+    const char *infile = NULL, *outfile = NULL;
+    int mixfreq = 44100, bits = 16;
+    int i;
+    double seconds, elapsed;
+    GTimer* timer;
+    gboolean success;
+
+    g_assert(argc >= 2 && !strcmp(argv[1], "--render"));
+
+    for (i = 2; i < argc; i++) {
+        if ((!strcmp(argv[i], "-m") || !strcmp(argv[i], "--mixer")) && i + 1 < argc) {
+            if (!(m = render_find_mixer(argv[++i]))) {
+                fprintf(stderr, _("Unknown mixer: %s\n"), argv[i]);
+                render_usage(argv[0]);
+                return 1;
+            }
+        } else if ((!strcmp(argv[i], "-r") || !strcmp(argv[i], "--rate")) && i + 1 < argc) {
+            mixfreq = atoi(argv[++i]);
+        } else if ((!strcmp(argv[i], "-b") || !strcmp(argv[i], "--bits")) && i + 1 < argc) {
+            bits = atoi(argv[++i]);
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            render_usage(argv[0]);
+            return 1;
+        } else if (!infile) {
+            infile = argv[i];
+        } else if (!outfile) {
+            outfile = argv[i];
+        } else {
+            render_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!infile || !outfile || mixfreq < 4000 || mixfreq > 192000 || (bits != 8 && bits != 16)) {
+        render_usage(argv[0]);
+        return 1;
+    }
+
+    /* No display here; the GUI helpers print their messages to
+       stderr instead of opening dialogs. */
+    gui_set_headless(TRUE);
+    prefs_init();
+    gui_settings_load_config();
+
+    /* XM_Load() checks the sample lengths against this one */
+    mixer = m;
+
+    if (!(xm = File_Load(infile)))
+        return 1;
+
+    /* Nothing plays in real time here; no note may go missing */
+    st_mixer_sample_allow_waiting(TRUE);
+
+    timer = g_timer_new();
+    success = render_module(xm, outfile, m, mixfreq, bits, &seconds);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    if (success) {
+        printf(_("%s: %.1f s rendered in %.2f s (%.1fx real time) using mixer %s\n"),
+            outfile, seconds, elapsed, elapsed > 0.0 ? seconds / elapsed : 0.0, m->id);
+    }
+
+    XM_Free(xm);
+    xm = NULL;
+    prefs_close();
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+
+/*
+ * The Real SoundTracker - Headless rendering of modules to files (header)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _ST_RENDER_H
+#define _ST_RENDER_H
+
+#include <glib.h>
+
+#include "mixer.h"
+#include "xm.h"
+
+/* Plays the module once from the beginning with a private player and
+   mixer instance and writes the result to a WAV file. Neither the
+   audio thread nor any driver is involved, so this runs as fast as
+   the machine can mix. The length of the rendered audio in seconds is
+   stored in *seconds. */
+gboolean render_module(XM* xm,
+    const gchar* filename,
+    st_mixer* mixer,
+    int mixfreq,
+    int bits,
+    double* seconds);
+
+/* Entry point for "soundtracker --render [options] in.xm out.wav" */
+int render_main(int argc, char* argv[]);
+
+#endif /* _ST_RENDER_H */
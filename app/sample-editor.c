@@ -64,6 +64,9 @@
 // == GUI variables
 
 static STSample* current_sample = NULL;
+/* Keeps the displayed data of a sample loaded on demand from being
+   evicted */
+static st_mixer_sample_buffer* current_buffer = NULL;
 
 static GtkWidget *spin_volume, *spin_panning, *spin_finetune, *spin_relnote;
 static GtkWidget *savebutton, *savebutton_rgn;
@@ -199,19 +202,11 @@ static void sample_editor_trim_dialog(void);
 static void sample_editor_trim(gboolean beg, gboolean end, gfloat threshold);
 static void sample_editor_delete(STSample* sample, int start, int end);
 
+/* Makes the changes to the current sample audible */
 static void
-sample_editor_lock_sample(void)
+sample_editor_publish_sample(void)
 {
-    g_mutex_lock(&current_sample->sample.lock);
-}
-
-static void
-sample_editor_unlock_sample(void)
-{
-    if (gui_playing_mode) {
-        mixer->updatesample(&current_sample->sample);
-    }
-    g_mutex_unlock(&current_sample->sample.lock);
+    st_sample_publish(current_sample);
 }
 
 void sample_editor_page_create(GtkNotebook* nb)
@@ -608,6 +603,18 @@ void sample_editor_update(void)
     int m = xm_get_modified();
 
     sample_display_set_data(sampledisplay, NULL, ST_MIXER_FORMAT_S16_LE, 0, FALSE);
+    st_mixer_sample_buffer_unref(current_buffer);
+    current_buffer = NULL;
+
+    if (sts) {
+        /* Only read here; the data is widened when it is changed */
+        if (!st_mixer_sample_load(&sts->sample)) {
+            static GtkWidget* dialog = NULL;
+
+            gui_error_dialog(&dialog, _("Out of memory for sample data."), FALSE);
+        }
+        current_buffer = st_mixer_sample_acquire(&sts->sample);
+    }
 
     if (!sts || !sts->sample.data) {
         gtk_widget_set_sensitive(se->vertical_boxes[0], FALSE);
@@ -646,7 +653,9 @@ void sample_editor_update(void)
     sample_editor_set_selection_label(-1, 0);
 
     if (s->data) {
-        sample_display_set_data(sampledisplay, s->data, ST_MIXER_FORMAT_S16_LE, s->length, FALSE);
+        sample_display_set_data(sampledisplay, s->data,
+            s->format == ST_MIXER_SAMPLE_FORMAT_8 ? ST_MIXER_FORMAT_S8 : ST_MIXER_FORMAT_S16_LE,
+            s->length, FALSE);
 
         if (s->looptype != ST_MIXER_SAMPLE_LOOPTYPE_NONE) {
             sample_editor_blocked_set_display_loop(s->loopstart, s->loopend);
@@ -716,6 +725,20 @@ void sample_editor_set_sample(STSample* s)
     sample_editor_update();
 }
 
+/* Operations which change the sample data work on 16 bit values */
+static gboolean
+sample_editor_claim_data(STSample* s)
+{
+    if (!st_sample_claim_data(s)) {
+        static GtkWidget* dialog = NULL;
+
+        gui_error_dialog(&dialog, _("Out of memory for sample data."), FALSE);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static void
 sample_editor_update_mixer_position(double songtime)
 {
@@ -816,10 +839,9 @@ sample_editor_selection_to_loop_clicked(void)
 
     gtk_toggle_button_set_mode(GTK_TOGGLE_BUTTON(loopradio[0]), TRUE);
 
-    sample_editor_lock_sample();
     current_sample->sample.loopend = e;
     current_sample->sample.loopstart = s;
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
 
     sample_editor_blocked_set_loop_spins(s, e);
 
@@ -843,10 +865,9 @@ sample_editor_loop_changed()
             sample_editor_blocked_set_loop_spins(s, e);
         }
 
-        sample_editor_lock_sample();
         current_sample->sample.loopend = e;
         current_sample->sample.loopstart = s;
-        sample_editor_unlock_sample();
+        sample_editor_publish_sample();
 
         sample_editor_blocked_set_display_loop(s, e);
     }
@@ -867,10 +888,9 @@ sample_editor_display_loop_changed(SampleDisplay* sample_display,
     if (start != current_sample->sample.loopstart || end != current_sample->sample.loopend) {
         sample_editor_blocked_set_loop_spins(start, end);
 
-        sample_editor_lock_sample();
         current_sample->sample.loopend = end;
         current_sample->sample.loopstart = start;
-        sample_editor_unlock_sample();
+        sample_editor_publish_sample();
     }
 
     gui_xm_set_modified(1);
@@ -936,9 +956,8 @@ sample_editor_loopradio_changed(void)
 
     if (current_sample != NULL) {
         if (current_sample->sample.looptype != n) {
-            sample_editor_lock_sample();
             current_sample->sample.looptype = n;
-            sample_editor_unlock_sample();
+            sample_editor_publish_sample();
         }
 
         if (n != ST_MIXER_SAMPLE_LOOPTYPE_NONE) {
@@ -970,8 +989,6 @@ sample_editor_clear_clicked(void)
 {
     STInstrument* instr;
 
-    sample_editor_lock_sample();
-
     st_clean_sample(current_sample, NULL, NULL);
 
     instr = instrument_editor_get_instrument();
@@ -982,7 +999,7 @@ sample_editor_clear_clicked(void)
         sample_editor_update();
     }
 
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
 
     gui_xm_set_modified(1);
 }
@@ -992,15 +1009,14 @@ sample_editor_crop_clicked(void)
 {
     int start = sampledisplay->sel_start, end = sampledisplay->sel_end;
 
-    if (current_sample == NULL || start == -1)
+    if (current_sample == NULL || start == -1 || !sample_editor_claim_data(current_sample))
         return;
 
     int l = current_sample->sample.length;
 
-    sample_editor_lock_sample();
     sample_editor_delete(current_sample, 0, start);
     sample_editor_delete(current_sample, end - start, l - start);
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
 
     sample_editor_set_sample(current_sample);
     gui_xm_set_modified(1);
@@ -1096,6 +1112,8 @@ void sample_editor_copy_cut_common(gboolean copy,
 
     if (oldsample == NULL || ss == -1)
         return;
+    if (spliceout && !sample_editor_claim_data(oldsample))
+        return;
 
     se = sampledisplay->sel_end;
 
@@ -1114,9 +1132,14 @@ void sample_editor_copy_cut_common(gboolean copy,
 
             gui_error_dialog(&dialog, N_("Out of memory for copybuffer.\n"), FALSE);
         } else {
-            memcpy(copybuffer,
-                oldsample->sample.data + ss,
-                cutlen * 2);
+            /* The copy buffer is 16 bit */
+            const int bits = oldsample->sample.format == ST_MIXER_SAMPLE_FORMAT_8 ? 8 : 16;
+
+            st_convert_sample((gint8*)oldsample->sample.data + ss * bits / 8,
+                copybuffer,
+                bits,
+                16,
+                cutlen);
         }
         memcpy(&copybuffer_sampleinfo, oldsample, sizeof(STSample));
     }
@@ -1133,8 +1156,6 @@ void sample_editor_copy_cut_common(gboolean copy,
     if (!newsample)
         return;
 
-    sample_editor_lock_sample();
-
     memcpy(newsample,
         oldsample->sample.data,
         ss * 2);
@@ -1142,7 +1163,7 @@ void sample_editor_copy_cut_common(gboolean copy,
         oldsample->sample.data + se,
         (oldsample->sample.length - se) * 2);
 
-    free(oldsample->sample.data);
+    st_mixer_sample_free_data(&oldsample->sample);
 
     oldsample->sample.data = newsample;
     oldsample->sample.length = newlen;
@@ -1172,7 +1193,7 @@ void sample_editor_copy_cut_common(gboolean copy,
     }
 
     st_sample_fix_loop(oldsample);
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
     sample_editor_set_sample(oldsample);
     gui_xm_set_modified(1);
 }
@@ -1234,18 +1255,17 @@ void sample_editor_paste_clicked(void)
 
     if (!oldsample->sample.data) {
         /* pasting into empty sample */
-        sample_editor_lock_sample();
         sample_editor_init_sample(_("<just pasted>")); /* Use only charachers from FT2 codeset in the translation! */
         oldsample->treat_as_8bit = copybuffer_sampleinfo.treat_as_8bit;
         oldsample->volume = copybuffer_sampleinfo.volume;
         oldsample->finetune = copybuffer_sampleinfo.finetune;
         oldsample->panning = copybuffer_sampleinfo.panning;
         oldsample->relnote = copybuffer_sampleinfo.relnote;
-        sample_editor_unlock_sample();
+        sample_editor_publish_sample();
         ss = 0;
         update_ie = 1;
     } else {
-        if (ss == -1)
+        if (ss == -1 || !sample_editor_claim_data(oldsample))
             return;
     }
 
@@ -1255,8 +1275,6 @@ void sample_editor_paste_clicked(void)
     if (!newsample)
         return;
 
-    sample_editor_lock_sample();
-
     memcpy(newsample,
         oldsample->sample.data,
         ss * 2);
@@ -1269,12 +1287,12 @@ void sample_editor_paste_clicked(void)
         oldsample->sample.data + ss,
         (oldsample->sample.length - ss) * 2);
 
-    free(oldsample->sample.data);
+    st_mixer_sample_free_data(&oldsample->sample);
 
     oldsample->sample.data = newsample;
     oldsample->sample.length = newlen;
 
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
     sample_editor_update();
     if (update_ie)
         instrument_editor_update(TRUE);
@@ -1288,12 +1306,10 @@ sample_editor_reverse_clicked(void)
     int i;
     gint16 *p, *q;
 
-    if (!current_sample || ss == -1) {
+    if (!current_sample || ss == -1 || !sample_editor_claim_data(current_sample)) {
         return;
     }
 
-    sample_editor_lock_sample();
-
     p = q = current_sample->sample.data;
     p += ss;
     q += se;
@@ -1305,7 +1321,7 @@ sample_editor_reverse_clicked(void)
     }
 
     gui_xm_set_modified(1);
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
     sample_editor_update();
     sample_display_set_selection(sampledisplay, ss, se);
 }
@@ -1452,7 +1468,6 @@ sample_editor_load_wav_main(const int mode, FILE* f, struct wl* wavload)
         }
     }
 
-    sample_editor_lock_sample();
     sample_editor_init_sample(wavload->samplename);
     current_sample->sample.data = sbuf;
     current_sample->treat_as_8bit = (wavload->sampleWidth == 8);
@@ -1482,7 +1497,6 @@ sample_editor_load_wav_main(const int mode, FILE* f, struct wl* wavload)
             goto errnodata;
         }
 
-        g_mutex_lock(&next->sample.lock);
         sample_editor_init_sample_full(next, wavload->samplename);
         next->sample.data = sbuf2;
         next->treat_as_8bit = (wavload->sampleWidth == 8);
@@ -1528,12 +1542,9 @@ sample_editor_load_wav_main(const int mode, FILE* f, struct wl* wavload)
         free(tmp);
 
     if (mode == MODE_STEREO_2) {
-        if (gui_playing_mode) {
-            mixer->updatesample(&next->sample);
-        }
-        g_mutex_unlock(&next->sample.lock);
+        st_sample_publish(next);
     }
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
 
     instrument_editor_update(TRUE);
     sample_editor_update();
@@ -1820,6 +1831,7 @@ sample_editor_save_wav_main(const gchar* fn,
     AFfilesetup outfilesetup;
     double rate = 44100.0;
 #endif
+    gint16* data = current_sample->sample.data + offset;
 
     statusbar_update(STATUS_SAVING_SAMPLE, TRUE);
 
@@ -1861,16 +1873,27 @@ sample_editor_save_wav_main(const gchar* fn,
         return;
     }
 
+    if (current_sample->sample.format == ST_MIXER_SAMPLE_FORMAT_8) {
+        /* Widened for writing only */
+        data = malloc(2 * length);
+        g_assert(data);
+        st_convert_sample((gint8*)current_sample->sample.data + offset,
+            data,
+            8,
+            16,
+            length);
+    }
+
 #if USE_SNDFILE
     sf_writef_short(outfile,
-        current_sample->sample.data + offset,
+        data,
         length);
     sf_close(outfile);
 #else
     if (current_sample->treat_as_8bit) {
         void* buf = malloc(1 * length);
         g_assert(buf);
-        st_convert_sample(current_sample->sample.data + offset,
+        st_convert_sample(data,
             buf,
             16,
             8,
@@ -1884,11 +1907,14 @@ sample_editor_save_wav_main(const gchar* fn,
         free(buf);
     } else {
         afWriteFrames(outfile, AF_DEFAULT_TRACK,
-            current_sample->sample.data + offset,
+            data,
             length);
     }
     afCloseFile(outfile);
 #endif
+    if (current_sample->sample.format == ST_MIXER_SAMPLE_FORMAT_8) {
+        free(data);
+    }
 
     statusbar_update(STATUS_SAMPLE_SAVED, FALSE);
 }
@@ -2238,7 +2264,6 @@ sample_editor_ok_clicked(void)
             return;
         }
 
-    sample_editor_lock_sample();
     st_clean_sample(current_sample, NULL, NULL);
     instr = instrument_editor_get_instrument();
     if (st_instrument_num_samples(instr) == 0)
@@ -2248,7 +2273,6 @@ sample_editor_ok_clicked(void)
 
     if (mode == MODE_STEREO_2) {
 
-        g_mutex_lock(&next->sample.lock);
         st_clean_sample(next, samplename, NULL);
         next->sample.data = sbuf2;
         next->treat_as_8bit = !multiply;
@@ -2428,12 +2452,9 @@ sample_editor_ok_clicked(void)
         &current_sample->relnote,
         &current_sample->finetune);
 
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
     if (mode == MODE_STEREO_2) {
-        if (gui_playing_mode) {
-            mixer->updatesample(&next->sample);
-        }
-        g_mutex_unlock(&next->sample.lock);
+        st_sample_publish(next);
     }
 
     instrument_editor_update(TRUE);
@@ -2548,7 +2569,7 @@ sample_editor_perform_ramp(GtkWidget* w, gint action,
     gint i, m, q;
     gint16* p;
 
-    if (!current_sample || ss == -1) {
+    if (!current_sample || ss == -1 || !sample_editor_claim_data(current_sample)) {
         sample_editor_close_volume_ramp_dialog(w);
         return;
     }
@@ -2576,8 +2597,6 @@ sample_editor_perform_ramp(GtkWidget* w, gint action,
     }
 
     // Now perform the actual operation
-    sample_editor_lock_sample();
-
     p = current_sample->sample.data;
     p += ss;
     for (i = 0; i < se - ss; i++) {
@@ -2586,7 +2605,7 @@ sample_editor_perform_ramp(GtkWidget* w, gint action,
         *p++ = CLAMP((int)q, -32768, +32767);
     }
 
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
     gui_xm_set_modified(1);
     sample_editor_update();
     sample_display_set_selection(sampledisplay, ss, se);
@@ -2654,6 +2673,8 @@ sample_editor_trim(gboolean trbeg, gboolean trend, gfloat thrshld)
         return;
     if (!trbeg && !trend)
         return;
+    if (!sample_editor_claim_data(current_sample))
+        return;
 
     /* if there's no selection, we operate on the entire sample */
     if (start == -1) {
@@ -2754,7 +2775,6 @@ sample_editor_trim(gboolean trbeg, gboolean trend, gfloat thrshld)
         on = start;
     if (off > end)
         off = end;
-    sample_editor_lock_sample();
     if (trbeg) {
         sample_editor_delete(current_sample, start, on);
         off -= on - start;
@@ -2763,7 +2783,7 @@ sample_editor_trim(gboolean trbeg, gboolean trend, gfloat thrshld)
     if (trend)
         sample_editor_delete(current_sample, off, end);
     st_sample_fix_loop(current_sample);
-    sample_editor_unlock_sample();
+    sample_editor_publish_sample();
 
     sample_editor_set_sample(current_sample);
     gui_xm_set_modified(1);
@@ -2790,7 +2810,7 @@ void sample_editor_delete(STSample* sample, int start, int end)
     memcpy(newdata, sample->sample.data, start * 2);
     memcpy(newdata + start, sample->sample.data + end, (sample->sample.length - end) * 2);
 
-    free(sample->sample.data);
+    st_mixer_sample_free_data(&sample->sample);
 
     sample->sample.data = newdata;
     sample->sample.length = newlen;
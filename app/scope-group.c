@@ -170,7 +170,23 @@ gint scope_group_timeout(ScopeGroup* s)
     g_assert(o2 >= 0 && o2 <= scopebuf_length);
 
     for (i = 0; i < s->numchan; i++) {
-        if (o2 > o1) {
+        if (time1 >= scopebuf_sound_end[i]) {
+            /* The mixer hasn't written anything for this channel */
+            sample_display_set_data(s->scopes[i], NULL, ST_MIXER_FORMAT_S8, 0, FALSE);
+        } else if (time2 > scopebuf_sound_end[i]) {
+            /* The channel fell silent in the middle of the window */
+            int k = (scopebuf_sound_end[i] - time1) * scopebuf_freq;
+
+            k = CLAMP(k, 0, l);
+            if (o2 > o1) {
+                memcpy(buf, scopebufs[i] + o1, 2 * l);
+            } else {
+                memcpy(buf, scopebufs[i] + o1, 2 * (scopebuf_length - o1));
+                memcpy(buf + scopebuf_length - o1, scopebufs[i], 2 * o2);
+            }
+            memset(buf + k, 0, 2 * (l - k));
+            sample_display_set_data(s->scopes[i], buf, ST_MIXER_FORMAT_S16_LE, l, TRUE);
+        } else if (o2 > o1) {
             sample_display_set_data(s->scopes[i], scopebufs[i] + o1, ST_MIXER_FORMAT_S16_LE, l, TRUE);
         } else {
             memcpy(buf, scopebufs[i] + o1, 2 * (scopebuf_length - o1));
@@ -26,6 +26,7 @@
 
 #include <glib.h>
 
+#include "audio.h"
 #include "st-subs.h"
 #include "xm.h"
 
@@ -317,15 +318,40 @@ void st_copy_instrument(STInstrument* src, STInstrument* dest)
     guint32 length;
 
     st_clean_instrument(dest, NULL);
+    st_instrument_load_data(src);
 
     memcpy(dest, src, sizeof(STInstrument));
     for (i = 0; i < sizeof(src->samples) / sizeof(src->samples[0]); i++) {
-        if ((length = dest->samples[i].sample.length * sizeof(dest->samples[i].sample.data[0]))) {
+        dest->samples[i].sample.buffer = NULL;
+        dest->samples[i].sample.readers = 0;
+        dest->samples[i].sample.deferred = NULL;
+        dest->samples[i].sample.data = NULL;
+        if (src->samples[i].sample.data
+            && (length = st_mixer_sample_size(dest->samples[i].sample.format, dest->samples[i].sample.length))) {
             dest->samples[i].sample.data = malloc(length);
             memcpy(dest->samples[i].sample.data, src->samples[i].sample.data, length);
         }
-        g_mutex_init(&dest->samples[i].sample.lock);
     }
+    st_instrument_publish(dest);
+}
+
+void st_instrument_publish(STInstrument* instr)
+{
+    int i;
+
+    for (i = 0; i < sizeof(instr->samples) / sizeof(instr->samples[0]); i++)
+        st_sample_publish(&instr->samples[i]);
+}
+
+gboolean st_instrument_load_data(STInstrument* instr)
+{
+    int i;
+    gboolean ok = TRUE;
+
+    for (i = 0; i < sizeof(instr->samples) / sizeof(instr->samples[0]); i++)
+        ok &= st_mixer_sample_load(&instr->samples[i].sample);
+
+    return ok;
 }
 
 void st_clean_instrument(STInstrument* instr,
@@ -356,8 +382,7 @@ void st_clean_instrument(STInstrument* instr,
 void st_clean_sample(STSample* s,
     const char* utf_name, const char* name)
 {
-    g_mutex_clear(&s->sample.lock);
-    free(s->sample.data);
+    st_mixer_sample_retire(&s->sample);
     memset(s, 0, sizeof(STSample));
     if (utf_name) {
         strncpy(s->utf_name, utf_name, 88);
@@ -370,7 +395,6 @@ void st_clean_sample(STSample* s,
     } else
         s->needs_conversion = FALSE;
     s->sample.loopend = 1;
-    g_mutex_init(&s->sample.lock);
 }
 
 void st_clean_song(XM* xm)
@@ -428,6 +452,17 @@ void st_set_pattern_length(XMPattern* pat,
     pat->length = l;
 }
 
+void st_sample_publish(STSample* s)
+{
+    st_mixer_sample_publish(&s->sample);
+    audio_mixer_updatesample(&s->sample);
+}
+
+gboolean st_sample_claim_data(STSample* s)
+{
+    return st_mixer_sample_claim(&s->sample);
+}
+
 void st_sample_fix_loop(STSample* sts)
 {
     st_mixer_sample_info* s = &sts->sample;
@@ -66,11 +66,22 @@ gboolean st_is_empty_track(XMNote* notes,
 int st_instrument_num_samples(STInstrument* i);
 void st_clean_instrument(STInstrument* i, const char* name);
 void st_copy_instrument(STInstrument* src, STInstrument* dest);
+void st_instrument_publish(STInstrument* i);
+/* Makes sure that the sample data is in memory for reading, in the
+   format it has. Data loaded on demand may be evicted again later (see
+   st_mixer_sample_evict()). */
+gboolean st_instrument_load_data(STInstrument* i);
 gboolean st_instrument_used_in_song(XM* xm, int instr);
 
 /* --- Sample functions --- */
 void st_clean_sample(STSample* s, const char* utf_name, const char* name);
 void st_sample_fix_loop(STSample* s);
+/* Hands the current state of the sample over to the mixers; to be
+   called after every change (see st_mixer_sample_publish()) */
+void st_sample_publish(STSample* s);
+/* Makes the sample data 16 bit and keeps it in memory, for code which
+   changes it (see st_mixer_sample_claim()) */
+gboolean st_sample_claim_data(STSample* s);
 void st_convert_sample(void* src,
     void* dst,
     int srcformat,
@@ -3,6 +3,7 @@
  * The Real SoundTracker - time buffer
  *
  * Copyright (C) 1999-2001 Michael Krause
+ * Copyright (C) 2026 agent <agent@local>
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -22,13 +23,21 @@
 #include "time-buffer.h"
 
 #include <glib.h>
+#include <string.h>
 
-/* This implementation of the time buffer interface might be rather
-   suboptimal... */
+/* Single producer (audio thread), single consumer (GUI thread) ring of
+   preallocated slots. head and tail are free-running counters; the
+   slot of counter i is i & mask. The producer only writes head and
+   discard, the consumer only writes tail. */
 
 struct time_buffer {
-    GMutex mutex;
-    GList* list;
+    gchar* slots;
+    gsize itemsize;
+    guint mask;
+
+    gint head; /* next slot to be written */
+    gint tail; /* oldest slot still in use by the consumer */
+    gint discard; /* items before this one have been cleared */
 };
 
 typedef struct time_buffer_item {
@@ -36,14 +45,24 @@ typedef struct time_buffer_item {
     /* then user data follows */
 } time_buffer_item;
 
+#define SLOT(t, i) ((time_buffer_item*)((t)->slots + (gsize)((guint)(i) & (t)->mask) * (t)->itemsize))
+
 time_buffer*
-time_buffer_new(double maxtimedelta)
+time_buffer_new(gsize itemsize,
+    guint capacity)
 {
-    time_buffer* t = g_new(time_buffer, 1);
+    time_buffer* t = g_new0(time_buffer, 1);
+    guint size = 1;
+
+    g_assert(itemsize >= sizeof(time_buffer_item));
+
+    while (size < capacity)
+        size <<= 1;
 
     if (t) {
-        g_mutex_init(&t->mutex);
-        t->list = NULL;
+        t->itemsize = itemsize;
+        t->mask = size - 1;
+        t->slots = g_malloc0(size * itemsize);
     }
 
     return t;
@@ -52,66 +71,68 @@ time_buffer_new(double maxtimedelta)
 void time_buffer_destroy(time_buffer* t)
 {
     if (t) {
-        g_list_free(t->list);
-        g_mutex_clear(&t->mutex);
+        g_free(t->slots);
         g_free(t);
     }
 }
 
 void time_buffer_clear(time_buffer* t)
 {
-    while (t->list) {
-        g_free(t->list->data);
-        t->list = g_list_remove_link(t->list, t->list);
-    }
+    g_atomic_int_set(&t->discard, g_atomic_int_get(&t->head));
 }
 
-gboolean
-time_buffer_add(time_buffer* t,
-    void* item,
-    double time)
+void* time_buffer_reserve(time_buffer* t)
 {
-    time_buffer_item* a = item;
+    guint head = g_atomic_int_get(&t->head);
 
-    g_mutex_lock(&t->mutex);
-    a->time = time;
-    t->list = g_list_append(t->list, a);
-    g_mutex_unlock(&t->mutex);
+    if (head - (guint)g_atomic_int_get(&t->tail) > t->mask)
+        return NULL; /* full; the consumer is lagging behind */
 
-    return TRUE;
+    return SLOT(t, head);
 }
 
-void* time_buffer_get(time_buffer* t,
+void time_buffer_commit(time_buffer* t,
     double time)
 {
-    int i, j, l;
-    void* result = NULL;
-    GList* list;
+    guint head = g_atomic_int_get(&t->head);
 
-    g_mutex_lock(&t->mutex);
-    l = g_list_length(t->list);
+    SLOT(t, head)->time = time;
+    g_atomic_int_set(&t->head, head + 1);
+}
 
-    if (l == 0) {
-        g_mutex_unlock(&t->mutex);
+void* time_buffer_get(time_buffer* t,
+    double time)
+{
+    /* discard first, so that it can't be ahead of head. A clear happening
+       in between only shows up at the next call. */
+    guint discard = g_atomic_int_get(&t->discard);
+    guint head = g_atomic_int_get(&t->head);
+    guint tail = t->tail;
+    guint lo, hi;
+
+    if ((gint)(discard - tail) > 0)
+        tail = discard;
+
+    if (tail == head) {
+        g_atomic_int_set(&t->tail, tail);
         return NULL;
     }
 
-    for (i = 0, list = t->list; i < l - 1; i++, list = list->next) {
-        time_buffer_item* a = list->data;
-        if (time < a->time)
-            break;
+    /* Bisect for the latest item not later than time. If there is none,
+       the oldest item is returned. */
+    lo = tail + 1;
+    hi = head;
+    while (lo != hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (SLOT(t, mid)->time <= time)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    for (j = 0; j < i - 1; j++) {
-        GList* node = t->list;
-        g_free(node->data);
-        t->list = g_list_remove_link(t->list, node);
-        g_list_free(node);
-    }
-
-    result = t->list->data;
-
-    g_mutex_unlock(&t->mutex);
+    /* The items before the one returned aren't needed any more */
+    g_atomic_int_set(&t->tail, lo - 1);
 
-    return result;
+    return SLOT(t, lo - 1);
 }
@@ -29,15 +29,25 @@
    info must be delayed to coincide with the audio output in the
    speakers.
 
-   The _add and _get functions are thread-safe. */
+   The items are stored in a fixed number of preallocated slots. Each
+   item must start with a double, which is set to the item's time. One
+   thread (the audio thread) may add items and clear the buffer while
+   another one (the GUI) gets them, without locking or allocating. */
 
 typedef struct time_buffer time_buffer;
 
-time_buffer* time_buffer_new(double maxtimedelta);
+time_buffer* time_buffer_new(gsize itemsize, guint capacity);
 void time_buffer_destroy(time_buffer* t);
 
-gboolean time_buffer_add(time_buffer* t, void* item, double time);
+/* Producer side. Returns the slot to fill in for the next item, or NULL
+   if the buffer is full; the item is published by time_buffer_commit(). */
+void* time_buffer_reserve(time_buffer* t);
+void time_buffer_commit(time_buffer* t, double time);
 void time_buffer_clear(time_buffer* t);
+
+/* Consumer side. Returns the latest item not later than time (or the
+   oldest one if all are later), dropping all older ones. The item stays
+   valid until the next call. */
 void* time_buffer_get(time_buffer* t, double time);
 
 #endif /* _TIME_BUFFER_H */
@@ -25,117 +25,144 @@
 #include <math.h>
 #include <string.h>
 
-#include "audio.h"
-#include "gui-settings.h"
-#include "main.h"
 #include "mixer.h"
 #include "tracer.h"
 #include "xm-player.h"
 
-static int num_channels, mixfreq;
+struct tracer {
+    int num_channels, mixfreq;
+    guint32 channel_mask; /* only channels set here are traced */
+    guint32 active; /* channels that may have a sample running */
 
-// This is an artificial limit. The code can do more channels.
-static tracer_channel channels[32];
+    // This is an artificial limit. The code can do more channels.
+    tracer_channel channels[32];
+};
 
-void tracer_setnumch(int n)
+static void*
+tracer_new_instance(void)
 {
-    g_assert(n >= 1 && n <= 32);
+    return g_new0(tracer, 1);
+}
 
-    num_channels = n;
+static void
+tracer_destroy_instance(void* tp)
+{
+    g_free(tp);
 }
 
 static void
-tracer_updatesample(st_mixer_sample_info* si)
+tracer_setnumch_instance(void* tp,
+    int n)
 {
-    int i;
-    tracer_channel* c;
+    tracer* const t = tp;
 
-    for (i = 0; i < 32; i++) {
-        c = &channels[i];
+    g_assert(n >= 1 && n <= 32);
 
-        if (c->sample != si || !(c->flags & TR_FLAG_SAMPLE_RUNNING)) {
-            continue;
-        }
+    t->num_channels = n;
+}
 
-        if (c->data != si->data
-            || c->length != si->length
-            || c->looptype != si->looptype) {
-            c->flags &= ~TR_FLAG_SAMPLE_RUNNING;
-            continue;
-        }
+static void
+tracer_updatesample(void* tp,
+    st_mixer_sample_info* si)
+{
+    /* The channels keep copies of the loop data; the mixers check the
+       sample when they take over the traced channels */
+}
 
-        /* No relevant data has changed. Don't stop the sample, but update
-	   our local loop data instead. */
-        c->looptype = si->looptype;
-        if (c->looptype != ST_MIXER_SAMPLE_LOOPTYPE_NONE) {
-            if (c->positionw < si->loopstart) {
-                c->positionw = si->loopstart;
-                c->positionf = 0x7fffffff;
-            } else if (c->positionw >= si->loopend) {
-                c->positionw = si->loopend - 1;
-                c->positionf = 0x7fffffff;
-            }
-        }
-    }
+static void
+tracer_setmixfreq(void* tp,
+    guint32 frequency)
+{
+    tracer* const t = tp;
+
+    t->mixfreq = frequency;
 }
 
 static void
-tracer_setmixfreq(guint32 frequency)
+tracer_reset(void* tp)
 {
-    mixfreq = frequency;
+    tracer* const t = tp;
+
+    memset(t->channels, 0, sizeof(t->channels));
+    t->active = 0;
 }
 
+/* Rebuilds the active mask after the channels have been overwritten */
 static void
-tracer_reset(void)
+tracer_update_active(tracer* t)
 {
-    memset(channels, 0, sizeof(channels));
+    int i;
+
+    t->active = 0;
+    for (i = 0; i < 32; i++) {
+        if (t->channels[i].flags & TR_FLAG_SAMPLE_RUNNING) {
+            t->active |= 1 << i;
+        }
+    }
 }
 
 static void
-tracer_startnote(int channel,
+tracer_startnote(void* tp,
+    int channel,
     st_mixer_sample_info* s)
 {
-    tracer_channel* c = &channels[channel];
+    tracer* const t = tp;
+    tracer_channel* c = &t->channels[channel];
+    st_mixer_sample_buffer* b;
 
     c->flags = 0;
 
     c->sample = s;
 
-    // The following three for update_sample()
-    c->data = s->data;
-    c->length = s->length;
-    c->looptype = s->looptype;
+    /* The sample data itself isn't needed, so no reference to the
+       snapshot is kept */
+    b = st_mixer_sample_acquire(s);
+    if (!b) {
+        return;
+    }
+    c->data = b->data;
+    c->length = b->length;
+    c->looptype = b->looptype;
+    c->loopstart = b->loopstart;
+    c->loopend = b->loopend;
+    st_mixer_sample_buffer_unref(b);
 
     c->positionw = 0;
     c->positionf = 0;
     c->playend = 0;
-    if (s->looptype == ST_MIXER_SAMPLE_LOOPTYPE_AMIGA) {
+    if (c->looptype == ST_MIXER_SAMPLE_LOOPTYPE_AMIGA) {
         c->flags |= TR_FLAG_LOOP_UNIDIRECTIONAL;
-    } else if (s->looptype == ST_MIXER_SAMPLE_LOOPTYPE_PINGPONG) {
+    } else if (c->looptype == ST_MIXER_SAMPLE_LOOPTYPE_PINGPONG) {
         c->flags |= TR_FLAG_LOOP_BIDIRECTIONAL;
     }
     c->direction = 1;
     c->freso = 0.0;
     c->ffreq = 1.0;
     c->flags |= TR_FLAG_SAMPLE_RUNNING;
+    t->active |= 1 << channel;
 }
 
 static void
-tracer_stopnote(int channel)
+tracer_stopnote(void* tp,
+    int channel)
 {
-    tracer_channel* c = &channels[channel];
+    tracer* const t = tp;
+    tracer_channel* c = &t->channels[channel];
 
     c->flags = 0; /* Just stop the note without reverances */
+    t->active &= ~(1 << channel);
 }
 
 static void
-tracer_setsmplpos(int channel,
+tracer_setsmplpos(void* tp,
+    int channel,
     guint32 offset)
 {
-    tracer_channel* c = &channels[channel];
+    tracer* const t = tp;
+    tracer_channel* c = &t->channels[channel];
 
     if (c->sample && c->flags != 0) {
-        if (offset < c->sample->length) {
+        if (offset < c->length) {
             c->positionw = offset;
             c->positionf = 0;
             c->direction = 1;
@@ -146,13 +173,15 @@ tracer_setsmplpos(int channel,
 }
 
 static void
-tracer_setsmplend(int channel,
+tracer_setsmplend(void* tp,
+    int channel,
     guint32 offset)
 {
-    tracer_channel* c = &channels[channel];
+    tracer* const t = tp;
+    tracer_channel* c = &t->channels[channel];
 
     if (c->sample && c->flags != 0) {
-        if (c->positionw != 0 || offset < c->sample->length) {
+        if (c->positionw != 0 || offset < c->length) {
             // only end if the selection is not the whole sample
             c->playend = offset;
         }
@@ -160,40 +189,48 @@ tracer_setsmplend(int channel,
 }
 
 static void
-tracer_setfreq(int channel,
+tracer_setfreq(void* tp,
+    int channel,
     float frequency)
 {
-    tracer_channel* c = &channels[channel];
+    tracer* const t = tp;
+    tracer_channel* c = &t->channels[channel];
 
-    frequency /= mixfreq;
+    frequency /= t->mixfreq;
 
     c->freqw = (guint32)floor(frequency);
     c->freqf = (guint32)((frequency - c->freqw) * 4294967296.0);
 }
 
 static void
-tracer_setvolume(int channel,
+tracer_setvolume(void* tp,
+    int channel,
     float volume)
 {
-    tracer_channel* c = &channels[channel];
+    tracer* const t = tp;
+    tracer_channel* c = &t->channels[channel];
 
     c->volume = volume;
 }
 
 static void
-tracer_setpanning(int channel,
+tracer_setpanning(void* tp,
+    int channel,
     float panning)
 {
-    tracer_channel* c = &channels[channel];
+    tracer* const t = tp;
+    tracer_channel* c = &t->channels[channel];
 
     c->panning = 0.5 * (panning + 1.0);
 }
 
 static void
-tracer_setchcutoff(int channel,
+tracer_setchcutoff(void* tp,
+    int channel,
     float freq)
 {
-    tracer_channel* c = &channels[channel];
+    tracer* const t = tp;
+    tracer_channel* c = &t->channels[channel];
 
     if (freq < 0.0) {
         c->ffreq = 1.0;
@@ -207,10 +244,12 @@ tracer_setchcutoff(int channel,
 }
 
 static void
-tracer_setchreso(int channel,
+tracer_setchreso(void* tp,
+    int channel,
     float reso)
 {
-    tracer_channel* c = &channels[channel];
+    tracer* const t = tp;
+    tracer_channel* c = &t->channels[channel];
 
     g_assert(0.0 <= reso);
     g_assert(reso <= 1.0);
@@ -224,10 +263,10 @@ tracer_mix_sub(tracer_channel* ch,
     const gboolean loopit = (ch->playend == 0) && (ch->flags & (TR_FLAG_LOOP_UNIDIRECTIONAL | TR_FLAG_LOOP_BIDIRECTIONAL));
     const gboolean gonnapingpong = loopit && (ch->flags & TR_FLAG_LOOP_BIDIRECTIONAL);
 
-    const gint64 lstart64 = ((guint64)ch->sample->loopstart) << 32;
+    const gint64 lstart64 = ((guint64)ch->loopstart) << 32;
     const gint64 freq64 = (((guint64)ch->freqw) << 32) + (guint64)ch->freqf;
     gint64 pos64 = ((guint64)(ch->positionw) << 32) + (guint64)ch->positionf;
-    const gint32 ende = (ch->playend != 0) ? (ch->playend) : (loopit ? ch->sample->loopend : ch->length);
+    const gint32 ende = (ch->playend != 0) ? (ch->playend) : (loopit ? ch->loopend : ch->length);
     const gint64 ende64 = (guint64)ende << 32;
 
     gint64 vieweit64;
@@ -294,19 +333,24 @@ tracer_mix_sub(tracer_channel* ch,
 }
 
 static void*
-tracer_mix(void* dest, guint32 count, gint16* scopebufs[], int scopebufs_offset)
+tracer_mix(void* tp, void* dest, guint32 count, gint16* scopebufs[], int scopebufs_offset)
 {
+    tracer* const t = tp;
+    guint32 mask = t->active & t->channel_mask & (guint32)(((guint64)1 << t->num_channels) - 1);
     int chnr;
 
-    for (chnr = 0; chnr < num_channels; chnr++) {
-        tracer_channel* ch = channels + chnr;
+    while (mask) {
+        tracer_channel* ch;
         int num_samples_left = count;
 
-        if (!((ch->flags & TR_FLAG_SAMPLE_RUNNING) && (gui_settings.permanent_channels & (1 << chnr))))
-            continue;
+        chnr = g_bit_nth_lsf(mask, -1);
+        mask &= mask - 1;
+        ch = t->channels + chnr;
 
-        g_assert(&ch->sample->lock);
-        g_mutex_lock(&ch->sample->lock);
+        if (!(ch->flags & TR_FLAG_SAMPLE_RUNNING)) {
+            t->active &= ~(1 << chnr);
+            continue;
+        }
 
         while (num_samples_left && (ch->flags & TR_FLAG_SAMPLE_RUNNING)) {
             int num_samples = 0;
@@ -316,7 +360,9 @@ tracer_mix(void* dest, guint32 count, gint16* scopebufs[], int scopebufs_offset)
             num_samples_left -= num_samples;
         }
 
-        g_mutex_unlock(&ch->sample->lock);
+        if (!(ch->flags & TR_FLAG_SAMPLE_RUNNING)) {
+            t->active &= ~(1 << chnr);
+        }
     }
     return NULL;
 }
@@ -325,13 +371,16 @@ static st_mixer mixer_tracer = {
     "tracer",
     "Pseudo-mixer for channel settings tracing", /* It will NEVER be used and hence translated */
 
-    tracer_setnumch,
+    tracer_new_instance,
+    tracer_destroy_instance,
+    tracer_setnumch_instance,
     tracer_updatesample,
     NULL,
     NULL,
     tracer_setmixfreq,
     NULL,
     NULL,
+    NULL,
     tracer_reset,
     tracer_startnote,
     tracer_stopnote,
@@ -351,48 +400,300 @@ static st_mixer mixer_tracer = {
     NULL
 };
 
-void tracer_trace(int mixfreq, int songpos, int patpos)
+tracer*
+tracer_new(void)
+{
+    return tracer_new_instance();
+}
+
+void tracer_destroy(tracer* t)
+{
+    tracer_destroy_instance(t);
+}
+
+void tracer_setnumch(tracer* t,
+    int n)
+{
+    tracer_setnumch_instance(t, n);
+}
+
+/* Encodes a player position such that tracing up to (songpos, patpos)
+   is finished as soon as the position reaches
+   tracer_position(songpos, patpos, TRUE). */
+static inline int
+tracer_position(int songpos,
+    int patpos,
+    gboolean lasttick)
+{
+    return (((songpos << 8) + patpos) << 1) + (lasttick ? 1 : 0);
+}
+
+/* One player tick: the player advances to the next tick, and the
+   channels are traced up to the time of it. Returns the position
+   reached. */
+static int
+tracer_tick(tracer* t,
+    XMPlayer* p,
+    double* previous,
+    double* rest)
+{
+    double time;
+    double current = xmplayer_play(p);
+    guint32 samples;
+
+    time = current - *previous + *rest;
+    *previous = current;
+
+    samples = time * t->mixfreq;
+    *rest = time - (double)samples / (double)t->mixfreq;
+
+    tracer_mix(t, NULL, samples, NULL, 0);
+
+    return tracer_position(p->songpos, p->patpos, p->curtick >= p->tempo - 1);
+}
+
+/* --- Checkpoint index --- */
+
+/* Distance of the checkpoints in rows */
+#define TRACER_INDEX_INTERVAL 32
+
+/* Don't let songs that never loop fill up the memory */
+#define TRACER_INDEX_MAX_CHECKPOINTS 4096
+
+/* Everything needed to resume tracing in the middle of the song */
+typedef struct tracer_checkpoint {
+    XMPlayer player;
+    tracer_channel channels[32];
+    double previous, rest; /* Time of the last tick, fractional part of the samples */
+    int maxpos; /* Furthest position reached from the start of the song up to here */
+} tracer_checkpoint;
+
+struct tracer_index {
+    /* Protects mixfreq and checkpoints, which are accessed from the
+       audio thread by tracer_trace() */
+    GMutex lock;
+    int mixfreq; /* as requested by the last tracer_trace() call; 0 = unknown yet */
+    GPtrArray* checkpoints;
+
+    /* State of the builder, only used by tracer_index_build() */
+    XM* xm;
+    int build_mixfreq;
+    gboolean complete;
+    XMPlayer* player;
+    tracer* tracer;
+    st_mixer_ctx ctx;
+    double previous, rest;
+    int maxpos, lastrow, rows;
+};
+
+static void
+tracer_index_clear(tracer_index* idx)
+{
+    guint i;
+
+    g_mutex_lock(&idx->lock);
+    for (i = 0; i < idx->checkpoints->len; i++)
+        g_free(g_ptr_array_index(idx->checkpoints, i));
+    g_ptr_array_set_size(idx->checkpoints, 0);
+    g_mutex_unlock(&idx->lock);
+}
+
+tracer_index*
+tracer_index_new(void)
+{
+    tracer_index* idx = g_new0(tracer_index, 1);
+
+    g_mutex_init(&idx->lock);
+    idx->checkpoints = g_ptr_array_new();
+    idx->tracer = tracer_new();
+    idx->ctx.mixer = &mixer_tracer;
+    idx->ctx.m = idx->tracer;
+    idx->player = xmplayer_new(&idx->ctx);
+
+    return idx;
+}
+
+void tracer_index_destroy(tracer_index* idx)
+{
+    tracer_index_clear(idx);
+    g_ptr_array_free(idx->checkpoints, TRUE);
+    xmplayer_destroy(idx->player);
+    tracer_destroy(idx->tracer);
+    g_mutex_clear(&idx->lock);
+    g_free(idx);
+}
+
+void tracer_index_reset(tracer_index* idx,
+    XM* xm)
+{
+    tracer_index_clear(idx);
+    idx->xm = xm;
+    idx->build_mixfreq = 0; /* restart the builder */
+}
+
+gboolean
+tracer_index_build(tracer_index* idx,
+    int rows)
+{
+    XMPlayer* const p = idx->player;
+    tracer* const t = idx->tracer;
+    int mixfreq;
+
+    g_mutex_lock(&idx->lock);
+    mixfreq = idx->mixfreq;
+    g_mutex_unlock(&idx->lock);
+
+    if (!idx->xm || !mixfreq)
+        return FALSE;
+
+    if (mixfreq != idx->build_mixfreq) {
+        tracer_index_clear(idx);
+
+        xmplayer_init_module(p, idx->xm);
+        xmplayer_init_play_song(p, 0, 0, TRUE);
+        t->channel_mask = 0xffffffff;
+        tracer_setmixfreq(t, mixfreq);
+        tracer_reset(t);
+
+        idx->build_mixfreq = mixfreq;
+        idx->complete = FALSE;
+        idx->previous = idx->rest = 0.0;
+        idx->maxpos = -1;
+        idx->lastrow = -1;
+        idx->rows = 0;
+    }
+
+    while (!idx->complete && rows > 0) {
+        int pos = tracer_tick(t, p, &idx->previous, &idx->rest);
+
+        if (p->looped) {
+            idx->complete = TRUE;
+            break;
+        }
+
+        idx->maxpos = MAX(idx->maxpos, pos);
+        if ((pos >> 1) == idx->lastrow)
+            continue;
+
+        idx->lastrow = pos >> 1;
+        rows--;
+        if (++idx->rows % TRACER_INDEX_INTERVAL == 0) {
+            tracer_checkpoint* cp = g_new(tracer_checkpoint, 1);
+
+            cp->player = *p;
+            memcpy(cp->channels, t->channels, sizeof(cp->channels));
+            cp->previous = idx->previous;
+            cp->rest = idx->rest;
+            cp->maxpos = idx->maxpos;
+
+            g_mutex_lock(&idx->lock);
+            g_ptr_array_add(idx->checkpoints, cp);
+            idx->complete = idx->checkpoints->len >= TRACER_INDEX_MAX_CHECKPOINTS;
+            g_mutex_unlock(&idx->lock);
+        }
+    }
+
+    return !idx->complete;
+}
+
+/* Restores the latest checkpoint from which the trace up to the position
+   stoppos can be resumed. Returns FALSE if there is none. */
+static gboolean
+tracer_index_restore(tracer_index* idx,
+    tracer* t,
+    XMPlayer* p,
+    int mixfreq,
+    int stoppos,
+    double* previous,
+    double* rest)
+{
+    tracer_checkpoint* cp = NULL;
+    int lo, hi;
+
+    g_mutex_lock(&idx->lock);
+
+    if (idx->mixfreq != mixfreq) {
+        /* The checkpoints are useless for us; let the builder start over */
+        idx->mixfreq = mixfreq;
+        g_mutex_unlock(&idx->lock);
+        return FALSE;
+    }
+
+    /* maxpos is monotonic, so bisect for the last checkpoint before which
+       the trace wouldn't have stopped */
+    lo = 0;
+    hi = idx->checkpoints->len;
+    if (hi > 0 && ((tracer_checkpoint*)g_ptr_array_index(idx->checkpoints, 0))->player.xm != p->xm)
+        hi = 0;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (((tracer_checkpoint*)g_ptr_array_index(idx->checkpoints, mid))->maxpos < stoppos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo > 0) {
+        cp = g_ptr_array_index(idx->checkpoints, lo - 1);
+        xmplayer_copy_state(p, &cp->player);
+        memcpy(t->channels, cp->channels, sizeof(t->channels));
+        tracer_update_active(t);
+        *previous = cp->previous;
+        *rest = cp->rest;
+    }
+
+    g_mutex_unlock(&idx->lock);
+
+    return cp != NULL;
+}
+
+void tracer_trace(tracer* t,
+    XMPlayer* p,
+    tracer_index* idx,
+    int mixfreq,
+    int songpos,
+    int patpos,
+    guint32 channel_mask)
 {
-    /* Attemp to take pitchband into account */
     /* Test if tempo and BPM are traced */
-    st_mixer* real_mixer = mixer;
-    mixer = &mixer_tracer;
+    st_mixer_ctx tracer_ctx = { &mixer_tracer, t, t->num_channels, 0.0 };
+    st_mixer_ctx* real_mixer = xmplayer_set_mixer(p, &tracer_ctx);
 
     int stopsongpos = songpos;
     int stoppatpos = patpos;
+    int stoppos;
 
     double rest = 0, previous = 0; /* Fractional part of the samples */
 
+    tracer_ctx.pitchbend = real_mixer->pitchbend;
+
     if ((stoppatpos -= 1) < 0) {
         stopsongpos -= 1;
-        stoppatpos = xm->patterns[xm->pattern_order_table[stopsongpos]].length - 1;
+        stoppatpos = p->xm->patterns[p->xm->pattern_order_table[stopsongpos]].length - 1;
     }
+    stoppos = tracer_position(stopsongpos, stoppatpos, TRUE);
 
-    tracer_setmixfreq(mixfreq);
-    tracer_reset();
+    t->channel_mask = channel_mask;
+    tracer_setmixfreq(t, mixfreq);
+    tracer_reset(t);
 
-    while (1) {
-        double t;
+    /* Jump to the nearest checkpoint and trace only the remainder. The
+       checkpoints are recorded without pitchbending. */
+    if (idx && tracer_ctx.pitchbend == 0.0)
+        tracer_index_restore(idx, t, p, mixfreq, stoppos, &previous, &rest);
 
-        double current = xmplayer_play();
-        t = current - previous + rest;
-        previous = current;
-
-        guint32 samples = t * mixfreq;
-        rest = t - (double)samples / (double)mixfreq;
-
-        tracer_mix(NULL, samples, NULL, 0);
-        if (player_songpos > stopsongpos || (player_songpos == stopsongpos && player_patpos > stoppatpos) || (player_songpos == stopsongpos && player_patpos == stoppatpos && curtick >= player_tempo - 1))
-            break; //? maybe player_patpos - 1
-    }
+    while (tracer_tick(t, p, &previous, &rest) < stoppos)
+        ;
 
-    mixer = real_mixer;
+    xmplayer_set_mixer(p, real_mixer);
 }
 
 tracer_channel*
-tracer_return_channel(int n)
+tracer_return_channel(tracer* t,
+    int n)
 {
-    g_assert(n < num_channels);
+    g_assert(n < t->num_channels);
 
-    return &channels[n];
+    return &t->channels[n];
 }
@@ -24,13 +24,17 @@
 #define _TRACER_H
 
 #include "mixer.h"
+#include "xm-player.h"
 
 typedef struct tracer_channel {
     st_mixer_sample_info* sample;
 
-    void* data; // for updatesample() to see if sample has changed
+    // Copies from the snapshot the note was started with
+    void* data;
     int looptype;
     guint32 length;
+    guint32 loopstart;
+    guint32 loopend;
 
     guint32 flags; // see below
     float volume; // 0.0 ... 1.0
@@ -51,7 +55,35 @@ typedef struct tracer_channel {
 #define TR_FLAG_LOOP_BIDIRECTIONAL 2
 #define TR_FLAG_SAMPLE_RUNNING 4
 
-void tracer_trace(int mixfreq, int songpos, int patpos);
-tracer_channel* tracer_return_channel(int number);
-void tracer_setnumch(int n);
+typedef struct tracer tracer;
+
+tracer* tracer_new(void);
+void tracer_destroy(tracer* t);
+void tracer_setnumch(tracer* t, int n);
+
+/* Checkpoints of the complete tracing state every few rows, so that
+   tracer_trace() needn't replay the song from the start each time. The
+   index is built step by step in idle time by tracer_index_build() (GUI
+   thread), while tracer_trace() may use it from the audio thread. */
+typedef struct tracer_index tracer_index;
+
+tracer_index* tracer_index_new(void);
+void tracer_index_destroy(tracer_index* idx);
+
+/* Drops all checkpoints. Must be called whenever the module has been
+   changed or is going to be freed (xm may be NULL then). */
+void tracer_index_reset(tracer_index* idx, XM* xm);
+
+/* Extends the index by up to the given number of rows. Nothing is built
+   before tracer_trace() has told the mixing frequency to be used.
+   Returns FALSE if there is nothing left to do. */
+gboolean tracer_index_build(tracer_index* idx, int rows);
+
+/* Runs the player p from the start of the song up to the given position
+   and records the sample playback state of the channels in channel_mask,
+   to be loaded into a real mixer by its loadchsettings(). If idx is not
+   NULL, tracing starts at the nearest checkpoint before the position.
+   p must have been initialized by xmplayer_init_play_song(p, 0, 0, TRUE). */
+void tracer_trace(tracer* t, XMPlayer* p, tracer_index* idx, int mixfreq, int songpos, int patpos, guint32 channel_mask);
+tracer_channel* tracer_return_channel(tracer* t, int number);
 #endif
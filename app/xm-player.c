@@ -34,17 +34,9 @@
 
 #include "audio.h"
 #include "gui.h"
-#include "main.h"
 #include "xm-player.h"
 #include "xm.h"
 
-int player_songpos, player_patpos;
-int player_tempo, player_bpm;
-guint8 curtick;
-gboolean player_looped;
-static double current_time;
-static int xmplayer_playmode;
-
 static inline int
 env_length(STEnvelope* env)
 {
@@ -181,111 +173,6 @@ enum {
     xmpCmdMODtTempo = 128,
 };
 
-typedef struct channel {
-    int chVol;
-    int chFinalVol;
-    int chPan;
-    int chFinalPan;
-    gint32 chPitch; /* Pitch really means 'period' in nonlinear and module frequencies */
-    gint32 chFinalPitch;
-    int curnote;
-    long chCutoff;
-    long chReso;
-
-    guint8 chCurIns;
-    guint8 chLastIns;
-    int chCurNormNote;
-    guint8 chSustain;
-    guint16 chFadeVol;
-    guint16 chAVibPos;
-    guint32 chAVibSwpPos;
-    guint32 chVolEnvPos;
-    guint32 chPanEnvPos;
-
-    guint8 chDefVol;
-    int chDefPan;
-    guint8 chCommand;
-    guint8 chVCommand;
-    gint32 chPortaToPitch;
-    gint32 chPortaToVal;
-    guint8 chVolSlideVal;
-    guint8 chGVolSlideVal;
-    guint8 chVVolPanSlideVal;
-    guint8 chPanSlideVal;
-    guint8 chFineVolSlideUVal;
-    guint8 chFineVolSlideDVal;
-    gint32 chPortaUVal;
-    gint32 chPortaDVal;
-    guint8 chFinePortaUVal;
-    guint8 chFinePortaDVal;
-    guint8 chXFinePortaUVal;
-    guint8 chXFinePortaDVal;
-    guint8 chVibRate;
-    guint8 chVibPos;
-    guint8 chVibType;
-    guint8 chVibDep;
-    guint8 chTremRate;
-    guint8 chTremPos;
-    guint8 chTremType;
-    guint8 chTremDep;
-    guint8 chPatLoopCount;
-    guint8 chPatLoopStart;
-    guint8 chArpPos;
-    guint8 chArpOffsets[3];
-    guint8 chActionTick;
-    guint8 chMRetrigPos;
-    guint8 chMRetrigLen;
-    guint8 chMRetrigAct;
-    guint8 chDelayNote;
-    guint8 chDelayIns;
-    guint8 chDelayVol;
-    guint8 chOffset;
-    guint8 chGlissando;
-    guint8 chTremorPos;
-    guint8 chTremorLen;
-    guint8 chTremorOff;
-
-    int nextstop;
-    STSample* nextsamp;
-    int nextpos;
-    int sampleplayend; /* don't play all of the sample, but stop at (here) */
-    STSample* cursamp;
-    STInstrument* curins;
-    int hacksample; /* if 1, then simply play the sample pointed to by cursamp */
-} channel;
-
-static channel channels[32];
-
-static guint8 globalvol;
-
-static guint8 tick0;
-
-static int currow, play_only_row;
-static XMPattern* curpattern;
-static int patlen;
-static int curord;
-
-static int nord;
-static int ninst;
-static int nsamp;
-static int linearfreq;
-static int nchan;
-static int loopord;
-static int ismod;
-
-static int jumptoord;
-static int jumptorow;
-static int patdelay;
-static gboolean player_will_loop;
-
-static guint8 procnot;
-static guint8 procins;
-static guint8 procvol;
-static guint8 proccmd;
-static guint8 procdat;
-
-static int realgvol;
-
 static guint32 hnotetab6848[16] = { 11131415, 4417505, 1753088, 695713, 276094, 109568, 43482, 17256, 6848, 2718, 1078, 428, 170, 67, 27, 11 };
 static guint32 hnotetab8363[16] = { 13594045, 5394801, 2140928, 849628, 337175, 133808, 53102, 21073, 8363, 3319, 1317, 523, 207, 82, 33, 13 };
 static guint16 notetab[16] = { 32768, 30929, 29193, 27554, 26008, 24548, 23170, 21870, 20643, 19484, 18390, 17358, 16384, 15464, 14596, 13777 };
@@ -976,13 +863,13 @@ int mcpGetNote8363(int frq)
     return -x - i;
 }
 
-static int freqrange(int x)
+static int freqrange(XMPlayer* p, int x)
 {
-    if (ismod) {
+    if (p->ismod) {
         /* Values from ProTracker 2.2a documentation */
         return CLAMP(x, 113 << 4, 856 << 4);
     } else {
-        if (linearfreq)
+        if (p->linearfreq)
             return (x < -72 * 256) ? -72 * 256 : (x > 96 * 256) ? 96 * 256 : x;
         else
             return (x < 107) ? 107 : (x > 438272) ? 438272 : x;
@@ -1000,12 +887,13 @@ static int panrange(int x)
 }
 
 static int
-xm_player_start_note(channel* ch,
+xm_player_start_note(XMPlayer* p,
+    xm_player_channel* ch,
     int note)
 {
-    STInstrument* ins = &xm->instruments[ch->chCurIns - 1];
+    STInstrument* ins = &p->xm->instruments[ch->chCurIns - 1];
     note--;
-    if (ins->samplemap[note] > nsamp)
+    if (ins->samplemap[note] > p->nsamp)
         return 0;
     ch->curins = ins;
     ch->cursamp = &ins->samples[ins->samplemap[note]];
@@ -1015,17 +903,17 @@ xm_player_start_note(channel* ch,
 }
 
 static gint32
-xm_player_get_note_pitch(channel* ch)
+xm_player_get_note_pitch(XMPlayer* p, xm_player_channel* ch)
 {
-    if (!ismod) {
-        gint32 pitch = 48 * 256 - (((procnot - 1) << 8) - ch->chCurNormNote);
+    if (!p->ismod) {
+        gint32 pitch = 48 * 256 - (((p->procnot - 1) << 8) - ch->chCurNormNote);
 
-        if (linearfreq)
+        if (p->linearfreq)
             return pitch;
         else
             return mcpGetFreq6848(pitch);
     } else {
-        int note = procnot - 1 - 36;
+        int note = p->procnot - 1 - 36;
 
         if (note < 0)
             note = 0;
@@ -1037,37 +925,37 @@ xm_player_get_note_pitch(channel* ch)
 }
 
 static void
-xm_player_playnote_protracker(channel* ch)
+xm_player_playnote_protracker(XMPlayer* p, xm_player_channel* ch)
 {
     int portatmp = 0;
     int delaytmp;
 
-    if (proccmd == xmpCmdPortaNote)
+    if (p->proccmd == xmpCmdPortaNote)
         portatmp = 1;
-    if (proccmd == xmpCmdPortaVol)
+    if (p->proccmd == xmpCmdPortaVol)
         portatmp = 1;
 
-    delaytmp = (proccmd == xmpCmdDelayNote) && procdat;
+    delaytmp = (p->proccmd == xmpCmdDelayNote) && p->procdat;
 
     if (!ch->chCurIns)
         return;
 
     /* This needs to be fixed! */
-    if (!procnot && procins && ch->chCurIns != ch->chLastIns)
-        procnot = ch->curnote;
+    if (!p->procnot && p->procins && ch->chCurIns != ch->chLastIns)
+        p->procnot = ch->curnote;
 
-    if (procnot && !delaytmp)
-        ch->curnote = procnot;
+    if (p->procnot && !delaytmp)
+        ch->curnote = p->procnot;
 
-    if (procins) {
+    if (p->procins) {
         gint32 checknote = ch->curnote;
         if (!checknote)
             checknote = 49;
-        if (!xm_player_start_note(ch, checknote))
+        if (!xm_player_start_note(p, ch, checknote))
             return;
     }
 
-    if (procnot && !delaytmp) {
+    if (p->procnot && !delaytmp) {
         if (!portatmp) {
             gint32 nn;
             ch->nextstop = 1;
@@ -1079,18 +967,18 @@ xm_player_playnote_protracker(channel* ch)
 
             /* CurNormNote is only relevant in FastTracker mode */
             nn = -ch->cursamp->relnote * 256 - ch->cursamp->finetune * 2;
-            if (proccmd == xmpCmdSFinetune)
-                nn = -ch->cursamp->relnote * 256 - (gint16)(procdat << 4) + 0x80;
+            if (p->proccmd == xmpCmdSFinetune)
+                nn = -ch->cursamp->relnote * 256 - (gint16)(p->procdat << 4) + 0x80;
             ch->chCurNormNote = nn;
 
-            ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(ch);
+            ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(p, ch);
 
             ch->nextpos = 0;
             ch->sampleplayend = -1;
 
-            if (proccmd == xmpCmdOffset) {
-                if (procdat != 0)
-                    ch->chOffset = procdat;
+            if (p->proccmd == xmpCmdOffset) {
+                if (p->procdat != 0)
+                    ch->chOffset = p->procdat;
                 ch->nextpos = ch->chOffset << 8;
                 if (1 && ch->nextpos > ch->nextsamp->sample.length)
                     ch->nextpos = ch->nextsamp->sample.length - 16;
@@ -1102,11 +990,11 @@ xm_player_playnote_protracker(channel* ch)
             ch->chMRetrigPos = 0;
             ch->chTremorPos = 0;
         } else {
-            ch->chPortaToPitch = xm_player_get_note_pitch(ch);
+            ch->chPortaToPitch = xm_player_get_note_pitch(p, ch);
         }
     }
 
-    if (procins) {
+    if (p->procins) {
         ch->chVol = ch->chDefVol;
         ch->chFinalVol = ch->chDefVol;
         if (ch->chDefPan != -1) {
@@ -1122,53 +1010,53 @@ xm_player_playnote_protracker(channel* ch)
 }
 
 static void
-xm_player_playnote_fasttracker(channel* ch)
+xm_player_playnote_fasttracker(XMPlayer* p, xm_player_channel* ch)
 {
     int portatmp = 0;
     int delaytmp;
     int keyoff = 0;
 
-    if (proccmd == xmpCmdPortaNote)
+    if (p->proccmd == xmpCmdPortaNote)
         portatmp = 1;
-    if (proccmd == xmpCmdPortaVol)
+    if (p->proccmd == xmpCmdPortaVol)
         portatmp = 1;
-    if ((procvol >> 4) == xmpVCmdPortaNote)
+    if ((p->procvol >> 4) == xmpVCmdPortaNote)
         portatmp = 1;
 
-    delaytmp = (proccmd == xmpCmdDelayNote) && procdat;
+    delaytmp = (p->proccmd == xmpCmdDelayNote) && p->procdat;
 
-    if (procnot == 97) {
-        procnot = 0;
+    if (p->procnot == 97) {
+        p->procnot = 0;
         keyoff = 1;
     }
 
-    if ((proccmd == xmpCmdKeyOff) && !procdat)
+    if ((p->proccmd == xmpCmdKeyOff) && !p->procdat)
         keyoff = 1;
 
     if (!ch->chCurIns)
         return;
 
-    if (procins && !keyoff && !delaytmp)
+    if (p->procins && !keyoff && !delaytmp)
         ch->chSustain = 1;
 
-    if (procnot && !delaytmp)
-        ch->curnote = procnot;
+    if (p->procnot && !delaytmp)
+        ch->curnote = p->procnot;
 
-    if (procins && !delaytmp) {
+    if (p->procins && !delaytmp) {
         gint32 checknote = ch->curnote;
         if (!checknote)
             checknote = 49;
-        if (!xm_player_start_note(ch, checknote))
+        if (!xm_player_start_note(p, ch, checknote))
             return;
     }
 
-    if (procnot && !delaytmp) {
+    if (p->procnot && !delaytmp) {
         if (!portatmp) {
             gint32 nn;
             ch->nextstop = 1;
 
-            if (procins) {
-                if (!xm_player_start_note(ch, ch->curnote))
+            if (p->procins) {
+                if (!xm_player_start_note(p, ch, ch->curnote))
                     return;
             }
 
@@ -1179,18 +1067,18 @@ xm_player_playnote_fasttracker(channel* ch)
 
             /* CurNormNote is only relevant in FastTracker mode */
             nn = -ch->cursamp->relnote * 256 - ch->cursamp->finetune * 2;
-            if (proccmd == xmpCmdSFinetune)
-                nn = -ch->cursamp->relnote * 256 - (gint16)(procdat << 4) + 0x80;
+            if (p->proccmd == xmpCmdSFinetune)
+                nn = -ch->cursamp->relnote * 256 - (gint16)(p->procdat << 4) + 0x80;
             ch->chCurNormNote = nn;
 
-            ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(ch);
+            ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(p, ch);
 
             ch->nextpos = 0;
             ch->sampleplayend = -1;
 
-            if (proccmd == xmpCmdOffset) {
-                if (procdat != 0)
-                    ch->chOffset = procdat;
+            if (p->proccmd == xmpCmdOffset) {
+                if (p->procdat != 0)
+                    ch->chOffset = p->procdat;
                 ch->nextpos = ch->chOffset << 8;
             }
 
@@ -1200,20 +1088,20 @@ xm_player_playnote_fasttracker(channel* ch)
             ch->chMRetrigPos = 0;
             ch->chTremorPos = 0;
         } else {
-            ch->chPortaToPitch = xm_player_get_note_pitch(ch);
+            ch->chPortaToPitch = xm_player_get_note_pitch(p, ch);
         }
     }
 
-    if (procnot && delaytmp)
+    if (p->procnot && delaytmp)
         return;
 
     if (keyoff && ch->cursamp) {
         ch->chSustain = 0;
-        if (!(ch->curins->vol_env.flags & EF_ON) && !procins)
+        if (!(ch->curins->vol_env.flags & EF_ON) && !p->procins)
             ch->chFadeVol = 0;
     }
 
-    if (procins && ch->chSustain) {
+    if (p->procins && ch->chSustain) {
         ch->chVol = ch->chDefVol;
         ch->chFinalVol = ch->chDefVol;
         if (ch->chDefPan != -1) {
@@ -1229,31 +1117,31 @@ xm_player_playnote_fasttracker(channel* ch)
 }
 
 static void
-PlayNote(int chnr)
+PlayNote(XMPlayer* p, int chnr)
 {
-    channel* ch = &channels[chnr];
+    xm_player_channel* ch = &p->channels[chnr];
 
-    if (ismod)
-        xm_player_playnote_protracker(ch);
+    if (p->ismod)
+        xm_player_playnote_protracker(p, ch);
     else
-        xm_player_playnote_fasttracker(ch);
+        xm_player_playnote_fasttracker(p, ch);
 }
 
 static void
-xmplayer_final_channel_ops(int chnr)
+xmplayer_final_channel_ops(XMPlayer* p, int chnr)
 {
     int vol, pan;
-    channel* ch = &channels[chnr];
+    xm_player_channel* ch = &p->channels[chnr];
 
-    if (player_mute_channels[chnr] && (xmplayer_playmode == PLAYING_SONG || xmplayer_playmode == PLAYING_PATTERN)) {
-        driver_setvolume(chnr, 0);
+    if (p->mute && p->mute[chnr] && (p->playmode == PLAYING_SONG || p->playmode == PLAYING_PATTERN)) {
+        driver_setvolume(p->mix, chnr, 0);
         return;
     }
 
-    vol = (ch->chFinalVol * globalvol) >> 4;
+    vol = (ch->chFinalVol * p->globalvol) >> 4;
     pan = ch->chFinalPan - 128;
 
-    if (!ismod && !ch->hacksample) {
+    if (!p->ismod && !ch->hacksample) {
         if (!ch->chSustain) {
             vol = (vol * ch->chFadeVol) >> 15;
             if (ch->chFadeVol >= ch->curins->volfade)
@@ -1299,58 +1187,58 @@ xmplayer_final_channel_ops(int chnr)
     }
 
     if (ch->nextstop) {
-        driver_stopnote(chnr);
+        driver_stopnote(p->mix, chnr);
     }
     if (ch->nextsamp != NULL) {
-        driver_startnote(chnr, &ch->nextsamp->sample);
+        driver_startnote(p->mix, chnr, &ch->nextsamp->sample);
     }
     if (ch->nextpos != -1) {
-        driver_setsmplpos(chnr, ch->nextpos);
+        driver_setsmplpos(p->mix, chnr, ch->nextpos);
         if (ch->sampleplayend != -1) {
-            driver_setsmplend(chnr, ch->sampleplayend);
+            driver_setsmplend(p->mix, chnr, ch->sampleplayend);
         }
     }
-    if (ismod) {
+    if (p->ismod) {
         if (ch->chFinalPitch != 0) { /* == 0 happens on tru_funk.mod */
             /* PAL clock constant is 3546895, NTSC clock constant is 3579545 */
             /* Taken from "Amiga Hardware Reference Manual, revised & updated", September 1989 printing */
-            driver_setfreq(chnr, (double)(3546895 * 16) / ch->chFinalPitch);
+            driver_setfreq(p->mix, chnr, (double)(3546895 * 16) / ch->chFinalPitch);
         }
     } else {
-        if (linearfreq) {
-            driver_setfreq(chnr, pitch_to_freq(ch->chFinalPitch));
+        if (p->linearfreq) {
+            driver_setfreq(p->mix, chnr, pitch_to_freq(ch->chFinalPitch));
         } else {
             if (ch->chFinalPitch != 0) { /* == 0 happens on tru_funk.mod */
-                driver_setfreq(chnr, pitch_to_freq(-mcpGetNote8363(8363 * 6848 / ch->chFinalPitch)));
+                driver_setfreq(p->mix, chnr, pitch_to_freq(-mcpGetNote8363(8363 * 6848 / ch->chFinalPitch)));
             }
         }
     }
 
-    driver_setvolume(chnr, (double)vol / 4 / 64);
+    driver_setvolume(p->mix, chnr, (double)vol / 4 / 64);
 
-    if (ismod) {
-        driver_setpanning(chnr, chnr == 0 || chnr == 3 ? -1.0 : +1.0);
+    if (p->ismod) {
+        driver_setpanning(p->mix, chnr, chnr == 0 || chnr == 3 ? -1.0 : +1.0);
     } else {
-        driver_setpanning(chnr, (double)pan / 128);
+        driver_setpanning(p->mix, chnr, (double)pan / 128);
     }
 
     if (ch->chCutoff == 0xff && ch->chReso == 0) {
-        driver_set_ch_filter_freq(chnr, -1.0);
+        driver_set_ch_filter_freq(p->mix, chnr, -1.0);
     } else {
-        driver_set_ch_filter_freq(chnr, 0.5 * pow(2, (float)(ch->chCutoff - 255) / 32.0));
-        driver_set_ch_filter_reso(chnr, (float)ch->chReso / 255);
+        driver_set_ch_filter_freq(p->mix, chnr, 0.5 * pow(2, (float)(ch->chCutoff - 255) / 32.0));
+        driver_set_ch_filter_reso(p->mix, chnr, (float)ch->chReso / 255);
     }
 }
 
 static gint32
-xm_player_handle_glissando(channel* ch)
+xm_player_handle_glissando(XMPlayer* p, xm_player_channel* ch)
 {
     if (ch->chGlissando) {
-        if (ismod) {
-            fprintf(stderr, "Glissando (E31) for ProTracker modules not supported yet (in module '%s').\n", xm->utf_name);
+        if (p->ismod) {
+            fprintf(stderr, "Glissando (E31) for ProTracker modules not supported yet (in module '%s').\n", p->xm->utf_name);
             return ch->chPitch;
         } else {
-            if (linearfreq)
+            if (p->linearfreq)
                 return ((ch->chPitch + ch->chCurNormNote + 0x80) & ~0xFF) - ch->chCurNormNote;
             else
                 return mcpGetFreq6848(((mcpGetNote6848(ch->chPitch) + ch->chCurNormNote + 0x80) & ~0xFF) - ch->chCurNormNote);
@@ -1359,14 +1247,64 @@ xm_player_handle_glissando(channel* ch)
         return ch->chPitch;
 }
 
-static void xmpPlayTick()
+/* Rows ahead whose samples are asked for, so that the loader thread has
+   them ready when the notes are started (see st_mixer_sample_prefetch()) */
+#define XM_PLAYER_PREFETCH_ROWS 4
+
+static void
+xm_player_prefetch_row(XMPlayer* p,
+    XMPattern* pat,
+    int row)
 {
     int i;
 
-    tick0 = 0;
+    for (i = 0; i < p->nchan; i++) {
+        const XMNote* n = &pat->channels[i][row];
+        const int ins = n->instrument ? n->instrument : p->channels[i].chCurIns;
+        STInstrument* instr;
+
+        if (!n->note || n->note > 96 || !ins || ins > p->ninst)
+            continue;
+        instr = &p->xm->instruments[ins - 1];
+        if (instr->samplemap[n->note - 1] < p->nsamp)
+            st_mixer_sample_prefetch(&instr->samples[instr->samplemap[n->note - 1]].sample);
+    }
+}
 
-    for (i = 0; i < nchan; i++) {
-        channel* ch = &channels[i];
+/* After a jump all of the rows ahead, otherwise just the one which has
+   come into reach. The song is followed into the next patterns, but not
+   the jumps in them. */
+static void
+xm_player_prefetch(XMPlayer* p,
+    gboolean jumped)
+{
+    XMPattern* pat = p->curpattern;
+    int ord = p->curord;
+    int row = p->currow + (jumped ? 1 : XM_PLAYER_PREFETCH_ROWS);
+    int n;
+
+    for (n = jumped ? XM_PLAYER_PREFETCH_ROWS : 1; n > 0; n--, row++) {
+        while (row >= pat->length) {
+            row -= pat->length;
+            if (p->playmode == PLAYING_SONG) {
+                if (++ord >= p->nord)
+                    ord = p->loopord;
+                pat = &p->xm->patterns[p->xm->pattern_order_table[ord]];
+            }
+        }
+        xm_player_prefetch_row(p, pat, row);
+    }
+}
+
+static void xmpPlayTick(XMPlayer* p)
+{
+    int i;
+    gboolean jumped = FALSE, moved = FALSE;
+
+    p->tick0 = 0;
+
+    for (i = 0; i < p->nchan; i++) {
+        xm_player_channel* ch = &p->channels[i];
         ch->chFinalVol = ch->chVol;
         ch->chFinalPan = ch->chPan;
         ch->chFinalPitch = ch->chPitch;
@@ -1375,206 +1313,212 @@ static void xmpPlayTick()
         ch->nextpos = -1;
     }
 
-    if (xmplayer_playmode == PLAYING_NOTE) {
-        for (i = 0; i < nchan; i++) {
-            channel* ch = &channels[i];
+    if (p->playmode == PLAYING_NOTE) {
+        for (i = 0; i < p->nchan; i++) {
+            xm_player_channel* ch = &p->channels[i];
             if (!ch->cursamp) {
-                driver_stopnote(i);
+                driver_stopnote(p->mix, i);
             } else {
-                xmplayer_final_channel_ops(i);
+                xmplayer_final_channel_ops(p, i);
             }
         }
         return;
     }
 
-    curtick++;
-    if (curtick >= player_tempo)
-        curtick = 0;
+    p->curtick++;
+    if (p->curtick >= p->tempo)
+        p->curtick = 0;
 
-    if (player_will_loop) {
-        player_looped = TRUE;
-        player_will_loop = FALSE;
+    if (p->will_loop) {
+        p->looped = TRUE;
+        p->will_loop = FALSE;
     }
 
-    if (!curtick && patdelay) {
-        if (jumptoord != -1) {
-            if (jumptoord != curord)
-                for (i = 0; i < nchan; i++) {
-                    channel* ch = &channels[i];
+    if (!p->curtick && p->patdelay) {
+        if (p->jumptoord != -1) {
+            jumped = TRUE;
+            if (p->jumptoord != p->curord)
+                for (i = 0; i < p->nchan; i++) {
+                    xm_player_channel* ch = &p->channels[i];
                     ch->chPatLoopCount = 0;
                     ch->chPatLoopStart = 0;
                 }
 
-            if (jumptoord >= nord) {
-                jumptoord = loopord;
-                player_looped = TRUE;
+            if (p->jumptoord >= p->nord) {
+                p->jumptoord = p->loopord;
+                p->looped = TRUE;
             }
 
-            if (xmplayer_playmode == PLAYING_SONG) {
-                curord = jumptoord;
-                patlen = xm->patterns[xm->pattern_order_table[curord]].length;
-                curpattern = &xm->patterns[xm->pattern_order_table[curord]];
+            if (p->playmode == PLAYING_SONG) {
+                p->curord = p->jumptoord;
+                p->patlen = p->xm->patterns[p->xm->pattern_order_table[p->curord]].length;
+                p->curpattern = &p->xm->patterns[p->xm->pattern_order_table[p->curord]];
             }
-            currow = jumptorow;
-            jumptoord = -1;
+            p->currow = p->jumptorow;
+            p->jumptoord = -1;
         }
     }
 
-    if (!curtick && (!patdelay || ismod)) {
-        tick0 = 1;
+    if (!p->curtick && (!p->patdelay || p->ismod)) {
+        p->tick0 = 1;
 
-        if (!patdelay) {
-            currow++;
-            if ((jumptoord == -1) && (currow >= patlen)) {
-                jumptoord = curord + 1;
-                jumptorow = 0;
+        if (!p->patdelay) {
+            moved = TRUE;
+            p->currow++;
+            if ((p->jumptoord == -1) && (p->currow >= p->patlen)) {
+                p->jumptoord = p->curord + 1;
+                p->jumptorow = 0;
             }
-            if (jumptoord != -1) {
-                if (jumptoord != curord)
-                    for (i = 0; i < nchan; i++) {
-                        channel* ch = &channels[i];
+            if (p->jumptoord != -1) {
+                jumped = TRUE;
+                if (p->jumptoord != p->curord)
+                    for (i = 0; i < p->nchan; i++) {
+                        xm_player_channel* ch = &p->channels[i];
                         ch->chPatLoopCount = 0;
                         ch->chPatLoopStart = 0;
                     }
 
-                if (jumptoord >= nord) {
-                    jumptoord = loopord;
-                    player_looped = TRUE;
+                if (p->jumptoord >= p->nord) {
+                    p->jumptoord = p->loopord;
+                    p->looped = TRUE;
                 }
 
-                if (xmplayer_playmode == PLAYING_SONG) {
-                    curord = jumptoord;
-                    patlen = xm->patterns[xm->pattern_order_table[curord]].length;
-                    curpattern = &xm->patterns[xm->pattern_order_table[curord]];
+                if (p->playmode == PLAYING_SONG) {
+                    p->curord = p->jumptoord;
+                    p->patlen = p->xm->patterns[p->xm->pattern_order_table[p->curord]].length;
+                    p->curpattern = &p->xm->patterns[p->xm->pattern_order_table[p->curord]];
                 }
-                currow = jumptorow;
-                jumptoord = -1;
+                p->currow = p->jumptorow;
+                p->jumptoord = -1;
             }
         }
 
-        if (play_only_row != -1 && currow != play_only_row) {
-            currow = play_only_row;
-            xmplayer_playmode = PLAYING_NOTE;
+        if (p->play_only_row != -1 && p->currow != p->play_only_row) {
+            p->currow = p->play_only_row;
+            p->playmode = PLAYING_NOTE;
             return;
         }
 
-        for (i = 0; i < nchan; i++) {
-            channel* ch = &channels[i];
+        if (jumped || moved)
+            xm_player_prefetch(p, jumped);
+
+        for (i = 0; i < p->nchan; i++) {
+            xm_player_channel* ch = &p->channels[i];
 
-            procnot = curpattern->channels[i][currow].note;
-            procins = curpattern->channels[i][currow].instrument;
-            procvol = curpattern->channels[i][currow].volume;
-            proccmd = curpattern->channels[i][currow].fxtype;
-            procdat = curpattern->channels[i][currow].fxparam;
+            p->procnot = p->curpattern->channels[i][p->currow].note;
+            p->procins = p->curpattern->channels[i][p->currow].instrument;
+            p->procvol = p->curpattern->channels[i][p->currow].volume;
+            p->proccmd = p->curpattern->channels[i][p->currow].fxtype;
+            p->procdat = p->curpattern->channels[i][p->currow].fxparam;
 
-            if (proccmd == 0xE) {
-                proccmd = 36 + (procdat >> 4);
-                procdat &= 0xF;
+            if (p->proccmd == 0xE) {
+                p->proccmd = 36 + (p->procdat >> 4);
+                p->procdat &= 0xF;
             }
 
-            if (!patdelay) {
-                if (procins && procins <= ninst) {
+            if (!p->patdelay) {
+                if (p->procins && p->procins <= p->ninst) {
                     ch->chLastIns = ch->chCurIns;
-                    ch->chCurIns = procins;
+                    ch->chCurIns = p->procins;
                 }
-                if (procins <= ninst)
-                    PlayNote(i);
+                if (p->procins <= p->ninst)
+                    PlayNote(p, i);
             }
 
-            ch->chVCommand = procvol >> 4;
+            ch->chVCommand = p->procvol >> 4;
 
             switch (ch->chVCommand) {
             case xmpVCmdVol0x:
             case xmpVCmdVol1x:
             case xmpVCmdVol2x:
             case xmpVCmdVol3x:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
-                    ch->chFinalVol = ch->chVol = procvol - 0x10;
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
+                    ch->chFinalVol = ch->chVol = p->procvol - 0x10;
                 break;
             case xmpVCmdVol40:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
                     ch->chFinalVol = ch->chVol = 0x40;
                 break;
             case xmpVCmdVolSlideD:
             case xmpVCmdVolSlideU:
             case xmpVCmdPanSlideL:
             case xmpVCmdPanSlideR:
-                ch->chVVolPanSlideVal = procvol & 0xF;
+                ch->chVVolPanSlideVal = p->procvol & 0xF;
                 break;
             case xmpVCmdFVolSlideD:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
-                    ch->chFinalVol = ch->chVol = volrange(ch->chVol - (procvol & 0xF));
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
+                    ch->chFinalVol = ch->chVol = volrange(ch->chVol - (p->procvol & 0xF));
                 break;
             case xmpVCmdFVolSlideU:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
-                    ch->chFinalVol = ch->chVol = volrange(ch->chVol + (procvol & 0xF));
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
+                    ch->chFinalVol = ch->chVol = volrange(ch->chVol + (p->procvol & 0xF));
                 break;
             case xmpVCmdVibRate:
-                if (procvol & 0xF)
-                    ch->chVibRate = ((procvol & 0xF) << 2);
+                if (p->procvol & 0xF)
+                    ch->chVibRate = ((p->procvol & 0xF) << 2);
                 break;
             case xmpVCmdVibDep:
-                if (procvol & 0xF)
-                    ch->chVibDep = ((procvol & 0xF) << (1 + (!linearfreq && !ismod)));
+                if (p->procvol & 0xF)
+                    ch->chVibDep = ((p->procvol & 0xF) << (1 + (!p->linearfreq && !p->ismod)));
                 break;
             case xmpVCmdPanning:
-                if ((proccmd != xmpCmdDelayNote) || !procdat)
-                    ch->chFinalPan = ch->chPan = (procvol & 0xF) * 0x11;
+                if ((p->proccmd != xmpCmdDelayNote) || !p->procdat)
+                    ch->chFinalPan = ch->chPan = (p->procvol & 0xF) * 0x11;
                 break;
             case xmpVCmdPortaNote:
-                if (procvol & 0xF)
-                    ch->chPortaToVal = (procvol & 0xF) << 8;
+                if (p->procvol & 0xF)
+                    ch->chPortaToVal = (p->procvol & 0xF) << 8;
                 break;
             }
 
-            ch->chCommand = proccmd;
+            ch->chCommand = p->proccmd;
 
             switch (ch->chCommand) {
             case xmpCmdArpeggio:
-                if (!procdat)
+                if (!p->procdat)
                     ch->chCommand = 0xFF;
                 ch->chArpOffsets[0] = 0;
-                ch->chArpOffsets[1] = procdat >> 4;
-                ch->chArpOffsets[2] = procdat & 0xF;
+                ch->chArpOffsets[1] = p->procdat >> 4;
+                ch->chArpOffsets[2] = p->procdat & 0xF;
                 break;
             case xmpCmdPortaU:
-                if (procdat)
-                    ch->chPortaUVal = procdat << 4;
+                if (p->procdat)
+                    ch->chPortaUVal = p->procdat << 4;
                 break;
             case xmpCmdPortaD:
-                if (procdat)
-                    ch->chPortaDVal = procdat << 4;
+                if (p->procdat)
+                    ch->chPortaDVal = p->procdat << 4;
                 break;
             case xmpCmdPortaNote:
-                if (procdat)
-                    ch->chPortaToVal = procdat << 4;
+                if (p->procdat)
+                    ch->chPortaToVal = p->procdat << 4;
                 break;
             case xmpCmdVibrato:
-                if (procdat & 0xF)
-                    ch->chVibDep = (procdat & 0xF) << (1 + (!linearfreq && !ismod));
-                if (procdat & 0xF0)
-                    ch->chVibRate = (procdat >> 4) << 2;
+                if (p->procdat & 0xF)
+                    ch->chVibDep = (p->procdat & 0xF) << (1 + (!p->linearfreq && !p->ismod));
+                if (p->procdat & 0xF0)
+                    ch->chVibRate = (p->procdat >> 4) << 2;
                 break;
             case xmpCmdPortaVol:
             case xmpCmdVibVol:
             case xmpCmdVolSlide:
-                if (procdat || ismod)
-                    ch->chVolSlideVal = procdat;
+                if (p->procdat || p->ismod)
+                    ch->chVolSlideVal = p->procdat;
                 break;
             case xmpCmdTremolo:
-                if (procdat & 0xF)
-                    ch->chTremDep = (procdat & 0xF) << 2;
-                if (procdat & 0xF0)
-                    ch->chTremRate = (procdat >> 4) << 2;
+                if (p->procdat & 0xF)
+                    ch->chTremDep = (p->procdat & 0xF) << 2;
+                if (p->procdat & 0xF0)
+                    ch->chTremRate = (p->procdat >> 4) << 2;
                 break;
             case xmpCmdPanning:
-                ch->chFinalPan = ch->chPan = procdat;
+                ch->chFinalPan = ch->chPan = p->procdat;
                 break;
             case xmpCmdSetFCutoff:
-                ch->chCutoff = procdat;
+                ch->chCutoff = p->procdat;
                 break;
             case xmpCmdSetFReso:
-                ch->chReso = procdat;
+                ch->chReso = p->procdat;
                 break;
             case xmpCmdSetFHFCutoff:
                 //		mcpSet(0,mcpMasterFHFCutoff,procdat);
@@ -1584,61 +1528,61 @@ static void xmpPlayTick()
                 break;
 
             case xmpCmdJump:
-                if (!patdelay) {
-                    jumptoord = procdat;
-                    jumptorow = 0;
-                    player_will_loop = TRUE;
+                if (!p->patdelay) {
+                    p->jumptoord = p->procdat;
+                    p->jumptorow = 0;
+                    p->will_loop = TRUE;
                 }
                 break;
             case xmpCmdVolume:
-                ch->chFinalVol = ch->chVol = volrange(procdat);
+                ch->chFinalVol = ch->chVol = volrange(p->procdat);
                 break;
             case xmpCmdBreak:
-                if (!patdelay) {
-                    if (jumptoord == -1)
-                        jumptoord = curord + 1;
-                    jumptorow = (procdat & 0xF) + (procdat >> 4) * 10;
+                if (!p->patdelay) {
+                    if (p->jumptoord == -1)
+                        p->jumptoord = p->curord + 1;
+                    p->jumptorow = (p->procdat & 0xF) + (p->procdat >> 4) * 10;
                 }
                 break;
             case xmpCmdSpeed:
-                if (!procdat) {
-                    jumptoord = procdat;
-                    jumptorow = 0;
-                    player_will_loop = TRUE;
+                if (!p->procdat) {
+                    p->jumptoord = p->procdat;
+                    p->jumptorow = 0;
+                    p->will_loop = TRUE;
                     break;
                 }
-                if (procdat >= 0x20) {
-                    player_bpm = procdat;
+                if (p->procdat >= 0x20) {
+                    p->bpm = p->procdat;
                 } else {
-                    player_tempo = procdat;
+                    p->tempo = p->procdat;
                 }
                 break;
             case xmpCmdMODtTempo:
-                if (!procdat) {
-                    jumptoord = procdat;
-                    jumptorow = 0;
+                if (!p->procdat) {
+                    p->jumptoord = p->procdat;
+                    p->jumptorow = 0;
                 } else {
-                    player_tempo = procdat;
+                    p->tempo = p->procdat;
                 }
                 break;
             case xmpCmdGVolume:
-                globalvol = volrange(procdat);
+                p->globalvol = volrange(p->procdat);
                 break;
             case xmpCmdGVolSlide:
-                if (procdat)
-                    ch->chGVolSlideVal = procdat;
+                if (p->procdat)
+                    ch->chGVolSlideVal = p->procdat;
                 break;
             case xmpCmdKeyOff:
-                ch->chActionTick = procdat;
+                ch->chActionTick = p->procdat;
                 break;
             case xmpCmdRetrigger:
-                ch->chActionTick = procdat;
+                ch->chActionTick = p->procdat;
                 break;
             case xmpCmdNoteCut:
-                ch->chActionTick = procdat;
+                ch->chActionTick = p->procdat;
                 break;
             case xmpCmdEnvPos:
-                ch->chVolEnvPos = ch->chPanEnvPos = procdat;
+                ch->chVolEnvPos = ch->chPanEnvPos = p->procdat;
                 if (!ch->curins)
                     break;
                 if (ch->curins->vol_env.flags & EF_ON)
@@ -1649,138 +1593,138 @@ static void xmpPlayTick()
                         ch->chPanEnvPos = env_length(&ch->curins->pan_env);
                 break;
             case xmpCmdPanSlide:
-                if (procdat)
-                    ch->chPanSlideVal = procdat;
+                if (p->procdat)
+                    ch->chPanSlideVal = p->procdat;
                 break;
             case xmpCmdMRetrigger:
-                if (procdat) {
-                    ch->chMRetrigLen = procdat & 0xF;
-                    ch->chMRetrigAct = procdat >> 4;
+                if (p->procdat) {
+                    ch->chMRetrigLen = p->procdat & 0xF;
+                    ch->chMRetrigAct = p->procdat >> 4;
                 }
                 break;
             case xmpCmdTremor:
-                if (procdat) {
-                    ch->chTremorLen = (procdat & 0xF) + (procdat >> 4) + 2;
-                    ch->chTremorOff = (procdat >> 4) + 1;
+                if (p->procdat) {
+                    ch->chTremorLen = (p->procdat & 0xF) + (p->procdat >> 4) + 2;
+                    ch->chTremorOff = (p->procdat >> 4) + 1;
                     ch->chTremorPos = 0;
                 }
                 break;
             case xmpCmdXPorta:
-                if ((procdat >> 4) == 1) {
-                    if (procdat & 0xF)
-                        ch->chXFinePortaUVal = procdat & 0xF;
-                    ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch - (ch->chXFinePortaUVal << 2));
-                } else if ((procdat >> 4) == 2) {
-                    if (procdat & 0xF)
-                        ch->chXFinePortaDVal = procdat & 0xF;
-                    ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch + (ch->chXFinePortaDVal << 2));
+                if ((p->procdat >> 4) == 1) {
+                    if (p->procdat & 0xF)
+                        ch->chXFinePortaUVal = p->procdat & 0xF;
+                    ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch - (ch->chXFinePortaUVal << 2));
+                } else if ((p->procdat >> 4) == 2) {
+                    if (p->procdat & 0xF)
+                        ch->chXFinePortaDVal = p->procdat & 0xF;
+                    ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch + (ch->chXFinePortaDVal << 2));
                 }
                 break;
             case xmpCmdFPortaU:
-                if (procdat || ismod)
-                    ch->chFinePortaUVal = procdat;
-                ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch - (ch->chFinePortaUVal << 4));
+                if (p->procdat || p->ismod)
+                    ch->chFinePortaUVal = p->procdat;
+                ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch - (ch->chFinePortaUVal << 4));
                 break;
             case xmpCmdFPortaD:
-                if (procdat || ismod)
-                    ch->chFinePortaDVal = procdat;
-                ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch + (ch->chFinePortaDVal << 4));
+                if (p->procdat || p->ismod)
+                    ch->chFinePortaDVal = p->procdat;
+                ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch + (ch->chFinePortaDVal << 4));
                 break;
             case xmpCmdGlissando:
-                ch->chGlissando = procdat;
+                ch->chGlissando = p->procdat;
                 break;
             case xmpCmdVibType:
-                ch->chVibType = procdat & 3;
+                ch->chVibType = p->procdat & 3;
                 break;
             case xmpCmdPatLoop:
-                if (!procdat)
-                    ch->chPatLoopStart = currow;
+                if (!p->procdat)
+                    ch->chPatLoopStart = p->currow;
                 else {
                     ch->chPatLoopCount++;
-                    if (ch->chPatLoopCount <= procdat) {
-                        jumptorow = ch->chPatLoopStart;
-                        jumptoord = curord;
+                    if (ch->chPatLoopCount <= p->procdat) {
+                        p->jumptorow = ch->chPatLoopStart;
+                        p->jumptoord = p->curord;
                     } else {
                         ch->chPatLoopCount = 0;
-                        ch->chPatLoopStart = currow + 1;
+                        ch->chPatLoopStart = p->currow + 1;
                     }
                 }
                 break;
             case xmpCmdTremType:
-                ch->chTremType = procdat & 3;
+                ch->chTremType = p->procdat & 3;
                 break;
             case xmpCmdSPanning:
-                ch->chFinalPan = ch->chPan = procdat * 0x11;
+                ch->chFinalPan = ch->chPan = p->procdat * 0x11;
                 break;
             case xmpCmdFVolSlideU:
-                if (procdat || ismod)
-                    ch->chFineVolSlideUVal = procdat;
+                if (p->procdat || p->ismod)
+                    ch->chFineVolSlideUVal = p->procdat;
                 ch->chFinalVol = ch->chVol = volrange(ch->chVol + ch->chFineVolSlideUVal);
                 break;
             case xmpCmdFVolSlideD:
-                if (procdat || ismod)
-                    ch->chFineVolSlideDVal = procdat;
+                if (p->procdat || p->ismod)
+                    ch->chFineVolSlideDVal = p->procdat;
                 ch->chFinalVol = ch->chVol = volrange(ch->chVol - ch->chFineVolSlideDVal);
                 break;
             case xmpCmdPatDelay:
-                if (!patdelay)
-                    patdelay = procdat + 1;
+                if (!p->patdelay)
+                    p->patdelay = p->procdat + 1;
                 break;
             case xmpCmdDelayNote:
-                if (procnot)
-                    ch->chDelayNote = procnot;
-                ch->chDelayIns = procins;
-                ch->chDelayVol = procvol;
-                ch->chActionTick = procdat;
+                if (p->procnot)
+                    ch->chDelayNote = p->procnot;
+                ch->chDelayIns = p->procins;
+                ch->chDelayVol = p->procvol;
+                ch->chActionTick = p->procdat;
                 break;
             }
         }
     }
-    if (!curtick && patdelay) {
-        patdelay--;
+    if (!p->curtick && p->patdelay) {
+        p->patdelay--;
     }
 
-    for (i = 0; i < nchan; i++) {
-        channel* ch = &channels[i];
+    for (i = 0; i < p->nchan; i++) {
+        xm_player_channel* ch = &p->channels[i];
 
         switch (ch->chVCommand) {
         case xmpVCmdVolSlideD:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol - ch->chVVolPanSlideVal);
             break;
         case xmpVCmdVolSlideU:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol + ch->chVVolPanSlideVal);
             break;
         case xmpVCmdVibDep: // KB says "FICKEN" :)
             switch (ch->chVibType) {
             case 0:
-                ch->chFinalPitch = freqrange((16 * sin(2 * M_PI * (double)ch->chVibPos / 256) * (double)ch->chVibDep) + (double)ch->chPitch);
+                ch->chFinalPitch = freqrange(p, (16 * sin(2 * M_PI * (double)ch->chVibPos / 256) * (double)ch->chVibDep) + (double)ch->chPitch);
                 break;
             case 1:
-                ch->chFinalPitch = freqrange((((ch->chVibPos - 0x80) * ch->chVibDep) >> 3) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, (((ch->chVibPos - 0x80) * ch->chVibDep) >> 3) + ch->chPitch);
                 break;
             case 2:
-                ch->chFinalPitch = freqrange(((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 2) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, ((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 2) + ch->chPitch);
                 break;
             }
-            if (!tick0)
+            if (!p->tick0)
                 ch->chVibPos += ch->chVibRate;
             break;
         case xmpVCmdPanSlideL:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalPan = ch->chPan = panrange(ch->chPan - ch->chVVolPanSlideVal);
             break;
         case xmpVCmdPanSlideR:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalPan = ch->chPan = panrange(ch->chPan + ch->chVVolPanSlideVal);
             break;
         case xmpVCmdPortaNote:
-            if (!tick0) {
+            if (!p->tick0) {
                 if (ch->chPitch < ch->chPortaToPitch) {
                     ch->chPitch += ch->chPortaToVal;
                     if (ch->chPitch > ch->chPortaToPitch)
@@ -1791,19 +1735,19 @@ static void xmpPlayTick()
                         ch->chPitch = ch->chPortaToPitch;
                 }
             }
-            ch->chFinalPitch = xm_player_handle_glissando(ch);
+            ch->chFinalPitch = xm_player_handle_glissando(p, ch);
             break;
         }
 
         switch (ch->chCommand) {
         case xmpCmdArpeggio:
-            if (ismod) {
-                ch->chFinalPitch = freqrange((ch->chPitch * notetab[ch->chArpOffsets[curtick % 3]]) >> 15);
+            if (p->ismod) {
+                ch->chFinalPitch = freqrange(p, (ch->chPitch * notetab[ch->chArpOffsets[p->curtick % 3]]) >> 15);
             } else {
-                if (linearfreq)
-                    ch->chFinalPitch = freqrange(ch->chPitch - (ch->chArpOffsets[ch->chArpPos] << 8));
+                if (p->linearfreq)
+                    ch->chFinalPitch = freqrange(p, ch->chPitch - (ch->chArpOffsets[ch->chArpPos] << 8));
                 else
-                    ch->chFinalPitch = freqrange((ch->chPitch * notetab[ch->chArpOffsets[ch->chArpPos]]) >> 15);
+                    ch->chFinalPitch = freqrange(p, (ch->chPitch * notetab[ch->chArpOffsets[ch->chArpPos]]) >> 15);
                 /* not sure if this is correct, even for XM's. One should think
 		   ArpPos is equivalent to the tick counter (-mkrause). */
                 ch->chArpPos++;
@@ -1812,17 +1756,17 @@ static void xmpPlayTick()
             }
             break;
         case xmpCmdPortaU:
-            if (tick0)
+            if (p->tick0)
                 break;
-            ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch - ch->chPortaUVal);
+            ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch - ch->chPortaUVal);
             break;
         case xmpCmdPortaD:
-            if (tick0)
+            if (p->tick0)
                 break;
-            ch->chFinalPitch = ch->chPitch = freqrange(ch->chPitch + ch->chPortaDVal);
+            ch->chFinalPitch = ch->chPitch = freqrange(p, ch->chPitch + ch->chPortaDVal);
             break;
         case xmpCmdPortaNote:
-            if (!tick0) {
+            if (!p->tick0) {
                 if (ch->chPitch < ch->chPortaToPitch) {
                     ch->chPitch += ch->chPortaToVal;
                     if (ch->chPitch > ch->chPortaToPitch)
@@ -1833,25 +1777,25 @@ static void xmpPlayTick()
                         ch->chPitch = ch->chPortaToPitch;
                 }
             }
-            ch->chFinalPitch = xm_player_handle_glissando(ch);
+            ch->chFinalPitch = xm_player_handle_glissando(p, ch);
             break;
         case xmpCmdVibrato:
             switch (ch->chVibType) {
             case 0:
-                ch->chFinalPitch = freqrange(8 * sin(2 * M_PI * (double)ch->chVibPos / 256) * (double)ch->chVibDep + (double)ch->chPitch);
+                ch->chFinalPitch = freqrange(p, 8 * sin(2 * M_PI * (double)ch->chVibPos / 256) * (double)ch->chVibDep + (double)ch->chPitch);
                 break;
             case 1:
-                ch->chFinalPitch = freqrange((((ch->chVibPos - 0x80) * ch->chVibDep) >> 4) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, (((ch->chVibPos - 0x80) * ch->chVibDep) >> 4) + ch->chPitch);
                 break;
             case 2:
-                ch->chFinalPitch = freqrange(((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 3) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, ((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 3) + ch->chPitch);
                 break;
             }
-            if (!tick0)
+            if (!p->tick0)
                 ch->chVibPos += ch->chVibRate;
             break;
         case xmpCmdPortaVol:
-            if (!tick0) {
+            if (!p->tick0) {
                 if (ch->chPitch < ch->chPortaToPitch) {
                     ch->chPitch += ch->chPortaToVal;
                     if (ch->chPitch > ch->chPortaToPitch)
@@ -1862,27 +1806,27 @@ static void xmpPlayTick()
                         ch->chPitch = ch->chPortaToPitch;
                 }
             }
-            ch->chFinalPitch = xm_player_handle_glissando(ch);
-            if (tick0)
+            ch->chFinalPitch = xm_player_handle_glissando(p, ch);
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol + ((ch->chVolSlideVal & 0xF0) ? (ch->chVolSlideVal >> 4) : -(ch->chVolSlideVal & 0xF)));
             break;
         case xmpCmdVibVol:
             switch (ch->chVibType) {
             case 0:
-                ch->chFinalPitch = freqrange(8 * sin(2 * M_PI * (double)ch->chVibPos / 256) * (double)ch->chVibDep + (double)ch->chPitch);
+                ch->chFinalPitch = freqrange(p, 8 * sin(2 * M_PI * (double)ch->chVibPos / 256) * (double)ch->chVibDep + (double)ch->chPitch);
                 break;
             case 1:
-                ch->chFinalPitch = freqrange((((ch->chVibPos - 0x80) * ch->chVibDep) >> 4) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, (((ch->chVibPos - 0x80) * ch->chVibDep) >> 4) + ch->chPitch);
                 break;
             case 2:
-                ch->chFinalPitch = freqrange(((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 3) + ch->chPitch);
+                ch->chFinalPitch = freqrange(p, ((((ch->chVibPos & 0x80) - 0x40) * ch->chVibDep) >> 3) + ch->chPitch);
                 break;
             }
-            if (!tick0)
+            if (!p->tick0)
                 ch->chVibPos += ch->chVibRate;
 
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol + ((ch->chVolSlideVal & 0xF0) ? (ch->chVolSlideVal >> 4) : -(ch->chVolSlideVal & 0xF)));
             break;
@@ -1899,33 +1843,33 @@ static void xmpPlayTick()
                 break;
             }
             ch->chFinalVol = volrange(ch->chFinalVol);
-            if (!tick0)
+            if (!p->tick0)
                 ch->chTremPos += ch->chTremRate;
             break;
         case xmpCmdVolSlide:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalVol = ch->chVol = volrange(ch->chVol + ((ch->chVolSlideVal & 0xF0) ? (ch->chVolSlideVal >> 4) : -(ch->chVolSlideVal & 0xF)));
             break;
         case xmpCmdGVolSlide:
-            if (tick0)
+            if (p->tick0)
                 break;
             if (ch->chGVolSlideVal & 0xF0)
-                globalvol = volrange(globalvol + (ch->chGVolSlideVal >> 4));
+                p->globalvol = volrange(p->globalvol + (ch->chGVolSlideVal >> 4));
             else
-                globalvol = volrange(globalvol - (ch->chGVolSlideVal & 0xF));
+                p->globalvol = volrange(p->globalvol - (ch->chGVolSlideVal & 0xF));
             break;
         case xmpCmdKeyOff:
-            if (tick0)
+            if (p->tick0)
                 break;
-            if (curtick == ch->chActionTick) {
+            if (p->curtick == ch->chActionTick) {
                 ch->chSustain = 0;
                 if (ch->cursamp && !(ch->curins->vol_env.flags & EF_ON))
                     ch->chFadeVol = 0;
             }
             break;
         case xmpCmdPanSlide:
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chFinalPan = ch->chPan = panrange(ch->chPan + ((ch->chPanSlideVal & 0xF0) ? (ch->chPanSlideVal >> 4) : -(ch->chPanSlideVal & 0xF)));
             break;
@@ -1972,7 +1916,7 @@ static void xmpPlayTick()
         case xmpCmdTremor:
             if (ch->chTremorPos >= ch->chTremorOff)
                 ch->chFinalVol = 0;
-            if (tick0)
+            if (p->tick0)
                 break;
             ch->chTremorPos++;
             if (ch->chTremorPos == ch->chTremorLen)
@@ -1981,28 +1925,28 @@ static void xmpPlayTick()
         case xmpCmdRetrigger:
             if (!ch->chActionTick)
                 break;
-            if (!(curtick % ch->chActionTick)) {
+            if (!(p->curtick % ch->chActionTick)) {
                 ch->nextpos = 0;
                 ch->sampleplayend = -1;
             }
             break;
         case xmpCmdNoteCut:
-            if (tick0)
+            if (p->tick0)
                 break;
-            if (curtick == ch->chActionTick)
+            if (p->curtick == ch->chActionTick)
                 ch->chFinalVol = ch->chVol = 0;
             break;
         case xmpCmdDelayNote:
-            if (tick0)
+            if (p->tick0)
                 break;
-            if (curtick != ch->chActionTick)
+            if (p->curtick != ch->chActionTick)
                 break;
-            procnot = ch->chDelayNote;
-            procins = ch->chDelayIns;
-            proccmd = 0;
-            procdat = 0;
-            procvol = 0;
-            PlayNote(i);
+            p->procnot = ch->chDelayNote;
+            p->procins = ch->chDelayIns;
+            p->proccmd = 0;
+            p->procdat = 0;
+            p->procvol = 0;
+            PlayNote(p, i);
             switch (ch->chDelayVol >> 4) {
             case xmpVCmdVol0x:
             case xmpVCmdVol1x:
@@ -2021,168 +1965,218 @@ static void xmpPlayTick()
         }
 
         if (!ch->cursamp) {
-            driver_stopnote(i);
+            driver_stopnote(p->mix, i);
         } else {
-            xmplayer_final_channel_ops(i);
+            xmplayer_final_channel_ops(p, i);
         }
     }
 }
 
-void xmplayer_init_module(void)
+XMPlayer*
+xmplayer_new(st_mixer_ctx* mix)
+{
+    XMPlayer* p = g_new0(XMPlayer, 1);
+
+    p->mix = mix;
+    p->tempo = 6;
+    p->bpm = 125;
+
+    return p;
+}
+
+void xmplayer_destroy(XMPlayer* p)
+{
+    g_free(p);
+}
+
+st_mixer_ctx*
+xmplayer_set_mixer(XMPlayer* p,
+    st_mixer_ctx* mix)
+{
+    st_mixer_ctx* old = p->mix;
+
+    p->mix = mix;
+
+    return old;
+}
+
+void xmplayer_copy_state(XMPlayer* dest,
+    const XMPlayer* src)
+{
+    XM* xm = dest->xm;
+    st_mixer_ctx* mix = dest->mix;
+    const gint8* mute = dest->mute;
+
+    g_assert(src->xm == xm);
+
+    *dest = *src;
+    dest->xm = xm;
+    dest->mix = mix;
+    dest->mute = mute;
+}
+
+void xmplayer_init_module(XMPlayer* p,
+    XM* xm)
 {
     g_assert(xm != NULL);
 
-    player_tempo = xm->tempo;
-    player_bpm = xm->bpm;
+    p->xm = xm;
+
+    p->tempo = p->xm->tempo;
+    p->bpm = p->xm->bpm;
 }
 
 static gboolean
-xmplayer_init_playing(gboolean init_all, gboolean all)
+xmplayer_init_playing(XMPlayer* p, gboolean init_all, gboolean all)
 {
     int i;
 
-    nchan = all ? 32 : xm->num_channels;
-    driver_setnumch(nchan);
+    p->nchan = all ? 32 : p->xm->num_channels;
+    driver_setnumch(p->mix, p->nchan);
 
-    current_time = 0.0;
+    p->current_time = 0.0;
 
-    ninst = 128;
-    nord = xm->song_length;
-    nsamp = 128;
-    ismod = xm->flags & XM_FLAGS_IS_MOD;
-    linearfreq = !(xm->flags & XM_FLAGS_AMIGA_FREQ);
-    loopord = xm->restart_position;
-    curtick = player_tempo - 1;
-    patdelay = 0;
+    p->ninst = 128;
+    p->nord = p->xm->song_length;
+    p->nsamp = 128;
+    p->ismod = p->xm->flags & XM_FLAGS_IS_MOD;
+    p->linearfreq = !(p->xm->flags & XM_FLAGS_AMIGA_FREQ);
+    p->loopord = p->xm->restart_position;
+    p->curtick = p->tempo - 1;
+    p->patdelay = 0;
 
     if (init_all) {
-        globalvol = 0x40;
-        realgvol = 0x40;
+        p->globalvol = 0x40;
+        p->realgvol = 0x40;
 
-        memset(channels, 0, sizeof(channels));
+        memset(p->channels, 0, sizeof(p->channels));
 
-        for (i = 0; i < nchan; i++) {
-            channels[i].chCutoff = 0xff;
-            channels[i].chReso = 0;
+        for (i = 0; i < p->nchan; i++) {
+            p->channels[i].chCutoff = 0xff;
+            p->channels[i].chReso = 0;
         }
     }
 
     return TRUE;
 }
 
-void xmplayer_set_tempo(int tempo)
+void xmplayer_set_tempo(XMPlayer* p, int tempo)
 {
-    player_tempo = tempo;
+    p->tempo = tempo;
 }
 
-void xmplayer_set_bpm(int bpm)
+void xmplayer_set_bpm(XMPlayer* p, int bpm)
 {
-    player_bpm = bpm;
+    p->bpm = bpm;
 }
 
 gboolean
-xmplayer_init_play_song(int songpos,
+xmplayer_init_play_song(XMPlayer* p,
+    int songpos,
     int patpos,
     gboolean init_all)
 {
-    jumptorow = patpos;
-    currow = patpos;
-    play_only_row = -1;
-    jumptoord = songpos;
-    curord = songpos;
-    player_will_loop = FALSE;
-    player_looped = FALSE;
-    xmplayer_playmode = PLAYING_SONG;
+    p->jumptorow = patpos;
+    p->currow = patpos;
+    p->play_only_row = -1;
+    p->jumptoord = songpos;
+    p->curord = songpos;
+    p->will_loop = FALSE;
+    p->looped = FALSE;
+    p->playmode = PLAYING_SONG;
 
     if (songpos == 0 && init_all)
-        xmplayer_init_module();
+        xmplayer_init_module(p, p->xm);
 
-    return xmplayer_init_playing(init_all, FALSE);
+    return xmplayer_init_playing(p, init_all, FALSE);
 }
 
 gboolean
-xmplayer_init_play_pattern(int pattern,
+xmplayer_init_play_pattern(XMPlayer* p,
+    int pattern,
     int patpos,
     int only1row)
 {
-    jumptorow = patpos;
-    currow = patpos;
-    play_only_row = only1row ? patpos : -1;
-    jumptoord = 0;
-    curord = 0;
-    patlen = xm->patterns[pattern].length;
-    curpattern = &xm->patterns[pattern];
-    xmplayer_playmode = PLAYING_PATTERN;
-
-    return xmplayer_init_playing(TRUE, FALSE);
+    p->jumptorow = patpos;
+    p->currow = patpos;
+    p->play_only_row = only1row ? patpos : -1;
+    p->jumptoord = 0;
+    p->curord = 0;
+    p->patlen = p->xm->patterns[pattern].length;
+    p->curpattern = &p->xm->patterns[pattern];
+    p->playmode = PLAYING_PATTERN;
+
+    return xmplayer_init_playing(p, TRUE, FALSE);
 }
 
-void xmplayer_stop(void)
+void xmplayer_stop(XMPlayer* p)
 {
-    xmplayer_playmode = 0;
+    p->playmode = 0;
 }
 
 gboolean
-xmplayer_play_note(int channel,
+xmplayer_play_note(XMPlayer* p,
+    int channel,
     int note,
     int instrument,
     gboolean all)
 {
-    if (!xmplayer_playmode) {
-        xmplayer_playmode = PLAYING_NOTE;
-        if (!xmplayer_init_playing(TRUE, all))
+    if (!p->playmode) {
+        p->playmode = PLAYING_NOTE;
+        if (!xmplayer_init_playing(p, TRUE, all))
             return FALSE;
     }
 
     /* start note here */
-    memset(&channels[channel], 0, sizeof(channels[channel]));
+    memset(&p->channels[channel], 0, sizeof(p->channels[channel]));
 
-    proccmd = 0;
-    procnot = note;
-    procins = channels[channel].chCurIns = instrument;
-    procdat = 0;
-    procvol = 0;
+    p->proccmd = 0;
+    p->procnot = note;
+    p->procins = p->channels[channel].chCurIns = instrument;
+    p->procdat = 0;
+    p->procvol = 0;
 
-    PlayNote(channel);
+    PlayNote(p, channel);
 
-    channels[channel].chCutoff = 0xff;
-    channels[channel].chReso = 0;
+    p->channels[channel].chCutoff = 0xff;
+    p->channels[channel].chReso = 0;
 
-    channels[channel].nextpos = -1;
-    channels[channel].sampleplayend = -1;
-    channels[channel].nextstop = 1;
-    xmplayer_final_channel_ops(channel);
+    p->channels[channel].nextpos = -1;
+    p->channels[channel].sampleplayend = -1;
+    p->channels[channel].nextstop = 1;
+    xmplayer_final_channel_ops(p, channel);
 
     return TRUE;
 }
 
 gboolean
-xmplayer_play_note_full(int chnr,
+xmplayer_play_note_full(XMPlayer* p,
+    int chnr,
     int note,
     STSample* sample,
     guint32 offset,
     guint32 count)
 {
     gint32 nn;
-    channel* ch = &channels[chnr];
+    xm_player_channel* ch = &p->channels[chnr];
 
-    if (!xmplayer_playmode) {
-        xmplayer_playmode = PLAYING_NOTE;
+    if (!p->playmode) {
+        p->playmode = PLAYING_NOTE;
         /* In sample editor the polyphony is not needed to try a sample */
-        if (!xmplayer_init_playing(TRUE, FALSE))
+        if (!xmplayer_init_playing(p, TRUE, FALSE))
             return FALSE;
     }
 
-    memset(&channels[chnr], 0, sizeof(channels[chnr]));
+    memset(&p->channels[chnr], 0, sizeof(p->channels[chnr]));
 
     /* Oh, how I HATE HATE HATE this replayer source code. It's so messy.
        But I can't rewrite it since I lose FT compatibility then... */
 
-    proccmd = 0;
-    procnot = note;
-    procins = 0;
-    procdat = 0;
-    procvol = 0;
+    p->proccmd = 0;
+    p->procnot = note;
+    p->procins = 0;
+    p->procdat = 0;
+    p->procvol = 0;
 
     ch->cursamp = sample;
     ch->chDefVol = ch->cursamp->volume;
@@ -2194,7 +2188,7 @@ xmplayer_play_note_full(int chnr,
     nn = -ch->cursamp->relnote * 256 - ch->cursamp->finetune * 2;
     ch->chCurNormNote = nn;
 
-    ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(ch);
+    ch->chPitch = ch->chFinalPitch = ch->chPortaToPitch = xm_player_get_note_pitch(p, ch);
 
     ch->chVibPos = 0;
     ch->chTremPos = 0;
@@ -2221,42 +2215,42 @@ xmplayer_play_note_full(int chnr,
     ch->nextstop = 1;
     ch->nextpos = offset;
     ch->sampleplayend = offset + count;
-    xmplayer_final_channel_ops(chnr);
+    xmplayer_final_channel_ops(p, chnr);
 
     return TRUE;
 }
 
-void xmplayer_play_note_keyoff(int channel)
+void xmplayer_play_note_keyoff(XMPlayer* p, int channel)
 {
-    channels[channel].chSustain = 0;
+    p->channels[channel].chSustain = 0;
 }
 
 double
-xmplayer_play(void)
+xmplayer_play(XMPlayer* p)
 {
-    player_songpos = curord;
-    player_patpos = currow;
+    p->songpos = p->curord;
+    p->patpos = p->currow;
 
-    xmpPlayTick();
+    xmpPlayTick(p);
 
-    current_time += (double)125 / (player_bpm * 50);
-    return current_time;
+    p->current_time += (double)125 / (p->bpm * 50);
+    return p->current_time;
 }
 
-void xmplayer_set_songpos(int songpos)
+void xmplayer_set_songpos(XMPlayer* p, int songpos)
 {
-    jumptorow = currow = player_patpos = 0;
-    jumptoord = curord = player_songpos = songpos;
-    curtick = player_tempo - 1;
-    globalvol = 64;
+    p->jumptorow = p->currow = p->patpos = 0;
+    p->jumptoord = p->curord = p->songpos = songpos;
+    p->curtick = p->tempo - 1;
+    p->globalvol = 64;
 }
 
-void xmplayer_set_pattern(int pattern)
+void xmplayer_set_pattern(XMPlayer* p, int pattern)
 {
-    patlen = xm->patterns[pattern].length;
-    curpattern = &xm->patterns[pattern];
+    p->patlen = p->xm->patterns[pattern].length;
+    p->curpattern = &p->xm->patterns[pattern];
 
-    if (currow >= patlen) {
-        currow = jumptorow = 0;
+    if (p->currow >= p->patlen) {
+        p->currow = p->jumptorow = 0;
     }
 }
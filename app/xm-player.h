@@ -24,28 +24,157 @@
 
 #include <glib.h>
 
+#include "mixer.h"
 #include "xm.h"
 
-extern int player_songpos, player_patpos;
-extern int player_tempo, player_bpm;
-extern gboolean player_looped;
-extern guint8 curtick;
+typedef struct xm_player_channel {
+    int chVol;
+    int chFinalVol;
+    int chPan;
+    int chFinalPan;
+    gint32 chPitch; /* Pitch really means 'period' in nonlinear and module frequencies */
+    gint32 chFinalPitch;
+    int curnote;
+    long chCutoff;
+    long chReso;
 
-void xmplayer_init_module(void);
-gboolean xmplayer_init_play_song(int songpos, int patpos, gboolean initall);
-gboolean xmplayer_init_play_pattern(int pattern, int patpos, int only1row);
-gboolean xmplayer_play_note(int channel, int note, int instrument, gboolean all);
-gboolean xmplayer_play_note_full(int channel,
+    guint8 chCurIns;
+    guint8 chLastIns;
+    int chCurNormNote;
+    guint8 chSustain;
+    guint16 chFadeVol;
+    guint16 chAVibPos;
+    guint32 chAVibSwpPos;
+    guint32 chVolEnvPos;
+    guint32 chPanEnvPos;
+
+    guint8 chDefVol;
+    int chDefPan;
+    guint8 chCommand;
+    guint8 chVCommand;
+    gint32 chPortaToPitch;
+    gint32 chPortaToVal;
+    guint8 chVolSlideVal;
+    guint8 chGVolSlideVal;
+    guint8 chVVolPanSlideVal;
+    guint8 chPanSlideVal;
+    guint8 chFineVolSlideUVal;
+    guint8 chFineVolSlideDVal;
+    gint32 chPortaUVal;
+    gint32 chPortaDVal;
+    guint8 chFinePortaUVal;
+    guint8 chFinePortaDVal;
+    guint8 chXFinePortaUVal;
+    guint8 chXFinePortaDVal;
+    guint8 chVibRate;
+    guint8 chVibPos;
+    guint8 chVibType;
+    guint8 chVibDep;
+    guint8 chTremRate;
+    guint8 chTremPos;
+    guint8 chTremType;
+    guint8 chTremDep;
+    guint8 chPatLoopCount;
+    guint8 chPatLoopStart;
+    guint8 chArpPos;
+    guint8 chArpOffsets[3];
+    guint8 chActionTick;
+    guint8 chMRetrigPos;
+    guint8 chMRetrigLen;
+    guint8 chMRetrigAct;
+    guint8 chDelayNote;
+    guint8 chDelayIns;
+    guint8 chDelayVol;
+    guint8 chOffset;
+    guint8 chGlissando;
+    guint8 chTremorPos;
+    guint8 chTremorLen;
+    guint8 chTremorOff;
+
+    int nextstop;
+    STSample* nextsamp;
+    int nextpos;
+    int sampleplayend; /* don't play all of the sample, but stop at (here) */
+    STSample* cursamp;
+    STInstrument* curins;
+    int hacksample; /* if 1, then simply play the sample pointed to by cursamp */
+} xm_player_channel;
+
+/* The complete replay state of one module. Any number of players can
+   be run in parallel as long as each one drives its own mixer
+   instance. */
+typedef struct XMPlayer {
+    /* Current position, may be read by the user */
+    int songpos, patpos;
+    int tempo, bpm;
+    gboolean looped;
+    guint8 curtick;
+
+    XM* xm;
+    st_mixer_ctx* mix;
+    const gint8* mute; /* channel mute flags, or NULL */
+
+    /* Internal state */
+    double current_time;
+    int playmode;
+
+    xm_player_channel channels[32];
+
+    guint8 globalvol;
+
+    guint8 tick0;
+
+    int currow, play_only_row;
+    XMPattern* curpattern;
+    int patlen;
+    int curord;
+
+    int nord;
+    int ninst;
+    int nsamp;
+    int linearfreq;
+    int nchan;
+    int loopord;
+    int ismod;
+
+    int jumptoord;
+    int jumptorow;
+    int patdelay;
+    gboolean will_loop;
+
+    guint8 procnot;
+    guint8 procins;
+    guint8 procvol;
+    guint8 proccmd;
+    guint8 procdat;
+
+    int realgvol;
+} XMPlayer;
+
+XMPlayer* xmplayer_new(st_mixer_ctx* mix);
+void xmplayer_destroy(XMPlayer* p);
+/* Returns the previously used mixer */
+st_mixer_ctx* xmplayer_set_mixer(XMPlayer* p, st_mixer_ctx* mix);
+/* Copies the replay state of src to dest; module, mixer and mute flags
+   of dest are kept. Both players must be playing the same module. */
+void xmplayer_copy_state(XMPlayer* dest, const XMPlayer* src);
+
+void xmplayer_init_module(XMPlayer* p, XM* xm);
+gboolean xmplayer_init_play_song(XMPlayer* p, int songpos, int patpos, gboolean initall);
+gboolean xmplayer_init_play_pattern(XMPlayer* p, int pattern, int patpos, int only1row);
+gboolean xmplayer_play_note(XMPlayer* p, int channel, int note, int instrument, gboolean all);
+gboolean xmplayer_play_note_full(XMPlayer* p,
+    int channel,
     int note,
     STSample* sample,
     guint32 offset,
     guint32 count);
-void xmplayer_play_note_keyoff(int channel);
-double xmplayer_play(void);
-void xmplayer_stop(void);
-void xmplayer_set_songpos(int songpos);
-void xmplayer_set_pattern(int pattern);
-void xmplayer_set_tempo(int tempo);
-void xmplayer_set_bpm(int bpm);
+void xmplayer_play_note_keyoff(XMPlayer* p, int channel);
+double xmplayer_play(XMPlayer* p);
+void xmplayer_stop(XMPlayer* p);
+void xmplayer_set_songpos(XMPlayer* p, int songpos);
+void xmplayer_set_pattern(XMPlayer* p, int pattern);
+void xmplayer_set_tempo(XMPlayer* p, int tempo);
+void xmplayer_set_bpm(XMPlayer* p, int bpm);
 
 #endif /* _ST_XMPLAYER_H */
@@ -25,10 +25,12 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -39,16 +41,370 @@
 #include <glib/gprintf.h>
 
 #include "audio.h"
+#include "decompress.h"
+#include "delta-decode.h"
 #include "endian-conv.h"
 #include "gui-settings.h"
 #include "gui-subs.h"
 #include "recode.h"
 #include "st-subs.h"
-#include "xm-player.h"
 #include "xm.h"
 
 #define LFSTAT_IS_MODULE 1
 
+/* A mapped module file which is kept around for the samples that are
+   loaded from it later on (see gui_settings.lazy_samples) */
+typedef struct xm_image {
+    gint ref_count;
+    void* data;
+    gsize length;
+    dev_t dev; /* identify the file, see xm_release_file() */
+    ino_t ino;
+} xm_image;
+
+/* Set for the thread running File_Load_Controlled() */
+static GPrivate xm_load_control = G_PRIVATE_INIT(NULL);
+
+static gboolean
+xm_load_cancelled(void)
+{
+    XMLoadControl* ctl = g_private_get(&xm_load_control);
+
+    return ctl && g_atomic_int_get(&ctl->cancel);
+}
+
+/* Tells the controlling thread that done of total is finished of the
+   part of the work that is from ... to per mille of the whole */
+static void
+xm_load_report(gsize done,
+    gsize total,
+    int from,
+    int to)
+{
+    XMLoadControl* ctl = g_private_get(&xm_load_control);
+
+    if (ctl && total) {
+        g_atomic_int_set(&ctl->progress, from + (int)((double)done / total * (to - from)));
+    }
+}
+
+/* The loaders work on the whole file image in memory (usually mapped)
+   through this cursor. Reads past the end fail like fread() does. */
+typedef struct xm_cursor {
+    const guint8* data;
+    gsize length;
+    gsize pos;
+    xm_image* image; /* if set, sample data is loaded on demand */
+    GArray* jobs; /* if set, sample data is decoded after loading, see xm_decode_samples() */
+} xm_cursor;
+
+/* Returns the next n bytes and steps over them, or NULL if there
+   aren't so many left */
+static inline const guint8*
+xm_cursor_take(xm_cursor* c, gsize n)
+{
+    const guint8* p;
+
+    if (n > c->length - c->pos) {
+        return NULL;
+    }
+    p = c->data + c->pos;
+    c->pos += n;
+
+    return p;
+}
+
+static inline gboolean
+xm_cursor_read(xm_cursor* c, void* dest, gsize n)
+{
+    const guint8* p = xm_cursor_take(c, n);
+
+    if (!p) {
+        return FALSE;
+    }
+    memcpy(dest, p, n);
+
+    return TRUE;
+}
+
+/* Positions past the end are clamped, so that the next read fails */
+static inline void
+xm_cursor_seek(xm_cursor* c, gsize pos)
+{
+    c->pos = MIN(pos, c->length);
+}
+
+static inline void
+xm_cursor_skip(xm_cursor* c, gsize n)
+{
+    xm_cursor_seek(c, n > c->length - c->pos ? c->length : c->pos + n);
+}
+
+/* Reads the rest of a stream into memory, for the loaders which get a
+   FILE* from the outside */
+static guint8*
+xm_read_stream(FILE* f, gsize* length)
+{
+    guint8* buf = NULL;
+    gsize size = 0, n;
+
+    *length = 0;
+    do {
+        if (*length == size) {
+            size = MAX(size * 2, 65536);
+            buf = g_realloc(buf, size);
+        }
+        n = fread(buf + *length, 1, size - *length, f);
+        *length += n;
+    } while (n);
+
+    if (ferror(f)) {
+        g_free(buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+static void
+xm_image_unref(xm_image* image)
+{
+    if (g_atomic_int_dec_and_test(&image->ref_count)) {
+        munmap(image->data, image->length);
+        g_free(image);
+    }
+}
+
+/* How sample data is stored in the file */
+enum {
+    XM_SAMPLE_DELTA16,
+    XM_SAMPLE_DELTA8,
+    XM_SAMPLE_RAW8
+};
+
+typedef struct xm_deferred_sample {
+    st_mixer_sample_deferred d;
+    xm_image* image;
+    gsize offset, count;
+    int format;
+} xm_deferred_sample;
+
+/* 8 bit samples are kept as they are, see ST_MIXER_SAMPLE_FORMAT_8 */
+static void
+xm_decode_sample(void* dest,
+    const guint8* src,
+    gsize count,
+    int format)
+{
+    switch (format) {
+    case XM_SAMPLE_DELTA16:
+        delta_decode_16(dest, src, count);
+        break;
+    case XM_SAMPLE_DELTA8:
+        delta_decode_8(dest, src, count);
+        break;
+    default:
+        memcpy(dest, src, count);
+        break;
+    }
+}
+
+/* Called by the mixer code, in the sample loader thread or in one which
+   waits for the data */
+static gboolean
+xm_deferred_sample_load(st_mixer_sample_info* si)
+{
+    xm_deferred_sample* ds = (xm_deferred_sample*)si->deferred;
+
+    if (!(si->data = malloc(st_mixer_sample_size(si->format, ds->count)))) {
+        return FALSE;
+    }
+    xm_decode_sample(si->data, (guint8*)ds->image->data + ds->offset, ds->count, ds->format);
+
+    return TRUE;
+}
+
+static void
+xm_deferred_sample_free(st_mixer_sample_deferred* d)
+{
+    xm_deferred_sample* ds = (xm_deferred_sample*)d;
+
+    xm_image_unref(ds->image);
+    g_free(ds);
+}
+
+/* --- Decoding the samples of a module in parallel --- */
+
+/* Below this amount of sample data the threads don't pay off */
+#define XM_DECODE_PARALLEL_MIN_BYTES (1 << 20)
+
+/* Interval of the progress reports while waiting for the threads */
+#define XM_DECODE_PROGRESS_INTERVAL (G_USEC_PER_SEC / 10)
+
+typedef struct xm_decode_batch {
+    GMutex lock;
+    GCond done;
+    gsize bytes_done;
+    int jobs_left;
+    XMLoadControl* ctl; /* of the loading thread, the pool threads don't know it */
+} xm_decode_batch;
+
+typedef struct xm_decode_job {
+    void* dest;
+    const guint8* src;
+    gsize count;
+    int format;
+    xm_decode_batch* batch;
+} xm_decode_job;
+
+static gsize
+xm_decode_job_size(const xm_decode_job* j)
+{
+    return j->format == XM_SAMPLE_DELTA16 ? 2 * j->count : j->count;
+}
+
+static void
+xm_decode_thread(gpointer data,
+    gpointer user_data)
+{
+    xm_decode_job* j = data;
+    xm_decode_batch* b = j->batch;
+
+    /* After a cancellation the module is thrown away anyway */
+    if (!b->ctl || !g_atomic_int_get(&b->ctl->cancel)) {
+        xm_decode_sample(j->dest, j->src, j->count, j->format);
+    }
+
+    g_mutex_lock(&b->lock);
+    b->bytes_done += xm_decode_job_size(j);
+    if (--b->jobs_left == 0) {
+        g_cond_signal(&b->done);
+    }
+    g_mutex_unlock(&b->lock);
+}
+
+static GThreadPool*
+xm_decode_get_pool(void)
+{
+    static GThreadPool* pool = NULL;
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (n > 1) {
+            pool = g_thread_pool_new(xm_decode_thread, NULL, n, FALSE, NULL);
+        }
+        g_once_init_leave(&initialized, 1);
+    }
+
+    return pool;
+}
+
+/* Biggest samples first, so that the threads finish at about the same
+   time */
+static gint
+xm_decode_job_cmp(gconstpointer a,
+    gconstpointer b)
+{
+    const gsize sa = xm_decode_job_size(a), sb = xm_decode_job_size(b);
+
+    return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+/* Decodes the sample data queued by xm_load_sample_data(). The
+   samples are independent of each other, so they are spread over a
+   thread pool. This is the second half of the load progress. */
+static void
+xm_decode_samples(GArray* jobs)
+{
+    GThreadPool* pool = xm_decode_get_pool();
+    xm_decode_batch b;
+    gsize total = 0;
+    guint i;
+
+    for (i = 0; i < jobs->len; i++) {
+        total += xm_decode_job_size(&g_array_index(jobs, xm_decode_job, i));
+    }
+
+    if (!pool || jobs->len < 2 || total < XM_DECODE_PARALLEL_MIN_BYTES) {
+        for (i = 0; i < jobs->len; i++) {
+            xm_decode_job* j = &g_array_index(jobs, xm_decode_job, i);
+
+            xm_decode_sample(j->dest, j->src, j->count, j->format);
+        }
+        return;
+    }
+
+    g_mutex_init(&b.lock);
+    g_cond_init(&b.done);
+    b.bytes_done = 0;
+    b.jobs_left = jobs->len;
+    b.ctl = g_private_get(&xm_load_control);
+
+    g_array_sort(jobs, xm_decode_job_cmp);
+    for (i = 0; i < jobs->len; i++) {
+        xm_decode_job* j = &g_array_index(jobs, xm_decode_job, i);
+
+        j->batch = &b;
+        g_thread_pool_push(pool, j, NULL);
+    }
+
+    g_mutex_lock(&b.lock);
+    while (b.jobs_left) {
+        if (!g_cond_wait_until(&b.done, &b.lock, g_get_monotonic_time() + XM_DECODE_PROGRESS_INTERVAL)) {
+            xm_load_report(b.bytes_done, total, 500, 1000);
+        }
+    }
+    g_mutex_unlock(&b.lock);
+
+    g_mutex_clear(&b.lock);
+    g_cond_clear(&b.done);
+}
+
+/* Takes the data of s (whose length is already set) from the cursor.
+   It is decoded right now, after the whole module has been read (if
+   the cursor collects jobs) or, if the cursor is on a kept image, only
+   when the sample is needed. */
+static gboolean
+xm_load_sample_data(STSample* s,
+    xm_cursor* c,
+    int format)
+{
+    const guint8* src;
+    xm_deferred_sample* ds;
+
+    s->sample.format = format == XM_SAMPLE_DELTA16 ? ST_MIXER_SAMPLE_FORMAT_16 : ST_MIXER_SAMPLE_FORMAT_8;
+    if (!(src = xm_cursor_take(c, st_mixer_sample_size(s->sample.format, s->sample.length)))) {
+        return FALSE;
+    }
+
+    if (!c->image) {
+        if (!(s->sample.data = malloc(st_mixer_sample_size(s->sample.format, s->sample.length))))
+            return FALSE;
+        if (c->jobs) {
+            xm_decode_job j = { s->sample.data, src, s->sample.length, format, NULL };
+
+            g_array_append_val(c->jobs, j);
+        } else {
+            xm_decode_sample(s->sample.data, src, s->sample.length, format);
+        }
+        return TRUE;
+    }
+
+    ds = g_new0(xm_deferred_sample, 1);
+    ds->d.load = xm_deferred_sample_load;
+    ds->d.free = xm_deferred_sample_free;
+    ds->image = c->image;
+    g_atomic_int_inc(&c->image->ref_count);
+    ds->offset = src - c->data;
+    ds->count = s->sample.length;
+    ds->format = format;
+    st_mixer_sample_defer(&s->sample, &ds->d);
+
+    return TRUE;
+}
+
 static guint16 npertab[60] = {
     /* -> Tuning 0 */
     1712, 1616, 1524, 1440, 1356, 1280, 1208, 1140, 1076, 1016, 960, 906,
@@ -88,41 +444,45 @@ void xm_freq_note_to_relnote_finetune(float frequency,
     *relnote = rn;
 }
 
-static gboolean
+/* Number of bytes following a packed note's flag byte */
+static const guint8 xm_packed_note_size[32] = {
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5
+};
+
+/* Unpacks the note at p and returns the position of the next one, or
+   NULL if the note doesn't fit before end */
+static inline const guint8*
 xm_load_xm_note(XMNote* note,
-    FILE* f)
+    const guint8* p,
+    const guint8* end)
 {
-    guint8 c, d[4];
+    guint8 c;
 
-    note->note = 0;
-    note->instrument = 0;
-    note->volume = 0;
-    note->fxtype = 0;
-    note->fxparam = 0;
-
-    c = fgetc(f);
+    if (p >= end) {
+        return NULL;
+    }
+    c = *p++;
 
     if (c & 0x80) {
-        if (c & 0x01)
-            note->note = fgetc(f);
-        if (c & 0x02)
-            note->instrument = fgetc(f);
-        if (c & 0x04)
-            note->volume = fgetc(f);
-        if (c & 0x08)
-            note->fxtype = fgetc(f);
-        if (c & 0x10)
-            note->fxparam = fgetc(f);
+        if (xm_packed_note_size[c & 0x1f] > end - p)
+            return NULL;
+        note->note = c & 0x01 ? *p++ : 0;
+        note->instrument = c & 0x02 ? *p++ : 0;
+        note->volume = c & 0x04 ? *p++ : 0;
+        note->fxtype = c & 0x08 ? *p++ : 0;
+        note->fxparam = c & 0x10 ? *p++ : 0;
     } else {
-        if (fread(d, 1, sizeof(d), f) != sizeof(d))
-            return FALSE;
+        if (end - p < 4)
+            return NULL;
         note->note = c;
-        note->instrument = d[0];
-        note->volume = d[1];
-        note->fxtype = d[2];
-        note->fxparam = d[3];
+        note->instrument = p[0];
+        note->volume = p[1];
+        note->fxtype = p[2];
+        note->fxparam = p[3];
+        p += 4;
     }
-    return TRUE;
+    return p;
 }
 
 static int
@@ -179,15 +539,15 @@ xm_put_xm_note(XMNote* n,
 static int
 xm_load_xm_pattern(XMPattern* pat,
     int num_channels,
-    FILE* f)
+    xm_cursor* c)
 {
     guint8 ph[9];
     int i, j;
     guint16 len;
     guint32 hdr_len, datasize;
-    unsigned long position;
+    const guint8 *p, *end;
 
-    if (fread(ph, 1, sizeof(ph), f) != sizeof(ph)) {
+    if (!xm_cursor_read(c, ph, sizeof(ph))) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Pattern header reading error."), FALSE);
@@ -206,8 +566,7 @@ xm_load_xm_pattern(XMPattern* pat,
 
     /* skip the rest of the header, if exists */
     if ((hdr_len = get_le_32(ph)) > 9)
-        fseek(f, hdr_len - 9, SEEK_CUR);
-    position = ftell(f);
+        xm_cursor_skip(c, hdr_len - 9);
 
     if (!st_init_pattern_channels(pat,
             len > 0 ? len : 1,
@@ -217,19 +576,25 @@ xm_load_xm_pattern(XMPattern* pat,
     if ((datasize = get_le_16(ph + 7)) == 0)
         return 1;
 
-    /* Read channel data */
+    /* The whole packed data block at once; this is also the error-proof
+       positioning to the next pattern */
+    if (!(p = xm_cursor_take(c, datasize))) {
+        static GtkWidget* dialog = NULL;
+
+        gui_error_dialog(&dialog, _("Error loading notes."), FALSE);
+        return 0;
+    }
+    end = p + datasize;
+
+    /* Read channel data. If the block ends early, the remaining notes
+       stay empty. */
     for (j = 0; j < len; j++) {
         for (i = 0; i < num_channels; i++) {
-            if (!xm_load_xm_note(&pat->channels[i][j], f)) {
-                static GtkWidget* dialog = NULL;
-
-                gui_error_dialog(&dialog, _("Error loading notes."), FALSE);
-                return 0;
-            }
+            if (!(p = xm_load_xm_note(&pat->channels[i][j], p, end)))
+                return 1;
         }
     }
 
-    fseek(f, position + datasize, SEEK_SET); /* error-proof positioning to the next pattern */
     return 1;
 }
 
@@ -237,14 +602,14 @@ static int
 xm_load_patterns(XMPattern ptr[],
     int num_patterns,
     int num_channels,
-    FILE* f,
-    int (*loadfunc)(XMPattern*, int, FILE*))
+    xm_cursor* c,
+    int (*loadfunc)(XMPattern*, int, xm_cursor*))
 {
     int i, e;
 
     for (i = 0; i < 256; i++) {
         if (i < num_patterns)
-            e = loadfunc(&ptr[i], num_channels, f);
+            e = loadfunc(&ptr[i], num_channels, c);
         else
             e = st_init_pattern_channels(&ptr[i], 64, (num_channels + 1) & 0xfe);
 
@@ -312,20 +677,17 @@ string_seal(gchar* str, const guint length)
 static gboolean
 xm_load_xm_samples(STSample samples[],
     int num_samples,
-    FILE* f)
+    xm_cursor* c)
 {
-    int i, j;
+    int i;
     guint8 sh[40];
     STSample* s;
-    guint16 p;
-    gint16* d16;
-    gint8* d8;
 
     g_assert(num_samples <= 128);
 
     for (i = 0; i < num_samples; i++) {
         s = &samples[i];
-        if (fread(sh, 1, sizeof(sh), f) != sizeof(sh)) {
+        if (!xm_cursor_read(c, sh, sizeof(sh))) {
             static GtkWidget* dialog = NULL;
 
             gui_error_dialog(&dialog, _("Sample header reading error"), FALSE);
@@ -368,36 +730,21 @@ xm_load_xm_samples(STSample samples[],
             s->sample.loopstart >>= 1;
             s->sample.loopend >>= 1;
 
-            d16 = s->sample.data = malloc(2 * s->sample.length);
-            if (fread(d16, 1, 2 * s->sample.length, f) != 2 * s->sample.length) {
+            if (!xm_load_sample_data(s, c, XM_SAMPLE_DELTA16)) {
                 static GtkWidget* dialog = NULL;
 
                 gui_error_dialog(&dialog, _("Sample data reading error"), FALSE);
                 return FALSE;
             }
-            le_16_array_to_host_order(d16, s->sample.length);
-
-            for (j = s->sample.length, p = 0; j; j--) {
-                p += *d16;
-                *d16++ = p;
-            }
         } else {
             s->treat_as_8bit = TRUE;
 
-            d16 = s->sample.data = malloc(2 * s->sample.length);
-            d8 = (gint8*)d16;
-            d8 += s->sample.length;
-            if (fread(d8, 1, s->sample.length, f) != s->sample.length) {
+            if (!xm_load_sample_data(s, c, XM_SAMPLE_DELTA8)) {
                 static GtkWidget* dialog = NULL;
 
                 gui_error_dialog(&dialog, _("Sample data reading error"), FALSE);
                 return FALSE;
             }
-
-            for (j = s->sample.length, p = 0; j; j--) {
-                p += *d8++;
-                *d16++ = p << 8;
-            }
         }
 
         if (s->sample.loopend == 0) {
@@ -414,6 +761,14 @@ xm_load_xm_samples(STSample samples[],
     return TRUE;
 }
 
+/* 8 bit data is saved as it is, without being widened first */
+static inline gint16
+xm_sample_value(const st_mixer_sample_info* si,
+    guint32 k)
+{
+    return si->format == ST_MIXER_SAMPLE_FORMAT_8 ? ((gint8*)si->data)[k] << 8 : si->data[k];
+}
+
 static gboolean
 xm_save_xm_samples(STSample samples[],
     FILE* f,
@@ -454,19 +809,26 @@ xm_save_xm_samples(STSample samples[],
     for (i = 0; i < num_samples; i++) {
         s = &samples[i];
 
+        /* Data which is loaded on demand is read in whatever format it
+           has; it may be evicted again later */
+        if (!st_mixer_sample_load(&s->sample)) {
+            is_error = TRUE;
+            continue;
+        }
+
         if (!s->treat_as_8bit) {
             // Save as 16 bit sample
-            gint16 *packbuf, *d16, *ss;
-            gint16 p, d;
+            gint16 *packbuf, *ss;
+            gint16 p, d, v;
 
             packbuf = malloc(s->sample.length * 2);
-            d16 = s->sample.data;
             ss = packbuf;
 
-            for (k = s->sample.length, p = 0, d = 0; k; k--) {
-                d = *d16 - p;
+            for (k = 0, p = 0, d = 0; k < s->sample.length; k++) {
+                v = xm_sample_value(&s->sample, k);
+                d = v - p;
                 *ss++ = d;
-                p = *d16++;
+                p = v;
             }
 
             le_16_array_to_host_order(packbuf, s->sample.length);
@@ -474,18 +836,17 @@ xm_save_xm_samples(STSample samples[],
             free(packbuf);
         } else {
             // Save as 8 bit sample
-            gint16* d16;
             gint8 *packbuf, *ss;
-            gint8 p, d;
+            gint8 p, d, v;
 
             packbuf = malloc(s->sample.length);
-            d16 = s->sample.data;
             ss = packbuf;
 
-            for (k = s->sample.length, p = 0, d = 0; k; k--) {
-                d = (*d16 >> 8) - p;
+            for (k = 0, p = 0, d = 0; k < s->sample.length; k++) {
+                v = xm_sample_value(&s->sample, k) >> 8;
+                d = v - p;
                 *ss++ = d;
-                p = (*d16++ >> 8);
+                p = v;
             }
 
             is_error |= fwrite(packbuf, 1, s->sample.length, f) != s->sample.length;
@@ -514,7 +875,7 @@ xm_check_envelope(STEnvelope* e)
 
 static int
 xm_load_xm_instrument(STInstrument* instr,
-    FILE* f)
+    xm_cursor* c)
 {
     guint8 a[29], b[16];
     guint16 num_samples;
@@ -522,7 +883,7 @@ xm_load_xm_instrument(STInstrument* instr,
 
     st_clean_instrument(instr, NULL);
 
-    if (fread(a, 1, sizeof(a), f) != sizeof(a)) {
+    if (!xm_cursor_read(c, a, sizeof(a))) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Instrument header reading error"), FALSE);
@@ -549,9 +910,9 @@ xm_load_xm_instrument(STInstrument* instr,
 
     if (num_samples == 0) {
         /* Skip rest of header */
-        fseek(f, iheader_size - sizeof(a), SEEK_CUR);
+        xm_cursor_skip(c, iheader_size - sizeof(a));
     } else {
-        if (fread(a, 1, 4, f) != 4) {
+        if (!xm_cursor_read(c, a, 4)) {
             static GtkWidget* dialog = NULL;
 
             gui_error_dialog(&dialog, _("Instrument header reading error"), FALSE);
@@ -563,20 +924,20 @@ xm_load_xm_instrument(STInstrument* instr,
             gui_error_dialog(&dialog, _("XM Load Error: Sample header size != 40.\n"), FALSE);
             return 0;
         }
-        if (fread(instr->samplemap, 1, 96, f) != 96) {
+        if (!xm_cursor_read(c, instr->samplemap, 96)) {
             static GtkWidget* dialog = NULL;
 
             gui_error_dialog(&dialog, _("Sample map reading error"), FALSE);
             return 0;
         }
-        if (fread(instr->vol_env.points, 1, 48, f) != 48) {
+        if (!xm_cursor_read(c, instr->vol_env.points, 48)) {
             static GtkWidget* dialog = NULL;
 
             gui_error_dialog(&dialog, _("Volume envelope points reading error"), FALSE);
             return 0;
         }
         le_16_array_to_host_order((gint16*)instr->vol_env.points, 24);
-        if (fread(instr->pan_env.points, 1, 48, f) != 48) {
+        if (!xm_cursor_read(c, instr->pan_env.points, 48)) {
             static GtkWidget* dialog = NULL;
 
             gui_error_dialog(&dialog, _("Panning envelope points reading error"), FALSE);
@@ -584,7 +945,7 @@ xm_load_xm_instrument(STInstrument* instr,
         }
         le_16_array_to_host_order((gint16*)instr->pan_env.points, 24);
 
-        if (fread(b, 1, sizeof(b), f) != sizeof(b)) {
+        if (!xm_cursor_read(c, b, sizeof(b))) {
             static GtkWidget* dialog = NULL;
 
             gui_error_dialog(&dialog, _("Envelope parameters reading error"), FALSE);
@@ -621,10 +982,10 @@ xm_load_xm_instrument(STInstrument* instr,
 
         if (iheader_size > 241) {
             /* Skip remainder of header */
-            fseek(f, iheader_size - 241, SEEK_CUR);
+            xm_cursor_skip(c, iheader_size - 241);
         }
 
-        if (!xm_load_xm_samples(instr->samples, num_samples, f))
+        if (!xm_load_xm_samples(instr->samples, num_samples, c))
             return 0;
     }
 
@@ -635,17 +996,15 @@ xm_load_xm_instrument(STInstrument* instr,
    is not entirely identical to the instrument format found in XM
    modules. Thanks to KB for reverse-engineering the file format (see
    XI.TXT) */
-gboolean
-xm_load_xi(STInstrument* instr,
-    FILE* f)
+static gboolean
+xm_load_xi_image(STInstrument* instr,
+    xm_cursor* c)
 {
     guint8 a[29], b[38];
     int num_samples;
     static GtkWidget* dialog = NULL;
 
-    st_clean_instrument(instr, NULL);
-
-    if (fread(a, 1, 21, f) != 21) {
+    if (!xm_cursor_read(c, a, 21)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Instrument header reading error"), FALSE);
@@ -659,7 +1018,7 @@ xm_load_xi(STInstrument* instr,
         return 0;
     }
 
-    if (fread(a, 1, 22, f) != 22) {
+    if (!xm_cursor_read(c, a, 22)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Instrument header reading error"), FALSE);
@@ -671,7 +1030,7 @@ xm_load_xi(STInstrument* instr,
     seal_ascii(instr->name, 22);
     instr->needs_conversion = FALSE;
 
-    if (fread(a, 1, 23, f) != 23) {
+    if (!xm_cursor_read(c, a, 23)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Instrument header reading error"), FALSE);
@@ -685,20 +1044,20 @@ xm_load_xi(STInstrument* instr,
         return 0;
     }
 
-    if (fread(instr->samplemap, 1, 96, f) != 96) {
+    if (!xm_cursor_read(c, instr->samplemap, 96)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Instrument sample map reading error"), FALSE);
         return FALSE;
     }
-    if (fread(instr->vol_env.points, 1, 48, f) != 48) {
+    if (!xm_cursor_read(c, instr->vol_env.points, 48)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Instrument volume envelope points reading error"), FALSE);
         return FALSE;
     }
     le_16_array_to_host_order((gint16*)instr->vol_env.points, 24);
-    if (fread(instr->pan_env.points, 1, 48, f) != 48) {
+    if (!xm_cursor_read(c, instr->pan_env.points, 48)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Instrument panning envelope points reading error"), FALSE);
@@ -706,7 +1065,7 @@ xm_load_xi(STInstrument* instr,
     }
     le_16_array_to_host_order((gint16*)instr->pan_env.points, 24);
 
-    if (fread(b, 1, 16, f) != 16) {
+    if (!xm_cursor_read(c, b, 16)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Instrument envelope parameters reading error"), FALSE);
@@ -739,18 +1098,57 @@ xm_load_xi(STInstrument* instr,
 
     instr->volfade = get_le_16(b + 14);
 
-    if (fread(a, 1, 24, f) != 24) {
+    if (!xm_cursor_read(c, a, 24)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Instrument header reading error"), FALSE);
         return FALSE;
     }
     num_samples = get_le_16(a + 22);
-    xm_load_xm_samples(instr->samples, num_samples, f);
+    if (num_samples > 128) {
+        static GtkWidget* dialog = NULL;
+
+        gui_error_dialog(&dialog, _("XI Load Error: Number of samples in instrument > 128.\n"), FALSE);
+        return FALSE;
+    }
+
+    if (!xm_load_xm_samples(instr->samples, num_samples, c))
+        return FALSE;
+    st_instrument_publish(instr);
 
     return 1;
 }
 
+gboolean
+xm_load_xi(STInstrument* instr,
+    FILE* f)
+{
+    guint8* image;
+    xm_cursor c;
+    gboolean ok;
+
+    st_clean_instrument(instr, NULL);
+
+    if (!(image = xm_read_stream(f, &c.length))) {
+        static GtkWidget* dialog = NULL;
+
+        gui_error_dialog(&dialog, _("Instrument header reading error"), FALSE);
+        return FALSE;
+    }
+    c.data = image;
+    c.pos = 0;
+    c.image = NULL;
+    c.jobs = NULL;
+    ok = xm_load_xi_image(instr, &c);
+    g_free(image);
+
+    /* Don't leave a half loaded instrument behind */
+    if (!ok)
+        st_clean_instrument(instr, NULL);
+
+    return ok;
+}
+
 gboolean
 xm_save_xi(STInstrument* instr,
     FILE* f)
@@ -892,16 +1290,12 @@ xm_save_xm_instrument(STInstrument* instr,
     return is_error;
 }
 
-static gboolean
+static void
 xm_load_mod_note(XMNote* dest,
-    FILE* f)
+    const guint8* c)
 {
-    guint8 c[4];
     int note, period;
 
-    if (fread(c, 1, 4, f) != 4)
-        return FALSE;
-
     period = ((c[0] & 0x0f) << 8) | c[1];
     note = 0;
 
@@ -919,16 +1313,15 @@ xm_load_mod_note(XMNote* dest,
     dest->volume = 0;
     dest->fxtype = c[2] & 0x0f;
     dest->fxparam = c[3];
-
-    return TRUE;
 }
 
 static int
 xm_load_mod_pattern(XMPattern* pat,
     int num_channels,
-    FILE* f)
+    xm_cursor* c)
 {
     int i, j, len;
+    const guint8* p;
 
     len = 64;
 
@@ -937,32 +1330,20 @@ xm_load_mod_pattern(XMPattern* pat,
     if (!st_init_pattern_channels(pat, len, num_channels))
         return 0;
 
+    if (!(p = xm_cursor_take(c, len * num_channels * 4)))
+        return 0;
+
     /* Read channel data */
     for (j = 0; j < len; j++) {
-        for (i = 0; i < num_channels; i++) {
-            if (!xm_load_mod_note(&pat->channels[i][j], f))
-                return 0;
-        }
+        for (i = 0; i < num_channels; i++, p += 4)
+            xm_load_mod_note(&pat->channels[i][j], p);
     }
 
     return 1;
 }
 
-static void
-xm_init_locks(XM* xm)
-{
-    int i, j;
-
-    for (i = 0; i < sizeof(xm->instruments) / sizeof(xm->instruments[0]); i++) {
-        STInstrument* ins = &xm->instruments[i];
-        for (j = 0; j < sizeof(ins->samples) / sizeof(ins->samples[0]); j++) {
-            g_mutex_init(&ins->samples[j].sample.lock);
-        }
-    }
-}
-
 static XM*
-xm_load_mod(FILE* f, int* status)
+xm_load_mod(xm_cursor* c, int* status)
 {
     XM* xm;
     guint8 sh[31][8];
@@ -971,20 +1352,18 @@ xm_load_mod(FILE* f, int* status)
 
     xm = calloc(1, sizeof(XM));
     if (!xm)
-        goto fileerr;
+        return NULL;
 
-    if (fread(xm->name, 1, 20, f) != 20) {
+    if (!xm_cursor_read(c, xm->name, 20)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Module header reading error."), FALSE);
         goto ende;
     }
 
-    xm_init_locks(xm);
-
     for (i = 0; i < 31; i++) {
         char buf[25];
-        if (fread(buf, 1, 22, f) != 22) {
+        if (!xm_cursor_read(c, buf, 22)) {
             static GtkWidget* dialog = NULL;
 
             gui_error_dialog(&dialog, _("Instrument header reading error."), FALSE);
@@ -993,7 +1372,7 @@ xm_load_mod(FILE* f, int* status)
         buf[22] = 0;
         /* In MOD files actually only valid ASCII charachters are used */
         st_clean_instrument(&xm->instruments[i], buf);
-        if (fread(sh[i], 1, 8, f) != 8) {
+        if (!xm_cursor_read(c, sh[i], 8)) {
             static GtkWidget* dialog = NULL;
 
             gui_error_dialog(&dialog, _("Sample header reading error."), FALSE);
@@ -1001,7 +1380,7 @@ xm_load_mod(FILE* f, int* status)
         }
     }
 
-    if (fread(mh, 1, 2, f) != 2) {
+    if (!xm_cursor_read(c, mh, 2)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Module header reading error."), FALSE);
@@ -1009,13 +1388,13 @@ xm_load_mod(FILE* f, int* status)
     }
     xm->song_length = mh[0];
 
-    if (fread(xm->pattern_order_table, 1, 128, f) != 128) {
+    if (!xm_cursor_read(c, xm->pattern_order_table, 128)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Pattern order table reading error."), FALSE);
         goto ende;
     }
-    if (fread(mh, 1, 4, f) != 4) {
+    if (!xm_cursor_read(c, mh, 4)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Module header reading error."), FALSE);
@@ -1048,11 +1427,9 @@ xm_load_mod(FILE* f, int* status)
 
     xm->tempo = 6;
     xm->bpm = 125;
-    player_tempo = xm->tempo;
-    player_bpm = xm->bpm;
     xm->flags = XM_FLAGS_IS_MOD | XM_FLAGS_AMIGA_FREQ;
 
-    if (!xm_load_patterns(xm->patterns, n + 1, xm->num_channels, f, xm_load_mod_pattern)) {
+    if (!xm_load_patterns(xm->patterns, n + 1, xm->num_channels, c, xm_load_mod_pattern)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Error while loading patterns."), FALSE);
@@ -1091,57 +1468,37 @@ xm_load_mod(FILE* f, int* status)
                 s->sample.looptype = 0;
             }
 
-            s->sample.data = malloc(2 * s->sample.length);
-            if (!s->sample.data) {
-                goto ende;
-            }
-            if (fread((char*)s->sample.data + s->sample.length, 1, s->sample.length, f) != s->sample.length) {
+            if (!xm_load_sample_data(s, c, XM_SAMPLE_RAW8)) {
                 static GtkWidget* dialog = NULL;
 
                 gui_error_dialog(&dialog, _("Sample data reading error."), FALSE);
                 goto ende;
             }
-            st_convert_sample((char*)s->sample.data + s->sample.length,
-                s->sample.data,
-                8,
-                16,
-                s->sample.length);
         }
     }
 
-    fclose(f);
     return xm;
 
 ende:
     XM_Free(xm);
-fileerr:
-    fclose(f);
     return NULL;
 }
 
-XM* XM_Load(const char* filename, int* status)
+static XM*
+xm_parse_image(xm_cursor* c, int* status)
 {
     XM* xm;
-    FILE* f;
     guint8 xh[80];
     int i, j, num_patterns, num_instruments;
 
     *status = 0;
-    f = fopen(filename, "rb");
-    if (!f) {
-        static GtkWidget* dialog = NULL;
-
-        gui_error_dialog(&dialog, _("Can't open file"), FALSE);
-        return NULL;
-    }
-
     memset(xh, 0, sizeof(xh));
 
-    if (fread(xh + 0, 1, sizeof(xh), f) != sizeof(xh)
+    if (!xm_cursor_read(c, xh + 0, sizeof(xh))
         || strncmp((char*)xh + 0, "Extended Module: ", 17) != 0
         || xh[37] != 0x1a) {
-        fseek(f, 0, SEEK_SET);
-        return xm_load_mod(f, status);
+        xm_cursor_seek(c, 0);
+        return xm_load_mod(c, status);
     }
 
     if (get_le_32(xh + 60) != 276) {
@@ -1159,8 +1516,7 @@ XM* XM_Load(const char* filename, int* status)
 
     xm = calloc(1, sizeof(XM));
     if (!xm)
-        goto fileerr;
-    xm_init_locks(xm);
+        return NULL;
 
     memcpy(xm->name, (char*)xh + 17, 20);
     recode_to_utf(xm->name, xm->utf_name, 20);
@@ -1183,21 +1539,25 @@ XM* XM_Load(const char* filename, int* status)
 
     num_patterns = get_le_16(xh + 70);
     num_instruments = get_le_16(xh + 72);
+    if (num_instruments > 128) {
+        static GtkWidget* dialog = NULL;
+
+        gui_error_dialog(&dialog, _("XM Load Error: Number of instruments > 128.\n"), FALSE);
+        goto ende;
+    }
     if (get_le_16(xh + 74) != 1) {
         xm->flags |= XM_FLAGS_AMIGA_FREQ;
     }
     xm->tempo = get_le_16(xh + 76);
     xm->bpm = get_le_16(xh + 78);
-    player_tempo = xm->tempo;
-    player_bpm = xm->bpm;
-    if (fread(xm->pattern_order_table, 1, 256, f) != 256) {
+    if (!xm_cursor_read(c, xm->pattern_order_table, 256)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Error while loading pattern order table."), FALSE);
         goto ende;
     }
 
-    if (!xm_load_patterns(xm->patterns, num_patterns, xm->num_channels, f, xm_load_xm_pattern)) {
+    if (!xm_load_patterns(xm->patterns, num_patterns, xm->num_channels, c, xm_load_xm_pattern)) {
         static GtkWidget* dialog = NULL;
 
         gui_error_dialog(&dialog, _("Error while loading patterns."), FALSE);
@@ -1205,12 +1565,16 @@ XM* XM_Load(const char* filename, int* status)
     }
 
     for (i = 0; i < num_instruments; i++) {
-        if (!xm_load_xm_instrument(&xm->instruments[i], f)) {
+        if (xm_load_cancelled()) {
+            goto ende;
+        }
+        if (!xm_load_xm_instrument(&xm->instruments[i], c)) {
             static GtkWidget* dialog = NULL;
 
             gui_error_dialog(&dialog, _("Error while loading instruments."), FALSE);
             goto ende;
         }
+        xm_load_report(c->pos, c->length, 0, 500);
     }
 
     // Check if sample lengths are okay
@@ -1234,16 +1598,121 @@ weiter:
         xm->num_channels++;
     }
 
-    fclose(f);
     return xm;
 
 ende:
     XM_Free(xm);
-fileerr:
-    fclose(f);
     return NULL;
 }
 
+/* Loads an XM or MOD from the file image. If kept is given, it's the
+   image and the samples are left in it until they're needed. */
+static XM*
+xm_load_image(const guint8* data, gsize length, xm_image* kept, int* status)
+{
+    xm_cursor c = { data, length, 0, kept, NULL };
+    XM* xm;
+
+    c.jobs = g_array_new(FALSE, FALSE, sizeof(xm_decode_job));
+    xm = xm_parse_image(&c, status);
+    if (xm) {
+        xm_decode_samples(c.jobs);
+        if (xm_load_cancelled()) {
+            XM_Free(xm);
+            xm = NULL;
+        }
+    }
+    g_array_free(c.jobs, TRUE);
+
+    return xm;
+}
+
+XM* XM_Load(const char* filename, int* status)
+{
+    XM* xm;
+    struct stat st;
+    void* image = MAP_FAILED;
+    int fd;
+
+    *status = 0;
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        static GtkWidget* dialog = NULL;
+
+        gui_error_dialog(&dialog, _("Can't open file"), FALSE);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (image == MAP_FAILED) {
+        /* Empty or not mappable; read it the usual way then */
+        gchar* contents;
+        gsize length;
+
+        if (!g_file_get_contents(filename, &contents, &length, NULL)) {
+            static GtkWidget* dialog = NULL;
+
+            gui_error_dialog(&dialog, _("Can't open file"), FALSE);
+            return NULL;
+        }
+        xm = xm_load_image((guint8*)contents, length, NULL, status);
+        g_free(contents);
+
+        return xm;
+    }
+
+    if (gui_settings.lazy_samples) {
+        /* The samples hold references; the image is unmapped when the
+           last of them is gone */
+        xm_image* kept = g_new(xm_image, 1);
+
+        kept->ref_count = 1;
+        kept->data = image;
+        kept->length = st.st_size;
+        kept->dev = st.st_dev;
+        kept->ino = st.st_ino;
+        xm = xm_load_image(image, st.st_size, kept, status);
+        xm_image_unref(kept);
+
+        return xm;
+    }
+
+    madvise(image, st.st_size, MADV_SEQUENTIAL);
+    xm = xm_load_image(image, st.st_size, NULL, status);
+    munmap(image, st.st_size);
+
+    return xm;
+}
+
+gboolean
+xm_release_file(XM* xm,
+    const char* filename)
+{
+    struct stat st;
+    guint i, j;
+    gboolean ok = TRUE;
+
+    if (stat(filename, &st) != 0)
+        return TRUE;
+
+    for (i = 0; i < sizeof(xm->instruments) / sizeof(xm->instruments[0]); i++) {
+        for (j = 0; j < sizeof(xm->instruments[i].samples) / sizeof(xm->instruments[i].samples[0]); j++) {
+            st_mixer_sample_info* si = &xm->instruments[i].samples[j].sample;
+            xm_deferred_sample* ds = (xm_deferred_sample*)si->deferred;
+
+            if (ds && ds->d.load == xm_deferred_sample_load
+                && ds->image->dev == st.st_dev && ds->image->ino == st.st_ino)
+                ok &= st_mixer_sample_detach(si);
+        }
+    }
+
+    return ok;
+}
+
 gboolean
 XM_Save(XM* xm,
     const char* filename,
@@ -1255,6 +1724,9 @@ XM_Save(XM* xm,
     int num_patterns, num_instruments;
     gboolean is_error = FALSE, illegal_chars = FALSE;
 
+    if (!xm_release_file(xm, filename))
+        return TRUE;
+
     f = fopen(filename, "wb");
     if (!f)
         return TRUE;
@@ -1310,14 +1782,11 @@ XM* XM_New()
     xm = calloc(1, sizeof(XM));
     if (!xm)
         goto ende;
-    xm_init_locks(xm);
 
     xm->song_length = 1;
     xm->num_channels = 8;
     xm->tempo = 6;
     xm->bpm = 125;
-    player_tempo = xm->tempo;
-    player_bpm = xm->bpm;
     if (!xm_load_patterns(xm->patterns, 0, xm->num_channels, NULL, NULL))
         goto ende;
 
@@ -1328,19 +1797,23 @@ ende:
     return NULL;
 }
 
+void XM_Publish(XM* xm)
+{
+    int i;
+
+    for (i = 0; i < sizeof(xm->instruments) / sizeof(xm->instruments[0]); i++)
+        st_instrument_publish(&xm->instruments[i]);
+}
+
 void XM_Free(XM* xm)
 {
-    int i, j;
+    int i;
 
     if (xm) {
         st_free_all_pattern_channels(xm);
 
         for (i = 0; i < sizeof(xm->instruments) / sizeof(xm->instruments[0]); i++) {
-            STInstrument* ins = &xm->instruments[i];
-            st_clean_instrument(ins, NULL);
-            for (j = 0; j < sizeof(ins->samples) / sizeof(ins->samples[0]); j++) {
-                g_mutex_clear(&ins->samples[j].sample.lock);
-            }
+            st_clean_instrument(&xm->instruments[i], NULL);
         }
 
         free(xm);
@@ -1359,14 +1832,18 @@ void XM_Free(XM* xm)
 * these routines handle modules that are compressed in the known formats-
 * zip, gz, lha, bz2.
 *
-* for simple ones like gz and bz2, it just creates a temp file, and tells
-* XM_Load() to load it before deleting the tmp file.
+* gz, bz2 and zip are unpacked into memory with zlib and libbz2 and the
+* module is parsed from there. Each file of a zip archive is tried in
+* turn; the first one that can be successfully loaded is the one that's
+* accepted as the mod file.
 *
+* lha (and the others, if the libraries are missing) still go through
+* the external tools: for simple ones like gz and bz2, it just creates a
+* temp file, and tells XM_Load() to load it before deleting the tmp file.
 * For more complex formats like zip and lha, where they can store multiple
 * files, it's an all-out affair- the compressed file is extracted, and
-* each file is loaded by XM_Load(). The first file it comes across that
-* can be successfully loaded is the one that's accepted as the mod file.
-* After it has loaded a mod, it will remove the directory.
+* each file is loaded by XM_Load(). After it has loaded a mod, it will
+* remove the directory.
 *
 **************************************************************************/
 char* err_msg = "Bzzzz, error extracting song, aborting operation.";
@@ -1524,6 +2001,7 @@ File_Extract_Archive(const char* extract_cmd, char* tmp_dir_path, int* status)
     return ret;
 }
 
+#if !HAVE_LIBZ || !HAVE_LIBBZ2
 /*
  * this is for zcat and bunzip2 style archives, where compression format
  * stores only one file
@@ -1554,6 +2032,76 @@ File_Extract_SingleFile(const char* extract_cmd, char* tmp_path, int* status)
 
     return ret;
 }
+#endif
+
+#if HAVE_LIBZ || HAVE_LIBBZ2
+/*
+ * gz and bz2 in-process: the whole file is unpacked into memory
+ */
+static XM*
+File_Load_Unpacked(gboolean (*unpack)(const gchar*, guint8**, gsize*),
+    const char* filename,
+    int* status)
+{
+    XM* ret;
+    guint8* data;
+    gsize length;
+
+    if (!unpack(filename, &data, &length)) {
+        static GtkWidget* dialog = NULL;
+        char str[256];
+
+        g_snprintf(str, sizeof str, "%s (Err 3)", err_msg);
+        gui_error_dialog(&dialog, str, TRUE);
+        return NULL;
+    }
+
+    ret = xm_load_image(data, length, NULL, status);
+    g_free(data);
+
+    return ret;
+}
+#endif
+
+#if HAVE_LIBZ
+typedef struct {
+    XM* xm;
+    int* status;
+} File_Zip_Result;
+
+static gboolean
+File_Load_Zip_Member(const gchar* name,
+    const guint8* data,
+    gsize length,
+    gpointer user_data)
+{
+    File_Zip_Result* r = user_data;
+
+    r->xm = xm_load_image(data, length, NULL, r->status);
+
+    return r->xm != NULL;
+}
+
+/*
+ * zip in-process: the members are unpacked one by one until one of them
+ * loads
+ */
+static XM*
+File_Load_Zip(const char* filename, int* status)
+{
+    File_Zip_Result r = { NULL, status };
+
+    if (!decompress_zip_foreach(filename, File_Load_Zip_Member, &r)) {
+        static GtkWidget* dialog = NULL;
+        char str[256];
+
+        g_snprintf(str, sizeof str, "%s (Err 1)", err_msg);
+        gui_error_dialog(&dialog, str, TRUE);
+    }
+
+    return r.xm;
+}
+#endif
 
 /*
  * this tests a file extension. if it matches, return 1, if not return 0
@@ -1579,6 +2127,17 @@ f_extension_cmp(const char* filename, char* exten)
 }
 
 XM* File_Load(const char* filename)
+{
+    XM* xm = File_Load_Controlled(filename, NULL);
+
+    if (xm)
+        XM_Publish(xm);
+
+    return xm;
+}
+
+XM* File_Load_Controlled(const char* filename,
+    XMLoadControl* ctl)
 {
     char tmp_path[256];
     char *str = NULL, *filename_esc = NULL;
@@ -1587,13 +2146,23 @@ XM* File_Load(const char* filename)
 
     g_assert(filename != NULL);
 
+    if (ctl) {
+        /* Nothing to tell until the module itself is read */
+        g_atomic_int_set(&ctl->progress, -1);
+    }
+    g_private_set(&xm_load_control, ctl);
+
     filename_esc = escape_filename(filename);
     st_tmpnam(tmp_path);
 
     /* test and load zip files. for unzip version 5.31 */
     if (f_extension_cmp(filename, ".zip")) {
+#if HAVE_LIBZ
+        ret = File_Load_Zip(filename, &status);
+#else
         str = g_strdup_printf("%s %s -d %s >>/dev/null", gui_settings.unzip_path, filename_esc, tmp_path);
         ret = File_Extract_Archive(str, tmp_path, &status);
+#endif
     }
 
     /* test and load lha files. for UNIX V1.00   */
@@ -1604,14 +2173,22 @@ XM* File_Load(const char* filename)
 
     /* for zcat 1.2.4 */
     else if (f_extension_cmp(filename, ".gz")) {
+#if HAVE_LIBZ
+        ret = File_Load_Unpacked(decompress_gzip, filename, &status);
+#else
         str = g_strdup_printf("%s %s >> %s", gui_settings.gz_path, filename_esc, tmp_path);
         ret = File_Extract_SingleFile(str, tmp_path, &status);
+#endif
     }
 
     /* for bunzip2 Version 0.9.0b     */
     else if (f_extension_cmp(filename, ".bz2")) {
+#if HAVE_LIBBZ2
+        ret = File_Load_Unpacked(decompress_bzip2, filename, &status);
+#else
         str = g_strdup_printf("%s -c %s >> %s", gui_settings.bz2_path, filename_esc, tmp_path);
         ret = File_Extract_SingleFile(str, tmp_path, &status);
+#endif
     }
 
     /* if not compressed, load as normal   */
@@ -1625,10 +2202,11 @@ XM* File_Load(const char* filename)
      * lots of dialog boxes popping up with this message, even when a
      * mod file is eventually found in a compressed archive. -- jsno
      */
-    if (!(status & LFSTAT_IS_MODULE)) {
+    if (!(status & LFSTAT_IS_MODULE) && !xm_load_cancelled()) {
         static GtkWidget* dialog = NULL;
         gui_error_dialog(&dialog, _("Not FastTracker XM and not supported MOD format!"), FALSE);
     }
+    g_private_set(&xm_load_control, NULL);
 
     g_free(str);
     g_free(filename_esc);
@@ -139,10 +139,30 @@ typedef struct XM {
 #define XM_FLAGS_AMIGA_FREQ 1
 #define XM_FLAGS_IS_MOD 2
 
+/* For loading a module in a thread of its own. The loader keeps
+   progress up to date (0 ... 1000, -1 while that can't be told) and
+   gives up as soon as it finds cancel set; both are accessed with
+   g_atomic_int_get() / _set(). */
+typedef struct XMLoadControl {
+    gint progress;
+    gint cancel;
+} XMLoadControl;
+
+/* File_Load() hands the samples over to the mixers. File_Load_Controlled()
+   leaves that to the thread the module is going to be used by, which
+   calls XM_Publish() (see st_mixer_sample_publish()). */
 XM* File_Load(const char* filename);
+XM* File_Load_Controlled(const char* filename,
+    XMLoadControl* ctl);
 XM* XM_Load(const char* filename, int* status);
 gboolean XM_Save(XM* xm, const char* filename, gboolean save_smpls);
+/* Samples of xm which are loaded on demand from the given file are
+   taken into memory for good, so that the file can be overwritten.
+   FALSE if there's not enough memory. */
+gboolean xm_release_file(XM* xm,
+    const char* filename);
 XM* XM_New(void);
+void XM_Publish(XM* xm);
 void XM_Free(XM*);
 
 gboolean xm_load_xi(STInstrument* instr,